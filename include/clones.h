@@ -46,6 +46,7 @@ struct SCloneEnt
     int       limit;                /* global limit (from services) */
     int       sllimit;              /* soft local limit (from SET) */
     int       sglimit;              /* soft global limit (from SET) */
+    int       refs;                 /* paused RWHOs holding this entry */
     char      ent[HOSTIPLEN+1];     /* IP entity */
 };
 
@@ -63,6 +64,8 @@ void clones_init(void);
 int  clones_set(char *, int, int);
 void clones_get(char *, int *, int *, int *);
 void clones_send(aClient *);
+void clones_hold(CloneEnt *);
+void clones_release(CloneEnt *);
 
 #ifdef THROTTLE_ENABLE
 
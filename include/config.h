@@ -221,10 +221,22 @@
  *
  * The maximum number of entries to write to the active kline storage journal
  * before compacting it.  This threshold prevents the journal from growing
- * indefinitely while klines are added and removed on a running server.
+ * indefinitely while klines are added and removed on a running server.  The
+ * compaction runs in a forked child process, writing a binary snapshot
+ * (.klines.db) that is loaded quickly on the next startup.
  */
 #define KLINE_STORE_COMPACT_THRESH 1000
 
+/*
+ * KLINE_STORE_FSYNC
+ *
+ * How often, in seconds, to fsync() the kline storage journal after writing
+ * to it.  Journal entries are always written out on the next pass through
+ * the main loop, but until they are synced they can still be lost if the
+ * machine (not just ircd) goes down.  0 leaves this to the operating system.
+ */
+#define KLINE_STORE_FSYNC 0
+
 /*
  * Pretty self explanatory: These are shown in server notices and to the 
  * recipient of a "you are banned" message.
@@ -636,15 +648,19 @@
 #define PORTNUM 7000 /* 7000 for DALnet */
 
 /*
- * NICKNAMEHISTORYLENGTH - size of WHOWAS array this defines the length
- * of the nickname history.  each time a user changes nickname or signs
- * off, their old nickname is added to the top of the list. NOTE: this
- * is directly related to the amount of memory ircd will use whilst
- * resident and running - it hardly ever gets swapped to disk!  Memory
- * will be preallocated for the entire whowas array when ircd is
- * started.
+ * WHOWAS_KEEPTIME - how many seconds a nickname stays in the WHOWAS
+ * history after its user changes nickname or signs off.  Hosts,
+ * usernames and realnames are shared between entries, so an entry
+ * costs some 120 bytes plus whichever of its strings no other entry
+ * holds.  Four hours on a server seeing 20 nick changes and signoffs a
+ * second comes to 100MB at the very worst, usually far less.
+ *
+ * WHOWAS_MAXENTRIES - caps the history however short WHOWAS_KEEPTIME
+ * would have it, should a flood of signoffs come through.  The oldest
+ * entries go first.
  */
-#define NICKNAMEHISTORYLENGTH 8192
+#define WHOWAS_KEEPTIME 14400
+#define WHOWAS_MAXENTRIES 500000
 
 /*
  * TIMESEC - Time interval to wait and if no messages have been
@@ -773,6 +789,22 @@
  */
 #define HYBRID_SOMAXCONN 25
 
+/*
+ * ACCEPT_BUDGET   - most new clients one listening socket hands out per
+ *                   pass of the io loop; the rest wait in its backlog for
+ *                   the next pass, so a flooded port can't hold up the
+ *                   others or the clients already connected.
+ * ACCEPT_TRIES    - most accept() calls on one socket per pass, counting
+ *                   the connections dropped before a client was made for
+ *                   them (throttled, z-lined, ...), which cost far less.
+ * LISTENER_SHARDS - sockets a port block with flag R opens on its port,
+ *                   with SO_REUSEPORT; the kernel spreads new connections
+ *                   over them, each with its own backlog and budget.
+ */
+#define ACCEPT_BUDGET   100
+#define ACCEPT_TRIES    400
+#define LISTENER_SHARDS 4
+
 /*
  * Throttling support:
  * THROTTLE_ENABLE    - enable throttling code, if undefined, the functions
@@ -782,7 +814,9 @@
  *                      happen
  * THROTTLE_RECORDTIME- length to keep records for each ip (since last connect
                         from this ip)
- * THROTTLE_HASHSIZE  - size of the throttle hashtable, also tuneable
+ * THROTTLE_HASHSIZE  - how many throttles (and clone entries) the
+ *                      hashtables start with room for; they grow as
+ *                      needed.  SET THROTTLE HASH raises it at runtime.
  *
  * Recommended values: 3, 15, 1800.  3+ connections in 15 or less seconds will
  * result in a connection throttle z:line.  These are also
@@ -797,7 +831,7 @@
 #define THROTTLE_TRIGCOUNT 3
 #define THROTTLE_TRIGTIME 15
 #define THROTTLE_RECORDTIME 1800
-#define THROTTLE_HASHSIZE 25147
+#define THROTTLE_HASHSIZE 4096
 
 /*
  * Message-throttling support.
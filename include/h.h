@@ -83,7 +83,7 @@ extern struct Counter Count;
 
 extern time_t 	 NOW;
 extern time_t	 last_stat_save;
-extern time_t 	 nextconnect, nextdnscheck, nextping, timeofday;
+extern time_t 	 timeofday;
 extern aClient  *client, me, *local[];
 extern aChannel *channel;
 extern struct    stats *ircstp;
@@ -188,8 +188,8 @@ extern char 	 *cipntoa(aClient *);
 extern int  	  dbufalloc, dbufblocks, debuglevel, errno;
 extern int  	  highest_fd, debuglevel, portnum,
     debugtty, maxusersperchannel;
-extern int  	  readcalls, udpfd, resfd;
-extern aClient 	 *add_connection(aListener *, int);
+extern int  	  readcalls, udpfd;
+extern aClient 	 *add_connection(aListener *, int, struct sockaddr *);
 extern int  	  add_listener(aPort *);
 extern void 	  add_local_domain(char *, int);
 extern int  	  check_client(aClient *);
@@ -209,7 +209,7 @@ extern int  	  setup_ping(void);
 extern void 	  summon(aClient *, char *, char *, char *);
 extern int  	  unixport(aClient *, char *, int);
 
-extern void 	do_dns_async(void);
+extern void 	do_dns_async(int);
 extern int 	completed_connection(aClient *);
 extern void 	accept_connection(aListener *);
 extern char *	irc_get_sockerr(aClient *);
@@ -232,8 +232,26 @@ extern void 	  send_authports(aClient *);
 
 extern void 	  restart(char *);
 extern void 	  send_channel_modes(aClient *, aChannel *);
+
+/* paced netbursts, m_server.c */
+extern unsigned char burst_slots;
+extern int        send_bursts(void);
+extern int        burst_filter(aClient *, char *, int);
+extern void       burst_client_gone(aClient *);
+extern void       burst_channel_gone(aChannel *);
+extern void       burst_abort(aClient *);
+extern aClient   *burst_find_server(aClient *, char *);
+
+/* paced WHO and RWHO, whoindex.c */
+extern int        send_searches(void);
+extern void       whosearch_stop(aClient *);
+extern void       whosearch_abort(aClient *);
+extern void       whosearch_client_gone(aClient *);
 extern void 	  server_reboot(void);
 extern void 	  terminate(void), write_pidfile(void);
+extern void       check_ping(void *);
+extern void       schedule_ping(aClient *);
+extern void       schedule_connect(time_t);
 
 extern int  	  match(char *, char *);
 extern char  	 *collapse(char *);
@@ -242,11 +260,7 @@ extern int        load_settings(void);
 extern int        save_settings(void);
 
 extern int  	  writecalls, writeb[];
-#ifdef WRITEV_IOV
 extern int        deliver_it(aClient *, struct iovec *, int);
-#else
-extern int  	  deliver_it(aClient *, char *, int);
-#endif
 
 extern char 	 *get_client_name(aClient *, int);
 extern char 	 *my_name_for_link(char *, aConnect *);
@@ -255,9 +269,11 @@ extern int  	  exit_client(aClient *, aClient *, aClient *, char *);
 extern void 	  initstats(void);
 extern char      *make_parv_copy(char *, int, char **);
 extern int        exit_banned_client(aClient *, int, char, char *, int);
+extern void       refuse_banned(int, char *, int, char, char *);
 
 extern int  	  parse(aClient *, char *, char *);
 extern void 	  init_tree_parse(struct Message *);
+extern unsigned long msg_percentile(struct Message *, int);
 
 extern int  	  do_numeric(int, aClient *, aClient *, int, char **);
 extern int  	  hunt_server(aClient *, aClient *, char *, int, int, char **);
@@ -286,7 +302,7 @@ extern anUser 	 *make_user(aClient *);
 extern aClass 	 *make_class(void);
 extern aServer   *make_server(aClient *);
 extern aClient   *make_client(aClient *, aClient *);
-extern chanMember *find_user_member(chanMember *, aClient *);
+extern chanMember *find_user_member(aChannel *, aClient *);
 extern Link 	 *find_str_link(Link *, char *);
 extern DLink     *find_dlink(DLink *, void *);
 extern void 	  add_client_to_list(aClient *);
@@ -299,12 +315,11 @@ extern void       block_destroy(void);	        /* list.c */
 extern void     set_effective_class(aClient *);
 extern void     initclass(void);
 
-extern struct hostent *get_res(char *);
+extern struct hostent *get_res(char *, int);
 extern struct hostent *gethost_byaddr(char *, Link *, int);
 extern struct hostent *gethost_byname(char *, Link *, int);
 extern void 	  flush_cache(void);
 extern int  	  init_resolver(int);
-extern time_t 	  timeout_query_list(time_t);
 extern time_t 	  expire_cache(time_t);
 extern void 	  del_queries(char *);
 
@@ -323,6 +338,7 @@ extern void 	  add_history(aClient *, int);
 extern aClient   *get_history(char *, time_t);
 extern void 	  initwhowas(void);
 extern void 	  off_history(aClient *);
+extern aHashTable whowasTable, wwstringTable;
 
 extern int  	  dopacket(aClient *, char *, int);
 extern int  	  client_dopacket(aClient *, char *, int);
@@ -340,8 +356,8 @@ extern void 	  debug(int level, char *pattern, ...);
 extern void 	  send_listinfo(aClient *, char *);
 #endif
 
-extern void 	  send_list(aClient *, int);
-extern aChannel  *hash_get_chan_bucket(int);
+extern void 	  send_list(aClient *);
+extern void 	  list_free(aClient *);
 
 #ifdef DUMP_DEBUG
 extern FILE 	 *dumpfp;
@@ -362,6 +378,9 @@ void        	  free_fludees(aClient *cptr);
 
 #define MAXKILLS 20
 extern void    	  clear_watch_hash_table(void);
+extern void    	  clear_member_hash_table(void);
+extern void    	  add_to_member_hash_table(chanMember *);
+extern void    	  del_from_member_hash_table(chanMember *);
 extern int     	  add_to_watch_hash_table(char *, aClient *);
 extern int     	  del_from_watch_hash_table(char *, aClient *);
 extern int     	  hash_check_watch(aClient *, int);
@@ -30,36 +30,47 @@ typedef struct hashentry
     void       *list;
 } aHashEntry;
 
-/* Taner had BITS_PER_COL 4 BITS_PER_COL_MASK 0xF - Dianora */
-
-#define BITS_PER_COL 3
-#define BITS_PER_COL_MASK 0x7
-#define MAX_SUB     (1<<BITS_PER_COL)
-
-/* Client hash table 
- * used in hash.c 
+/*
+ * The client and channel tables are sized at runtime: a power of two
+ * number of buckets, doubled when the entries outnumber the buckets and
+ * halved when they fall below an eighth of them, never below the
+ * minimum.  A resize allocates the new table and moves the old one
+ * over a few buckets per add or delete, so no single call pays for it;
+ * in between, an old bucket already moved is looked up in the new
+ * table.
  */
 
-#define U_MAX_INITIAL  8192
-#define U_MAX_INITIAL_MASK (U_MAX_INITIAL-1)
-#define U_MAX (U_MAX_INITIAL*MAX_SUB)
+typedef struct hashtable
+{
+    aHashEntry *table[2];       /* table[1] only while resizing */
+    unsigned    size[2];
+    long        rehash;         /* next table[0] bucket to move, or -1 */
+    unsigned    entries;
+    unsigned    minsize;
+    size_t      nextoff;        /* offsetof() the chain pointer */
+    size_t      nameoff;        /* offsetof() the name hashed on */
+} aHashTable;
 
-/* Channel hash table 
- * used in hash.c 
- */
+#define HNEXT(ht, p)    (*(void **) ((char *) (p) + (ht)->nextoff))
+#define HNAME(ht, p)    ((char *) (p) + (ht)->nameoff)
 
-#define CH_MAX_INITIAL  2048
-#define CH_MAX_INITIAL_MASK (CH_MAX_INITIAL-1)
-#define CH_MAX (CH_MAX_INITIAL*MAX_SUB)
+#define U_HASH_MIN      4096
+#define CH_HASH_MIN     1024
+#define WW_HASH_MIN     1024
+#define WATCH_HASH_MIN  4096    /* a generic table, see throttle.h */
+#define MEMBER_HASH_MIN 16384   /* likewise */
 
-/* Who was hash table 
- * used in whowas.c 
- */
+/* chain lengths counted by hash_histogram(); the last counts that many
+ * or more */
+#define HASH_HIST       8
 
-#define WW_MAX_INITIAL  16
-#define WW_MAX_INITIAL_MASK (WW_MAX_INITIAL-1)
-#define WW_MAX (WW_MAX_INITIAL*MAX_SUB)
+/* the table routines, for tables kept outside hash.c (whowas.c) */
+extern unsigned    hash_nick_name(char *);
+extern void        hash_init(aHashTable *, unsigned, size_t, size_t);
+extern aHashEntry *hash_bucket(aHashTable *, unsigned);
+extern void        hash_add(aHashTable *, char *, void *);
+extern int         hash_del(aHashTable *, char *, void *);
+extern int         hash_histogram(aHashTable *, int *);
 
-#define WATCHHASHSIZE   10007
 
 #endif /* __hash_include__ */
@@ -98,9 +98,20 @@ enum c_hooktype {
    MHOOK_UNLOAD       /* Params: 2: (char *modulename, void *moduleopaque) */
 };
 
-extern int call_hooks(enum c_hooktype hooktype, ...);
+#define HOOK_TYPES (MHOOK_UNLOAD + 1)
+
+extern int hooks_set[HOOK_TYPES];       /* hooks registered, by type */
+extern int run_hooks(enum c_hooktype hooktype, ...);
+extern int (call_hooks)(enum c_hooktype hooktype, ...);
 extern int init_modules();
 
+/*
+ * A hook type with nothing registered costs its call site one test; only
+ * a type in use pays for the varargs call into run_hooks().
+ */
+#define call_hooks(type, ...) \
+    (hooks_set[(type)] ? run_hooks((type), ##__VA_ARGS__) : 0)
+
 #define MODULE_INTERFACE_VERSION 1011 /* the interface version (hooks, modules.c commands, etc) */
 
 #ifdef BIRCMODULE
@@ -62,10 +62,10 @@ typedef struct {
     const char *file;
 
     MemCount hashtable;
-    MemCount buckets;
+    MemCount buckets;           /* slots */
     MemCount total;
 
-    int e_hashents;
+    int entries;
 } MCGenericHash;
 
 
@@ -89,6 +89,7 @@ typedef struct {
     MemCount invites;
 #endif
     MemCount lopts;
+    MemCount fanout;
     MemCount total;
 
     /* static resources */
@@ -149,15 +150,16 @@ typedef struct {
 
     /* file local */
     MemCount watches;
+    MemCount clienthash;
+    MemCount channelhash;
     MemCount total;
-
-    /* static resources */
-    MemCount s_clienthash;
-    MemCount s_channelhash;
-    MemCount s_watchhash;
+    int      clientchains[HASH_HIST];   /* buckets by chain length */
+    int      channelchains[HASH_HIST];
 
     /* external resources */
     int e_links;
+    void *e_watchhash;
+    void *e_memberhash;
 } MChash;
 
 /* hide.c */
@@ -184,7 +186,10 @@ typedef struct {
 typedef struct {
     const char *file;
     
-    /* MEMTRACE: allocates userban reasons */
+    /* MEMTRACE: allocates userban masks and reasons */
+
+    /* static resources */
+    MemCount s_bufs;
 } MCklines;
 
 /* list.c */
@@ -221,6 +226,7 @@ typedef struct {
 #ifdef USE_HOOKMODULES
     MemCount modules;
     MemCount hooks;
+    MemCount hooktabs;
     MemCount total;
 
     int e_dlinks;
@@ -234,7 +240,6 @@ typedef struct {
     const char *file;
 
     /* file local */
-    MemCount msgnodes;
     MemCount total;
 
     /* static resources */
@@ -268,11 +273,13 @@ typedef struct {
 
     /* file local */
     MemCount cached;
+    MemCount negcached;
     MemCount requests;
     MemCount total;
 
     /* static resources */
     MemCount s_cachehash;
+    MemCount s_neghash;
     MemCount s_requesthash;
 } MCres;
 
@@ -383,8 +390,8 @@ typedef struct {
     MemCount cached;
     MemCount total;
 
-    /* static resources */
-    MemCount s_hash;
+    /* external resources */
+    void *e_hash;
 } MCscache;
 
 /* send.c */
@@ -400,7 +407,6 @@ typedef struct {
     const char *file;
 
     /* external resources */
-    BlockHeap *e_hashent_heap;
 #ifdef THROTTLE_ENABLE
     BlockHeap *e_throttle_heap;
     void      *e_throttle_hash;
@@ -417,6 +423,7 @@ typedef struct {
     /* local resources */
     MemCount lists;
     MemCount entries;
+    MemCount cidrnodes;
     MemCount cidr4big_userbans;
     MemCount cidr4_userbans;
     MemCount hosthash_userbans;
@@ -438,11 +445,30 @@ typedef struct {
 typedef struct {
     const char *file;
 
-    /* static resources */
-    MemCount s_whowas;
-    MemCount s_hash;
+    /* file local */
+    MemCount generations;
+    MemCount nicks;
+    MemCount strings;
+    MemCount total;
+    int      entries;                   /* in use, of the generations */
+    int      nickchains[HASH_HIST];
+
+    /* allocated by hash.c */
+    MemCount nickhash;
+    MemCount stringhash;
 } MCwhowas;
 
+/* whoindex.c */
+typedef struct {
+    const char *file;
+
+    /* file local */
+    MemCount nodes;
+    MemCount leaves;
+    MemCount searches;
+    MemCount total;
+} MCwhoindex;
+
 /* zlink.c */
 typedef struct {
     const char *file;
@@ -503,6 +529,7 @@ u_long memcount_scache(MCscache *);
 u_long memcount_send(MCsend *);
 u_long memcount_throttle(MCthrottle *);
 u_long memcount_userban(MCuserban *);
+u_long memcount_whoindex(MCwhoindex *);
 u_long memcount_whowas(MCwhowas *);
 u_long memcount_zlink(MCzlink *);
 
@@ -389,10 +389,8 @@ struct Message msgtab[] =
 #pragma clang diagnostic pop
 #endif
 
-MESSAGE_TREE *msg_tree_root;
 #else
 extern AliasInfo aliastab[];
 extern struct Message msgtab[];
-extern MESSAGE_TREE *msg_tree_root;
 #endif
 #endif /* __msg_include__  */
@@ -16,6 +16,7 @@
 #define IRC_MAXADDRS	10
 
 #define	AR_TTL		600	 /* TTL in seconds for dns cache entries */
+#define	AR_NEGTTL	120	 /* how long an address without a name stays so */
 
 struct res_in_addr
 {
@@ -47,6 +48,8 @@ typedef struct reslist
     char        resend;			/* send flag. 0 == dont resend */
     time_t      sentat;
     time_t      timeout;
+    aTimer      timer;			/* fires at sentat + timeout */
+    int         nsmask;			/* nameservers it was sent to */
     union
     {
 	struct in_addr addr4;
@@ -68,9 +71,18 @@ typedef struct cache
     time_t      expireat;
     time_t      ttl;
     struct hostent he;
-    struct cache *hname_next, *hnum_next, *list_next;
+    struct cache *hname_next, *hnum_next, *list_next, *list_prev;
 } aCache;
 
+/* an address known to have no usable name, see AR_NEGTTL */
+typedef struct negcache
+{
+    time_t      expireat;
+    int         family;
+    struct res_in_addr addr;
+    struct negcache *hnext, *list_next, *list_prev;
+} aNegCache;
+
 typedef struct cachetable 
 {
     aCache     *num_list;
@@ -85,7 +97,9 @@ typedef struct reshash
 
 #define ARES_CACSIZE	8192
 #define ARES_IDCACSIZE  8192
+#define ARES_NEGCACSIZE 4096
 
-#define	IRC_MAXCACHED	281
+#define	IRC_MAXCACHED	4096
+#define	IRC_MAXNEGCACHED 2048
 
 #endif /* __res_include__ */
@@ -32,6 +32,7 @@
 /* forward declaration */
 struct _SBufUser;
 struct _SBuf;
+struct iovec;
 
 
 typedef struct _SBuf
@@ -52,9 +53,6 @@ extern char*		sbuf_map(SBuf* theBuf, int* theLength);
 extern int          sbuf_flush(SBuf* theBuf);
 extern int          sbuf_getmsg(SBuf* theBuf, char* theData, int theLength);
 extern int          sbuf_get(SBuf* theBuf, char* theData, int theLength);
-
-#ifdef WRITEV_IOV
-extern int          sbuf_mapiov(SBuf *, struct iovec *);
-#endif
+extern int          sbuf_mapiov(SBuf *, struct iovec *, int *);
 
 #endif /* #ifndef SBUF_H */
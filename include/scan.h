@@ -0,0 +1,74 @@
+/************************************************************************
+ *   IRC - Internet Relay Chat, include/scan.h
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef	__scan_include__
+#define __scan_include__
+
+/*
+ * memscan2 - find the first a or b in [s, end), or return end.
+ *
+ * dopacket() finds line ends (CR, LF) with this, and parse() the
+ * parameter separators (space, NUL).  Blocks are compared 32 bytes at
+ * a time when the build targets AVX2 (-mavx2, -march=native), 16 at a
+ * time with SSE2, which every x86-64 has; the tail, and any other
+ * machine, goes byte by byte.
+ */
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static inline char *memscan2(char *s, char *end, char a, char b)
+{
+#if defined(__AVX2__)
+    __m256i wa = _mm256_set1_epi8(a), wb = _mm256_set1_epi8(b);
+
+    for (; end - s >= 32; s += 32)
+    {
+	__m256i v = _mm256_loadu_si256((__m256i *) s);
+	unsigned int m = _mm256_movemask_epi8(
+	    _mm256_or_si256(_mm256_cmpeq_epi8(v, wa),
+			    _mm256_cmpeq_epi8(v, wb)));
+
+	if (m)
+	    return s + __builtin_ctz(m);
+    }
+#endif
+#if defined(__SSE2__)
+    {
+	__m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+
+	for (; end - s >= 16; s += 16)
+	{
+	    __m128i v = _mm_loadu_si128((__m128i *) s);
+	    unsigned int m = _mm_movemask_epi8(
+		_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+
+	    if (m)
+		return s + __builtin_ctz(m);
+	}
+    }
+#endif
+    while (s < end && *s != a && *s != b)
+	s++;
+    return s;
+}
+
+#endif /* __scan_include__ */
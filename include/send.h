@@ -68,7 +68,9 @@ extern void send_part_to_common_channels(aClient *from, char *reason);
 extern void sendto_fdlist(fdlist *listp, char *pattern, ...) ATTRIBUTE_PRINTF(2, 3);
 extern void sendto_locops(char *pattern, ...) ATTRIBUTE_PRINTF(1, 2);
 extern void sendto_one(aClient *to, char *pattern, ...) ATTRIBUTE_PRINTF(2, 3);
+extern void sendto_one_lines(aClient *to, char *lines, int len, int count);
 extern void sendto_alias(AliasInfo *ai, aClient *from, char *pattern, ...) ATTRIBUTE_PRINTF(3, 4);
+extern void sendto_burst(aClient *to, char *pattern, ...) ATTRIBUTE_PRINTF(2, 3);
 extern void sendto_ops(char *pattern, ...) ATTRIBUTE_PRINTF(1, 2);
 extern void sendto_ops_butone(aClient *one, aClient *from, char *pattern, ...) ATTRIBUTE_PRINTF(3, 4);
 extern void sendto_ops_lev(int lev, char *pattern, ...) ATTRIBUTE_PRINTF(2, 3);
@@ -93,6 +95,7 @@ extern void vsendto_prefix_one(aClient *to, aClient *from,
 			       char *pattern, va_list vl);
 extern void vsendto_realops(char *pattern, va_list vl);
 
+extern void mark_sendq_dirty(aClient *to);
 extern void flush_connections(int fd);
 extern void dump_connections(int fd);
 extern void free_fluders(aClient *cptr, aChannel *chptr);
@@ -109,6 +109,8 @@ extern char REPORT_DO_DNS[HOSTLEN + 100], REPORT_FIN_DNS[HOSTLEN + 100], REPORT_
 
 #include "sbuf.h"
 
+#include "timer.h"
+
 typedef struct Client aClient;
 typedef struct Channel aChannel;
 typedef struct User anUser;
@@ -116,9 +118,12 @@ typedef struct Server aServer;
 typedef struct SLink Link;
 typedef struct SLinkD DLink;
 typedef struct ChanLink chanMember;
+typedef struct FanoutLink aFanoutLink;
 typedef struct SMode Mode;
 typedef struct Watch aWatch;
 typedef struct Ban aBan;
+typedef struct BanMatch aBanMatch;
+typedef struct BanIndex aBanIndex;
 #ifdef INVITE_LISTS
 typedef struct LInvite anInvite;
 #endif
@@ -611,25 +616,28 @@ struct MotdItem
 };
 
 /* lets speed this up... also removed away information. *tough* Dianora */
+/*
+ * The strings are shared between entries (see whowas.c), so an entry is
+ * a handful of pointers no matter how long the host or realname.
+ */
 typedef struct Whowas 
 {
-    int         hashv;
-    char        name[NICKLEN + 1];
-    char        username[USERLEN + 1];
-    char        hostname[HOSTLEN + 1];
+    char       *name;
+    char       *username;
+    char       *hostname;
 #ifdef USER_HOSTMASKING
-    char        mhostname[HOSTLEN + 1];
-    char        hostip[HOSTIPLEN + 1];
+    char       *mhostname;
+    char       *hostip;
 #endif
     char       *servername;
-    char        realname[REALLEN + 1];
+    char       *realname;
     time_t      logoff;
     long umode;
     struct Client *online;  /* Pointer to new nickname for chasing or NULL */
     
-    struct Whowas *next;    /* for hash table... */
-    
-    struct Whowas *prev;    /* for hash table... */
+    struct WhowasNick *nick;    /* history of this nick */
+    struct Whowas *next;    /* same nick, older */
+    struct Whowas *prev;    /* same nick, newer */
     struct Whowas *cnext;   /* for client struct linked list */
     struct Whowas *cprev;   /* for client struct linked list */
 } aWhowas;
@@ -686,6 +694,7 @@ typedef struct Whowas
 #define CONF_FLAGS_P_SSL      0x01
 #define CONF_FLAGS_P_NODNS    0x02
 #define CONF_FLAGS_P_NOIDENT  0x04
+#define CONF_FLAGS_P_REUSEPORT 0x08  /* LISTENER_SHARDS sockets, SO_REUSEPORT */
 
 /* global configuration flags */
 
@@ -798,7 +807,7 @@ struct Conf_Port
 	char *address;
 	int   port;
 	int   flags; /* For ssl flag (and noidentd/nodns flags in the future...) */
-    aListener *lstn;
+    aListener *lstn;  /* the first of its sockets, see Listener.shard */
 	int   legal;
 	aPort *next;
 };
@@ -837,7 +846,10 @@ struct Listener {
         long            receiveM;    
         u_long          ccount;   /* total number of clients to connect here */
         int             clients;  /* number of clients currently on this */
+        u_long          accepted; /* connections accept()ed here */
+        u_long          rejected; /* and closed again before a client was made */
         aPort           *aport;   /* link to the P: line I came from */
+        aListener       *shard;   /* next socket for the same P: line */
         int             flags;    /* Flags for ssl (and nodns/noidentd in the future) */
         SSL             *ssl;
         X509            *client_cert;
@@ -852,6 +864,18 @@ struct SServicesTag
 };
 
 /* Client structures */
+/* indexes a user is entered in for WHO and RWHO, see whoindex.c */
+#define WIDX_SERVER     0
+#define WIDX_NICK       1
+#define WIDX_HOST       2
+#define WIDX_IP         3
+#ifdef USER_HOSTMASKING
+#define WIDX_MHOST      4
+#define WIDX_TREES      5
+#else
+#define WIDX_TREES      4
+#endif
+
 struct User
 {
     Link       *channel;       /* chain of channel pointer blocks */
@@ -885,6 +909,11 @@ struct User
 #endif
     aOper      *oper;
     aAllow     *allow;
+    struct {                   /* place in each WHO index */
+        aClient *prev;
+        aClient *next;
+        void    *leaf;         /* users sharing the key, NULL if absent */
+    } widx[WIDX_TREES];
 };
 
 struct Server
@@ -904,30 +933,37 @@ struct Server
     void       *zip_out;
     void       *zip_in;
     int         uflags;           /* U:lined flags */
+    void       *burst;            /* netburst in progress, m_server.c */
+    aClient    *ingest;           /* uplink last named in its burst to us */
 };
 
 struct Client 
 {
-    struct Client *next, *prev, *hnext;
-    anUser     *user;       /* ...defined, if this is a User */
-    aServer    *serv;       /* ...defined, if this is a server */
-    aWhowas    *whowas;     /* Pointers to whowas structs */
-    time_t      lasttime;   /* ...should be only LOCAL clients? --msa */
-    time_t      firsttime;  /* time client was created */
-    time_t      since;      /* last time we parsed something */
-    ts_val      tsinfo;     /* TS on the nick, SVINFO on servers */
+    /*
+     * Hot fields: what the send and fanout paths look at for every
+     * recipient.  Keep these within the first 64 bytes, list.c checks.
+     */
+    aClient    *from;       /* == self, if Local Client, *NEVER* NULL! */
     long        flags;      /* client flags */
     long        umode;      /* We can illeviate overflow this way
                                Note: if you change this, you need to also
                                change struct SearchOptions,
                                struct Whowas and struct SServicesTag -Kobi.
                              */
-    aClient    *from;       /* == self, if Local Client, *NEVER* NULL! */
-    aClient    *uplink;     /* this client's uplink to the network */
     int         fd;         /* >= 0, for local clients */
-    int         hopcount;   /* number of servers to this 0 = local */
     short       status;     /* Client type */
-    char        nicksent;
+    unsigned char nicksent; /* netburst slots this client was sent in */
+    anUser     *user;       /* ...defined, if this is a User */
+    aServer    *serv;       /* ...defined, if this is a server */
+    aClient    *uplink;     /* this client's uplink to the network */
+    int         hopcount;   /* number of servers to this 0 = local */
+
+    struct Client *next, *prev, *hnext;
+    aWhowas    *whowas;     /* Pointers to whowas structs */
+    time_t      lasttime;   /* ...should be only LOCAL clients? --msa */
+    time_t      firsttime;  /* time client was created */
+    time_t      since;      /* last time we parsed something */
+    ts_val      tsinfo;     /* TS on the nick, SVINFO on servers */
     char        name[HOSTLEN + 1];  /* Unique name of the client, nick or
 				     * host */
     char        info[REALLEN + 1];  /* Free form additional client 
@@ -1005,6 +1041,21 @@ struct Client
      */
     
     int         count;		/* Amount of data in buffer */
+    /* hot local fields, used by send_message() for every message */
+    short       lastsq;	         /* # of 2k blocks when sendqueued called 
+				  * last */
+    SBuf        sendQ;	     /* Outgoing message queue--if socket full */
+    aClass     *class;           /* our current effective class */
+    aListener  *lstn;	         /* listener which we accepted from */
+    long        sendM;		 /* Statistics: protocol messages send */
+    long        sendK;		 /* Statistics: total k-bytes send */
+    u_short     sendB;		 /* counters to count upto 1-k lots of bytes */
+    u_short     receiveB;	 /* sent and received. */
+    SBuf        recvQ;	     /* Hold for data incoming yet to be parsed */
+    long        receiveM;	 /* Statistics: protocol messages received */
+    long        receiveK;	 /* Statistics: total k-bytes received */
+
+    /* cold local fields */
 #ifdef FLUD
     time_t      fludblock;
     struct fludbot *fluders;
@@ -1017,20 +1068,9 @@ struct Client
     int         oper_warn_count_down;	/* warn opers of this possible spambot 
 					 * every time this gets to 0 */
 #endif
-    char        buffer[BUFSIZE];        /* Incoming message buffer */
-    short       lastsq;	         /* # of 2k blocks when sendqueued called 
-				  * last */
-    SBuf        sendQ;	     /* Outgoing message queue--if socket full */
-    SBuf        recvQ;	     /* Hold for data incoming yet to be parsed */
-    long        sendM;		 /* Statistics: protocol messages send */
-    long        sendK;		 /* Statistics: total k-bytes send */
-    long        receiveM;	 /* Statistics: protocol messages received */
-    long        receiveK;	 /* Statistics: total k-bytes received */
-    u_short     sendB;		 /* counters to count upto 1-k lots of bytes */
-    u_short     receiveB;	 /* sent and received. */
+    aTimer      timer;           /* next ping or timeout check */
     long        lastrecvM;       /* to check for activity --Mika */
     int         priority;
-    aListener  *lstn;	         /* listener which we accepted from */
     int         authfd;	         /* fd for rfc931 authentication */
     char        username[USERLEN + 1]; /* username here now for auth stuff */
     unsigned short port;	 /* and the remote port# too :-) */
@@ -1057,7 +1097,6 @@ struct Client
     int sockerr;                /* what was the last error returned for
 				 * this socket? */
     int capabilities;           /* what this server/client supports */
-    aClass  *class;             /* our current effective class */
 
 #ifdef MSG_TARGET_LIMIT
     struct {
@@ -1073,10 +1112,13 @@ struct Client
 
     char *webirc_username;
     char *webirc_ip;
+
+    char        buffer[BUFSIZE];        /* Incoming message buffer */
 };
 
 #define	CLIENT_LOCAL_SIZE sizeof(aClient)
 #define	CLIENT_REMOTE_SIZE offsetof(aClient,count)
+#define	CLIENT_HOT_SIZE offsetof(aClient,next)
 /* statistics structures */
 struct stats
 {
@@ -1110,6 +1152,10 @@ struct stats
     unsigned int is_loc;    /* local connections made */
     unsigned int is_ref_1;  /* refused at kline stage 1 */
     unsigned int is_ref_2;  /* refused at kline stage 2 */
+    unsigned int is_burst;  /* netbursts sent */
+    unsigned long is_burstms;  /* time spent sending them, ms */
+    unsigned long is_burstmax; /* longest netburst, ms */
+    unsigned long is_burstsq;  /* peak sendQ during a netburst */
 #ifdef FLUD
     unsigned int is_flud;   /* users/channels flood protected */
 #endif	                    /* FLUD */
@@ -1143,6 +1189,8 @@ struct SAliasInfo
 #define MF_ALIAS    0x0004  /* aliastab index valid */
 
 /* Message table structure */
+#define MSG_HISTSIZE    32      /* handler time buckets, 2^n ns each */
+
 struct Message
 {
     char            *cmd;           /* command name */
@@ -1152,15 +1200,11 @@ struct Message
     int              aliasidx;      /* aliastab index */
     unsigned int     count;         /* number of times used */
     unsigned long    bytes;         /* number of bytes used */
+    unsigned long    ns;            /* time spent in the handler */
+    unsigned long    maxns;         /* longest single call */
+    unsigned int     hist[MSG_HISTSIZE]; /* calls by log2 of ns taken */
 };
 
-typedef struct msg_tree 
-{
-    char       *final;
-    struct Message *msg;
-    struct msg_tree *pointers[26];
-} MESSAGE_TREE;
-
 /*
  * Move BAN_INFO information out of the SLink struct its _only_ used
  * for bans, no use wasting the memory for it in any other type of
@@ -1178,9 +1222,60 @@ struct Ban
     char       *who;
     time_t      when;
     u_char	    type;
+    aBanMatch  *match;          /* compiled banstr, see ban_compile() */
     aBan 	   *next;
 };
 
+/* one nick, user or host field of a compiled ban mask */
+struct BanPart
+{
+    char           *pat;        /* NUL terminated field of the mask */
+    unsigned short  len;        /* strlen(pat) */
+    unsigned short  pre;        /* literal characters before 1st wildcard */
+    unsigned short  suf;        /* literal characters after last wildcard */
+    u_char          flags;      /* BMP_* */
+};
+
+#define BMP_LITERAL    0x01    /* no wildcards, compare with mycmp() */
+#define BMP_SIMPLE     0x02    /* "pre*suf", prefix/suffix compare is exact */
+
+/*
+ * Ban and exempt masks are compiled once when they are added, so that
+ * checking a client only runs match() on the fields that really need it.
+ * A mask that does not split cleanly into nick!user@host is matched
+ * whole, as before.
+ */
+struct BanMatch
+{
+    aBanMatch      *next;       /* chain in the channel's aBanIndex */
+    void           *owner;      /* aBan or aBanExempt compiled from */
+    char           *mask;       /* owner's banstr */
+    unsigned int    hashv;      /* host hash, for literal host masks */
+    u_char          type;       /* MTYP_* of the owner */
+    u_char          split;      /* nick, user and host below are valid */
+    u_char          cidr4bits;  /* prefix length if host is IPv4 CIDR */
+    u_char          cidr6bits;  /* prefix length if host is IPv6 CIDR */
+    u_char          cidr4[4];
+    u_char          cidr6[16];
+    struct BanPart  nick;
+    struct BanPart  user;
+    struct BanPart  host;
+};
+
+#define BANIDX_SIZE    16
+
+/*
+ * Per-channel index over compiled masks.  Masks with a literal host
+ * and no CIDR are hashed by that host, everything else is kept on the
+ * wild chain, much like the host_bans hash and wild lists in userban.c.
+ */
+struct BanIndex
+{
+    aBanMatch      *exact[BANIDX_SIZE];
+    aBanMatch      *wild;
+    int             count;
+};
+
 #ifdef INVITE_LISTS
 /* channel invite list structure */
 
@@ -1202,6 +1297,7 @@ struct Exempt
     char*        who;
     time_t       when;
     u_char       type;
+    aBanMatch*   match;         /* compiled banstr, see ban_compile() */
     aBanExempt*  next;
 };
 #endif
@@ -1210,12 +1306,23 @@ struct Exempt
 struct ChanLink 
 {
     struct ChanLink *next;
+    struct ChanLink *prev;
     aClient *cptr;
+    aChannel *chptr;            /* with cptr, the key in the member hash */
     int flags;
     time_t when;
     int last_message_number;    /* Number of messages sent to channel within max_messages_time */
     time_t last_message_time;   /* When last message was sent to channel. -Holbrook */
     unsigned int banserial;     /* used for bquiet cache */
+    int fanout;                 /* slot in chptr->lfds, -1 if remote */
+};
+
+/* remote server link in a channel's fanout set, see chan_fanout_add() */
+struct FanoutLink
+{
+    aClient *link;              /* directly connected server */
+    int members;                /* channel members reached through it */
+    int ulined;                 /* of those, U:lined clients on link itself */
 };
 
 /* general link structure used for chains */
@@ -1263,13 +1370,22 @@ struct Channel
     time_t      topic_time;
     int         users;
     chanMember* members;
+    int*        lfds;           /* packed fds of local members */
+    chanMember** lcms;          /* member entry for each lfds slot */
+    int         nlocal;         /* used lfds/lcms slots */
+    int         maxlocal;       /* allocated lfds/lcms slots */
+    aFanoutLink* rlinks;        /* server links with members behind them */
+    int         nrlinks;        /* used rlinks slots */
+    int         maxrlinks;      /* allocated rlinks slots */
     Link*       invites; /* users invited to the channel */
     aBan*       banlist;
+    aBanIndex*  banidx;         /* compiled banlist, NULL if empty */
 #ifdef INVITE_LISTS
     anInvite*   invite_list; /* +I list */
 #endif
 #ifdef EXEMPT_LISTS
     aBanExempt* banexempt_list;
+    aBanIndex*  exemptidx;      /* compiled banexempt_list, NULL if empty */
 #endif
     ts_val      channelts;
 #ifdef FLUD
@@ -1283,6 +1399,10 @@ struct Channel
     int         jrw_debt_ctr;   /* join rate warning: in-debt counter */
     int         jrw_debt_ts;    /* join rate warning: debt begin timestamp */
     unsigned int banserial;     /* used for bquiet cache */
+    unsigned char burstsent;    /* netburst slots this channel was sent in */
+    struct Channel *lnext, *lprev;  /* LIST index, by user count */
+    unsigned short lbucket;     /* LIST index bucket it is filed in */
+    unsigned int listrefs;      /* paused LIST cursors resting on it */
     int join_connect_time;      /* Number of seconds the user must be online to be able to join */
     int talk_connect_time;      /* Number of seconds the user must be online to be able to talk on the channel */
     int talk_join_time;         /* Number of seconds the user must be on the channel to be able to tlak on the channel */
@@ -1313,6 +1433,7 @@ struct Channel
 #define MTYP_FULL      0x01    /* mask is nick!user@host */
 #define MTYP_USERHOST  0x02    /* mask is user@host */
 #define MTYP_HOST      0x04    /* mask is host only */
+#define MTYP_ALL       (MTYP_FULL | MTYP_USERHOST | MTYP_HOST)
 
 /* Channel Visibility macros */
 
@@ -1366,7 +1487,7 @@ struct Channel
                                  (MODE_PRIVATE | MODE_SECRET)) == 0)
 
 #define IsMember(blah,chan) ((blah && blah->user && \
-		find_channel_link((blah->user)->channel, chan)) ? 1 : 0)
+		find_user_member(chan, blah)) ? 1 : 0)
 
 #define	IsChannelName(name) ((name) && (*(name) == '#'))
 
@@ -1491,7 +1612,6 @@ struct fludbot
 
 struct Watch 
 {
-    aWatch  *hnext;
     time_t   lasttime;
     Link  *watch;
     char  nick[1];
@@ -1501,7 +1621,9 @@ struct ListOptions
 {
     LOpts *next;
     Link  *yeslist, *nolist;
-    int   starthash;
+    aChannel *nextch;   /* next channel to look at, NULL between buckets */
+    int   bucket;       /* LIST index bucket being walked */
+    int   lowbucket;    /* last bucket that can hold a match */
     short int   showall, only_listed;
     unsigned short usermin;
     int   usermax;
@@ -69,8 +69,17 @@
 #include <time.h>
 #endif
 
-#ifdef WRITEV_IOV
 #include <sys/uio.h>
+#include <limits.h>
+
+/* sendQs are always written with writev(); gather as many segments per
+ * call as the system allows */
+#ifndef WRITEV_IOV
+# ifdef IOV_MAX
+#  define WRITEV_IOV IOV_MAX
+# else
+#  define WRITEV_IOV 16
+# endif
 #endif
 
 extern void dummy();
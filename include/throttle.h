@@ -80,21 +80,34 @@ void throttle_stats(aClient *cptr, char *name);
 #endif
 
 
-#include "queue.h"
-
-SLIST_HEAD(hashent_list_t, hashent_t);
-typedef struct hashent_list_t hashent_list;
+/*
+ * The generic hash table is open addressed: one array of slots, each
+ * holding an entry and its full hash value, probed linearly from the
+ * entry's home slot.  Insertions are Robin Hood style -- an entry
+ * further from home takes the slot of one nearer to home -- so probe
+ * sequences stay short and a lookup stops as soon as it meets an entry
+ * nearer home than itself.  Deletion shifts the following entries back
+ * rather than leaving tombstones.  The stored hash means a probe only
+ * touches an entry's key when the hashes match.
+ *
+ * The slot count is a power of two, doubled when the table is 3/4 full
+ * and halved when it falls below 1/8, but never below the size it was
+ * created with.
+ */
 
-typedef struct hashent_t
+typedef struct hashslot_t
 {
-    void    *ent;
-    SLIST_ENTRY(hashent_t) lp;
-} hashent;
+    unsigned int hash;
+    void    *ent;           /* NULL if the slot is empty */
+} hashslot;
 
 typedef struct hash_table_t
 {
-    int     size;           /* this should probably always be prime :) */
-    hashent_list *table;    /* our table */
+    char   *name;           /* for HASH */
+    int     size;           /* slots, always a power of two */
+    int     minsize;
+    int     count;
+    hashslot *table;        /* our table */
     size_t  keyoffset;      /* this stores the offset of the key from the
         given structure */
     size_t  keylen;         /* the length of the key. if 0, assume key
@@ -109,30 +122,43 @@ typedef struct hash_table_t
         * return of 0 (ZERO) means success! (this lets you use stuff like
                                              * strncmp easily) */
     int     (*cmpfunc)(void *, void *);
+
+    /* statistics, for HASH */
+    u_long  lookups;
+    u_long  probes;         /* slots looked at by those lookups */
+    int     resizes;
+
+    struct hash_table_t *next;  /* all tables, for HASH */
 } hash_table;
 
-/* this function creates a hashtable with 'elems' buckets (elems should be
-* prime for best efficiency).  'offset' is the offset of the key from
-* structures being added (this should be obtained with the 'offsetof()'
-                          * function).  len is the length of the key, and flags are any flags for the
-* table (see above).  cmpfunc is the function which should be used for
-* comparison when calling 'hash_find' */
-hash_table *create_hash_table(int elems, size_t offset, size_t len, int flags,
+/* this function creates a hashtable with room for at least 'elems'
+* entries before it first grows, named 'name' in HASH output.  'offset'
+* is the offset of the key from structures being added (this should be
+* obtained with the 'offsetof()' function).  len is the length of the
+* key, and flags are any flags for the table (see above).  cmpfunc is
+* the function which should be used for comparison when calling
+* 'hash_find' */
+hash_table *create_hash_table(char *name, int elems, size_t offset,
+                              size_t len, int flags,
                               int (*cmpfunc)(void *, void *));
 /* this function destroys a previously created hashtable */
 void destroy_hash_table(hash_table *table);
-/* this function resizes a hash-table to the new size given with 'elems'.
-* this is not in any way inexpensive, and should really not be done very
-* often.  */
+/* this function makes room for at least 'elems' entries, and keeps the
+* table at least that big from then on.  it rebuilds the whole table, so
+* should not be done very often.  */
 void resize_hash_table(hash_table *table, int elems);
-/* this function gets the hash value of a given key, relative to the size of
-* the hashtable */
+/* this function gets the full hash value of a given key */
 unsigned int hash_get_key_hash(hash_table *table, void *key, size_t offset);
 /* these functions do what you would expect, adding/deleting/finding items
 * in a hash table */
 int hash_insert(hash_table *table, void *ent);
 int hash_delete(hash_table *table, void *ent);
 void *hash_find(hash_table *table, void *key);
+/* returns each item in turn, starting with *pos set to 0, then NULL.
+* the table must not be changed while walking it. */
+void *hash_walk(hash_table *table, int *pos);
+/* sends the statistics of every table to a client, for HASH */
+void hash_table_report(aClient *cptr);
 
 #endif /* THROTTLE_H */
 /* vi:set ts=8 sts=4 sw=4 tw=79: */
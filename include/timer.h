@@ -0,0 +1,60 @@
+/************************************************************************
+ *   IRC - Internet Relay Chat, include/timer.h
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+/*
+ * A timer is embedded in whatever it times (a local client, a DNS
+ * query) or is a static for periodic jobs.  timer_init() once, then
+ * timer_set() and timer_del() as often as needed; setting a pending
+ * timer moves it.  When it comes due, run_timers() unlinks it and calls
+ * func(arg), which may set it again.
+ */
+
+typedef struct Timer aTimer;
+
+struct Timer
+{
+    aTimer     *next;
+    aTimer    **prev;           /* NULL unless pending */
+    time_t      when;
+    void      (*func)(void *);
+    void       *arg;
+};
+
+#define TimerPending(t)     ((t)->prev != NULL)
+
+typedef struct TimerStats
+{
+    unsigned long pending;      /* timers set and not yet due */
+    unsigned long fired;
+    unsigned long cascaded;     /* moved down a level of the wheel */
+    unsigned long maxfired;     /* most fired by one run_timers() */
+} TimerStats;
+
+extern TimerStats timerstats;
+
+extern void   init_timers(time_t);
+extern void   timer_init(aTimer *, void (*)(void *), void *);
+extern void   timer_set(aTimer *, time_t);
+extern void   timer_del(aTimer *);
+extern void   run_timers(time_t);
+extern time_t timer_next(void);
+
+#endif
@@ -79,17 +79,20 @@ struct simBan {
 void init_userban();
 
 struct userBan *make_hostbased_ban(char *, char *);
+struct userBan *userban_alloc();
 
 void add_hostbased_userban(struct userBan *);
 void remove_userban(struct userBan *);
 void userban_free(struct userBan *);
 
 struct userBan *check_userbanned(aClient *, unsigned int, unsigned int);
+struct userBan *check_ipbanned(int, void *, char *);
 struct userBan *find_userban_exact(struct userBan *, unsigned int);
 
 void expire_userbans();
 void remove_userbans_match_flags(unsigned int, unsigned int);
 void report_userbans_match_flags(aClient *cptr, unsigned int, unsigned int);
+void report_userban_stats(aClient *);
 
 int user_match_ban(aClient *, struct userBan *);
 char *get_userban_host(struct userBan *, char *, int);
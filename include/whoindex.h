@@ -0,0 +1,97 @@
+/*
+ *   whoindex.h - Secondary indexes over clients for WHO and RWHO
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef __whoindex_include__
+#define __whoindex_include__
+
+/* longest key: a reversed hostname and its terminator */
+#define WIDX_KEYLEN     (HOSTLEN + 2)
+
+typedef struct WhoQuery aWhoQuery;
+
+/*
+ * A lookup in one index: every user whose key there starts with the
+ * first 'bits' bits of 'key'.  String keys are upper cased, and carry
+ * their terminator, so a query including it is an exact match.
+ */
+struct WhoQuery
+{
+    int           tree;             /* WIDX_* */
+    int           bits;
+    unsigned char key[WIDX_KEYLEN];
+};
+
+extern void whoidx_add(aClient *);
+extern void whoidx_remove(aClient *);
+extern void whoidx_update(aClient *, int);
+
+/* fill in a query from a search argument, 0 if no index can serve it */
+extern int  whoidx_server(aWhoQuery *, aClient *);
+extern int  whoidx_nick(aWhoQuery *, char *);
+extern int  whoidx_host(aWhoQuery *, char *);
+extern int  whoidx_cidr(aWhoQuery *, int, void *, int);
+extern int  whoidx_ip(aWhoQuery *, char *);
+
+extern int       whoidx_plan(aWhoQuery *, int, int);
+extern int       whoidx_count(aWhoQuery *);
+extern aClient **whoidx_collect(aWhoQuery *, int *);
+extern char     *whoidx_name(aWhoQuery *);
+
+/* how long a search runs in one go, in nanoseconds */
+#define WHO_SLICE       2000000
+
+typedef struct WhoSearch aWhoSearch;
+
+/*
+ * A WHO or RWHO that may run over several io loop passes.  It walks
+ * either the client list or a set of candidates; what the command
+ * itself needs to carry on follows the struct, see WHOSEARCH_STATE.
+ */
+struct WhoSearch
+{
+    aWhoSearch  *next;              /* paused searches */
+    aClient     *cptr;              /* who asked */
+    aClient     *nextc;             /* client list cursor */
+    aClient    **set;               /* or the candidates */
+    int          nset;
+    int          pos;
+    int          size;
+    int          strused;
+    int          checks;
+    long long    deadline;          /* CLOCK_MONOTONIC, nanoseconds */
+    int        (*resume)(aWhoSearch *);
+    void       (*end)(aWhoSearch *);
+    void       (*release)(aWhoSearch *);
+    char         strings[BUFSIZE];  /* copies of the arguments */
+};
+
+#define WHOSEARCH_STATE(ws)     ((void *) ((ws) + 1))
+
+extern aWhoSearch *whosearch_new(aClient *, int, int (*)(aWhoSearch *),
+                                 void (*)(aWhoSearch *),
+                                 void (*)(aWhoSearch *));
+extern char       *whosearch_save(aWhoSearch *, char *);
+extern void        whosearch_clients(aWhoSearch *);
+extern void        whosearch_set(aWhoSearch *, aClient **, int);
+extern void        whosearch_members(aWhoSearch *, aChannel *);
+extern aClient    *whosearch_next(aWhoSearch *);
+extern int         whosearch_full(aWhoSearch *);
+extern void        whosearch_pause(aWhoSearch *);
+extern void        whosearch_free(aWhoSearch *);
+
+#endif /* __whoindex_include__ */
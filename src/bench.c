@@ -0,0 +1,1036 @@
+/************************************************************************
+ *   IRC - Internet Relay Chat, src/bench.c
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* mkdtemp() */
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+/*
+ * bench.c - microbenchmarks for the send, parse and match hot paths.
+ *
+ * Built by 'make bench' and linked against the same objects as the
+ * ircd itself (ircd.c is compiled with main renamed out of the way).
+ * Nothing here touches the network: local clients and server links get
+ * made-up fd numbers and are flagged FLAGS_BLOCKED, so send_message()
+ * queues into their sendQs and never tries a write.  The queues are
+ * emptied between timed batches.
+ *
+ * Every test reports the mean wall time per operation and the number of
+ * MyMalloc()/MyRealloc() calls per operation, as counted by support.c
+ * when built with -DBENCHMARK.
+ */
+
+#include "struct.h"
+#include "common.h"
+#include "sys.h"
+#include "h.h"
+#include "numeric.h"
+#include "msg.h"
+#include "channel.h"
+#include "inet.h"
+#include "throttle.h"
+#include "userban.h"
+#include "clones.h"
+#include "fds.h"
+#include "zlink.h"
+#include "scan.h"
+#include "whoindex.h"
+
+#include <sys/time.h>
+
+extern unsigned long bench_allocs;
+extern struct Message msgtab[];
+extern aChannel *get_channel(aClient *, char *, int, int *);
+extern void add_user_to_channel(aChannel *, aClient *, int);
+extern void init_globals();
+
+#define BENCH_LINKS     4       /* fake server links */
+#define BENCH_KLINES    100000  /* K-lines for the userban test */
+#define BENCH_BURST     20000   /* users in the simulated netburst */
+#define BENCH_BURSTCHAN 40      /* users per burst SJOIN line */
+#define BENCH_ZIPFLUSH  256     /* lines per zip flush (io loop pass) */
+#define BENCH_MEMBERS   1000    /* members asked about by bench_member() */
+
+typedef struct BenchStat BenchStat;
+
+struct BenchStat
+{
+    char *name;
+    unsigned long ops;
+    double ns;
+    unsigned long allocs;
+};
+
+static aClient *links[BENCH_LINKS];
+static int bench_maxfd = 0;
+static int bench_serial = 0;
+static char linebuf[BUFSIZE];
+
+static double bench_now()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (double) tv.tv_sec * 1e9 + (double) tv.tv_usec * 1e3;
+}
+
+/* empty every fake sendQ; called outside the timed region */
+static void bench_drain()
+{
+    int i;
+
+    for (i = 0; i <= bench_maxfd; i++)
+        if (local[i] && SBufLength(&local[i]->sendQ))
+            sbuf_flush(&local[i]->sendQ);
+}
+
+static int bench_fd()
+{
+    if (bench_maxfd + 1 >= MAXCONNECTIONS)
+        return -1;
+    return ++bench_maxfd;
+}
+
+static void bench_report(BenchStat *st)
+{
+    printf("%-34s %9lu ops %12.1f ns/op %9.2f allocs/op\n", st->name,
+           st->ops, st->ns / (double) st->ops,
+           (double) st->allocs / (double) st->ops);
+}
+
+static aClient *bench_link(char *name)
+{
+    aClient *cptr = make_client(NULL, &me);
+
+    cptr->fd = bench_fd();
+    local[cptr->fd] = cptr;
+    make_server(cptr);
+    strncpyzt(cptr->name, name, sizeof(cptr->name));
+    strcpy(cptr->info, "benchmark link");
+    cptr->hopcount = 1;
+    cptr->tsinfo = TS_DOESTS;
+    cptr->serv->up = me.name;
+    cptr->capabilities = CAPAB_BURST | CAPAB_UNCONN | CAPAB_NICKIPSTR;
+    cptr->flags |= FLAGS_BLOCKED;
+    SetServer(cptr);
+    Count.server++;
+    Count.myserver++;
+    add_to_list(&server_list, cptr);
+    add_client_to_list(cptr);
+    add_to_client_hash_table(cptr->name, cptr);
+    find_or_add(cptr->name);
+    return cptr;
+}
+
+static aClient *bench_local(char *nick)
+{
+    aClient *cptr;
+    int fd;
+
+    if ((fd = bench_fd()) < 0)
+        return NULL;
+
+    cptr = make_client(NULL, &me);
+    cptr->fd = fd;
+    local[fd] = cptr;
+    make_user(cptr);
+    strncpyzt(cptr->name, nick, sizeof(cptr->name));
+    strcpy(cptr->username, "bench");
+    strcpy(cptr->user->username, "bench");
+    ircsprintf(cptr->user->host, "%d.users.bench.example", fd);
+#ifdef USER_HOSTMASKING
+    strcpy(cptr->user->mhost, cptr->user->host);
+#endif
+    strcpy(cptr->sockhost, cptr->user->host);
+    strcpy(cptr->info, "benchmark client");
+    cptr->ip_family = AF_INET;
+    cptr->ip.ip4.s_addr = htonl(0x0a000000 | fd);
+    strcpy(cptr->hostip, inetntoa((char *) &cptr->ip.ip4));
+    cptr->user->server = me.name;
+    cptr->tsinfo = timeofday;
+    cptr->flags |= FLAGS_BLOCKED;
+    SetClient(cptr);
+    Count.local++;
+    Count.total++;
+    add_client_to_list(cptr);
+    add_to_client_hash_table(cptr->name, cptr);
+    whoidx_add(cptr);
+    return cptr;
+}
+
+/* introduce a remote user the way a peer would */
+static aClient *bench_remote(aClient *link, char *nick)
+{
+    int n = ++bench_serial;
+
+    ircsprintf(linebuf, "NICK %s 2 %ld +i ru%d %d.remote.bench.example "
+               "%s 0 172.%d.%d.%d :remote benchmark client", nick,
+               (long) timeofday, n & 0xffff, n, link->name, (n >> 16) & 0xff,
+               (n >> 8) & 0xff, n & 0xff);
+    parse(link, linebuf, linebuf + strlen(linebuf));
+    return find_person(nick, NULL);
+}
+
+/*
+ * build a channel with 'members' users: half of them local (as far
+ * as free fds allow), the rest spread over the fake server links.
+ * Returns the first local member, used as the speaker.
+ */
+static aClient *bench_channel(char *chname, int members)
+{
+    aChannel *chptr;
+    aClient *acptr, *speaker = NULL;
+    char nick[NICKLEN + 1];
+    int i, n, nlocal = (members + 1) / 2;
+
+    for (i = 0; i < members; i++)
+    {
+        n = ++bench_serial;
+        ircsprintf(nick, "%c%d", 'a' + n % 26, n);
+        if (i < nlocal && (acptr = bench_local(nick)))
+        {
+            if (!speaker)
+                speaker = acptr;
+        }
+        else if (!(acptr = bench_remote(links[i % BENCH_LINKS], nick)))
+            continue;
+
+        chptr = get_channel(acptr, chname, CREATE, NULL);
+        add_user_to_channel(chptr, acptr, i ? 0 : CHFL_CHANOP);
+    }
+    bench_drain();
+    return speaker;
+}
+
+static aClient *bench_fanout(char *name, char *chname, int members)
+{
+    BenchStat st;
+    aClient *speaker = bench_channel(chname, members);
+    aChannel *chptr = find_channel(chname, NULL);
+    int batch = MAX(1, 4096 / members), i, rounds = 0;
+    double t0, deadline;
+    unsigned long a0;
+
+    memset(&st, 0, sizeof(st));
+    st.name = name;
+
+    deadline = bench_now() + 5e8;
+    while (bench_now() < deadline || rounds < 3)
+    {
+        a0 = bench_allocs;
+        t0 = bench_now();
+        for (i = 0; i < batch; i++)
+            sendto_channel_butone(speaker, speaker, chptr,
+                                  ":%s PRIVMSG %s :%s", speaker->name,
+                                  chptr->chname, "the quick brown fox jumps "
+                                  "over the lazy dog");
+        st.ns += bench_now() - t0;
+        st.allocs += bench_allocs - a0;
+        st.ops += batch;
+        rounds++;
+        bench_drain();
+    }
+    bench_report(&st);
+    return speaker;
+}
+
+static void bench_parse(char *name, aClient *cptr, char **lines)
+{
+    BenchStat st;
+    double t0, deadline;
+    unsigned long a0;
+    int i, n;
+
+    memset(&st, 0, sizeof(st));
+    st.name = name;
+    for (n = 0; lines[n]; n++)
+        ;
+
+    deadline = bench_now() + 5e8;
+    while (bench_now() < deadline)
+    {
+        a0 = bench_allocs;
+        t0 = bench_now();
+        for (i = 0; i < 1024; i++)
+        {
+            /* parse() tokenizes in place, so each round needs a fresh
+             * copy of the line */
+            strcpy(linebuf, lines[i % n]);
+            parse(cptr, linebuf, linebuf + strlen(linebuf));
+        }
+        st.ns += bench_now() - t0;
+        st.allocs += bench_allocs - a0;
+        st.ops += 1024;
+        bench_drain();
+    }
+    bench_report(&st);
+}
+
+static char *match_masks[] =
+{
+    "*!*@*.example.com", "*!*@10.0.*", "*!*user@*", "nick*!*@*",
+    "*!*@*.users.undernet.org", "*!~*@*", "*!*@host-1?-3?.isp.net",
+    "jupe!*@*", "*!*@*.dal.net", "*!*ident@192.168.*.*", NULL
+};
+
+static char *match_names[] =
+{
+    "somenick!~someuser@cpe-24-58-101-12.twcny.res.rr.com",
+    "nick_away!user@staff.dal.net",
+    "x!y@10.0.13.7",
+    "WiZ!~wiz@host-12-34.isp.net",
+    "guest4821!~guest@2001:db8:4::1f",
+    "anotherone!ident@192.168.1.20", NULL
+};
+
+static void bench_match()
+{
+    BenchStat st;
+    double t0, deadline;
+    unsigned long a0;
+    int i, j, nm, nn, hits = 0;
+
+    memset(&st, 0, sizeof(st));
+    st.name = "match (ban masks x nuh)";
+    for (nm = 0; match_masks[nm]; nm++)
+        ;
+    for (nn = 0; match_names[nn]; nn++)
+        ;
+
+    deadline = bench_now() + 5e8;
+    while (bench_now() < deadline)
+    {
+        a0 = bench_allocs;
+        t0 = bench_now();
+        for (i = 0; i < nm; i++)
+            for (j = 0; j < nn; j++)
+                if (!match(match_masks[i], match_names[j]))
+                    hits++;
+        st.ns += bench_now() - t0;
+        st.allocs += bench_allocs - a0;
+        st.ops += nm * nn;
+    }
+    bench_report(&st);
+}
+
+/*
+ * Membership and status queries in the 20k member channel, asked for a
+ * spread of its members, as can_send() and the mode and kick handlers
+ * do for every line.
+ */
+static void bench_member(char *chname)
+{
+    BenchStat st;
+    aChannel *chptr = find_channel(chname, NULL);
+    aClient *who[BENCH_MEMBERS];
+    chanMember *cm;
+    double t0, deadline;
+    unsigned long a0;
+    int i, n = 0, step = MAX(1, chptr->users / BENCH_MEMBERS), hits = 0;
+
+    memset(&st, 0, sizeof(st));
+    st.name = "is_chan_op (20k members)";
+    for (i = 0, cm = chptr->members; cm && n < BENCH_MEMBERS; cm = cm->next)
+        if (i++ % step == 0)
+            who[n++] = cm->cptr;
+
+    deadline = bench_now() + 5e8;
+    while (bench_now() < deadline)
+    {
+        a0 = bench_allocs;
+        t0 = bench_now();
+        for (i = 0; i < n; i++)
+            if (is_chan_op(who[i], chptr))
+                hits++;
+        st.ns += bench_now() - t0;
+        st.allocs += bench_allocs - a0;
+        st.ops += n;
+    }
+    bench_report(&st);
+}
+
+/*
+ * A host suffix search over everyone the channel tests made, as WHO
+ * and RWHO run it: by scanning every client, and through the host
+ * index, matching only the candidates it returns.
+ */
+static void bench_who(char *mask)
+{
+    BenchStat st[2];
+    aWhoQuery q;
+    aClient *ac, **found;
+    double t0, deadline;
+    unsigned long a0;
+    int i, n, hits[2] = {0, 0};
+
+    memset(st, 0, sizeof(st));
+    st[0].name = "host search, scan (21k users)";
+    st[1].name = "host search, index (21k users)";
+    whoidx_host(&q, mask);
+
+    deadline = bench_now() + 5e8;
+    while (bench_now() < deadline)
+    {
+        a0 = bench_allocs;
+        t0 = bench_now();
+        for (ac = client; ac; ac = ac->next)
+            if (IsClient(ac) && !match(mask, ac->user->host))
+                hits[0]++;
+        st[0].ns += bench_now() - t0;
+        st[0].allocs += bench_allocs - a0;
+        st[0].ops++;
+
+        a0 = bench_allocs;
+        t0 = bench_now();
+        found = whoidx_collect(&q, &n);
+        for (i = 0; i < n; i++)
+            if (!match(mask, found[i]->user->host))
+                hits[1]++;
+        MyFree(found);
+        st[1].ns += bench_now() - t0;
+        st[1].allocs += bench_allocs - a0;
+        st[1].ops++;
+    }
+    if (hits[0] != hits[1])
+        printf("host search: scan found %d, index %d\n", hits[0], hits[1]);
+    bench_report(&st[0]);
+    bench_report(&st[1]);
+}
+
+static int bench_ptrcmp(const void *a, const void *b)
+{
+    aClient *x = *(aClient **) a, *y = *(aClient **) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Not timed: a WHO paused over a set of candidates, some of which then
+ * leave one after another, in no particular order.  When it resumes it
+ * must see each of the others once and none of those that left.
+ */
+static void bench_whosearch(aClient *asker)
+{
+    aWhoSearch *ws;
+    aClient *ac, **set, **gone;
+    int i, n = 0, ngone = 0, seen = 0, stale = 0;
+
+    for (ac = client; ac && n < 5000; ac = ac->next)
+        if (IsClient(ac))
+            n++;
+    set = MyMalloc(n * sizeof(aClient *));
+    gone = MyMalloc(n * sizeof(aClient *));
+    for (i = 0, ac = client; ac && i < n; ac = ac->next)
+        if (IsClient(ac))
+            set[i++] = ac;
+
+    ws = whosearch_new(asker, 0, NULL, NULL, NULL);
+    whosearch_set(ws, set, n);
+    for (i = 0; i < n / 10; i++)
+        whosearch_next(ws);
+    whosearch_pause(ws);
+
+    /* every seventh of what is left, picked in a scattered order */
+    for (i = n / 10; i < n; i += 7)
+        gone[ngone++] = set[n / 10 + ((i - n / 10) * 7919) % (n - n / 10)];
+    for (i = 0; i < ngone; i++)
+        whosearch_client_gone(gone[i]);
+    qsort(gone, ngone, sizeof(aClient *), bench_ptrcmp);
+
+    while ((ac = whosearch_next(ws)))
+    {
+        seen++;
+        if (bsearch(&ac, gone, ngone, sizeof(aClient *), bench_ptrcmp))
+            stale++;
+    }
+    for (i = 1; i < ngone; i++)
+        if (gone[i] == gone[i - 1])
+            ngone--;    /* picked twice, left once */
+    if (stale || seen != n - n / 10 - ngone)
+        printf("paused search: %d of %d departed clients still seen, "
+               "%d seen of %d\n", stale, ngone, seen, n - n / 10 - ngone);
+    whosearch_abort(asker);
+    MyFree(gone);
+}
+
+/* the i'th of the mixed K-line masks bench_userban() sets */
+static void bench_kline_mask(int i, char *user, char *host)
+{
+    strcpy(user, "*");
+    switch (i % 5)
+    {
+    case 0:
+    case 1:
+        ircsprintf(host, "%d.%d.%d.%d", 11 + (i >> 16 & 0x3f),
+                   i >> 8 & 0xff, i & 0xff, 1 + i % 250);
+        break;
+    case 2:
+        ircsprintf(host, "%d.%d.%d.0/24", 100 + (i >> 16 & 0x3f),
+                   i >> 8 & 0xff, i & 0xff);
+        break;
+    case 3:
+        ircsprintf(host, "*.pool%d.isp%d.example.net", i & 0xff, i >> 8);
+        break;
+    default:
+        ircsprintf(user, "*evil%d", i);
+        ircsprintf(host, "*.host%d.example.org", i);
+        break;
+    }
+}
+
+static void bench_add_kline(char *user, char *host)
+{
+    struct userBan *ban;
+
+    if (!(ban = make_hostbased_ban(user, host)))
+        return;
+    ban->flags |= UBAN_LOCAL;
+    DupString(ban->reason, "benchmark");
+    add_hostbased_userban(ban);
+}
+
+static void bench_userban()
+{
+    BenchStat st;
+    aClient *clients[256];
+    char user[USERLEN + 1], host[HOSTLEN + 1];
+    double t0, deadline;
+    unsigned long a0;
+    int i, hits = 0;
+
+    for (i = 0; i < BENCH_KLINES; i++)
+    {
+        bench_kline_mask(i, user, host);
+        bench_add_kline(user, host);
+    }
+
+    /* unregistered clients in the state check_userbanned() sees them */
+    for (i = 0; i < 256; i++)
+    {
+        aClient *cptr = make_client(NULL, &me);
+
+        make_user(cptr);
+        ircsprintf(cptr->username, "u%d", i);
+        strcpy(cptr->user->username, cptr->username);
+        ircsprintf(cptr->user->host, "dyn-%d.pool%d.isp%d.example.net", i,
+                   i * 7 & 0xff, 500 + i);
+        strcpy(cptr->sockhost, cptr->user->host);
+        cptr->ip_family = AF_INET;
+        cptr->ip.ip4.s_addr = htonl(0xc0000000 | (i * 2654435761u >> 8));
+        strcpy(cptr->hostip, inetntoa((char *) &cptr->ip.ip4));
+        clients[i] = cptr;
+    }
+
+    memset(&st, 0, sizeof(st));
+    st.name = "check_userbanned (100k K-lines)";
+    deadline = bench_now() + 5e8;
+    while (bench_now() < deadline)
+    {
+        a0 = bench_allocs;
+        t0 = bench_now();
+        for (i = 0; i < 256; i++)
+        {
+            /* the pair of lookups register_user() does */
+            if (check_userbanned(clients[i], UBAN_IP|UBAN_CIDR4,
+                                 UBAN_WILDUSER) ||
+                check_userbanned(clients[i], UBAN_HOST, 0))
+                hits++;
+        }
+        st.ns += bench_now() - t0;
+        st.allocs += bench_allocs - a0;
+        st.ops += 256;
+    }
+    bench_report(&st);
+}
+
+/*
+ * Reloading the K-lines bench_userban() left behind, from a text journal
+ * and from a snapshot, in a scratch directory.  Each is timed once and
+ * reported per K-line.
+ */
+static void bench_klinestore()
+{
+    BenchStat st;
+    char user[USERLEN + 1], host[HOSTLEN + 1];
+    char path[PATH_MAX];
+    double t0;
+    unsigned long a0;
+    FILE *fp;
+    int i;
+
+    /* klines.c */
+    extern int klinestore_load(void);
+    extern int klinestore_compact(void);
+
+    strcpy(dpath, "/tmp/bench.XXXXXX");
+    if (!mkdtemp(dpath))
+        return;
+
+    ircsnprintf(path, sizeof(path), "%s/.klines", dpath);
+    if (!(fp = fopen(path, "w")))
+        return;
+    for (i = 0; i < BENCH_KLINES; i++)
+    {
+        bench_kline_mask(i, user, host);
+        fprintf(fp, "+ 0 %s@%s benchmark\n", user, host);
+    }
+    fclose(fp);
+
+    memset(&st, 0, sizeof(st));
+    st.name = "klinestore_load, text journal (per K-line)";
+    remove_userbans_match_flags(UBAN_LOCAL, UBAN_CONF);
+    a0 = bench_allocs;
+    t0 = bench_now();
+    klinestore_load();
+    st.ns = bench_now() - t0;
+    st.allocs = bench_allocs - a0;
+    st.ops = BENCH_KLINES;
+    bench_report(&st);
+
+    /* untimed: writes the snapshot the next load reads */
+    klinestore_compact();
+
+    memset(&st, 0, sizeof(st));
+    st.name = "klinestore_load, snapshot (per K-line)";
+    remove_userbans_match_flags(UBAN_LOCAL, UBAN_CONF);
+    a0 = bench_allocs;
+    t0 = bench_now();
+    klinestore_load();
+    st.ns = bench_now() - t0;
+    st.allocs = bench_allocs - a0;
+    st.ops = BENCH_KLINES;
+    bench_report(&st);
+
+    memset(&st, 0, sizeof(st));
+    st.name = "klinestore_compact (per K-line)";
+    a0 = bench_allocs;
+    t0 = bench_now();
+    klinestore_compact();
+    st.ns = bench_now() - t0;
+    st.allocs = bench_allocs - a0;
+    st.ops = BENCH_KLINES;
+    bench_report(&st);
+
+    unlink(path);
+    ircsnprintf(path, sizeof(path), "%s/.klines.db", dpath);
+    unlink(path);
+    rmdir(dpath);
+}
+
+static void bench_burst()
+{
+    BenchStat st;
+    aClient *link = links[0];
+    char *p;
+    double t0;
+    unsigned long a0;
+    int i, j, n, len;
+
+    memset(&st, 0, sizeof(st));
+    st.name = "netburst ingest (per line)";
+
+    strcpy(linebuf, "BURST");
+    parse(link, linebuf, linebuf + 5);
+    for (i = 0; i < BENCH_BURST; i += BENCH_BURSTCHAN)
+    {
+        a0 = bench_allocs;
+        t0 = bench_now();
+        for (j = i; j < i + BENCH_BURSTCHAN; j++)
+        {
+            n = ++bench_serial;
+            ircsprintf(linebuf, "NICK burst%d 3 %ld +i b%d %d.burst.example "
+                       "%s 0 %d.%d.%d.%d :burst client %d", j,
+                       (long) timeofday, j, n, link->name, 198 + (n >> 24 & 1),
+                       n >> 16 & 0xff, n >> 8 & 0xff, n & 0xff, j);
+            parse(link, linebuf, linebuf + strlen(linebuf));
+        }
+        len = ircsprintf(linebuf, ":%s SJOIN %ld #burst%d +nt :@", link->name,
+                         (long) timeofday, i / BENCH_BURSTCHAN);
+        p = linebuf + len;
+        for (j = i; j < i + BENCH_BURSTCHAN; j++)
+            p += ircsprintf(p, "%sburst%d", (j == i) ? "" : " ", j);
+        parse(link, linebuf, p);
+        st.ns += bench_now() - t0;
+        st.allocs += bench_allocs - a0;
+        st.ops += BENCH_BURSTCHAN + 1;
+        bench_drain();
+    }
+    strcpy(linebuf, "BURST 0");
+    parse(link, linebuf, linebuf + 7);
+    bench_report(&st);
+}
+
+/* nick lookups against everyone the earlier tests introduced, half of
+ * them for nicks that aren't there */
+static void bench_lookup()
+{
+    static char names[1024][NICKLEN + 1];
+    BenchStat st;
+    double t0, deadline;
+    unsigned long a0;
+    int i, hits = 0;
+
+    memset(&st, 0, sizeof(st));
+    st.name = "find_client (40k users)";
+    for (i = 0; i < 1024; i++)
+        ircsprintf(names[i], (i & 1) ? "Burst%d" : "nobody%d",
+                   (i * 7919) % BENCH_BURST);
+
+    deadline = bench_now() + 5e8;
+    while (bench_now() < deadline)
+    {
+        a0 = bench_allocs;
+        t0 = bench_now();
+        for (i = 0; i < 1024; i++)
+            if (find_client(names[i], NULL))
+                hits++;
+        st.ns += bench_now() - t0;
+        st.allocs += bench_allocs - a0;
+        st.ops += 1024;
+    }
+    bench_report(&st);
+}
+
+static void bench_throttle()
+{
+    static char addrs[BENCH_BURST][HOSTIPLEN + 1];
+    BenchStat st;
+    double t0, deadline;
+    unsigned long a0;
+    int i;
+
+    memset(&st, 0, sizeof(st));
+    st.name = "throttle_check (20k addresses)";
+    for (i = 0; i < BENCH_BURST; i++)
+    {
+        ircsprintf(addrs[i], "10.%d.%d.%d", (i >> 16) & 255, (i >> 8) & 255,
+                   i & 255);
+        throttle_check(addrs[i], -1, NOW);
+    }
+
+    deadline = bench_now() + 5e8;
+    while (bench_now() < deadline)
+    {
+        a0 = bench_allocs;
+        t0 = bench_now();
+        for (i = 0; i < 1024; i++)
+            throttle_check(addrs[(i * 7919) % BENCH_BURST], -1, NOW);
+        st.ns += bench_now() - t0;
+        st.allocs += bench_allocs - a0;
+        st.ops += 1024;
+    }
+    bench_report(&st);
+}
+
+/*
+ * A zipped server link carrying netburst NICK lines, flushed every
+ * BENCH_ZIPFLUSH lines as the io loop would, and inflated again at the
+ * far end.  Reported per line for each side.
+ */
+/*
+ * Splitting 8K reads of burst traffic into lines and parameters: the
+ * byte loops dopacket() and parse() used to run, with every line copied
+ * into a client buffer, against memscan2() on the read buffer itself.
+ * Only the scanning is timed, nothing is parsed.
+ */
+static int bench_split_bytewise(char *buffer, int length, char *cptrbuf)
+{
+    char *ch1 = cptrbuf, *ch2 = buffer, *s;
+    int n = 0;
+
+    while (--length >= 0)
+    {
+        char g = (*ch1 = *ch2++);
+
+        if (g < '\16' && (g == '\n' || g == '\r'))
+        {
+            if (ch1 == cptrbuf)
+                continue;
+            *ch1 = '\0';
+            for (s = cptrbuf; ; n++)
+            {
+                while (*s == ' ')
+                    *s++ = '\0';
+                if (*s == '\0' || *s == ':')
+                    break;
+                while (*s && *s != ' ')
+                    s++;
+            }
+            ch1 = cptrbuf;
+        }
+        else if (ch1 < cptrbuf + BUFSIZE - 1)
+            ch1++;
+    }
+    return n;
+}
+
+static int bench_split_scan(char *buffer, int length)
+{
+    char *ch, *eol, *s, *end = buffer + length;
+    int n = 0;
+
+    for (ch = buffer; ch < end; ch = eol + 1)
+    {
+        if ((eol = memscan2(ch, end, '\n', '\r')) == end)
+            break;
+        if (eol == ch)
+            continue;
+        *eol = '\0';
+        for (s = ch; ; n++)
+        {
+            while (*s == ' ')
+                *s++ = '\0';
+            if (*s == '\0' || *s == ':')
+                break;
+            s = memscan2(s, eol, ' ', '\0');
+        }
+    }
+    return n;
+}
+
+static void bench_split()
+{
+    static char data[8192], work[8192];
+    char cptrbuf[BUFSIZE], *p;
+    BenchStat old, new;
+    double t0, deadline;
+    int i, j, len, lines = 0, n1 = 0, n2 = 0;
+
+    for (len = 0, i = 0; len < sizeof(data) - 1024; i++, lines++)
+    {
+        p = data + len;
+        if (i % 8 == 7)
+        {
+            p += ircsprintf(p, ":hub0.bench.example SJOIN %ld #burst%d +nt :@",
+                            (long) timeofday, i);
+            for (j = 0; j < BENCH_BURSTCHAN; j++)
+                p += ircsprintf(p, "%sburst%d", j ? " " : "", i * 40 + j);
+            p += ircsprintf(p, "\r\n");
+        }
+        else if (i % 4 == 3)
+            p += ircsprintf(p, ":burst%d PRIVMSG #burst%d :a line relayed "
+                            "through a hub\r\n", i, i / 8);
+        else
+            p += ircsprintf(p, "NICK burst%d 3 %ld +i b%d %d.burst.example "
+                            "hub0.bench.example 0 198.51.%d.%d :burst "
+                            "client %d\r\n", i, (long) timeofday, i, i,
+                            i >> 8 & 0xff, i & 0xff, i);
+        len = p - data;
+    }
+
+    memset(&old, 0, sizeof(old));
+    old.name = "line split, byte loop (per line)";
+    memset(&new, 0, sizeof(new));
+    new.name = "line split, memscan2 (per line)";
+
+    deadline = bench_now() + 5e8;
+    while (bench_now() < deadline)
+    {
+        memcpy(work, data, len);
+        t0 = bench_now();
+        n1 += bench_split_bytewise(work, len, cptrbuf);
+        old.ns += bench_now() - t0;
+        old.ops += lines;
+
+        memcpy(work, data, len);
+        t0 = bench_now();
+        n2 += bench_split_scan(work, len);
+        new.ns += bench_now() - t0;
+        new.ops += lines;
+    }
+    bench_report(&old);
+    bench_report(&new);
+    if (n1 != n2)
+        printf("line split: %d parameters against %d!\n", n1, n2);
+}
+
+static void bench_zlink()
+{
+    static char zbuf[65536];
+    BenchStat out, in;
+    void *zout = zip_create_output_session();
+    void *zin = zip_create_input_session();
+    char *msg, *p;
+    double t0, deadline;
+    unsigned long a0;
+    int i, j, n, len, zlen, more, err;
+
+    memset(&out, 0, sizeof(out));
+    out.name = "zip link, compress (per line)";
+    memset(&in, 0, sizeof(in));
+    in.name = "zip link, decompress (per line)";
+
+    deadline = bench_now() + 5e8;
+    for (j = 0; bench_now() < deadline; j++)
+    {
+        zlen = 0;
+        a0 = bench_allocs;
+        t0 = bench_now();
+        for (i = 0; i < BENCH_ZIPFLUSH; i++)
+        {
+            n = ++bench_serial;
+            len = ircsprintf(linebuf, "NICK burst%d 3 %ld +i b%d %d.burst."
+                             "example hub0.bench.example 0 %d.%d.%d.%d :burst "
+                             "client %d\n", n, (long) timeofday, n, n,
+                             198 + (n >> 24 & 1), n >> 16 & 0xff,
+                             n >> 8 & 0xff, n & 0xff, n);
+            for (msg = linebuf; ; msg = NULL)
+            {
+                p = zip_output(zout, msg, &len, i == BENCH_ZIPFLUSH - 1,
+                               &more, &err);
+                if (len > 0 && zlen + len <= sizeof(zbuf))
+                {
+                    memcpy(zbuf + zlen, p, len);
+                    zlen += len;
+                }
+                if (!more)
+                    break;
+            }
+        }
+        out.ns += bench_now() - t0;
+        out.allocs += bench_allocs - a0;
+        out.ops += BENCH_ZIPFLUSH;
+
+        a0 = bench_allocs;
+        t0 = bench_now();
+        for (msg = zbuf, len = zlen; ; msg = NULL)
+        {
+            p = zip_input(zin, msg, &len, &err);
+            if (len <= 0)
+                break;
+            zip_input_keep(zin, p, 0);
+        }
+        in.ns += bench_now() - t0;
+        in.allocs += bench_allocs - a0;
+        in.ops += BENCH_ZIPFLUSH;
+    }
+    bench_report(&out);
+    bench_report(&in);
+    zip_destroy_output_session(zout);
+    zip_destroy_input_session(zin);
+}
+
+static void bench_init()
+{
+    char name[HOSTLEN + 1];
+    int i;
+
+    timeofday = NOW = time(NULL);
+    memset((char *) &me, '\0', sizeof(me));
+    init_globals();
+    clear_client_hash_table();
+    clear_channel_hash_table();
+    clear_scache_hash_table();
+    clear_watch_hash_table();
+    clear_member_hash_table();
+    throttle_init();
+    clones_init();
+    init_fds();
+    init_userban();
+    initlists();
+    initwhowas();
+    initstats();
+    init_tree_parse(msgtab);
+    init_send();
+    initclass();
+#if defined(INITIAL_SBUFS_LARGE) && defined(INITIAL_SBUFS_SMALL)
+    sbuf_init();
+#endif
+
+    strcpy(me.name, "bench.server");
+    strcpy(me.info, "benchmark server");
+    me.fd = -1;
+    me.from = &me;
+    me.lasttime = me.since = me.firsttime = NOW;
+    SetMe(&me);
+    make_server(&me);
+    me.serv->up = me.name;
+    add_to_client_hash_table(me.name, &me);
+
+    for (i = 0; i < BENCH_LINKS; i++)
+    {
+        ircsprintf(name, "hub%d.bench.example", i);
+        links[i] = bench_link(name);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    static char *client_lines[] =
+    {
+        "PRIVMSG #fanout10 :hello there, how is everyone doing today?",
+        "NOTICE %s :ping me back when you get this",
+        "PING :bench.server",
+        "MODE #fanout10",
+        "AWAY :out to lunch",
+        "AWAY",
+        NULL
+    };
+    static char *server_lines[] =
+    {
+        ":%s PRIVMSG #fanout1k :a line relayed through a hub",
+        ":hub1.bench.example PING hub1.bench.example :bench.server",
+        ":%s AWAY :gone",
+        ":%s AWAY",
+        ":%s NOTICE #fanout1k :notice relayed through a hub",
+        NULL
+    };
+    char cbuf[6][BUFSIZE], sbuf[5][BUFSIZE];
+    aClient *speaker, *remote;
+    char *clines[7], *slines[6];
+    int i;
+
+    bench_init();
+
+    printf("mean wall time and MyMalloc() calls per operation:\n\n");
+
+    speaker = bench_fanout("channel fanout, 10 members", "#fanout10", 10);
+    bench_fanout("channel fanout, 1k members", "#fanout1k", 1000);
+    bench_fanout("channel fanout, 20k members", "#fanout20k", 20000);
+
+    /* a remote user in the 1k channel to send the server lines */
+    remote = bench_remote(links[1], "relay");
+    add_user_to_channel(find_channel("#fanout1k", NULL), remote, 0);
+    for (i = 0; client_lines[i]; i++)
+    {
+        ircsprintf(cbuf[i], client_lines[i], remote->name);
+        clines[i] = cbuf[i];
+    }
+    clines[i] = NULL;
+    for (i = 0; server_lines[i]; i++)
+    {
+        ircsprintf(sbuf[i], server_lines[i], remote->name);
+        slines[i] = sbuf[i];
+    }
+    slines[i] = NULL;
+
+    bench_parse("parse, client lines", speaker, clines);
+    bench_parse("parse, server lines", remote->from, slines);
+    bench_match();
+    bench_member("#fanout20k");
+    bench_who("*17.remote.bench.example");
+    bench_whosearch(speaker);
+    bench_userban();
+    bench_klinestore();
+    bench_burst();
+    bench_lookup();
+    bench_throttle();
+    bench_split();
+    bench_zlink();
+    return 0;
+}
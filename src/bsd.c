@@ -74,28 +74,38 @@ void dummy()
  * *NOTE*  alarm calls have been preserved, so this should work equally 
  *  well whether blocking or non-blocking mode is used...
  */
-#ifdef WRITEV_IOV
 int deliver_it(aClient *cptr, struct iovec *iov, int len)
-#else
-int deliver_it(aClient *cptr, char *str, int len)
-#endif
 {
     int         retval;
     aListener    *lptr = cptr->lstn;    
 #ifdef  DEBUGMODE
     writecalls++;
 #endif
-#ifdef WRITEV_IOV
     if(IsSSL(cptr) && cptr->ssl)
-        retval = safe_ssl_write(cptr, iov->iov_base, iov->iov_len);
+    {
+        int i, n;
+
+        /*
+         * SSL_write() takes one buffer at a time; keep going through the
+         * segments until one is only partly taken.  A blocked write is
+         * retried later with the same segment, as OpenSSL requires.
+         */
+        for (i = 0, retval = 0; i < len; i++)
+        {
+            n = safe_ssl_write(cptr, iov[i].iov_base, iov[i].iov_len);
+            if (n <= 0)
+            {
+                if (!retval)
+                    retval = n;
+                break;
+            }
+            retval += n;
+            if (n < (int) iov[i].iov_len)
+                break;
+        }
+    }
     else
         retval = writev(cptr->fd, iov, len);
-#else
-    if(IsSSL(cptr) && cptr->ssl)
-        retval = safe_ssl_write(cptr, str, len);
-    else
-        retval = send(cptr->fd, str, len, 0);
-#endif
     /*
      * Convert WOULDBLOCK to a return of "0 bytes moved". This 
      * should occur only if socket was non-blocking. Note, that all is
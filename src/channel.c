@@ -60,6 +60,9 @@ static int  is_banned(aClient *, aChannel *, chanMember *);
 static int  set_mode(aClient *, aClient *, aChannel *, int, 
                      int, char **, char *, char *);
 static void sub1_from_channel(aChannel *);
+static void list_link(aChannel *);
+static void list_unlink(aChannel *);
+static void list_refile(aChannel *);
 
 int         check_channelname(aClient *, unsigned char *);
 void        clean_channelname(unsigned char *);
@@ -247,6 +250,329 @@ static int client_matches_cidrstr(aClient *cptr, char *banstr)
     return 0;
 }
 
+/*
+ * Compiled ban masks.
+ *
+ * ban_compile() turns a ban or exempt mask into an aBanMatch.  When the
+ * mask is exactly nick!user@host, each field is matched on its own:
+ * literal fields are compared with mycmp(), and wildcard fields first
+ * have their literal prefix and suffix checked, so match() only runs
+ * when those pass and the field is more than a single '*'.  A CIDR host
+ * is parsed here once instead of on every check.
+ *
+ * The client side of a check is a BanTarget, built once per check.
+ */
+
+typedef struct
+{
+    aClient    *cptr;
+    int         plain;          /* no '!' or '@' inside nick, user, hosts */
+    int         nhosts;
+    char        nick[NICKLEN + 1];
+    char        user[USERLEN + 1];
+    int         nlen;
+    int         ulen;
+    char        host[3][HOSTLEN + 1];
+    int         hlen[3];
+    unsigned int hashv[3];
+    char       *full[3];        /* nick!user@host, see ban_target_full() */
+    char        fullbuf[3][NICKLEN + USERLEN + HOSTLEN + 6];
+} BanTarget;
+
+static unsigned int ban_hash(char *s)
+{
+    unsigned int h = 0;
+
+    while (*s)
+        h = (h << 5) + h + touppertab[(u_char) *s++];
+    return h;
+}
+
+static void ban_compile_part(struct BanPart *bp, char *pat)
+{
+    char *s;
+
+    bp->pat = pat;
+    bp->len = strlen(pat);
+    bp->flags = 0;
+
+    for (s = pat; *s && *s != '*' && *s != '?'; s++);
+    bp->pre = s - pat;
+    if (!*s)
+    {
+        bp->suf = 0;
+        bp->flags |= BMP_LITERAL;
+        return;
+    }
+
+    for (s = pat + bp->len; s > pat && s[-1] != '*' && s[-1] != '?'; s--);
+    bp->suf = (pat + bp->len) - s;
+
+    if (pat[bp->pre] == '*' && bp->pre + 1 + bp->suf == bp->len)
+        bp->flags |= BMP_SIMPLE;
+}
+
+static int ban_part_match(struct BanPart *bp, char *str, int slen)
+{
+    u_char *p, *s;
+    int n;
+
+    if (bp->flags & BMP_LITERAL)
+        return (slen == bp->len && !mycmp(bp->pat, str));
+
+    if (slen < bp->pre + bp->suf)
+        return 0;
+
+    for (p = (u_char *) bp->pat, s = (u_char *) str, n = bp->pre; n; n--)
+        if (touppertab[*p++] != touppertab[*s++])
+            return 0;
+    p = (u_char *) bp->pat + bp->len - bp->suf;
+    s = (u_char *) str + slen - bp->suf;
+    for (n = bp->suf; n; n--)
+        if (touppertab[*p++] != touppertab[*s++])
+            return 0;
+
+    if (bp->flags & BMP_SIMPLE)
+        return 1;
+    return !match(bp->pat, str);
+}
+
+/* compile banstr, the result is freed with MyFree() */
+static aBanMatch *ban_compile(char *banstr, u_char type, void *owner)
+{
+    aBanMatch *bm;
+    char *parts, *user, *host;
+    int len = strlen(banstr);
+
+    bm = (aBanMatch *) MyMalloc(sizeof(aBanMatch) + len + 1);
+    memset((char *) bm, '\0', sizeof(aBanMatch));
+    bm->owner = owner;
+    bm->mask = banstr;
+    bm->type = type;
+
+    if (strchr(banstr, '/') && (host = strchr(banstr, '@')))
+    {
+        int bits;
+
+        bits = inet_parse_cidr(AF_INET, host + 1, bm->cidr4,
+                               sizeof(bm->cidr4));
+        if (bits > 0)
+            bm->cidr4bits = bits;
+        bits = inet_parse_cidr(AF_INET6, host + 1, bm->cidr6,
+                               sizeof(bm->cidr6));
+        if (bits > 0)
+            bm->cidr6bits = bits;
+    }
+
+    /*
+     * exactly one '!' followed by exactly one '@', and no '\\' that
+     * might escape a wildcard, or match() it whole
+     */
+    if (!(user = strchr(banstr, '!')) || !(host = strchr(user, '@')) ||
+        strchr(user + 1, '!') || strchr(host + 1, '@') ||
+        memchr(banstr, '@', user - banstr) || strchr(banstr, '\\'))
+        return bm;
+
+    parts = (char *) (bm + 1);
+    strcpy(parts, banstr);
+    parts[user - banstr] = '\0';
+    parts[host - banstr] = '\0';
+    ban_compile_part(&bm->nick, parts);
+    ban_compile_part(&bm->user, parts + (user - banstr) + 1);
+    ban_compile_part(&bm->host, parts + (host - banstr) + 1);
+    if (bm->host.flags & BMP_LITERAL)
+        bm->hashv = ban_hash(bm->host.pat);
+    bm->split = 1;
+
+    return bm;
+}
+
+static int ban_target_part(char *dst, char *src, int max)
+{
+    char *s = check_string(src);
+    int n = 0, plain = 1;
+
+    for (; *s && n < max; s++)
+    {
+        if (*s == '!' || *s == '@')
+            plain = 0;
+        dst[n++] = *s;
+    }
+    dst[n] = '\0';
+    return plain ? n : -1;
+}
+
+static void ban_target_init(BanTarget *bt, aClient *cptr, char *nick)
+{
+    char *hosts[3];
+    int i, n;
+
+    hosts[0] = cptr->user->host;
+    hosts[1] = cptr->hostip;
+#ifdef USER_HOSTMASKING
+    hosts[2] = cptr->user->mhost;
+    bt->nhosts = 3;
+#else
+    bt->nhosts = 2;
+#endif
+
+    bt->cptr = cptr;
+    bt->plain = 1;
+    if ((bt->nlen = ban_target_part(bt->nick, nick, NICKLEN)) < 0)
+        bt->plain = 0;
+    if ((bt->ulen = ban_target_part(bt->user, cptr->user->username,
+                                    USERLEN)) < 0)
+        bt->plain = 0;
+    for (i = 0; i < bt->nhosts; i++)
+    {
+        if ((n = ban_target_part(bt->host[i], hosts[i], HOSTLEN)) < 0)
+            bt->plain = 0;
+        bt->hlen[i] = n;
+        bt->hashv[i] = ban_hash(bt->host[i]);
+        bt->full[i] = NULL;
+    }
+}
+
+static char *ban_target_full(BanTarget *bt, int i)
+{
+    if (!bt->full[i])
+    {
+        ircsprintf(bt->fullbuf[i], "%s!%s@%s", bt->nick, bt->user,
+                   bt->host[i]);
+        bt->full[i] = bt->fullbuf[i];
+    }
+    return bt->full[i];
+}
+
+static int ban_matches(aBanMatch *bm, BanTarget *bt)
+{
+    char cidrbuf[NICKLEN + USERLEN + HOSTLEN + 6];
+    aClient *cptr = bt->cptr;
+    int i, bits = 0;
+
+    if (bm->split && bt->plain)
+    {
+        if (!ban_part_match(&bm->nick, bt->nick, bt->nlen) ||
+            !ban_part_match(&bm->user, bt->user, bt->ulen))
+            return 0;
+        for (i = 0; i < bt->nhosts; i++)
+            if (ban_part_match(&bm->host, bt->host[i], bt->hlen[i]))
+                return 1;
+    }
+    else
+    {
+        for (i = 0; i < bt->nhosts; i++)
+            if (!match(bm->mask, ban_target_full(bt, i)))
+                return 1;
+    }
+
+    if (cptr->ip_family == AF_INET && bm->cidr4bits)
+        bits = bitncmp(&cptr->ip, bm->cidr4, bm->cidr4bits) ? 0 : 1;
+    else if (cptr->ip_family == AF_INET6 && bm->cidr6bits)
+        bits = bitncmp(&cptr->ip, bm->cidr6, bm->cidr6bits) ? 0 : 1;
+    if (!bits)
+        return 0;
+
+    /* nick and user were matched above */
+    if (bm->split && bt->plain)
+        return 1;
+
+    /* check the wildcards in the rest of the string */
+    ircsprintf(cidrbuf, "%s!%s@%s", bt->nick, bt->user,
+               strchr(bm->mask, '@') + 1);
+    return !match(bm->mask, cidrbuf);
+}
+
+static void banidx_add(aBanIndex **idxp, aBanMatch *bm)
+{
+    aBanIndex *idx = *idxp;
+    aBanMatch **chain;
+
+    if (!idx)
+    {
+        idx = *idxp = (aBanIndex *) MyMalloc(sizeof(aBanIndex));
+        memset((char *) idx, '\0', sizeof(aBanIndex));
+    }
+
+    if (bm->split && (bm->host.flags & BMP_LITERAL) &&
+        !bm->cidr4bits && !bm->cidr6bits)
+        chain = &idx->exact[bm->hashv % BANIDX_SIZE];
+    else
+        chain = &idx->wild;
+
+    bm->next = *chain;
+    *chain = bm;
+    idx->count++;
+}
+
+static void banidx_del(aBanIndex **idxp, aBanMatch *bm)
+{
+    aBanIndex *idx = *idxp;
+    aBanMatch **chain;
+    int i;
+
+    if (!idx)
+        return;
+
+    for (chain = &idx->wild; *chain; chain = &(*chain)->next)
+        if (*chain == bm)
+            break;
+    for (i = 0; !*chain && i < BANIDX_SIZE; i++)
+        for (chain = &idx->exact[i]; *chain; chain = &(*chain)->next)
+            if (*chain == bm)
+                break;
+    if (!*chain)
+        return;
+
+    *chain = bm->next;
+    if (--idx->count == 0)
+    {
+        MyFree(idx);
+        *idxp = NULL;
+    }
+}
+
+/*
+ * find a mask of one of the given MTYP_ types that matches bt.
+ * Literal host masks are looked up by the target's hosts, only the
+ * wild chain is walked in full.
+ */
+static aBanMatch *banidx_find(aBanIndex *idx, BanTarget *bt, int types)
+{
+    aBanMatch *bm;
+    int i;
+
+    if (!idx)
+        return NULL;
+
+    if (bt->plain)
+    {
+        for (i = 0; i < bt->nhosts; i++)
+            for (bm = idx->exact[bt->hashv[i] % BANIDX_SIZE]; bm;
+                 bm = bm->next)
+                if ((bm->type & types) && bm->hashv == bt->hashv[i] &&
+                    bm->host.len == bt->hlen[i] &&
+                    !mycmp(bm->host.pat, bt->host[i]) &&
+                    ban_part_match(&bm->nick, bt->nick, bt->nlen) &&
+                    ban_part_match(&bm->user, bt->user, bt->ulen))
+                    return bm;
+    }
+    else
+    {
+        /* odd characters in the client, check everything the slow way */
+        for (i = 0; i < BANIDX_SIZE; i++)
+            for (bm = idx->exact[i]; bm; bm = bm->next)
+                if ((bm->type & types) && ban_matches(bm, bt))
+                    return bm;
+    }
+
+    for (bm = idx->wild; bm; bm = bm->next)
+        if ((bm->type & types) && ban_matches(bm, bt))
+            return bm;
+
+    return NULL;
+}
+
 #ifdef EXEMPT_LISTS
 /* Exempt list functions (+e) */
 
@@ -304,6 +630,9 @@ int add_exempt_id(aClient* cptr, aChannel* chptr, char* exempt_id)
     else
         exempt->type = MTYP_FULL;
 
+    exempt->match = ban_compile(exempt->banstr, exempt->type, exempt);
+    banidx_add(&chptr->exemptidx, exempt->match);
+
     return 0;
 }
 
@@ -323,6 +652,8 @@ int del_exempt_id(aChannel* chptr, char* exempt_id)
 
            chptr->banserial++;
 
+           banidx_del(&chptr->exemptidx, tmp->match);
+           MyFree(tmp->match);
            MyFree(tmp->banstr);
            MyFree(tmp->who);
            MyFree(tmp);
@@ -499,6 +830,9 @@ static int add_banid(aClient *cptr, aChannel *chptr, char *banid)
     else
         ban->type = MTYP_FULL;
 
+    ban->match = ban_compile(ban->banstr, ban->type, ban);
+    banidx_add(&chptr->banidx, ban->match);
+
     ban->when = timeofday;
     chptr->banlist = ban;
     chptr->banserial++;
@@ -525,6 +859,8 @@ static int del_banid(aChannel *chptr, char *banid)
 
            chptr->banserial++;
 
+           banidx_del(&chptr->banidx, tmp->match);
+           MyFree(tmp->match);
            MyFree(tmp->banstr);
            MyFree(tmp->who);
            MyFree(tmp);
@@ -543,15 +879,7 @@ static int del_banid(aChannel *chptr, char *banid)
 
 static int is_banned(aClient *cptr, aChannel *chptr, chanMember *cm)
 {
-    aBan       *ban;
-#ifdef EXEMPT_LISTS
-    aBanExempt *exempt;
-#endif
-    char        s[NICKLEN + USERLEN + HOSTLEN + 6];
-#ifdef USER_HOSTMASKING
-    char        s3[NICKLEN + USERLEN + HOSTLEN + 6];
-#endif
-    char       *s2;
+    BanTarget   bt;
     
     if (!IsPerson(cptr))
         return 0;
@@ -565,35 +893,17 @@ static int is_banned(aClient *cptr, aChannel *chptr, chanMember *cm)
         cm->flags &= ~CHFL_BANNED;
     }
 
-    strcpy(s, make_nick_user_host(cptr->name, cptr->user->username,
-                                  cptr->user->host));
-#ifdef USER_HOSTMASKING
-    strcpy(s3, make_nick_user_host(cptr->name, cptr->user->username,
-                                   cptr->user->mhost));
-#endif
-    s2 = make_nick_user_host(cptr->name, cptr->user->username,
-                             cptr->hostip);
+    if (!chptr->banidx)
+        return 0;
 
-#ifdef EXEMPT_LISTS
-    for (exempt = chptr->banexempt_list; exempt; exempt = exempt->next)
-        if (!match(exempt->banstr, s) || !match(exempt->banstr, s2) ||
-#ifdef USER_HOSTMASKING
-            !match(exempt->banstr, s3) ||
-#endif
-	    client_matches_cidrstr(cptr, exempt->banstr))
-            return 0;
-#endif
+    ban_target_init(&bt, cptr, cptr->name);
 
-    for (ban = chptr->banlist; ban; ban = ban->next)
-        if ((match(ban->banstr, s) == 0) ||
-            (match(ban->banstr, s2) == 0) ||
-#ifdef USER_HOSTMASKING
-            (match(ban->banstr, s3) == 0) ||
+#ifdef EXEMPT_LISTS
+    if (banidx_find(chptr->exemptidx, &bt, MTYP_ALL))
+        return 0;
 #endif
-	    client_matches_cidrstr(cptr, ban->banstr))
-            break;
 
-    if (ban)
+    if (banidx_find(chptr->banidx, &bt, MTYP_ALL))
     {
         if (cm)
             cm->flags |= CHFL_BANNED;
@@ -616,7 +926,7 @@ void flush_user_banserial(aClient *cptr)
 	for (ptr = cptr->user->channel; ptr; ptr = ptr->next)
 	{
 		aChannel *chptr = ptr->value.chptr;
-		chanMember *cm = find_user_member(chptr->members, cptr);
+		chanMember *cm = find_user_member(chptr, cptr);
 
 		if (cm)
 			cm->banserial = chptr->banserial - 1;
@@ -625,47 +935,22 @@ void flush_user_banserial(aClient *cptr)
 
 aBan *nick_is_banned(aChannel *chptr, char *nick, aClient *cptr)
 {
-    aBan *ban;
-#ifdef EXEMPT_LISTS
-    aBanExempt *exempt;
-#endif
-    char *s, s2[NICKLEN+USERLEN+HOSTLEN+6];
-#ifdef USER_HOSTMASKING
-    char s3[NICKLEN+USERLEN+HOSTLEN+6];
-#endif
+    BanTarget bt;
+    aBanMatch *bm;
     
-    if (!IsPerson(cptr)) return NULL;
+    if (!IsPerson(cptr) || !chptr->banidx) return NULL;
     
-    strcpy(s2, make_nick_user_host(nick, cptr->user->username,
-                                   cptr->user->host));
-#ifdef USER_HOSTMASKING
-    strcpy(s3, make_nick_user_host(nick, cptr->user->username,
-                                   cptr->user->mhost));
-#endif
-    s = make_nick_user_host(nick, cptr->user->username, cptr->hostip);
+    ban_target_init(&bt, cptr, nick);
 
+    /* only check applicable bans */
 #ifdef EXEMPT_LISTS
-    for (exempt = chptr->banexempt_list; exempt; exempt = exempt->next)
-        if (exempt->type == MTYP_FULL &&
-            ((match(exempt->banstr, s2) == 0) ||
-#ifdef USER_HOSTMASKING
-             (match(exempt->banstr, s3) == 0) ||
-#endif
-             (match(exempt->banstr, s) == 0) ||
-	     client_matches_cidrstr(cptr, exempt->banstr)))
-            return NULL;
+    if (banidx_find(chptr->exemptidx, &bt, MTYP_FULL))
+        return NULL;
 #endif
 
-    for (ban = chptr->banlist; ban; ban = ban->next)
-        if (ban->type == MTYP_FULL &&        /* only check applicable bans */
-            ((match(ban->banstr, s2) == 0) ||    /* check host before IP */
-#ifdef USER_HOSTMASKING
-             (match(ban->banstr, s3) == 0) ||
-#endif
-             (match(ban->banstr, s) == 0) ||
-	     client_matches_cidrstr(cptr, ban->banstr)))
-            break;
-    return (ban);
+    if ((bm = banidx_find(chptr->banidx, &bt, MTYP_FULL)))
+        return (aBan *) bm->owner;
+    return NULL;
 }
 
 void remove_matching_bans(aChannel *chptr, aClient *cptr, aClient *from) 
@@ -1134,6 +1419,107 @@ joinrate_warn(aChannel *chptr, aClient *cptr)
 }
 
 
+/*
+ * Channel fanout sets.
+ *
+ * Every channel keeps the fds of its local members packed in lfds[] and
+ * one rlinks[] entry per server link with members behind it, so the
+ * channel senders can skip walking the member chain.  They are kept up
+ * to date by add_user_to_channel() and remove_user_from_channel().
+ */
+#define FANOUT_INITIAL  4
+
+static void chan_fanout_add(aChannel *chptr, chanMember *cm)
+{
+    aClient *who = cm->cptr;
+    aFanoutLink *fl;
+    int i;
+
+    if (MyClient(who))
+    {
+        if (chptr->nlocal == chptr->maxlocal)
+        {
+            chptr->maxlocal = chptr->maxlocal ? chptr->maxlocal * 2 :
+                                                FANOUT_INITIAL;
+            chptr->lfds = MyRealloc(chptr->lfds,
+                                    chptr->maxlocal * sizeof(int));
+            chptr->lcms = MyRealloc(chptr->lcms,
+                                    chptr->maxlocal * sizeof(chanMember *));
+        }
+        cm->fanout = chptr->nlocal;
+        chptr->lfds[chptr->nlocal] = who->fd;
+        chptr->lcms[chptr->nlocal] = cm;
+        chptr->nlocal++;
+        return;
+    }
+
+    cm->fanout = -1;
+
+    for (i = 0; i < chptr->nrlinks; i++)
+        if (chptr->rlinks[i].link == who->from)
+            break;
+
+    if (i == chptr->nrlinks)
+    {
+        if (chptr->nrlinks == chptr->maxrlinks)
+        {
+            chptr->maxrlinks = chptr->maxrlinks ? chptr->maxrlinks * 2 :
+                                                  FANOUT_INITIAL;
+            chptr->rlinks = MyRealloc(chptr->rlinks,
+                                      chptr->maxrlinks * sizeof(aFanoutLink));
+        }
+        fl = &chptr->rlinks[chptr->nrlinks++];
+        fl->link = who->from;
+        fl->members = 0;
+        fl->ulined = 0;
+    }
+    else
+        fl = &chptr->rlinks[i];
+
+    fl->members++;
+    /* super servers can only be flagged ULF_NOCHANMSG when directly
+     * connected, see sendto_channel_butone() */
+    if (IsULine(who) && who->uplink == who->from)
+        fl->ulined++;
+}
+
+static void chan_fanout_del(aChannel *chptr, chanMember *cm)
+{
+    aClient *who = cm->cptr;
+    int i;
+
+    /* local clients may already be closed (fd -2) here, so go by the
+     * slot recorded when they joined */
+    if ((i = cm->fanout) >= 0)
+    {
+        chptr->nlocal--;
+        if (i != chptr->nlocal)
+        {
+            chptr->lfds[i] = chptr->lfds[chptr->nlocal];
+            chptr->lcms[i] = chptr->lcms[chptr->nlocal];
+            chptr->lcms[i]->fanout = i;
+        }
+        return;
+    }
+
+    for (i = 0; i < chptr->nrlinks; i++)
+        if (chptr->rlinks[i].link == who->from)
+            break;
+
+    if (i == chptr->nrlinks)
+        return;
+
+    if (IsULine(who) && who->uplink == who->from)
+        chptr->rlinks[i].ulined--;
+
+    if (--chptr->rlinks[i].members == 0)
+    {
+        chptr->nrlinks--;
+        if (i != chptr->nrlinks)
+            chptr->rlinks[i] = chptr->rlinks[chptr->nrlinks];
+    }
+}
+
 /*
  * adds a user to a channel by adding another link to the channels
  * member chain.
@@ -1152,14 +1538,21 @@ void add_user_to_channel(aChannel *chptr, aClient *who, int flags)
         cm = make_chanmember();
         cm->flags = flags;
         cm->cptr = who;
+        cm->chptr = chptr;
         cm->next = chptr->members;
+        cm->prev = NULL;
         cm->banserial = chptr->banserial;
         cm->when = NOW;
         cm->last_message_number = 0;
         cm->last_message_time = 0;
 
+        if (chptr->members)
+            chptr->members->prev = cm;
         chptr->members = cm;
         chptr->users++;
+        add_to_member_hash_table(cm);
+        list_refile(chptr);
+        chan_fanout_add(chptr, cm);
         
         ptr = make_link();
         ptr->value.chptr = chptr;
@@ -1171,16 +1564,21 @@ void add_user_to_channel(aChannel *chptr, aClient *who, int flags)
 
 void remove_user_from_channel(aClient *sptr, aChannel *chptr)
 {
-    chanMember  **curr, *tmp;
+    chanMember      *cm;
     Link           **lcurr, *ltmp;
     
-    for (curr = &chptr->members; (tmp = *curr); curr = &tmp->next)
-        if (tmp->cptr == sptr)
-        {
-            *curr = tmp->next;
-            free_chanmember(tmp);
-            break;
-        }
+    if ((cm = find_user_member(chptr, sptr)))
+    {
+        if (cm->prev)
+            cm->prev->next = cm->next;
+        else
+            chptr->members = cm->next;
+        if (cm->next)
+            cm->next->prev = cm->prev;
+        del_from_member_hash_table(cm);
+        chan_fanout_del(chptr, cm);
+        free_chanmember(cm);
+    }
 
     for (lcurr = &sptr->user->channel; (ltmp = *lcurr); lcurr = &ltmp->next)
         if (ltmp->value.chptr == chptr)
@@ -1198,7 +1596,7 @@ int is_chan_op(aClient *cptr, aChannel *chptr)
     chanMember   *cm;
     
     if (chptr)
-        if ((cm = find_user_member(chptr->members, cptr)))
+        if ((cm = find_user_member(chptr, cptr)))
             return (cm->flags & CHFL_CHANOP);
     
     return 0;
@@ -1209,7 +1607,7 @@ int is_chan_halfop(aClient *cptr, aChannel *chptr)
     chanMember   *cm;
     
     if (chptr)
-        if ((cm = find_user_member(chptr->members, cptr)))
+        if ((cm = find_user_member(chptr, cptr)))
             return (cm->flags & CHFL_HALFOP);
     
     return 0;
@@ -1226,7 +1624,7 @@ inline int is_chan_cankick(aClient *cptr, aChannel *chptr)
     chanMember   *cm;
     
     if (chptr)
-        if ((cm = find_user_member(chptr->members, cptr)))
+        if ((cm = find_user_member(chptr, cptr)))
         {
             if(cm->flags & CHFL_CHANOP)
                 return 2;
@@ -1243,7 +1641,7 @@ int is_chan_opvoice(aClient *cptr, aChannel *chptr)
     chanMember   *cm;
     
     if (chptr)
-        if ((cm = find_user_member(chptr->members, cptr)))
+        if ((cm = find_user_member(chptr, cptr)))
             return ((cm->flags & CHFL_CHANOP) || (cm->flags & CHFL_HALFOP) || (cm->flags & CHFL_VOICE));
     
     return 0;
@@ -1254,7 +1652,7 @@ int is_deopped(aClient *cptr, aChannel *chptr)
     chanMember   *cm;
     
     if (chptr)
-        if ((cm = find_user_member(chptr->members, cptr)))
+        if ((cm = find_user_member(chptr, cptr)))
             return (cm->flags & CHFL_DEOPPED);
     
     return 0;
@@ -1265,7 +1663,7 @@ int has_voice(aClient *cptr, aChannel *chptr)
     chanMember   *cm;
     
     if (chptr)
-        if ((cm = find_user_member(chptr->members, cptr)))
+        if ((cm = find_user_member(chptr, cptr)))
             return (cm->flags & CHFL_VOICE);
     
     return 0;
@@ -1276,7 +1674,7 @@ time_t get_user_jointime(aClient *cptr, aChannel *chptr)
     chanMember   *cm;
 
     if (chptr)
-        if ((cm = find_user_member(chptr->members, cptr)))
+        if ((cm = find_user_member(chptr, cptr)))
             return cm->when;
 
     return 0;
@@ -1287,7 +1685,7 @@ time_t get_user_lastmsgtime(aClient *cptr, aChannel *chptr)
     chanMember   *cm;
 
     if (chptr)
-        if ((cm = find_user_member(chptr->members, cptr)))
+        if ((cm = find_user_member(chptr, cptr)))
             return cm->last_message_time;
 
     return 0;
@@ -1372,7 +1770,7 @@ int can_send(aClient *cptr, aChannel *chptr, char *msg)
     if (IsServer(cptr) || IsULine(cptr))
         return 0;
     
-    cm = find_user_member(chptr->members, cptr);
+    cm = find_user_member(chptr, cptr);
     ismine = MyClient(cptr);
     
     if(!cm)
@@ -1518,7 +1916,8 @@ static void channel_modes(aClient *cptr, char *mbuf, char *pbuf,
     return;
 }
 
-static void send_channel_lists(aClient *cptr, aChannel *chptr)
+static void send_channel_lists(aClient *cptr, aChannel *chptr, char *mbuf,
+                               char *pbuf)
 {
     aBan   *bp;
 #ifdef EXEMPT_LISTS
@@ -1530,23 +1929,23 @@ static void send_channel_lists(aClient *cptr, aChannel *chptr)
     char   *cp;
     int         count = 0, send = 0;
 
-    cp = modebuf + strlen(modebuf);
+    cp = mbuf + strlen(mbuf);
 
-    if (*parabuf) /* mode +l or +k xx */
+    if (*pbuf) /* mode +l or +k xx */
         count = 1;
 
     for (bp = chptr->banlist; bp; bp = bp->next) 
     {
-        if (strlen(parabuf) + strlen(bp->banstr) + 20 < (size_t) MODEBUFLEN) 
+        if (strlen(pbuf) + strlen(bp->banstr) + 20 < (size_t) MODEBUFLEN) 
         {
-            if(*parabuf)
-                strcat(parabuf, " ");
-            strcat(parabuf, bp->banstr);
+            if(*pbuf)
+                strcat(pbuf, " ");
+            strcat(pbuf, bp->banstr);
             count++;
             *cp++ = 'b';
             *cp = '\0';
         }
-        else if (*parabuf)
+        else if (*pbuf)
             send = 1;
 
         if (count == MAXTSMODEPARAMS)
@@ -1554,15 +1953,15 @@ static void send_channel_lists(aClient *cptr, aChannel *chptr)
 
         if (send) 
         {
-            sendto_one(cptr, ":%s MODE %s %ld %s %s", me.name, chptr->chname,
-                           chptr->channelts, modebuf, parabuf);
+            sendto_burst(cptr, ":%s MODE %s %ld %s %s", me.name, chptr->chname,
+                           chptr->channelts, mbuf, pbuf);
             send = 0;
-            *parabuf = '\0';
-            cp = modebuf;
+            *pbuf = '\0';
+            cp = mbuf;
             *cp++ = '+';
             if (count != MAXTSMODEPARAMS) 
             {
-                strcpy(parabuf, bp->banstr);
+                strcpy(pbuf, bp->banstr);
                 *cp++ = 'b';
                 count = 1;
             }
@@ -1574,15 +1973,15 @@ static void send_channel_lists(aClient *cptr, aChannel *chptr)
 #ifdef EXEMPT_LISTS
     for (exempt = chptr->banexempt_list; exempt; exempt = exempt->next)
     {
-        if (strlen(parabuf) + strlen(exempt->banstr) + 20 < (size_t)MODEBUFLEN)
+        if (strlen(pbuf) + strlen(exempt->banstr) + 20 < (size_t)MODEBUFLEN)
         {
-            if (*parabuf) strcat(parabuf, " ");
-            strcat(parabuf, exempt->banstr);
+            if (*pbuf) strcat(pbuf, " ");
+            strcat(pbuf, exempt->banstr);
             count++;
             *cp++ = 'e';
             *cp = 0;
         }
-        else if (*parabuf)
+        else if (*pbuf)
             send = 1;
         
         
@@ -1591,15 +1990,15 @@ static void send_channel_lists(aClient *cptr, aChannel *chptr)
         
         if (send)
         {
-            sendto_one(cptr, ":%s MODE %s %ld %s %s", me.name, chptr->chname,
-                           chptr->channelts, modebuf, parabuf);
+            sendto_burst(cptr, ":%s MODE %s %ld %s %s", me.name, chptr->chname,
+                           chptr->channelts, mbuf, pbuf);
             send = 0;
-            *parabuf = 0;
-            cp = modebuf;
+            *pbuf = 0;
+            cp = mbuf;
             *cp++ = '+';
             if (count != MAXTSMODEPARAMS)
             {
-                strcpy(parabuf, exempt->banstr);
+                strcpy(pbuf, exempt->banstr);
                 *cp++ = 'e';
                 count = 1;
             }
@@ -1611,15 +2010,15 @@ static void send_channel_lists(aClient *cptr, aChannel *chptr)
 #ifdef INVITE_LISTS
     for (inv = chptr->invite_list; inv; inv = inv->next)
     {
-        if (strlen(parabuf) + strlen(inv->invstr) + 20 < (size_t)MODEBUFLEN)
+        if (strlen(pbuf) + strlen(inv->invstr) + 20 < (size_t)MODEBUFLEN)
         {
-            if (*parabuf) strcat(parabuf, " ");
-            strcat(parabuf, inv->invstr);
+            if (*pbuf) strcat(pbuf, " ");
+            strcat(pbuf, inv->invstr);
             count++;
             *cp++ = 'I';
             *cp = 0;
         }
-        else if (*parabuf)
+        else if (*pbuf)
             send = 1;
         
         
@@ -1628,15 +2027,15 @@ static void send_channel_lists(aClient *cptr, aChannel *chptr)
         
         if (send)
         {
-            sendto_one(cptr, ":%s MODE %s %ld %s %s", me.name, chptr->chname,
-                           chptr->channelts, modebuf, parabuf);
+            sendto_burst(cptr, ":%s MODE %s %ld %s %s", me.name, chptr->chname,
+                           chptr->channelts, mbuf, pbuf);
             send = 0;
-            *parabuf = 0;
-            cp = modebuf;
+            *pbuf = 0;
+            cp = mbuf;
             *cp++ = '+';
             if (count != MAXTSMODEPARAMS)
             {
-                strcpy(parabuf, inv->invstr);
+                strcpy(pbuf, inv->invstr);
                 *cp++ = 'I';
                 count = 1;
             }
@@ -1654,16 +2053,17 @@ void send_channel_modes(aClient *cptr, aChannel *chptr)
     chanMember       *l, *anop = NULL, *skip = NULL;
     int         n = 0;
     char       *t;
+    char        mbuf[REALMODEBUFLEN], pbuf[REALMODEBUFLEN], sjbuf[BUFSIZE];
 
     if (*chptr->chname != '#')
         return;
 
-    *modebuf = *parabuf = '\0';
-    channel_modes(cptr, modebuf, parabuf, chptr);
+    *mbuf = *pbuf = '\0';
+    channel_modes(cptr, mbuf, pbuf, chptr);
 
-    ircsprintf(buf, ":%s SJOIN %ld %s %s %s :", me.name,
-               chptr->channelts, chptr->chname, modebuf, parabuf);
-    t = buf + strlen(buf);
+    ircsprintf(sjbuf, ":%s SJOIN %ld %s %s %s :", me.name,
+               chptr->channelts, chptr->chname, mbuf, pbuf);
+    t = sjbuf + strlen(sjbuf);
     for (l = chptr->members; l; l = l->next)
         if (l->flags & MODE_CHANOP)
         {
@@ -1705,15 +2105,15 @@ void send_channel_modes(aClient *cptr, aChannel *chptr)
         t += strlen(t);
         *t++ = ' ';
         n++;
-        if (t - buf > BUFSIZE - 80)
+        if (t - sjbuf > BUFSIZE - 80)
         {
             *t++ = '\0';
             if (t[-1] == ' ')
                 t[-1] = '\0';
-            sendto_one(cptr, "%s", buf);
-            sprintf(buf, ":%s SJOIN %ld %s 0 :", me.name,
+            sendto_burst(cptr, "%s", sjbuf);
+            sprintf(sjbuf, ":%s SJOIN %ld %s 0 :", me.name,
                     chptr->channelts, chptr->chname);
-            t = buf + strlen(buf);
+            t = sjbuf + strlen(sjbuf);
             n = 0;
         }
     }
@@ -1723,15 +2123,15 @@ void send_channel_modes(aClient *cptr, aChannel *chptr)
         *t++ = '\0';
         if (t[-1] == ' ')
             t[-1] = '\0';
-        sendto_one(cptr, "%s", buf);
+        sendto_burst(cptr, "%s", sjbuf);
     }
-    *parabuf = '\0';
-    *modebuf = '+';
-    modebuf[1] = '\0';
-    send_channel_lists(cptr, chptr);
-    if (modebuf[1] || *parabuf)
-        sendto_one(cptr, ":%s MODE %s %ld %s %s",
-                me.name, chptr->chname, chptr->channelts, modebuf, parabuf);
+    *pbuf = '\0';
+    *mbuf = '+';
+    mbuf[1] = '\0';
+    send_channel_lists(cptr, chptr, mbuf, pbuf);
+    if (mbuf[1] || *pbuf)
+        sendto_burst(cptr, ":%s MODE %s %ld %s %s",
+                me.name, chptr->chname, chptr->channelts, mbuf, pbuf);
 }
 
 /* m_mode parv[0] - sender parv[1] - channel */
@@ -1972,7 +2372,7 @@ static int set_mode(aClient *cptr, aClient *sptr, aChannel *chptr,
             }
                         
             who = find_chasing(sptr, parv[args], &chasing);
-            cm = find_user_member(chptr->members, who);
+            cm = find_user_member(chptr, who);
             if(cm == NULL) 
             {
                 sendto_one(sptr, err_str(ERR_USERNOTINCHANNEL),
@@ -2989,9 +3389,11 @@ get_channel(aClient *cptr, char *chname, int flag, int *created)
         chptr->nextch = channel;
         channel = chptr;
         chptr->channelts = timeofday;
+        chptr->burstsent = burst_slots;
         chptr->max_bans = MAXBANS;
         chptr->max_invites = MAXINVITELIST;
         (void) add_to_channel_hash_table(chname, chptr);
+        list_link(chptr);
         Count.chan++;
     }
     return chptr;
@@ -3072,7 +3474,9 @@ static void sub1_from_channel(aChannel *chptr)
     aBanExempt        *exempt, *exrem;
 #endif
     
-    if (--chptr->users <= 0) 
+    if (--chptr->users > 0)
+        list_refile(chptr);
+    else
     {
         /*
          * Now, find all invite links from channel structure
@@ -3085,10 +3489,12 @@ static void sub1_from_channel(aChannel *chptr)
         {
             bprem = bp;
             bp = bp->next;
+            MyFree(bprem->match);
             MyFree(bprem->banstr);
             MyFree(bprem->who);
             MyFree(bprem);
         }
+        MyFree(chptr->banidx);
 #ifdef INVITE_LISTS
         invite = chptr->invite_list;
         while (invite)
@@ -3106,12 +3512,16 @@ static void sub1_from_channel(aChannel *chptr)
         {
             exrem = exempt;
             exempt = exempt->next;
+            MyFree(exrem->match);
             MyFree(exrem->banstr);
             MyFree(exrem->who);
             MyFree(exrem);
         }
+        MyFree(chptr->exemptidx);
 #endif
 
+        burst_channel_gone(chptr);
+        list_unlink(chptr);
         if (chptr->prevch)
             chptr->prevch->nextch = chptr->nextch;
         else
@@ -3123,6 +3533,9 @@ static void sub1_from_channel(aChannel *chptr)
         free_fluders(NULL, chptr);
 #endif
         if(chptr->greetmsg) MyFree(chptr->greetmsg);
+        if(chptr->lfds) MyFree(chptr->lfds);
+        if(chptr->lcms) MyFree(chptr->lcms);
+        if(chptr->rlinks) MyFree(chptr->rlinks);
         free_channel(chptr);
         Count.chan--;
     }
@@ -3803,7 +4216,7 @@ int m_kick(aClient *cptr, aClient *sptr, int parc, char *parv[])
 #ifdef USE_HALFOPS
                     if(cankick != 2)
                     {
-                        chanMember *cm = find_user_member(chptr->members, who);
+                        chanMember *cm = find_user_member(chptr, who);
                         if(cm)
                         {
                             /* Don't allow half-ops to kick ops, other half-ops or voiced users */
@@ -4162,121 +4575,222 @@ int m_invite(aClient *cptr, aClient *sptr, int parc, char *parv[])
 
 
 /*
- * The function which sends the actual channel list back to the user.
- * Operates by stepping through the hashtable, sending the entries back if
- * they match the criteria.
- * cptr = Local client to send the output back to.
- * numsend = Number (roughly) of lines to send back. Once this number has
- * been exceeded, send_list will finish with the current hash bucket,
- * and record that number as the number to start next time send_list
- * is called for this user. So, this function will almost always send
- * back more lines than specified by numsend (though not by much,
- * assuming CH_MAX is was well picked). So be conservative in your choice
- * of numsend. -Rak
+ * The LIST index: every channel is kept on a list for its user count,
+ * exact up to LIST_BUCKETS - 1 with everything bigger in the top one,
+ * and moved when a join or part changes the count.  A LIST walks it
+ * from the top down, so the biggest channels come first and a user
+ * count range only visits the buckets that can match.
+ *
+ * A listing paused for want of sendQ room keeps a pointer to the next
+ * channel it will look at, counted in that channel's listrefs; moving
+ * or destroying a channel with listrefs set steps those cursors past
+ * it first.  A channel that changes size during a LIST may be shown
+ * twice, or missed if it moves into a bucket the walk has done, as may
+ * channels created or destroyed meanwhile.
  */
+#define LIST_BUCKETS    1024
+
+/* the most one RPL_LIST row can take before it is cut to 512 bytes */
+#define LIST_ROWMAX     (2 * HOSTLEN + CHANNELLEN + TOPICLEN + 32)
 
-void send_list(aClient *cptr, int numsend)
+static struct
 {
-    aChannel    *chptr;
-    LOpts       *lopt = cptr->user->lopt;
-    int         hashnum;
-    
-    for (hashnum = lopt->starthash; hashnum < CH_MAX; hashnum++)
+    aChannel *head, *tail;
+} listidx[LIST_BUCKETS];
+
+#define LIST_BUCKET(n)  ((n) <= 0 ? 0 : MIN((n), LIST_BUCKETS - 1))
+
+static void list_link(aChannel *chptr)
+{
+    int b = LIST_BUCKET(chptr->users);
+
+    chptr->lbucket = b;
+    chptr->lnext = NULL;
+    if ((chptr->lprev = listidx[b].tail))
+        chptr->lprev->lnext = chptr;
+    else
+        listidx[b].head = chptr;
+    listidx[b].tail = chptr;
+}
+
+static void list_unlink(aChannel *chptr)
+{
+    DLink *lp;
+    LOpts *lopt;
+
+    if (chptr->listrefs)
     {
-        if (numsend > 0)
+        for (lp = listing_clients; lp; lp = lp->next)
         {
-            for (chptr = (aChannel *)hash_get_chan_bucket(hashnum); 
-                 chptr; chptr = chptr->hnextch)
-            {
-                if (!PubChannel(chptr) && !IsAdmin(cptr)
-                    && !IsMember(cptr, chptr))
-                    continue;
+            lopt = lp->value.cptr->user->lopt;
+            if (lopt->nextch != chptr)
+                continue;
+            if ((lopt->nextch = chptr->lnext))
+                chptr->lnext->listrefs++;
+        }
+        chptr->listrefs = 0;
+    }
+
+    if (chptr->lprev)
+        chptr->lprev->lnext = chptr->lnext;
+    else
+        listidx[chptr->lbucket].head = chptr->lnext;
+    if (chptr->lnext)
+        chptr->lnext->lprev = chptr->lprev;
+    else
+        listidx[chptr->lbucket].tail = chptr->lprev;
+}
+
+/* the user count changed: move the channel if its bucket did */
+static void list_refile(aChannel *chptr)
+{
+    if (LIST_BUCKET(chptr->users) == chptr->lbucket)
+        return;
+    list_unlink(chptr);
+    list_link(chptr);
+}
+
+/* everything but the user count, which the walk has already bounded */
+static int list_match(aClient *cptr, LOpts *lopt, aChannel *chptr)
+{
+    if (!PubChannel(chptr) && !IsAdmin(cptr) && !IsMember(cptr, chptr))
+        return 0;
 #ifdef USE_CHANMODE_L
-                if (lopt->only_listed && !(chptr->mode.mode & MODE_LISTED))
-                    continue;
+    if (lopt->only_listed && !(chptr->mode.mode & MODE_LISTED))
+        return 0;
 #endif
-                if ((!lopt->showall) && ((chptr->users < lopt->usermin) ||
-                                         ((lopt->usermax >= 0) && 
-                                          (chptr->users > lopt->usermax)) ||
-                                         ((chptr->channelts) < 
-                                          lopt->chantimemin) ||
-                                         (chptr->topic_time < 
-                                          lopt->topictimemin) ||
-                                         (chptr->channelts > 
-                                          lopt->chantimemax) ||
-                                         (chptr->topic_time > 
-                                          lopt->topictimemax) ||
-                                         (lopt->nolist && 
-                                          find_str_link(lopt->nolist, 
-                                                        chptr->chname)) ||
-                                         (lopt->yeslist && 
-                                          !find_str_link(lopt->yeslist, 
-                                                         chptr->chname))))
-                    continue;
-
-                /* Seem'd more efficent to seperate into two commands 
-                 * then adding an or to the inline. -- Doc.
-                 */
-                if (IsAdmin(cptr))
-                {
-                    char tempchname[CHANNELLEN + 2], *altchname;
+    if (lopt->showall)
+        return 1;
+    if (chptr->users < lopt->usermin ||
+        (lopt->usermax >= 0 && chptr->users > lopt->usermax) ||
+        chptr->channelts < lopt->chantimemin ||
+        chptr->channelts > lopt->chantimemax ||
+        chptr->topic_time < lopt->topictimemin ||
+        chptr->topic_time > lopt->topictimemax)
+        return 0;
+    if (lopt->nolist && find_str_link(lopt->nolist, chptr->chname))
+        return 0;
+    if (lopt->yeslist && !find_str_link(lopt->yeslist, chptr->chname))
+        return 0;
+    return 1;
+}
 
-                    if (!PubChannel(chptr) && !IsMember(cptr, chptr))
-                    {
-                        tempchname[0] = '%';
-                        strcpy(&tempchname[1], chptr->chname);
-                        altchname = &tempchname[0];
-                    } 
-                    else 
-                        altchname = chptr->chname;
-
-                    sendto_one(cptr, rpl_str(RPL_LIST), me.name, cptr->name,
-                               altchname, chptr->users, chptr->topic);
-                } 
-                else 
-                {
-                    sendto_one(cptr, rpl_str(RPL_LIST), me.name, cptr->name,
-                               chptr->chname,
-                               chptr->users,
-                               chptr->topic);
-                }
-                numsend--;
-            }
-        }
-        else
-            break;
+/* set a new listing up to walk the buckets its user counts allow */
+static void list_start(LOpts *lopt)
+{
+    lopt->nextch = NULL;
+    lopt->bucket = (lopt->usermax >= 0) ? LIST_BUCKET(lopt->usermax) + 1 :
+        LIST_BUCKETS;
+    lopt->lowbucket = LIST_BUCKET(lopt->usermin);
+}
+
+/* end a listing, finished or not */
+void list_free(aClient *cptr)
+{
+    LOpts *lopt = cptr->user->lopt;
+    Link *lp, *next;
+
+    for (lp = lopt->yeslist; lp; lp = next)
+    {
+        next = lp->next;
+        MyFree(lp->value.cp);
+        free_link(lp);
     }
-    
-    /* All done */
-    if (hashnum == CH_MAX)
+    for (lp = lopt->nolist; lp; lp = next)
+    {
+        next = lp->next;
+        MyFree(lp->value.cp);
+        free_link(lp);
+    }
+    if (lopt->nextch)
+        lopt->nextch->listrefs--;
+
+    MyFree(lopt);
+    cptr->user->lopt = NULL;
+    remove_from_list(&listing_clients, cptr, NULL);
+}
+
+/*
+ * The function which sends the actual channel list back to the user.
+ * Sends as many rows as fit in the room left in the client's sendQ (up
+ * to the 2/3rds of it that IsSendable() allows), then leaves its place
+ * in the index for send_safelists() to pick up from once the client
+ * has read some.  Rows are formatted here and go into the sendQ a
+ * block at a time, rather than through a sendto_one() each.
+ */
+void send_list(aClient *cptr)
+{
+    LOpts       *lopt = cptr->user->lopt;
+    aChannel    *chptr;
+    char        pfx[2 * HOSTLEN + 16], block[8192], *p = block, *row;
+    int         pfxlen, rows = 0;
+    long        room;
+
+    if (cptr->flags & FLAGS_BLOCKED)
+        return;
+    room = (long) ((float) cptr->class->maxsendq / 1.5) -
+        SBufLength(&cptr->sendQ);
+    if (room <= 0)
+        return;
+
+    pfxlen = ircsprintf(pfx, ":%s %d %s ", me.name, RPL_LIST, cptr->name);
+
+    if ((chptr = lopt->nextch))
+        chptr->listrefs--;
+
+    while (room > 0)
     {
-        Link *lp, *next;
-        sendto_one(cptr, rpl_str(RPL_LISTEND), me.name, cptr->name);
-        for (lp = lopt->yeslist; lp; lp = next)
+        if (!chptr)
         {
-            next = lp->next;
-            MyFree(lp->value.cp);
-            free_link(lp);
+            if (lopt->bucket <= lopt->lowbucket)
+                break;
+            chptr = listidx[--lopt->bucket].head;
+            continue;
         }
-        for (lp = lopt->nolist; lp; lp = next)
+
+        if (list_match(cptr, lopt, chptr))
         {
-            next = lp->next;
-            MyFree(lp->value.cp);
-            free_link(lp);
+            if (p - block > (int) sizeof(block) - LIST_ROWMAX)
+            {
+                sendto_one_lines(cptr, block, p - block, rows);
+                p = block;
+                rows = 0;
+            }
+
+            /* RPL_LIST; admins see the channels not shown to others
+             * marked with a % */
+            row = p;
+            memcpy(p, pfx, pfxlen);
+            p += pfxlen;
+            if (IsAdmin(cptr) && !PubChannel(chptr) && !IsMember(cptr, chptr))
+                *p++ = '%';
+            p += ircsprintf(p, "%s %d :%s", chptr->chname, chptr->users,
+                            chptr->topic);
+            if (p - row > 510)
+                p = row + 510;
+            *p++ = '\r';
+            *p++ = '\n';
+            room -= p - row;
+            rows++;
         }
-        
-        MyFree(cptr->user->lopt);
-        cptr->user->lopt = NULL;
-        remove_from_list(&listing_clients, cptr, NULL);
+        chptr = chptr->lnext;
+    }
+
+    if (rows)
+        sendto_one_lines(cptr, block, p - block, rows);
+
+    /* out of room: wait here for send_safelists() */
+    if (chptr || lopt->bucket > lopt->lowbucket)
+    {
+        if ((lopt->nextch = chptr))
+            chptr->listrefs++;
         return;
     }
-    
-    /* 
-     * We've exceeded the limit on the number of channels to send back
-     * at once.
-     */
-    lopt->starthash = hashnum;
-    return;
+
+    /* All done */
+    lopt->nextch = NULL;
+    sendto_one(cptr, rpl_str(RPL_LISTEND), me.name, cptr->name);
+    list_free(cptr);
 }
 
 
@@ -4291,7 +4805,7 @@ int m_list(aClient *cptr, aClient *sptr, int parc, char *parv[])
     time_t      currenttime = time(NULL);
     char        *name, *p = NULL;
     LOpts       *lopt = NULL;
-    Link        *lp, *next;
+    Link        *lp;
     int         usermax, usermin, error = 0, doall = 0, only_listed = 1;
     int         x;
     time_t      chantimemin, chantimemax;
@@ -4327,24 +4841,10 @@ int m_list(aClient *cptr, aClient *sptr, int parc, char *parv[])
     }
 
     /* If a /list is in progress, then another one will cancel it */
-    if ((lopt = sptr->user->lopt)!=NULL)
+    if (sptr->user->lopt)
     {
         sendto_one(sptr, rpl_str(RPL_LISTEND), me.name, parv[0]);
-        for (lp = lopt->yeslist; lp; lp = next)
-        {
-            next = lp->next;
-            MyFree(lp->value.cp);
-            free_link(lp);
-        }
-        for (lp = lopt->nolist; lp; lp = next)
-        {
-            next = lp->next;
-            MyFree(lp->value.cp);
-            free_link(lp);
-        }
-        MyFree(sptr->user->lopt);
-        sptr->user->lopt = NULL;
-        remove_from_list(&listing_clients, sptr, NULL);
+        list_free(sptr);
         return 0;
     }
 
@@ -4356,14 +4856,14 @@ int m_list(aClient *cptr, aClient *sptr, int parc, char *parv[])
         memset(lopt, '\0', sizeof(LOpts));
 
         lopt->showall = 1;
+        lopt->usermax = -1;
 #ifdef USE_CHANMODE_L
         lopt->only_listed = 1;
 #endif
+        list_start(lopt);
 
         add_to_list(&listing_clients, sptr);
-
-        if (SBufLength(&cptr->sendQ) < 2048)
-            send_list(cptr, 64);
+        send_list(cptr);
 
         return 0;
     }
@@ -4508,11 +5008,10 @@ int m_list(aClient *cptr, aClient *sptr, int parc, char *parv[])
         lopt->nolist = nolist;
         lopt->yeslist = yeslist;
         lopt->only_listed = only_listed;
+        list_start(lopt);
 
         add_to_list(&listing_clients, sptr);
-
-        if (SBufLength(&cptr->sendQ) < 2048)
-            send_list(cptr, 64);
+        send_list(cptr);
         return 0;
     }
 
@@ -4826,24 +5325,28 @@ void kill_ban_list(aClient *cptr, aChannel *chptr)
     while(bp)
     {
         pnx = bp->next;
+        MyFree(bp->match);
         MyFree(bp->banstr);
         MyFree(bp->who);
         MyFree(bp);
         bp = pnx;
     }
     chptr->banlist = NULL;
+    MyFree(chptr->banidx);
 
 #ifdef EXEMPT_LISTS
     ep = chptr->banexempt_list;
     while(ep)
     {
         pnx = ep->next;
+        MyFree(ep->match);
         MyFree(ep->banstr);
         MyFree(ep->who);
         MyFree(ep);
         ep = pnx;
     }
     chptr->banexempt_list = NULL;
+    MyFree(chptr->exemptidx);
 #endif
 
 #ifdef INVITE_LISTS
@@ -5639,6 +6142,7 @@ memcount_channel(MCchannel *mc)
             mc->bans.m += sizeof(*ban);
             mc->bans.m += strlen(ban->banstr) + 1;
             mc->bans.m += strlen(ban->who) + 1;
+            mc->bans.m += sizeof(aBanMatch) + strlen(ban->banstr) + 1;
         }
 #ifdef EXEMPT_LISTS
         for (exempt = chptr->banexempt_list; exempt; exempt = exempt->next)
@@ -5647,6 +6151,7 @@ memcount_channel(MCchannel *mc)
             mc->exempts.m += sizeof(*exempt);
             mc->exempts.m += strlen(exempt->banstr) + 1;
             mc->exempts.m += strlen(exempt->who) + 1;
+            mc->exempts.m += sizeof(aBanMatch) + strlen(exempt->banstr) + 1;
         }
 #endif
 #ifdef INVITE_LISTS
@@ -5657,10 +6162,24 @@ memcount_channel(MCchannel *mc)
             mc->invites.m += strlen(invite->invstr) + 1;
             mc->invites.m += strlen(invite->who) + 1;
         }
+#endif
+        if (chptr->banidx)
+            mc->bans.m += sizeof(aBanIndex);
+#ifdef EXEMPT_LISTS
+        if (chptr->exemptidx)
+            mc->exempts.m += sizeof(aBanIndex);
 #endif
         for (cm = chptr->members; cm; cm = cm->next)
             mc->e_chanmembers++;
 
+        if (chptr->maxlocal || chptr->maxrlinks)
+        {
+            mc->fanout.c++;
+            mc->fanout.m += chptr->maxlocal * (sizeof(int) +
+                                               sizeof(chanMember *));
+            mc->fanout.m += chptr->maxrlinks * sizeof(aFanoutLink);
+        }
+
 #ifdef FLUD
         for (fb = chptr->fluders; fb; fb = fb->next)
             mc->e_fludbots++;
@@ -5698,6 +6217,8 @@ memcount_channel(MCchannel *mc)
 #endif
     mc->total.c += mc->lopts.c;
     mc->total.m += mc->lopts.m;
+    mc->total.c += mc->fanout.c;
+    mc->total.m += mc->fanout.m;
 
     mc->s_scratch.c++;
     mc->s_scratch.m += sizeof(nickbuf);
@@ -38,12 +38,7 @@
 #include "clones.h"
 
 
-#ifndef THROTTLE_ENABLE
-extern BlockHeap *hashent_freelist;
-#endif
-
-
-static void *clones_hashtable;
+static hash_table *clones_hashtable;
 
 BlockHeap *free_cloneents;
 CloneEnt  *clones_list;
@@ -73,7 +68,7 @@ get_clone(char *key, int create)
 static void
 expire_clone(CloneEnt *ce)
 {
-    if (ce->gcount || ce->limit || ce->sllimit || ce->sglimit)
+    if (ce->gcount || ce->limit || ce->sllimit || ce->sglimit || ce->refs)
         return;
 
     if (ce->next)
@@ -359,6 +354,22 @@ clones_remove(aClient *cptr)
 }
 #endif  /* THROTTLE_ENABLE */
 
+/*
+ * Keeps an entry on the list while a paused search has its place there.
+ */
+void
+clones_hold(CloneEnt *ce)
+{
+    ce->refs++;
+}
+
+void
+clones_release(CloneEnt *ce)
+{
+    ce->refs--;
+    expire_clone(ce);
+}
+
 /*
  * Sets a global clone limit.  A limit of 0 reverts to default settings.
  * Returns -1 on invalid parameters, old value otherwise.
@@ -441,17 +452,11 @@ clones_send(aClient *cptr)
     }
 }
 
-/*
- * Must be called AFTER throttle_init()
- */
 void
 clones_init(void)
 {
-#ifndef THROTTLE_ENABLE
-    hashent_freelist = BlockHeapCreate(sizeof(hashent), 1024);
-#endif
     free_cloneents = BlockHeapCreate(sizeof(CloneEnt), 1024);
-    clones_hashtable = create_hash_table(THROTTLE_HASHSIZE,
+    clones_hashtable = create_hash_table("Clone", THROTTLE_HASHSIZE,
                                          offsetof(CloneEnt, ent), HOSTIPLEN,
                                          2, (void *)strcmp);
 }
@@ -21,11 +21,12 @@
 #include "common.h"
 #include "sys.h"
 #include "hash.h"
+#include "numeric.h"
+#include "throttle.h"
 #include "h.h"
 #include "memcount.h"
 
-static aHashEntry clientTable[U_MAX];
-static aHashEntry channelTable[CH_MAX];
+static aHashTable clientTable, channelTable;
 
 /*
  * look in whowas.c for the missing ...[WW_MAX]; entry - Dianora
@@ -35,9 +36,9 @@ static aHashEntry channelTable[CH_MAX];
  * The server uses a chained hash table to provide quick and efficient
  * hash table mantainence (providing the hash function works evenly
  * over the input range).  The hash table is thus not susceptible to
- * problems of filling all the buckets or the need to rehash. It is
- * expected that the hash table would look somehting like this during
- * use: +-----+    +-----+    +-----+   +-----+ 
+ * problems of filling all the buckets.  It is expected that the hash
+ * table would look somehting like this during use:
+ *      +-----+    +-----+    +-----+   +-----+ 
  *   ---| 224 |----| 225 |----| 226 |---| 227 |--- 
  *      +-----+    +-----+    +-----+   +-----+ 
  *         |          |          | 
@@ -50,77 +51,191 @@ static aHashEntry channelTable[CH_MAX];
  *      +-----+
  * 
  * A - GOPbot, B - chang, C - hanuaway, D - *.mu.OZ.AU
- * 
- * The order shown above is just one instant of the server.  Each time a
- * lookup is made on an entry in the hash table and it is found, the
- * entry is moved to the top of the chain.
- * 
- * ^^^^^^^^^^^^^^^^ **** Not anymore - Dianora
- * 
+ *
+ * The client and channel tables grow and shrink with what is in them;
+ * see hash.h.
  */
 
+/*
+ * hash_nick_name
+ *
+ * FNV-1a over the case-folded name, with a final mix so the low bits,
+ * which pick the bucket, depend on every character.  The shift-and-add
+ * hash this replaces put names differing only in their last characters
+ * ("guest1234", "guest1235") into neighbouring buckets and lost the
+ * first characters of long names altogether.  Channel names use it too.
+ */
 unsigned hash_nick_name(char *nname)
 {
-    unsigned hash = 0;
-    int     hash2 = 0;
-    int     ret;
-    char    lower;
+    unsigned hash = 2166136261U;
 
     while (*nname)
     {
-	lower = ToLower(*nname);
-	hash = (hash << 1) + lower;
-	hash2 = (hash2 >> 1) + lower;
+	hash ^= (u_char) ToLower(*nname);
+	hash *= 16777619U;
 	nname++;
     }
-    ret = ((hash & U_MAX_INITIAL_MASK) << BITS_PER_COL) +
-	(hash2 & BITS_PER_COL_MASK);
-    return ret;
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bU;
+    hash ^= hash >> 13;
+    return hash;
+}
+
+static aHashEntry *hash_alloc(unsigned size)
+{
+    aHashEntry *table = MyMalloc(size * sizeof(aHashEntry));
+
+    memset((char *) table, '\0', size * sizeof(aHashEntry));
+    return table;
+}
+
+void hash_init(aHashTable *ht, unsigned minsize, size_t nextoff,
+	       size_t nameoff)
+{
+    if (ht->table[0])
+	MyFree(ht->table[0]);
+    if (ht->table[1])
+	MyFree(ht->table[1]);
+    memset((char *) ht, '\0', sizeof(*ht));
+    ht->table[0] = hash_alloc(minsize);
+    ht->size[0] = ht->minsize = minsize;
+    ht->rehash = -1;
+    ht->nextoff = nextoff;
+    ht->nameoff = nameoff;
+}
+
+/* the bucket a hash value lives in right now */
+aHashEntry *hash_bucket(aHashTable *ht, unsigned hashv)
+{
+    unsigned bucket = hashv & (ht->size[0] - 1);
+
+    if (ht->rehash >= 0 && bucket < (unsigned) ht->rehash)
+	return &ht->table[1][hashv & (ht->size[1] - 1)];
+    return &ht->table[0][bucket];
 }
 
 /*
- * hash_channel_name
- * 
- * calculate a hash value on at most the first 30 characters of the
- * channel name. Most names are short than this or dissimilar in this
- * range. There is little or no point hashing on a full channel name
- * which maybe 255 chars long.
+ * Move up to 'n' chains of a resize across, looking at no more than ten
+ * empty buckets per chain so a sparse table doesn't stall the caller.
  */
-int hash_channel_name(char *name)
+static void hash_step(aHashTable *ht, int n)
 {
-    unsigned int hash = 0;
-    int hash2 = 0;
-    char lower;
+    aHashEntry *from, *to;
+    void *p, *next;
+    int empty = n * 10;
 
-    while (*name)
+    while (ht->rehash >= 0 && n > 0)
     {
-	lower = ToLower(*name);
-	hash = (hash << 1) + lower;
-	hash2 = (hash2 >> 1) + lower;
-	name++;
+	from = &ht->table[0][ht->rehash];
+	if (from->list)
+	{
+	    for (p = from->list; p; p = next)
+	    {
+		next = HNEXT(ht, p);
+		to = &ht->table[1][hash_nick_name(HNAME(ht, p)) &
+				   (ht->size[1] - 1)];
+		HNEXT(ht, p) = to->list;
+		to->list = p;
+		to->links++;
+	    }
+	    from->list = NULL;
+	    from->links = 0;
+	    n--;
+	}
+	else if (--empty <= 0)
+	    n = 0;
+
+	if ((unsigned) ++ht->rehash == ht->size[0])
+	{
+	    MyFree(ht->table[0]);
+	    ht->table[0] = ht->table[1];
+	    ht->size[0] = ht->size[1];
+	    ht->table[1] = NULL;
+	    ht->size[1] = 0;
+	    ht->rehash = -1;
+	}
     }
-    return ((hash & CH_MAX_INITIAL_MASK) << BITS_PER_COL) +
-	(hash2 & BITS_PER_COL_MASK);
 }
 
-unsigned int hash_whowas_name(char *name)
+/* start a resize if the load calls for one, and push any under way on */
+static void hash_balance(aHashTable *ht)
 {
-    unsigned char *nname = (unsigned char *) name;
-    unsigned int hash = 0;
-    int hash2 = 0;
-    int ret;
-    char lower;
+    unsigned size = 0;
 
-    while (*nname)
+    if (ht->rehash < 0)
     {
-	lower = ToLower(*nname);
-	hash = (hash << 1) + lower;
-	hash2 = (hash2 >> 1) + lower;
-	nname++;
+	if (ht->entries > ht->size[0])
+	    size = ht->size[0] << 1;
+	else if (ht->entries < ht->size[0] / 8 && ht->size[0] > ht->minsize)
+	    size = ht->size[0] >> 1;
+	if (!size)
+	    return;
+	ht->table[1] = hash_alloc(size);
+	ht->size[1] = size;
+	ht->rehash = 0;
+    }
+    hash_step(ht, 2);
+}
+
+void hash_add(aHashTable *ht, char *name, void *p)
+{
+    aHashEntry *bucket = hash_bucket(ht, hash_nick_name(name));
+
+    HNEXT(ht, p) = bucket->list;
+    bucket->list = p;
+    bucket->links++;
+    bucket->hits++;
+    ht->entries++;
+    hash_balance(ht);
+}
+
+int hash_del(aHashTable *ht, char *name, void *p)
+{
+    aHashEntry *bucket = hash_bucket(ht, hash_nick_name(name));
+    void **pp;
+
+    for (pp = &bucket->list; *pp; pp = &HNEXT(ht, *pp))
+    {
+	if (*pp != p)
+	    continue;
+	*pp = HNEXT(ht, p);
+	HNEXT(ht, p) = NULL;
+	ht->entries--;
+	if (bucket->links > 0)
+	{
+	    bucket->links--;
+	    hash_balance(ht);
+	    return 1;
+	}
+	/*
+	 * Should never actually return from here and if we do it
+	 * is an error/inconsistency in the hash table.
+	 */
+	return -1;
     }
-    ret = ((hash & WW_MAX_INITIAL_MASK) << BITS_PER_COL) +
-	(hash2 & BITS_PER_COL_MASK);
-    return ret;
+    return 0;
+}
+
+/*
+ * Count the chains by length, from empty up to HASH_HIST - 1 or more,
+ * and return the longest.
+ */
+int hash_histogram(aHashTable *ht, int *hist)
+{
+    aHashEntry *bucket;
+    unsigned i, t;
+    int longest = 0;
+
+    memset((char *) hist, '\0', HASH_HIST * sizeof(int));
+    for (t = 0; t < 2 && ht->table[t]; t++)
+	for (i = t ? 0 : MAX(ht->rehash, 0); i < ht->size[t]; i++)
+	{
+	    bucket = &ht->table[t][i];
+	    hist[MIN(bucket->links, HASH_HIST - 1)]++;
+	    if (bucket->links > longest)
+		longest = bucket->links;
+	}
+    return longest;
 }
 
 /*
@@ -131,37 +246,27 @@ unsigned int hash_whowas_name(char *name)
 
 void clear_client_hash_table()
 {
-    memset((char *) clientTable, '\0', sizeof(aHashEntry) * U_MAX);
+    hash_init(&clientTable, U_HASH_MIN, offsetof(aClient, hnext),
+	      offsetof(aClient, name));
 }
 
 void clear_channel_hash_table()
 {
-    memset((char *) channelTable, '\0', sizeof(aHashEntry) * CH_MAX);
+    hash_init(&channelTable, CH_HASH_MIN, offsetof(aChannel, hnextch),
+	      offsetof(aChannel, chname));
 }
 
 /* add_to_client_hash_table */
 int add_to_client_hash_table(char *name, aClient *cptr)
 {
-    int     hashv;
-    
-    hashv = hash_nick_name(name);
-    cptr->hnext = (aClient *) clientTable[hashv].list;
-    clientTable[hashv].list = (void *) cptr;
-    clientTable[hashv].links++;
-    clientTable[hashv].hits++;
+    hash_add(&clientTable, name, cptr);
     return 0;
 }
 
 /* add_to_channel_hash_table */
 int add_to_channel_hash_table(char *name, aChannel *chptr)
 {
-    int     hashv;
-
-    hashv = hash_channel_name(name);
-    chptr->hnextch = (aChannel *) channelTable[hashv].list;
-    channelTable[hashv].list = (void *) chptr;
-    channelTable[hashv].links++;
-    channelTable[hashv].hits++;
+    hash_add(&channelTable, name, chptr);
     return 0;
 }
 
@@ -169,64 +274,13 @@ int add_to_channel_hash_table(char *name, aChannel *chptr)
 int
 del_from_client_hash_table(char *name, aClient *cptr)
 {
-    aClient *tmp, *prev = NULL;
-    int     hashv;
-
-    hashv = hash_nick_name(name);
-    for (tmp = (aClient *) clientTable[hashv].list; tmp; tmp = tmp->hnext)
-    {
-	if (tmp == cptr)
-	{
-	    if (prev)
-		prev->hnext = tmp->hnext;
-	    else
-		clientTable[hashv].list = (void *) tmp->hnext;
-	    tmp->hnext = NULL;
-	    if (clientTable[hashv].links > 0)
-	    {
-		clientTable[hashv].links--;
-		return 1;
-	    }
-	    else
-		/*
-		 * Should never actually return from here and if we do it
-		 * is an error/inconsistency in the hash table.
-		 */
-		return -1;
-	}
-	prev = tmp;
-    }
-    return 0;
+    return hash_del(&clientTable, name, cptr);
 }
 
 /* del_from_channel_hash_table */
 int del_from_channel_hash_table(char *name, aChannel *chptr)
 {
-    aChannel *tmp, *prev = NULL;
-    int     hashv;
-    
-    hashv = hash_channel_name(name);
-    for (tmp = (aChannel *) channelTable[hashv].list; tmp;
-	 tmp = tmp->hnextch)
-    {
-	if (tmp == chptr)
-	{
-	    if (prev)
-		prev->hnextch = tmp->hnextch;
-	    else
-		channelTable[hashv].list = (void *) tmp->hnextch;
-	    tmp->hnextch = NULL;
-	    if (channelTable[hashv].links > 0)
-	    {
-		channelTable[hashv].links--;
-		return 1;
-	    }
-	    else
-		return -1;
-	}
-	prev = tmp;
-    }
-    return 0;
+    return hash_del(&channelTable, name, chptr);
 }
 
 /* hash_find_client */
@@ -234,10 +288,8 @@ aClient *hash_find_client(char *name, aClient *cptr)
 {
     aClient *tmp;
     aHashEntry *tmp3;
-    int hashv;
     
-    hashv = hash_nick_name(name);
-    tmp3 = &clientTable[hashv];
+    tmp3 = hash_bucket(&clientTable, hash_nick_name(name));
     /* Got the bucket, now search the chain. */
     for (tmp = (aClient *) tmp3->list; tmp; tmp = tmp->hnext)
 	if (mycmp(name, tmp->name) == 0) 
@@ -267,13 +319,11 @@ aClient *hash_find_nickserver(char *name, aClient *cptr)
 {
     aClient *tmp;
     aHashEntry *tmp3;
-    int hashv;
     char *serv;
 
     serv = strchr(name, '@');
     *serv++ = '\0';
-    hashv = hash_nick_name(name);
-    tmp3 = &clientTable[hashv];
+    tmp3 = hash_bucket(&clientTable, hash_nick_name(name));
     /* Got the bucket, now search the chain. */
     for (tmp = (aClient *) tmp3->list; tmp; tmp = tmp->hnext)
 	if (mycmp(name, tmp->name) == 0 && tmp->user &&
@@ -293,10 +343,7 @@ aClient *hash_find_server(char *server, aClient *cptr)
     aClient *tmp;
     aHashEntry *tmp3;
     
-    int         hashv;
-    
-    hashv = hash_nick_name(server);
-    tmp3 = &clientTable[hashv];
+    tmp3 = hash_bucket(&clientTable, hash_nick_name(server));
 
     for (tmp = (aClient *) tmp3->list; tmp; tmp = tmp->hnext)
     {
@@ -320,12 +367,10 @@ aClient *hash_find_server(char *server, aClient *cptr)
 /* hash_find_channel */
 aChannel *hash_find_channel(char *name, aChannel *chptr)
 {
-    int         hashv;
     aChannel *tmp;
     aHashEntry *tmp3;
     
-    hashv = hash_channel_name(name);
-    tmp3 = &channelTable[hashv];
+    tmp3 = hash_bucket(&channelTable, hash_nick_name(name));
     
     for (tmp = (aChannel *) tmp3->list; tmp; tmp = tmp->hnextch)
 	if (mycmp(name, tmp->chname) == 0)
@@ -340,14 +385,41 @@ aChannel *hash_find_channel(char *name, aChannel *chptr)
  * protocol.  It is simply here to help debug and to monitor the
  * performance of the hash functions and table, enabling a better
  * algorithm to be sought if this one becomes troublesome. -avalon
- * 
- * Needs rewriting for DOUGH_HASH, consider this a place holder until
- * thats done. Hopefully for hybrid-5, if not. tough. - Dianora
- * 
+ *
+ * Shows each table's size, load, any resize under way and how long its
+ * chains are.
  */
 
+static void report_hash(aClient *sptr, char *what, aHashTable *ht)
+{
+    int hist[HASH_HIST], longest;
+
+    longest = hash_histogram(ht, hist);
+    if (ht->rehash >= 0)
+	sendto_one(sptr, ":%s NOTICE %s :%s hash: %u entries, %u buckets,"
+		   " resizing to %u (%ld moved)", me.name, sptr->name, what,
+		   ht->entries, ht->size[0], ht->size[1], ht->rehash);
+    else
+	sendto_one(sptr, ":%s NOTICE %s :%s hash: %u entries, %u buckets",
+		   me.name, sptr->name, what, ht->entries, ht->size[0]);
+    sendto_one(sptr, ":%s NOTICE %s :%s chains: 0:%d 1:%d 2:%d 3:%d 4:%d"
+	       " 5:%d 6:%d %d+:%d longest %d", me.name, sptr->name, what,
+	       hist[0], hist[1], hist[2], hist[3], hist[4], hist[5], hist[6],
+	       HASH_HIST - 1, hist[HASH_HIST - 1], longest);
+}
+
 int m_hash(aClient *cptr, aClient *sptr, int parc, char *parv[])
 {
+    if (!IsAnOper(sptr))
+    {
+	sendto_one(sptr, err_str(ERR_NOPRIVILEGES), me.name, parv[0]);
+	return 0;
+    }
+    report_hash(sptr, "Client", &clientTable);
+    report_hash(sptr, "Channel", &channelTable);
+    report_hash(sptr, "Whowas", &whowasTable);
+    report_hash(sptr, "Whowas string", &wwstringTable);
+    hash_table_report(sptr);
     return 0;
 }
 
@@ -370,29 +442,75 @@ int m_hash(aClient *cptr, aClient *sptr, int parc, char *parv[])
  * hash-get-notify:
  */
 
-static   aWatch  *watchTable[WATCHHASHSIZE];
+static hash_table *watchTable;
 
 void clear_watch_hash_table(void)
 {
-    memset((char *)watchTable, '\0', sizeof(watchTable));
+    if (watchTable)
+	destroy_hash_table(watchTable);
+    watchTable = create_hash_table("Watch", WATCH_HASH_MIN,
+				   offsetof(aWatch, nick), 0, HASH_FL_NOCASE,
+				   (int (*)(void *, void *)) mycmp);
 }
 
 
+/*
+ * The member hash finds the chanMember for a (client, channel) pair
+ * without walking either the channel's member list or the client's
+ * channel list, which in a large channel would cost a pointer chase per
+ * member for every message, mode and kick.  Members are keyed on their
+ * cptr and chptr fields, which sit side by side in the chanMember.
+ */
+
+static hash_table *memberTable;
+
+#define MEMBER_KEYLEN	(offsetof(chanMember, chptr) + sizeof(aChannel *) - \
+			 offsetof(chanMember, cptr))
+
+static int member_cmp(void *a, void *b)
+{
+    return memcmp(a, b, MEMBER_KEYLEN);
+}
+
+void clear_member_hash_table(void)
+{
+    if (memberTable)
+	destroy_hash_table(memberTable);
+    memberTable = create_hash_table("Member", MEMBER_HASH_MIN,
+				    offsetof(chanMember, cptr), MEMBER_KEYLEN,
+				    0, member_cmp);
+}
+
+void add_to_member_hash_table(chanMember *cm)
+{
+    hash_insert(memberTable, cm);
+}
+
+void del_from_member_hash_table(chanMember *cm)
+{
+    hash_delete(memberTable, cm);
+}
+
+chanMember *find_user_member(aChannel *chptr, aClient *cptr)
+{
+    chanMember key;
+
+    if (!chptr || !cptr)
+	return NULL;
+    key.cptr = cptr;
+    key.chptr = chptr;
+    return (chanMember *) hash_find(memberTable, &key.cptr);
+}
+
 /* add_to_watch_hash_table */
 int   add_to_watch_hash_table(char *nick, aClient *cptr)
 {
-    int   hashv;
     aWatch  *anptr;
     Link  *lp;
     
     
-    /* Get the right bucket... */
-    hashv = hash_nick_name(nick)%WATCHHASHSIZE;
-    
-    /* Find the right nick (header) in the bucket, or NULL... */
-    if ((anptr = (aWatch *)watchTable[hashv]))
-	while (anptr && mycmp(anptr->nick, nick))
-	    anptr = anptr->hnext;
+    /* Find the right nick (header), or NULL... */
+    anptr = (aWatch *) hash_find(watchTable, nick);
     
     /* If found NULL (no header for this nick), make one... */
     if (!anptr)
@@ -403,8 +521,7 @@ int   add_to_watch_hash_table(char *nick, aClient *cptr)
 	
 	anptr->watch = NULL;
 	
-	anptr->hnext = watchTable[hashv];
-	watchTable[hashv] = anptr;
+	hash_insert(watchTable, anptr);
     }
     /* Is this client already on the watch-list? */
     if ((lp = anptr->watch))
@@ -432,18 +549,12 @@ int   add_to_watch_hash_table(char *nick, aClient *cptr)
 /* hash_check_watch */
 int hash_check_watch(aClient *cptr, int reply)
 {
-    int   hashv;
     aWatch  *anptr;
     Link  *lp;
     
     
-    /* Get us the right bucket */
-    hashv = hash_nick_name(cptr->name)%WATCHHASHSIZE;
-	
-    /* Find the right header in this bucket */
-    if ((anptr = (aWatch *)watchTable[hashv]))
-	while (anptr && mycmp(anptr->nick, cptr->name))
-	    anptr = anptr->hnext;
+    /* Find the right header */
+    anptr = (aWatch *) hash_find(watchTable, cptr->name);
     if (!anptr)
 	return 0;   /* This nick isn't on watch */
     
@@ -468,37 +579,18 @@ int hash_check_watch(aClient *cptr, int reply)
 /* hash_get_watch */
 aWatch  *hash_get_watch(char *name)
 {
-    int   hashv;
-    aWatch  *anptr;
-    
-    
-    hashv = hash_nick_name(name)%WATCHHASHSIZE;
-    
-    if ((anptr = (aWatch *)watchTable[hashv]))
-	while (anptr && mycmp(anptr->nick, name))
-	    anptr = anptr->hnext;
-    
-    return anptr;
+    return (aWatch *) hash_find(watchTable, name);
 }
 
 /* del_from_watch_hash_table */
 int   del_from_watch_hash_table(char *nick, aClient *cptr)
 {
-    int   hashv;
-    aWatch  *anptr, *nlast = NULL;
+    aWatch  *anptr;
     Link  *lp, *last = NULL;
     
     
-    /* Get the bucket for this nick... */
-    hashv = hash_nick_name(nick)%WATCHHASHSIZE;
-    
-    /* Find the right header, maintaining last-link pointer... */
-    if ((anptr = (aWatch *)watchTable[hashv]))
-	while (anptr && mycmp(anptr->nick, nick))
-	{
-	    nlast = anptr;
-	    anptr = anptr->hnext;
-	}
+    /* Find the right header... */
+    anptr = (aWatch *) hash_find(watchTable, nick);
     if (!anptr)
 	return 0;   /* No such watch */
     
@@ -548,10 +640,7 @@ int   del_from_watch_hash_table(char *nick, aClient *cptr)
     /* In case this header is now empty of notices, remove it */
     if (!anptr->watch)
     {
-	if (!nlast)
-	    watchTable[hashv] = anptr->hnext;
-	else
-	    nlast->hnext = anptr->hnext;
+	hash_delete(watchTable, anptr);
 	MyFree(anptr);
     }
     
@@ -564,7 +653,6 @@ int   del_from_watch_hash_table(char *nick, aClient *cptr)
 /* hash_del_watch_list */
 int   hash_del_watch_list(aClient *cptr)
 {
-    int   hashv;
     aWatch  *anptr;
     Link  *np, *lp, *last;
     
@@ -597,28 +685,10 @@ int   hash_del_watch_list(aClient *cptr)
 		last->next = lp->next;
 	    free_link(lp);
 	    
-	    /*
-	     * If this leaves a header without notifies,
-	     * remove it. Need to find the last-pointer!
-	     */
+	    /* If this leaves a header without notifies, remove it. */
 	    if (!anptr->watch)
 	    {
-		aWatch  *np2, *nl;
-		
-		hashv = hash_nick_name(anptr->nick)%WATCHHASHSIZE;
-		
-		nl = NULL;
-		np2 = watchTable[hashv];
-		while (np2 != anptr)
-		{
-		    nl = np2;
-		    np2 = np2->hnext;
-		}
-		
-		if (nl)
-		    nl->hnext = anptr->hnext;
-		else
-		    watchTable[hashv] = anptr->hnext;
+		hash_delete(watchTable, anptr);
 		MyFree(anptr);
 	    }
 	}
@@ -633,42 +703,36 @@ int   hash_del_watch_list(aClient *cptr)
     return 0;
 }
 
-aChannel *hash_get_chan_bucket(int hashv)
-{
-    if (hashv > CH_MAX)
-	return NULL;
-    return (aChannel *)channelTable[hashv].list;
-}
-
 u_long
 memcount_hash(MChash *mc)
 {
     aWatch  *wptr;
     Link    *lp;
-    int      i;
+    int      pos = 0;
 
     mc->file = __FILE__;
 
-    for (i = 0; i < WATCHHASHSIZE; i++)
+    while ((wptr = hash_walk(watchTable, &pos)))
     {
-        for (wptr = watchTable[i]; wptr; wptr = wptr->hnext)
-        {
-            mc->watches.c++;
-            mc->watches.m += sizeof(*wptr) + strlen(wptr->nick);
-
-            for (lp = wptr->watch; lp; lp = lp->next)
-                mc->e_links++;
-        }
+        mc->watches.c++;
+        mc->watches.m += sizeof(*wptr) + strlen(wptr->nick);
+
+        for (lp = wptr->watch; lp; lp = lp->next)
+            mc->e_links++;
     }
     mc->total.c += mc->watches.c;
     mc->total.m += mc->watches.m;
 
-    mc->s_clienthash.c = sizeof(clientTable)/sizeof(clientTable[0]);
-    mc->s_clienthash.m = sizeof(clientTable);
-    mc->s_channelhash.c = sizeof(channelTable)/sizeof(channelTable[0]);
-    mc->s_channelhash.m = sizeof(channelTable);
-    mc->s_watchhash.c = sizeof(watchTable)/sizeof(watchTable[0]);
-    mc->s_watchhash.m = sizeof(watchTable);
+    mc->clienthash.c = clientTable.size[0] + clientTable.size[1];
+    mc->clienthash.m = mc->clienthash.c * sizeof(aHashEntry);
+    hash_histogram(&clientTable, mc->clientchains);
+    mc->channelhash.c = channelTable.size[0] + channelTable.size[1];
+    mc->channelhash.m = mc->channelhash.c * sizeof(aHashEntry);
+    hash_histogram(&channelTable, mc->channelchains);
+    mc->total.m += mc->clienthash.m + mc->channelhash.m;
+
+    mc->e_watchhash = watchTable;
+    mc->e_memberhash = memberTable;
 
     return mc->total.m;
 }
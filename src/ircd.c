@@ -119,6 +119,7 @@ extern void     read_shortmotd(char *);     /* defined in s_serv.c */
 extern void     read_help(char *);          /* defined in s_serv.c */
 extern void     init_globals();
 extern int      klinestore_init(int);    /* defined in klines.c */
+extern void     klinestore_flush(void);  /* defined in klines.c */
 
 extern int uhm_type;
 extern int uhm_umodeh;
@@ -133,13 +134,6 @@ char        *sbrk0;                 /* initial sbrk(0) */
 static int  dorehash = 0;
 char        dpath[PATH_MAX] = {0};  /* our configure files live in here */
 char        spath[PATH_MAX] = {0};  /* the path to our binary */
-int         rehashed = 1;
-int         zline_in_progress = 0; /* killing off matching D lines */
-time_t      nextconnect = 1;       /* time for next try_connections call */
-time_t      nextping = 1;          /* same as above for check_pings() */
-time_t      nextdnscheck = 0;      /* next time to poll dns to force timeout */
-time_t      nextexpire = 1;        /* next expire run on the dns cache */
-time_t      nextbanexpire = 1;     /* next time to expire the throttles/userbans */
 
 #ifdef PROFILING
 extern void _start, etext;
@@ -199,6 +193,7 @@ void s_die()
     FILE *fp;
     char tmp[PATH_MAX];
     dump_connections(me.fd);
+    klinestore_flush();
 #ifdef  USE_SYSLOG
     (void) syslog(LOG_CRIT, "Server killed By SIGTERM");
 #endif
@@ -263,6 +258,7 @@ void server_reboot()
         
     Debug((DEBUG_NOTICE, "Restarting server..."));
     dump_connections(me.fd);
+    klinestore_flush();
     /*
      * fd 0 must be 'preserved' if either the -d or -i options have
      * been passed to us before restarting.
@@ -380,160 +376,210 @@ static time_t try_connections(time_t currenttime)
     return (next);
 }
 
-/* dianora's code in the new checkpings is slightly wasteful.
- * however, upon inspection (thanks seddy), when we close a connection,
- * the ordering of local[i] is NOT reordered; simply local[highest_fd] becomes
- * local[i], so we can just i--;  - lucas
+/*
+ * Every local connection has a timer, set for the next time it might
+ * need looking at: when it is due a PING, when a PING it was sent or
+ * its registration runs out.  Traffic doesn't touch the timer; if it
+ * fires and the client has been heard from since, it is set again from
+ * lasttime.  This replaces a sweep over every connection each 9 seconds.
  */
+static time_t ping_deadline(aClient *cptr)
+{
+    int ping = IsRegistered(cptr) ? cptr->class->pingfreq : CONNECTTIMEOUT;
+    time_t when;
+
+    if (cptr->flags & FLAGS_DEADSOCKET)
+        return timeofday;
+
+    if (cptr->flags & FLAGS_PINGSENT)
+        when = cptr->lasttime + 2 * ping;
+    else
+        when = cptr->lasttime + ping + 1;
+    if (!IsRegistered(cptr) && cptr->since + ping < when)
+        when = cptr->since + ping;
+    if (IsUnknown(cptr) && cptr->firsttime && cptr->firsttime + 101 < when)
+        when = cptr->firsttime + 101;
+
+    return MAX(when, timeofday + 1);
+}
 
-static time_t check_pings(time_t currenttime)
+/* look at a client again once its ping time may have changed: it just
+ * registered, and has a class of its own */
+void schedule_ping(aClient *cptr)
 {
-    aClient     *cptr;
-    int          ping = 0, i;
-    time_t       oldest = 0; /* timeout removed, see EXPLANATION below */
-    char         fbuf[512], *errtxt = "No response from %s, closing link";
+    timer_set(&cptr->timer, ping_deadline(cptr));
+}
 
+void check_ping(void *arg)
+{
+    aClient     *cptr = (aClient *) arg;
+    int          ping;
+    time_t       currenttime = timeofday;
+    char         fbuf[512], *errtxt = "No response from %s, closing link";
 
-    for (i = 0; i <= highest_fd; i++) 
-    {
-        if (!(cptr = local[i]) || IsMe(cptr) || IsLog(cptr))
-            continue;
+    if (cptr->fd < 0 || local[cptr->fd] != cptr || IsMe(cptr) || IsLog(cptr))
+        return;
 
-        /* Note: No need to notify opers here. It's 
-         * already done when "FLAGS_DEADSOCKET" is set.
-         */
+    /* Note: No need to notify opers here. It's 
+     * already done when "FLAGS_DEADSOCKET" is set.
+     */
 
-        if (cptr->flags & FLAGS_DEADSOCKET) 
-        {
-            exit_client(cptr, cptr, &me, (cptr->flags & FLAGS_SENDQEX) ?
-                        "SendQ exceeded" : "Dead socket");
-            continue;
-        }
+    if (cptr->flags & FLAGS_DEADSOCKET) 
+    {
+        exit_client(cptr, cptr, &me, (cptr->flags & FLAGS_SENDQEX) ?
+                    "SendQ exceeded" : "Dead socket");
+        return;
+    }
 
-        if (IsRegistered(cptr))
-            ping = cptr->class->pingfreq;
-        else
-            ping = CONNECTTIMEOUT;
+    if (IsRegistered(cptr))
+        ping = cptr->class->pingfreq;
+    else
+        ping = CONNECTTIMEOUT;
 
+    /*
+     * If the client pingtime is fine (ie, not larger than the client ping) 
+     * skip over all the checks below. - lucas
+     */
+        
+    if (ping < (currenttime - cptr->lasttime))
+    {
         /*
-         * Ok, so goto's are ugly and can be avoided here but this code
-         * is already indented enough so I think its justified. -avalon
-         *
-         * justified by what? laziness? <g>
-         * If the client pingtime is fine (ie, not larger than the client ping) 
-         * skip over all the checks below. - lucas
+         * If the server hasnt talked to us in 2*ping seconds and it has
+         * a ping time, then close its connection. If the client is a
+         * user and a KILL line was found to be active, close this
+         * connection too.
          */
-        
-        if (ping < (currenttime - cptr->lasttime))
+        if (((cptr->flags & FLAGS_PINGSENT) &&
+             ((currenttime - cptr->lasttime) >= (2 * ping))) ||
+            ((!IsRegistered(cptr) && 
+              (currenttime - cptr->since) >= ping))) 
         {
-            /*
-             * If the server hasnt talked to us in 2*ping seconds and it has
-             * a ping time, then close its connection. If the client is a
-             * user and a KILL line was found to be active, close this
-             * connection too.
-             */
-            if (((cptr->flags & FLAGS_PINGSENT) &&
-                 ((currenttime - cptr->lasttime) >= (2 * ping))) ||
-                ((!IsRegistered(cptr) && 
-                  (currenttime - cptr->since) >= ping))) 
+            if (!IsRegistered(cptr) && (DoingDNS(cptr) || 
+                                        DoingAuth(cptr))) 
             {
-                if (!IsRegistered(cptr) && (DoingDNS(cptr) || 
-                                            DoingAuth(cptr))) 
+                if (cptr->authfd >= 0) 
                 {
-                    if (cptr->authfd >= 0) 
-                    {
-                        del_fd(cptr->authfd);
-                        close(cptr->authfd);
-                        cptr->authfd = -1;
-                        cptr->count = 0;
-                        *cptr->buffer = '\0';
-                    }
+                    del_fd(cptr->authfd);
+                    close(cptr->authfd);
+                    cptr->authfd = -1;
+                    cptr->count = 0;
+                    *cptr->buffer = '\0';
+                }
 #ifdef SHOW_HEADERS
-                    if (DoingDNS(cptr))
-                        sendto_one(cptr, "%s", REPORT_FAIL_DNS);
-                    if (DoingAuth(cptr))
-                        sendto_one(cptr, "%s", REPORT_FAIL_ID);
+                if (DoingDNS(cptr))
+                    sendto_one(cptr, "%s", REPORT_FAIL_DNS);
+                if (DoingAuth(cptr))
+                    sendto_one(cptr, "%s", REPORT_FAIL_ID);
 #endif
-                    Debug((DEBUG_NOTICE, "DNS/AUTH timeout %s",
-                           get_client_name(cptr, TRUE)));
-                    del_queries((char *) cptr);
-                    ClearAuth(cptr);
-                    ClearDNS(cptr);
-                    cptr->since = currenttime;
-                    check_client_fd(cptr);
-                    continue;
-                }
-                
-                if (IsServer(cptr) || IsConnecting(cptr) || IsHandshake(cptr)) 
-                {
-                    ircsprintf(fbuf, "from %s: %s", me.name, errtxt);
-                    sendto_gnotice(fbuf, get_client_name(cptr, HIDEME));
-                    ircsprintf(fbuf, ":%s GNOTICE :%s", me.name, errtxt);
-                    sendto_serv_butone(cptr, fbuf, 
-                                       get_client_name(cptr, HIDEME));
-                }
+                Debug((DEBUG_NOTICE, "DNS/AUTH timeout %s",
+                       get_client_name(cptr, TRUE)));
+                del_queries((char *) cptr);
+                ClearAuth(cptr);
+                ClearDNS(cptr);
+                cptr->since = currenttime;
+                check_client_fd(cptr);
+                schedule_ping(cptr);
+                return;
+            }
                 
-                exit_client(cptr, cptr, &me, "Ping timeout");
-                continue;
-            } /* don't send pings during a burst, as we send them already. */
-            else if (!(cptr->flags & (FLAGS_PINGSENT|FLAGS_BURST)) && 
-                     !(IsConnecting(cptr) || IsHandshake(cptr))) 
+            if (IsServer(cptr) || IsConnecting(cptr) || IsHandshake(cptr)) 
             {
-                /*
-                 * if we havent PINGed the connection and we havent heard from
-                 * it in a while, PING it to make sure it is still alive.
-                 */
-                cptr->flags |= FLAGS_PINGSENT;
-                /* not nice but does the job */
-                cptr->lasttime = currenttime - ping;
-                sendto_one(cptr, "PING :%s", me.name);
+                ircsprintf(fbuf, "from %s: %s", me.name, errtxt);
+                sendto_gnotice(fbuf, get_client_name(cptr, HIDEME));
+                ircsprintf(fbuf, ":%s GNOTICE :%s", me.name, errtxt);
+                sendto_serv_butone(cptr, fbuf, 
+                                   get_client_name(cptr, HIDEME));
             }
+                
+            exit_client(cptr, cptr, &me, "Ping timeout");
+            return;
+        } /* don't send pings during a burst, as we send them already. */
+        else if (!(cptr->flags & (FLAGS_PINGSENT|FLAGS_BURST)) && 
+                 !(IsConnecting(cptr) || IsHandshake(cptr))) 
+        {
+            /*
+             * if we havent PINGed the connection and we havent heard from
+             * it in a while, PING it to make sure it is still alive.
+             */
+            cptr->flags |= FLAGS_PINGSENT;
+            /* not nice but does the job */
+            cptr->lasttime = currenttime - ping;
+            sendto_one(cptr, "PING :%s", me.name);
         }
-        
-        /* see EXPLANATION below
-         *
-         * timeout = cptr->lasttime + ping;
-         * while (timeout <= currenttime)
-         *  timeout += ping;
-         * if (timeout < oldest || !oldest)
-         *   oldest = timeout;
-         */
-
-        /*
-         * Check UNKNOWN connections - if they have been in this state
-         * for > 100s, close them.
-         */
-        if (IsUnknown(cptr))
-            if (cptr->firsttime ? ((timeofday - cptr->firsttime) > 100) : 0) 
-                (void) exit_client(cptr, cptr, &me, "Connection Timed Out");
     }
-    
-    rehashed = 0;
-    zline_in_progress = 0;
-    
-    /* EXPLANATION
-     * on a server with a large volume of clients, at any given point
-     * there may be a client which needs to be pinged the next second,
-     * or even right away (a second may have passed while running
-     * check_pings). Preserving CPU time is more important than
-     * pinging clients out at exact times, IMO. Therefore, I am going to make
-     * check_pings always return currenttime + 9. This means that it may take
-     * a user up to 9 seconds more than pingfreq to timeout. Oh well.
-     * Plus, the number is 9 to 'stagger' our check_pings calls out over
-     * time, to avoid doing it and the other tasks ircd does at the same time
-     * all the time (which are usually done on intervals of 5 seconds or so). 
-     * - lucas
-     *
-     *  if (!oldest || oldest < currenttime)
-     *     oldest = currenttime + PINGFREQUENCY;
+        
+    /*
+     * Check UNKNOWN connections - if they have been in this state
+     * for > 100s, close them.
      */
+    if (IsUnknown(cptr))
+        if (cptr->firsttime ? ((timeofday - cptr->firsttime) > 100) : 0) 
+        {
+            (void) exit_client(cptr, cptr, &me, "Connection Timed Out");
+            return;
+        }
 
-    oldest = currenttime + 9;
+    schedule_ping(cptr);
+}
 
-    Debug((DEBUG_NOTICE, "Next check_ping() call at: %s, %d %d %d",
-           myctime(oldest), ping, oldest, currenttime));
+/*
+ * The server-wide periodic jobs, each on a timer of its own.
+ */
+static aTimer connect_timer, dnscache_timer, banexpire_timer, tensec_timer;
 
-    return oldest;
+static void connect_tick(void *unused)
+{
+    time_t next = try_connections(timeofday);
+
+    /* 0: no autoconnects to wait for; a rehash will ask again */
+    if (next)
+        timer_set(&connect_timer, next);
+}
+
+/* try autoconnects no later than 'when' */
+void schedule_connect(time_t when)
+{
+    if (!TimerPending(&connect_timer) || connect_timer.when > when)
+        timer_set(&connect_timer, when);
+}
+
+static void dnscache_tick(void *unused)
+{
+    timer_set(&dnscache_timer, expire_cache(timeofday));
+}
+
+static void banexpire_tick(void *unused)
+{
+    static int lastexp = 0;
+
+    /*
+     * magic number: 13 seconds
+     * space out these heavy tasks at semi-random intervals, so as not to coincide
+     * with anything else ircd does regularly 
+     */
+    timer_set(&banexpire_timer, timeofday + 13);
+
+    if(lastexp == 0)
+    {
+        expire_userbans();
+        lastexp++;
+    }
+    else if(lastexp == 1)
+    {
+        expire_simbans();
+        lastexp++;
+    }
+    else
+    {
+        throttle_timer(NOW);
+        lastexp = 0;
+    }
+}
+
+static void tensec_tick(void *unused)
+{
+    timer_set(&tensec_timer, timeofday + 10);
+    call_hooks(CHOOK_10SEC);
 }
 
 /* get_paths()
@@ -837,6 +883,8 @@ main(int argc, char *argv[])
     clear_client_hash_table();
     clear_channel_hash_table();
     clear_scache_hash_table();  /* server cache name table */
+    clear_watch_hash_table();
+    clear_member_hash_table();
 
     /* init the throttle system -wd */
     throttle_init();
@@ -847,6 +895,9 @@ main(int argc, char *argv[])
     /* init the file descriptor tracking system */
     init_fds();
 
+    /* timers for pings, timeouts and the periodic jobs */
+    init_timers(timeofday);
+
     /* init the kline/akill system */
     init_userban();
 
@@ -1018,22 +1069,28 @@ void send_safelists()
       lpn = lp->next;
 
       cptr = lp->value.cptr;
-      while(DoList(cptr) && IsSendable(cptr))
-         send_list(cptr, 64);
+      if(IsSendable(cptr))
+         send_list(cptr);
    }
 }
 
 void io_loop()
 {
     char to_send[200];
-    int lastexp=0;
-
-    time_t      next10sec = 0; /* For events we do every 10 seconds */
-
     time_t      lastbwcalc = 0;
     long        lastbwSK = 0, lastbwRK = 0;
     time_t      lasttimeofday;
     int delay = 0;
+    int bursting, searching;
+
+    timer_init(&connect_timer, connect_tick, NULL);
+    timer_init(&dnscache_timer, dnscache_tick, NULL);
+    timer_init(&banexpire_timer, banexpire_tick, NULL);
+    timer_init(&tensec_timer, tensec_tick, NULL);
+    timer_set(&connect_timer, timeofday);
+    timer_set(&dnscache_timer, timeofday);
+    timer_set(&banexpire_timer, timeofday);
+    timer_set(&tensec_timer, timeofday);
 
     while(1)
     {
@@ -1077,66 +1134,12 @@ void io_loop()
         }
 
         /*
-         * We only want to connect if a connection is due, not every
-         * time through.  Note, if there are no active C lines, this call
-         * to Tryconnections is made once only; it will return 0. - avalon
+         * Sleep no longer than until the next timer is due.
          */
-
-        if (nextconnect && timeofday >= nextconnect)
-            nextconnect = try_connections(timeofday);
-
-        /* DNS checks. One to timeout queries, one for cache expiries.*/
-
-        if (timeofday >= nextdnscheck)
-            nextdnscheck = timeout_query_list(timeofday);
-        if (timeofday >= nextexpire)
-            nextexpire = expire_cache(timeofday);
-
-        if (timeofday >= nextbanexpire)
-        {
-            /*
-             * magic number: 13 seconds
-             * space out these heavy tasks at semi-random intervals, so as not to coincide
-             * with anything else ircd does regularly 
-             */
-            nextbanexpire = NOW + 13;
-            
-            if(lastexp == 0)
-            {
-                expire_userbans();
-                lastexp++;
-            }
-            else if(lastexp == 1)
-            {
-                expire_simbans();
-                lastexp++;
-            }
-            else
-            {
-                throttle_timer(NOW);
-                lastexp = 0;
-            }
-        }
-
-        if (timeofday >= next10sec)
-        {
-            next10sec = timeofday + 10;
-            call_hooks(CHOOK_10SEC);
-        }
-
-        /*
-         * take the smaller of the two 'timed' event times as the time
-         * of next event (stops us being late :) - avalon WARNING -
-         * nextconnect can return 0!
-         */
-
-        if (nextconnect)
-            delay = MIN(nextping, nextconnect);
+        if ((delay = timer_next()))
+            delay -= timeofday;
         else
-            delay = nextping;
-        delay = MIN(nextdnscheck, delay);
-        delay = MIN(nextexpire, delay);
-        delay -= timeofday;
+            delay = TIMESEC;
 
         /*
          * Parse people who have blocked recvqs
@@ -1149,6 +1152,15 @@ void io_loop()
          */
         send_safelists();
 
+        /*
+         * Feed new links their netburst a slice at a time, and don't
+         * sleep while one of them could take more
+         */
+        bursting = send_bursts();
+
+        /* likewise WHO and RWHO replies that ran out of time */
+        searching = send_searches();
+
         /*
          * Adjust delay to something reasonable [ad hoc values] (one
          * might think something more clever here... --msa) 
@@ -1158,8 +1170,8 @@ void io_loop()
          * i.e. PINGS -> a disconnection :( 
          * - avalon
          */
-        if (delay < 1)
-            delay = 1;
+        if (bursting || searching || delay < 1)
+            delay = 0;
         else
         {
             /* We need to get back here to do that recvq thing */
@@ -1171,16 +1183,8 @@ void io_loop()
 
         engine_read_message(delay);     /* check everything! */
 
-        /*
-         * * ...perhaps should not do these loops every time, but only if
-         * there is some chance of something happening (but, note that
-         * conf->hold times may be changed elsewhere--so precomputed next
-         * event time might be too far away... (similarly with ping
-         * times) --msa
-         */
-        
-        if ((timeofday >= nextping))
-            nextping = check_pings(timeofday);
+        /* pings, timeouts and the periodic jobs that have come due */
+        run_timers(timeofday);
 
 #ifdef PROFILING
         if (profiling_newmsg)
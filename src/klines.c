@@ -18,6 +18,9 @@
  *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
 /*
  * This is a simple K-Line journal implementation.  When a K-Line with a
  * duration of KLINE_MIN_STORE_TIME or more is added, it is written to the
@@ -27,12 +30,17 @@
  * When a K-Line is manually removed, it also results in a journal entry:
  *   - user@hostmask
  * 
- * This allows K-Lines to be saved across restarts and rehashes.
+ * This allows K-Lines to be saved across restarts and rehashes.  Entries are
+ * buffered and written out together on the next pass of the event loop, and
+ * the journal is fsync()ed as often as KLINE_STORE_FSYNC asks.
  *
  * To keep the journal from getting larger than it needs to be, it is
- * periodically compacted: all active K-Lines are dumped into a new file, which
- * then replaces the active journal.  This is done on startup as well as every
- * KLINE_STORE_COMPACT_THRESH journal entries.
+ * periodically compacted: all active K-Lines are dumped into a binary snapshot
+ * (.klines.db), and the journal starts over.  On startup the snapshot is
+ * loaded first and the journal replayed over it.  Compaction is done in the
+ * foreground on startup and rehash, and in a forked child every
+ * KLINE_STORE_COMPACT_THRESH journal entries, so a large store never stalls
+ * the server.
  */
  
 
@@ -42,6 +50,10 @@
 #include "h.h"
 
 #include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "userban.h"
 #include "numeric.h"
@@ -49,10 +61,16 @@
 
 static int journal = -1;
 static char journalfilename[PATH_MAX];
+static char journaltmpname[PATH_MAX];   /* .klines_c */
+static char snapfilename[PATH_MAX];
+static char snaptmpname[PATH_MAX];      /* .klines.db_c */
+static char snapbadname[PATH_MAX];      /* .klines.db.bad */
 static int journalcount;
 
 void klinestore_add(struct userBan *);
 void klinestore_remove(struct userBan *);
+int klinestore_compact(void);
+int klinestore_load(void);
 
 /* ircd.c */
 extern int forked;
@@ -309,10 +327,89 @@ ks_error(char *msg)
 }
 
 /*
- * Writes a K-Line to the appropriate file.
+ * Journal entries collect in ks_pend and go out with one write() on the next
+ * pass of the event loop.  While a compaction child is running they are also
+ * written to .klines_c, which becomes the new journal once the child's
+ * snapshot is in place, however many there are by then.
  */
-void
-ks_write(int f, char type, struct userBan *ub)
+static char ks_pend[8192];
+static int ks_pendlen;
+static int ks_tail = -1;        /* .klines_c, while a compaction runs */
+
+static pid_t compactor;         /* background compaction child, or 0 */
+static aTimer ks_timer;
+#if KLINE_STORE_FSYNC > 0
+static int ks_dirty;            /* journal written since the last fsync() */
+static time_t ks_synced;
+#endif
+
+/*
+ * The snapshot (.klines.db) is a ksHeader followed by 'count' records, each
+ * a ksRecord, then the user, host and reason strings with their NULs, padded
+ * to 8 bytes.  It is written and read in host byte order.
+ */
+#define KS_MAGIC        "KLINEDB1"
+#define KS_ALIGN(n)     (((n) + 7) & ~7)
+#define KS_RECLEN(r)    KS_ALIGN(sizeof(ksRecord) + (r)->ulen + (r)->hlen \
+                                 + (r)->rlen + 3)
+#define KS_TYPEFLAGS    (UBAN_HOST|UBAN_IP|UBAN_WILD|UBAN_CIDR4|UBAN_CIDR4BIG \
+                         |UBAN_WILDUSER|UBAN_WILDHOST)
+
+typedef struct
+{
+    char magic[8];
+    unsigned int recsize;       /* sizeof(ksRecord), catches layout changes */
+    unsigned int count;
+} ksHeader;
+
+typedef struct
+{
+    time_t expire;              /* 0 for permanent */
+    unsigned int flags;         /* type flags, as make_hostbased_ban() sets */
+    unsigned char family;       /* 4 or 6 for a CIDR ban, otherwise 0 */
+    unsigned char bits;
+    unsigned short ulen;
+    unsigned short hlen;
+    unsigned short rlen;
+    char ip[16];
+} ksRecord;
+
+/* snapshot writer state, for ks_dumpban() */
+static char ks_sbuf[8192];
+static int ks_sbuflen;
+static int ks_sfd;
+static int ks_serr;
+static unsigned int ks_scount;
+
+static void ks_background(void);
+
+
+/*
+ * Writes out buffered journal entries.
+ */
+static void
+ks_flush(void)
+{
+    if (ks_pendlen && journal >= 0)
+    {
+        { int __attribute__((unused)) ret = write(journal, ks_pend,
+                                                  ks_pendlen); }
+#if KLINE_STORE_FSYNC > 0
+        ks_dirty = 1;
+#endif
+    }
+    if (ks_pendlen && ks_tail >= 0)
+        { int __attribute__((unused)) ret = write(ks_tail, ks_pend,
+                                                  ks_pendlen); }
+
+    ks_pendlen = 0;
+}
+
+/*
+ * Adds a K-Line entry to the journal.
+ */
+static void
+ks_journal(char type, struct userBan *ub)
 {
     char outbuf[1024];
     char cidr[4] = "";
@@ -346,15 +443,22 @@ ks_write(int f, char type, struct userBan *ub)
     else
         len = ircsprintf(outbuf, "%c %s@%s%s\n", type, user, host, cidr);
 
-    { int __attribute__((unused)) ret = write(f, outbuf, len); }
+    if (ks_pendlen + len > sizeof(ks_pend))
+        ks_flush();
+    memcpy(ks_pend + ks_pendlen, outbuf, len);
+    ks_pendlen += len;
+
+    if (!TimerPending(&ks_timer) || ks_timer.when > NOW)
+        timer_set(&ks_timer, NOW);
 }
 
 /*
- * Parses a K-Line entry from a storage journal line.
+ * Parses a K-Line entry from a storage journal line.  Pass 1 for 'dups' when
+ * it is being replayed over a snapshot, which may hold some of its K-Lines.
  * Returns 0 on invalid input, 1 otherwise.
  */
 static int
-ks_read(char *s)
+ks_read(char *s, int dups)
 {
     char type;
     time_t duration = 0;
@@ -429,6 +533,12 @@ ks_read(char *s)
 
     if (type == '+')
     {
+        if (dups && find_userban_exact(ban, UBAN_LOCAL))
+        {
+            userban_free(ban);
+            return 1;
+        }
+
         if (duration)
         {
             ban->flags |= UBAN_TEMPORARY;
@@ -458,27 +568,290 @@ ks_read(char *s)
 }
 
 /*
- * Compact K-Line store: dump active klines to a new file and remove the
- * current journal.
- * Returns 1 on success, 0 on failure.
+ * Writes out the snapshot buffer.
  */
-int
-klinestore_compact(void)
+static void
+ks_sflush(void)
 {
-    char buf1[PATH_MAX];
-    int newfile;
+    int n;
+
+    if (ks_sbuflen && !ks_serr)
+    {
+        n = write(ks_sfd, ks_sbuf, ks_sbuflen);
+        if (n != ks_sbuflen)
+            ks_serr = (n < 0) ? errno : ENOSPC;
+    }
+
+    ks_sbuflen = 0;
+}
+
+/*
+ * Adds a K-Line to the snapshot being written.  Called from ks_dumpklines().
+ */
+void
+ks_dumpban(struct userBan *ub)
+{
+    ksRecord rec;
+    char *reason = "";
+    char *p;
+
+    if (ub->reason)
+        reason = ub->reason;
+
+    memset(&rec, 0, sizeof(rec));
+    if (ub->flags & UBAN_TEMPORARY)
+        rec.expire = ub->timeset + ub->duration;
+    rec.flags = ub->flags & KS_TYPEFLAGS;
+    if (ub->flags & (UBAN_CIDR4|UBAN_CIDR4BIG))
+    {
+        rec.family = (ub->cidr_family == AF_INET6) ? 6 : 4;
+        rec.bits = ub->cidr_bits;
+        memcpy(rec.ip, &ub->cidr_ip, (rec.family == 6) ? 16 : 4);
+    }
+    rec.ulen = ub->u ? strlen(ub->u) : 0;
+    rec.hlen = ub->h ? strlen(ub->h) : 0;
+    rec.rlen = strlen(reason);
+
+    if (ks_sbuflen + KS_RECLEN(&rec) > sizeof(ks_sbuf))
+        ks_sflush();
+
+    p = ks_sbuf + ks_sbuflen;
+    memset(p, 0, KS_RECLEN(&rec));
+    memcpy(p, &rec, sizeof(rec));
+    p += sizeof(rec);
+    if (ub->u)
+        memcpy(p, ub->u, rec.ulen);
+    p += rec.ulen + 1;
+    if (ub->h)
+        memcpy(p, ub->h, rec.hlen);
+    p += rec.hlen + 1;
+    memcpy(p, reason, rec.rlen);
+
+    ks_sbuflen += KS_RECLEN(&rec);
+    ks_scount++;
+}
+
+/*
+ * Dumps all active klines to the snapshot compaction file .klines.db_c and
+ * syncs it to disk.  Runs in the compaction child, or in the foreground on
+ * startup and rehash.
+ * Returns 0 on success, otherwise an errno value.
+ */
+static int
+ks_snapshot(void)
+{
+    ksHeader hdr;
 
     /* userban.c */
-    extern void ks_dumpklines(int);
+    extern void ks_dumpklines(void);
 
-    if (forked)
-        sendto_ops_lev(DEBUG_LEV, "Compacting K-Line store...");
-    journalcount = 0;
+    ks_sfd = open(snaptmpname, O_WRONLY|O_CREAT|O_TRUNC, 0700);
+    if (ks_sfd < 0)
+        return errno;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, KS_MAGIC, sizeof(hdr.magic));
+    hdr.recsize = sizeof(ksRecord);
 
-    /* open a compaction file to dump all active klines to */
-    ircsnprintf(buf1, sizeof(buf1), "%s/.klines_c", dpath);
-    newfile = open(buf1, O_WRONLY|O_CREAT|O_TRUNC, 0700);
-    if (newfile < 0)
+    /* the count goes in once it is known */
+    memcpy(ks_sbuf, &hdr, sizeof(hdr));
+    ks_sbuflen = sizeof(hdr);
+    ks_serr = 0;
+    ks_scount = 0;
+
+    ks_dumpklines();
+    ks_sflush();
+
+    hdr.count = ks_scount;
+    if (!ks_serr && pwrite(ks_sfd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+        ks_serr = errno;
+    if (!ks_serr && fsync(ks_sfd) < 0)
+        ks_serr = errno;
+
+    close(ks_sfd);
+    return ks_serr;
+}
+
+/* is a string of len bytes, then its NUL, and no NUL before that */
+static int
+ks_goodstr(char *s, unsigned int len)
+{
+    return s[len] == 0 && !memchr(s, 0, len);
+}
+
+/*
+ * Checks a snapshot record with 'left' bytes of the file from its start:
+ * that it and its strings fit, that the strings are terminated where the
+ * lengths say, and that the flags describe a ban make_hostbased_ban()
+ * could have made.  Returns 1 if it is sound.
+ */
+static int
+ks_goodrecord(ksRecord *rec, size_t left)
+{
+    unsigned int kind;
+    char *s;
+
+    if (left < sizeof(ksRecord) || left < KS_RECLEN(rec))
+        return 0;
+
+    s = (char *) rec + sizeof(ksRecord);
+    if (!ks_goodstr(s, rec->ulen))
+        return 0;
+    s += rec->ulen + 1;
+    if (!ks_goodstr(s, rec->hlen))
+        return 0;
+    s += rec->hlen + 1;
+    if (!ks_goodstr(s, rec->rlen))
+        return 0;
+
+    if (rec->flags & ~KS_TYPEFLAGS)
+        return 0;
+    kind = rec->flags & (UBAN_HOST|UBAN_IP|UBAN_CIDR4|UBAN_CIDR4BIG);
+    if (kind & (UBAN_CIDR4|UBAN_CIDR4BIG))
+    {
+        if (kind != UBAN_CIDR4 && kind != UBAN_CIDR4BIG)
+            return 0;
+        if (!(rec->family == 4 && rec->bits <= 32)
+            && !(rec->family == 6 && rec->bits <= 128))
+            return 0;
+    }
+    else if ((kind != UBAN_HOST && kind != UBAN_IP) || rec->family)
+        return 0;
+
+    return 1;
+}
+
+/*
+ * Loads the snapshot.  Its records carry each ban's type and CIDR data, so
+ * they go straight into the ban lists without make_hostbased_ban() parsing
+ * and classifying every mask again.
+ * Every record is checked before any is loaded, so a damaged snapshot
+ * adds nothing and the journal is replayed on its own.
+ * Returns the number of K-Lines loaded, or -1 if the snapshot is unreadable
+ * or corrupt.
+ */
+static int
+ks_load(void)
+{
+    struct stat st;
+    ksHeader *hdr;
+    ksRecord *rec;
+    struct userBan *ban;
+    char *base;
+    char *end;
+    char *p;
+    char *s;
+    unsigned int i;
+    int fd;
+    int ok = 1;
+    int loaded = 0;
+
+    fd = open(snapfilename, O_RDONLY);
+    if (fd < 0)
+        return (errno == ENOENT) ? 0 : -1;
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ksHeader))
+    {
+        close(fd);
+        return -1;
+    }
+
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return -1;
+
+    end = base + st.st_size;
+    hdr = (ksHeader *) base;
+    if (memcmp(hdr->magic, KS_MAGIC, sizeof(hdr->magic))
+        || hdr->recsize != sizeof(ksRecord))
+        ok = 0;
+
+    p = base + sizeof(ksHeader);
+    for (i = 0; ok && i < hdr->count; i++)
+    {
+        rec = (ksRecord *) p;
+        if (!ks_goodrecord(rec, end - p))
+            ok = 0;
+        else
+            p += KS_RECLEN(rec);
+    }
+
+    p = base + sizeof(ksHeader);
+    for (i = 0; ok && i < hdr->count; i++)
+    {
+        rec = (ksRecord *) p;
+        s = p + sizeof(ksRecord);
+        p += KS_RECLEN(rec);
+
+        /* already expired */
+        if (rec->expire && NOW >= rec->expire)
+            continue;
+
+        ban = userban_alloc();
+        ban->flags = rec->flags | UBAN_LOCAL;
+
+        if (rec->ulen)
+        {
+            ban->u = MyMalloc(rec->ulen + 1);
+            memcpy(ban->u, s, rec->ulen + 1);
+        }
+        s += rec->ulen + 1;
+
+        if (rec->hlen)
+        {
+            ban->h = MyMalloc(rec->hlen + 1);
+            memcpy(ban->h, s, rec->hlen + 1);
+        }
+        s += rec->hlen + 1;
+
+        if (rec->rlen)
+        {
+            ban->reason = MyMalloc(rec->rlen + 1);
+            memcpy(ban->reason, s, rec->rlen + 1);
+        }
+
+        if (rec->family)
+        {
+            ban->cidr_family = (rec->family == 6) ? AF_INET6 : AF_INET;
+            ban->cidr_bits = rec->bits;
+            memcpy(&ban->cidr_ip, rec->ip, sizeof(rec->ip));
+        }
+
+        if (rec->expire)
+        {
+            ban->flags |= UBAN_TEMPORARY;
+            ban->timeset = NOW;
+            ban->duration = rec->expire - NOW;
+        }
+
+        add_hostbased_userban(ban);
+        loaded++;
+    }
+
+    munmap(base, st.st_size);
+    return ok ? loaded : -1;
+}
+
+/*
+ * Puts a finished snapshot in place, and starts a new journal with whatever
+ * was logged after the snapshot was taken.
+ * Returns 1 on success, 0 on failure.
+ */
+static int
+ks_install(void)
+{
+    char buf1[PATH_MAX];
+    int newfile;
+
+    /* what was added since the snapshot began, or nothing */
+    if (ks_tail >= 0)
+    {
+        newfile = ks_tail;
+        ks_tail = -1;
+    }
+    else if ((newfile = open(journaltmpname, O_WRONLY|O_CREAT|O_TRUNC,
+                             0700)) < 0)
     {
         ircsnprintf(buf1, sizeof(buf1), "ERROR: Unable to create K-Line"
                     " compaction file .klines_c: %s",
@@ -487,17 +860,28 @@ klinestore_compact(void)
         return 0;
     }
 
-    /* do the dump */
-    ks_dumpklines(newfile);
+#if KLINE_STORE_FSYNC > 0
+    fsync(newfile);
+#endif
     close(newfile);
 
+    /* snapshot first: replaying the old journal over the new one is safe */
+    if (rename(snaptmpname, snapfilename) < 0)
+    {
+        ircsnprintf(buf1, sizeof(buf1), "ERROR: Unable to rename K-Line"
+                    " snapshot .klines.db_c to .klines.db: %s",
+                    strerror(errno));
+        ks_error(buf1);
+        return 0;
+    }
+
     /* close active storage file, rename compaction file, and reopen */
     if (journal >= 0)
     {
         close(journal);
         journal = -1;
     }
-    if (rename(buf1, journalfilename) < 0)
+    if (rename(journaltmpname, journalfilename) < 0)
     {
         ircsnprintf(buf1, sizeof(buf1), "ERROR: Unable to rename K-Line"
                     " compaction file .klines_c to .klines: %s",
@@ -517,6 +901,163 @@ klinestore_compact(void)
     return 1;
 }
 
+/*
+ * Gives up on the entries kept for a compaction that won't be installed.
+ */
+static void
+ks_droptail(void)
+{
+    if (ks_tail >= 0)
+    {
+        close(ks_tail);
+        ks_tail = -1;
+    }
+}
+
+/*
+ * Collects a finished compaction child, and installs its snapshot.
+ */
+static void
+ks_reap(void)
+{
+    char buf1[256];
+    int status;
+    pid_t pid;
+
+    pid = waitpid(compactor, &status, WNOHANG);
+    if (pid == 0)
+        return;
+
+    compactor = 0;
+
+    /* the child's exit status is 0 or an errno value */
+    if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+    {
+        ircsnprintf(buf1, sizeof(buf1), "ERROR: Unable to write K-Line"
+                    " snapshot .klines.db_c: %s",
+                    (pid > 0 && WIFEXITED(status))
+                    ? strerror(WEXITSTATUS(status)) : "compaction aborted");
+        ks_error(buf1);
+        ks_droptail();
+        return;
+    }
+
+    /* the old journal must be complete until it is replaced */
+    ks_flush();
+    ks_install();
+}
+
+/*
+ * Runs a compaction in a child process, which writes the snapshot from its
+ * copy of the ban lists while the server carries on.  Journal entries made in
+ * the meantime are kept for the new journal.
+ */
+static void
+ks_background(void)
+{
+    char buf1[256];
+    pid_t pid;
+
+    ks_flush();
+    journalcount = 0;
+
+    ks_tail = open(journaltmpname, O_WRONLY|O_CREAT|O_TRUNC, 0700);
+    if (ks_tail < 0)
+    {
+        ircsnprintf(buf1, sizeof(buf1), "ERROR: Unable to create K-Line"
+                    " compaction file .klines_c: %s", strerror(errno));
+        ks_error(buf1);
+        klinestore_compact();
+        return;
+    }
+
+    pid = fork();
+    if (pid < 0)
+    {
+        ircsnprintf(buf1, sizeof(buf1), "ERROR: Unable to fork K-Line"
+                    " compaction: %s", strerror(errno));
+        ks_error(buf1);
+        klinestore_compact();
+        return;
+    }
+
+    if (pid == 0)
+        _exit(ks_snapshot());
+
+    if (forked)
+        sendto_ops_lev(DEBUG_LEV, "Compacting K-Line store in the"
+                       " background...");
+    compactor = pid;
+
+    if (!TimerPending(&ks_timer))
+        timer_set(&ks_timer, NOW + 1);
+}
+
+/*
+ * Journal timer: flushes entries, syncs the journal per KLINE_STORE_FSYNC,
+ * and polls for a finished compaction.
+ */
+static void
+ks_tick(void *unused)
+{
+    ks_flush();
+
+    if (compactor)
+        ks_reap();
+
+#if KLINE_STORE_FSYNC > 0
+    if (ks_dirty && NOW >= ks_synced + KLINE_STORE_FSYNC)
+    {
+        if (journal >= 0)
+            fsync(journal);
+        ks_dirty = 0;
+        ks_synced = NOW;
+    }
+    if (ks_dirty)
+        timer_set(&ks_timer, ks_synced + KLINE_STORE_FSYNC);
+#endif
+
+    if (compactor && (!TimerPending(&ks_timer) || ks_timer.when > NOW + 1))
+        timer_set(&ks_timer, NOW + 1);
+}
+
+/*
+ * Compact K-Line store: write a new snapshot of all active klines and start
+ * an empty journal, in the foreground.
+ * Returns 1 on success, 0 on failure.
+ */
+int
+klinestore_compact(void)
+{
+    char buf1[PATH_MAX];
+    int err;
+
+    if (forked)
+        sendto_ops_lev(DEBUG_LEV, "Compacting K-Line store...");
+    journalcount = 0;
+
+    /* this supersedes any compaction running in the background */
+    if (compactor)
+    {
+        kill(compactor, SIGKILL);
+        waitpid(compactor, NULL, 0);
+        compactor = 0;
+    }
+    ks_droptail();
+
+    ks_flush();
+
+    if ((err = ks_snapshot()))
+    {
+        ircsnprintf(buf1, sizeof(buf1), "ERROR: Unable to write K-Line"
+                    " snapshot .klines.db_c: %s", strerror(err));
+        ks_error(buf1);
+        return 0;
+    }
+
+    return ks_install();
+}
+
 /*
  * Add a K-Line to the active store.
  */
@@ -524,10 +1065,10 @@ void
 klinestore_add(struct userBan *ban)
 {
     if (journal >= 0)
-        ks_write(journal, '+', ban);
+        ks_journal('+', ban);
 
-    if (++journalcount > KLINE_STORE_COMPACT_THRESH)
-        klinestore_compact();
+    if (++journalcount > KLINE_STORE_COMPACT_THRESH && !compactor)
+        ks_background();
 }
 
 /*
@@ -537,33 +1078,73 @@ void
 klinestore_remove(struct userBan *ban)
 {
     if (journal >= 0)
-        ks_write(journal, '-', ban);
+        ks_journal('-', ban);
 
-    if (++journalcount > KLINE_STORE_COMPACT_THRESH)
-        klinestore_compact();
+    if (++journalcount > KLINE_STORE_COMPACT_THRESH && !compactor)
+        ks_background();
 }
 
 /*
- * Initialize K-Line storage.  Pass 1 when klines don't need to be reloaded.
+ * Write out anything still buffered.  Called on shutdown and restart.
+ */
+void
+klinestore_flush(void)
+{
+    ks_flush();
+
+#if KLINE_STORE_FSYNC > 0
+    if (ks_dirty && journal >= 0)
+        fsync(journal);
+    ks_dirty = 0;
+#endif
+}
+
+/*
+ * Loads the K-Lines from the snapshot and the journal, closing the journal
+ * first if it is open.  The journal stays closed until the next compaction.
  * Returns 0 on failure, 1 otherwise.
  */
 int
-klinestore_init(int noreload)
+klinestore_load(void)
 {
     char buf1[1024];
     FILE *jf;
+    int loaded;
+
+    if (ircsnprintf(journalfilename, sizeof(journalfilename), "%s/.klines",
+                    dpath) >= (int) sizeof(journalfilename) ||
+        ircsnprintf(journaltmpname, sizeof(journaltmpname), "%s/.klines_c",
+                    dpath) >= (int) sizeof(journaltmpname) ||
+        ircsnprintf(snapfilename, sizeof(snapfilename), "%s/.klines.db",
+                    dpath) >= (int) sizeof(snapfilename) ||
+        ircsnprintf(snaptmpname, sizeof(snaptmpname), "%s/.klines.db_c",
+                    dpath) >= (int) sizeof(snaptmpname) ||
+        ircsnprintf(snapbadname, sizeof(snapbadname), "%s/.klines.db.bad",
+                    dpath) >= (int) sizeof(snapbadname))
+    {
+        ks_error("ERROR: K-Line storage path is too long");
+        return 0;
+    }
 
-    ircsnprintf(journalfilename, sizeof(journalfilename), "%s/.klines", dpath);
+    if (!ks_timer.func)
+        timer_init(&ks_timer, ks_tick, NULL);
 
     if (journal >= 0)
     {
-        if (noreload)
-            return 1;
-
+        /* the replay below should see everything logged so far */
+        ks_flush();
         close(journal);
         journal = -1;
     }
 
+    /* load the last snapshot, keeping a bad one around for inspection */
+    if ((loaded = ks_load()) < 0)
+    {
+        rename(snapfilename, snapbadname);
+        ks_error("ERROR: K-Line snapshot .klines.db is unreadable or"
+                 " corrupt, moved to .klines.db.bad");
+    }
+
     /* "a+" to create if it doesn't exist */
     jf = fopen(journalfilename, "a+");
     if (!jf)
@@ -575,7 +1156,7 @@ klinestore_init(int noreload)
     }
     rewind(jf);
 
-    /* replay journal */
+    /* replay journal entries made since the snapshot */
     while (fgets(buf1, sizeof(buf1), jf))
     {
         char *s = strchr(buf1, '\n');
@@ -586,11 +1167,26 @@ klinestore_init(int noreload)
 
         *s = 0;
 
-        if (!ks_read(buf1))
+        if (!ks_read(buf1, loaded > 0))
             break;
     }
 
     fclose(jf);
+    return 1;
+}
+
+/*
+ * Initialize K-Line storage.  Pass 1 when klines don't need to be reloaded.
+ * Returns 0 on failure, 1 otherwise.
+ */
+int
+klinestore_init(int noreload)
+{
+    if (journal >= 0 && noreload)
+        return 1;
+
+    if (!klinestore_load())
+        return 0;
 
     /* this will reopen the journal for appending */
     return klinestore_compact();
@@ -600,7 +1196,10 @@ u_long
 memcount_klines(MCklines *mc)
 {
     mc->file = __FILE__;
-    
+
+    mc->s_bufs.c = 2;
+    mc->s_bufs.m = sizeof(ks_pend) + sizeof(ks_sbuf);
+
     return 0;
 }
 
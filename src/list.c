@@ -80,6 +80,9 @@ BlockHeap  *free_fludbots;
 
 #endif /* FLUD */
 
+/* the hot fields at the head of aClient must fit one cache line */
+typedef char client_hot_size_check[(CLIENT_HOT_SIZE <= 64) ? 1 : -1];
+
 void initlists()
 {
     /* Might want to bump up LINK_PREALLOCATE if FLUD is defined */
@@ -182,6 +185,7 @@ aClient    *make_client(aClient *from, aClient *uplink)
 	cptr->since = cptr->lasttime = cptr->firsttime = timeofday;
 	cptr->sockerr = -1;
 	cptr->authfd = -1;
+	timer_init(&cptr->timer, check_ping, cptr);
 	return (cptr);
     }
     else /* from is not NULL */
@@ -208,6 +212,7 @@ void free_client(aClient *cptr)
     
     if (cptr->fd == -2)
     {
+	timer_del(&cptr->timer);
 	retval = BlockHeapFree(free_local_aClients, cptr);
     }
     else
@@ -360,6 +365,8 @@ void remove_client_from_list(aClient *cptr)
 	if (IsInvisible(cptr))
 	    Count.invisi--;
     }
+    burst_client_gone(cptr);
+    whosearch_client_gone(cptr);
     if (cptr->prev)
 	cptr->prev->next = cptr->next;
     else
@@ -422,22 +429,11 @@ void add_client_to_list(aClient *cptr)
     client = cptr;
     if (cptr->next)
 	cptr->next->prev = cptr;
+    /* links being burst will hear of it as it happens */
+    cptr->nicksent = burst_slots;
     return;
 }
 
-/* Look for ptr in the linked listed pointed to by link. */
-chanMember *find_user_member(chanMember *cm, aClient *ptr)
-{
-    if (ptr)
-	while (cm)
-	{
-	    if (cm->cptr == ptr)
-		return (cm);
-	    cm = cm->next;
-	}
-    return ((chanMember *) NULL);
-}
-
 Link *find_channel_link(Link *lp, aChannel *chptr)
 {
     if (chptr)
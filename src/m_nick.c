@@ -31,6 +31,7 @@
 #include "h.h"
 #include "userban.h"
 #include "hooks.h"
+#include "whoindex.h"
 
 extern int do_user(char *, aClient *, aClient *, char *, char *, char *,
 		   unsigned long, char *, char *);
@@ -175,7 +176,13 @@ int m_nick(aClient *cptr, aClient *sptr, int parc, char *parv[])
      */
     do
     {
-	if ((acptr = find_server(nick, NULL)))
+	/*
+	 * Servers and clients share the client hash and no name is ever
+	 * both, so the one lookup serves both checks.
+	 */
+	acptr = find_client(nick, NULL);
+	if (acptr && (IsServer(acptr) || IsMe(acptr)))
+	{
 	    if (MyConnect(sptr))
 	    {
 		sendto_one(sptr, err_str(ERR_NICKNAMEINUSE), me.name,
@@ -183,18 +190,13 @@ int m_nick(aClient *cptr, aClient *sptr, int parc, char *parv[])
 		return 0;
 	    }
 	
-	/* 
-	 * acptr already has result from find_server
-	 * Well. unless we have a capricious server on the net, a nick can
-	 * never be the same as a server name - Dianora
-	 * That's not the only case; maybe someone broke do_nick_name
-	 * or changed it so they could use "." in nicks on their network 
-	 * - sedition
-	 */
-     
-	if (acptr)
-	{
-	    /*
+	    /* 
+	     * Well. unless we have a capricious server on the net, a nick can
+	     * never be the same as a server name - Dianora
+	     * That's not the only case; maybe someone broke do_nick_name
+	     * or changed it so they could use "." in nicks on their network 
+	     * - sedition
+	     *
 	     * We have a nickname trying to use the same name as a
 	     * server. Send out a nick collision KILL to remove the
 	     * nickname. As long as only a KILL is sent out, there is no
@@ -209,7 +211,7 @@ int m_nick(aClient *cptr, aClient *sptr, int parc, char *parv[])
 	    return exit_client(cptr, sptr, &me, "Nick/Server collision");
 	}
 	
-	if (!(acptr = find_client(nick, NULL)))
+	if (!acptr)
 	    break;
      
 	/*
@@ -380,7 +382,7 @@ int m_nick(aClient *cptr, aClient *sptr, int parc, char *parv[])
     
     if (IsServer(sptr))
     {
-	uplink = find_server(parv[7], NULL);
+	uplink = burst_find_server(cptr, parv[7]);
 	if(!uplink)
 	{
 	    /* if we can't find the server this nick is on, 
@@ -665,6 +667,8 @@ int m_nick(aClient *cptr, aClient *sptr, int parc, char *parv[])
     }
     strcpy(sptr->name, nick);
     add_to_client_hash_table(nick, sptr);
+    if (IsPerson(sptr))
+	whoidx_update(sptr, WIDX_NICK);
     if (IsPerson(sptr) && !samenick)
 	hash_check_watch(sptr, RPL_LOGON);
     return 0;
@@ -29,6 +29,7 @@
 #include "channel.h"
 #include "inet.h"
 #include "clones.h"
+#include "whoindex.h"
 
 #include "pcre.h"
 
@@ -165,7 +166,7 @@ static const char *rwho_help[] = {
     NULL
 };
 
-static struct {
+static struct rwho_options {
     unsigned  check[2];         /* things to try match */
     unsigned  rplfields;        /* fields to include in the response */
     unsigned  misc;             /* miscellaneous flags */
@@ -176,6 +177,7 @@ static struct {
     pcre     *re;               /* regex pattern */
     aClient  *server;           /* server */
     aChannel *chptr;            /* search in channel */
+    char     *nick_re;          /* nick regexp, if the first pattern */
     char     *host_pat[2];      /* wildcard host pattern */
     int      (*host_func[2])(char *, char *); /* host match function */
     int       umodes[2];        /* usermodes */
@@ -205,6 +207,26 @@ static struct {
 static char rwhobuf[2048];
 static char scratch[1024];
 
+/* an RWHO under way, kept with its aWhoSearch between slices */
+struct rwho_search
+{
+    struct rwho_options opts;
+    char      chname[CHANNELLEN+1];  /* channel and server, found again */
+    char      server[HOSTLEN+1];     /* by name when the search resumes */
+#ifdef THROTTLE_ENABLE
+    int       clones;                /* walking the clone list */
+    CloneEnt *ce;                    /* next entry there, held */
+#endif
+    int       results;
+    int       left;
+    int       examined;
+    int       passes;
+    clock_t   cpu;
+    int       failcode;              /* PCRE error in this slice */
+    aClient  *failclient;
+    char      plan[32];              /* how it searched, for RWC_TIME */
+};
+
 
 /*
  * Send a syntax error message.
@@ -896,6 +918,78 @@ static int rwho_parseopts(aClient *sptr, int parc, char *parv[])
     if (spatidx && !rwho_compile(sptr, remap))
         return 0;
 
+    /* only the first pattern is anchored at the start of the nick */
+    if (rwho_opts.spat[0] == RWHO_NICK)
+        rwho_opts.nick_re = remap[RWHO_NICK];
+
+    return 1;
+}
+
+/* characters that only ever match themselves in a regexp */
+#define RWHO_LITERAL(c) (((c) >= 'a' && (c) <= 'z') || \
+                         ((c) >= 'A' && (c) <= 'Z') || IsDigit(c) || \
+                         (c) == '-' || (c) == '_')
+
+/*
+ * Turn the literal run a nick regexp starts with into a wildcard mask,
+ * or return 0 if it doesn't start with one.  A literal followed by a
+ * quantifier may be absent, and alternation could discard the run.
+ */
+static int rwho_nickmask(char *re, char *mask)
+{
+    int len;
+
+    if (strchr(re, '|'))
+        return 0;
+    for (len = 0; len < NICKLEN && RWHO_LITERAL(re[len]); len++)
+        mask[len] = re[len];
+    if (len && (re[len] == '?' || re[len] == '*' || re[len] == '{'))
+        len--;
+    if (!len)
+        return 0;
+    mask[len++] = '*';
+    mask[len] = '\0';
+    return 1;
+}
+
+/*
+ * If an index finds fewer candidates than a scan would look at, fetch
+ * them.  Returns 1, the MyMalloc()ed candidates and the plan if so,
+ * else 0.
+ * Only positive matches narrow the search.
+ */
+static int rwho_index(aClient ***found, int *nfound, char *plan)
+{
+    aWhoQuery q[4];
+    char      mask[NICKLEN + 2];
+    int       nq = 0;
+    int       best;
+
+    if ((rwho_opts.check[0] & RWM_SERVER) &&
+        whoidx_server(&q[nq], rwho_opts.server))
+        nq++;
+
+    if ((rwho_opts.check[0] & RWM_HOST) &&
+        whoidx_host(&q[nq], rwho_opts.host_pat[0]))
+        nq++;
+
+    if ((rwho_opts.check[0] & RWM_IP) &&
+        (rwho_opts.ip_str[0] ? whoidx_ip(&q[nq], rwho_opts.ip_str[0]) :
+         whoidx_cidr(&q[nq], rwho_opts.ip_family[0], &rwho_opts.ip_addr[0],
+                     rwho_opts.ip_cidr_bits[0])))
+        nq++;
+
+    if (rwho_opts.nick_re && rwho_nickmask(rwho_opts.nick_re, mask) &&
+        whoidx_nick(&q[nq], mask))
+        nq++;
+
+    best = whoidx_plan(q, nq, rwho_opts.chptr ? rwho_opts.chptr->users :
+                       Count.total);
+    if (best < 0)
+        return 0;
+
+    ircsprintf(plan, "%s index", whoidx_name(&q[best]));
+    *found = whoidx_collect(&q[best], nfound);
     return 1;
 }
 
@@ -1116,11 +1210,7 @@ static void rwho_reply(aClient *cptr, aClient *ac, char *buf, chanMember *cm)
         char chname[CHANNELLEN+2] = "*";
 
         if (!cm && (rwho_opts.misc & RWC_CHANNEL) && chptr)
-        {
-            for (cm = chptr->members; cm; cm = cm->next)
-                if (cm->cptr == ac)
-                    break;
-        }
+            cm = find_user_member(chptr, ac);
 
         dst = status;
         if (ac->user->away)
@@ -1231,11 +1321,7 @@ static void rwho_reply(aClient *cptr, aClient *ac, char *buf, chanMember *cm)
             *dst++ = '%';
 
         if (!cm && (rwho_opts.rplfields & RWO_CHANNEL) && chptr)
-        {
-            for (cm = chptr->members; cm; cm = cm->next)
-                if (cm->cptr == ac)
-                    break;
-        }
+            cm = find_user_member(chptr, ac);
 
         if (cm)
         {
@@ -1325,240 +1411,409 @@ static void rwho_reply(aClient *cptr, aClient *ac, char *buf, chanMember *cm)
     *dst = 0;
 }
 
+#ifdef THROTTLE_ENABLE
 /*
- * m_rwho - flexible client search with regular expression support
- * parv[0] - sender
- * parv[1] - flags
- * parv[2] - arguments
+ * Look at the users on one clone list entry.
+ * Returns 0 once the result limit is reached, 1 otherwise.
  */
-int m_rwho(aClient *cptr, aClient *sptr, int parc, char *parv[])
+static int rwho_clone(aClient *sptr, struct rwho_search *st, CloneEnt *ce,
+                      char *fill)
 {
-    chanMember *cm;
-    aClient    *ac;
-    aClient    *failclient = NULL;
-    int         failcode = 0;
-    int         results = 0;
-    int         left;
-    char       *fill;
-    clock_t     cbegin;
-    clock_t     cend;
+    aClient *ac;
+    aClient *fm = NULL;
 
-    if (!IsAnOper(sptr))
+    if (!ce->clients)
+        return 1;
+
+    if ((rwho_opts.check[0] & RWM_CLONES) &&
+        (ce->gcount < rwho_opts.clones[0]))
+        return 1;
+
+    if ((rwho_opts.check[1] & RWM_CLONES) &&
+        (ce->gcount > rwho_opts.clones[1]))
+        return 1;
+
+    rwho_opts.thismatches = 0;
+    rwho_opts.thisclones = ce->gcount;
+
+    /* if using match flag D or summarizing, we need the match count */
+    if (((rwho_opts.check[0] | rwho_opts.check[1]) & RWM_MATCHES)
+        || (rwho_opts.rplfields & RWO_MATCHES))
     {
-        sendto_one(sptr, getreply(ERR_NOPRIVILEGES), me.name, parv[0]);
-        return 0;
-    }
+        for (ac = ce->clients; ac; ac = ac->clone.next)
+        {
+            st->examined++;
+            if (!rwho_match(ac, &st->failcode, &st->failclient))
+                continue;
 
-    cbegin = clock();
+            if (!fm)
+                fm = ac;
 
-    if (!rwho_parseopts(sptr, parc, parv))
-        return 0;
+            rwho_opts.thismatches++;
+        }
 
-    left = rwho_opts.limit ? rwho_opts.limit : INT_MAX;
+        /* we know no matches, so no need to process further */
+        if (!rwho_opts.thismatches)
+            return 1;
 
-    fill = rwho_prepbuf(sptr);
+        if ((rwho_opts.check[0] & RWM_MATCHES) &&
+            (rwho_opts.thismatches < rwho_opts.matches[0]))
+            return 1;
 
-    if (rwho_opts.chptr && !IsAdmin(sptr) && !ShowChannel(sptr, rwho_opts.chptr))
-        rwho_opts.countonly = 1;
+        if ((rwho_opts.check[1] & RWM_MATCHES) &&
+            (rwho_opts.thismatches > rwho_opts.matches[1]))
+            return 1;
+    }
 
-#ifdef THROTTLE_ENABLE
-    if (((rwho_opts.check[0] | rwho_opts.check[1]) & (RWM_CLONES|RWM_MATCHES))
-        || (rwho_opts.rplfields & (RWO_CLONES|RWO_MATCHES)))
+    /* if summarizing, we cached from the sweep above */
+    if (rwho_opts.rplfields & RWO_MATCHES)
     {
-        CloneEnt *ce;
-        aClient *fm;
+        if (!st->left)
+        {
+            sendto_one(sptr, getreply(ERR_WHOLIMEXCEED), me.name,
+                       sptr->name, rwho_opts.limit, "RWHO");
+            return 0;
+        }
 
-        for (ce = clones_list; ce; ce = ce->next)
+        if (!rwho_opts.countonly)
         {
-            if (!ce->clients)
-                continue;
+            rwho_reply(sptr, fm, fill, NULL);
+            sendto_one(sptr, "%s", rwhobuf);
+        }
 
-            if ((rwho_opts.check[0] & RWM_CLONES) &&
-                (ce->gcount < rwho_opts.clones[0]))
-                continue;
+        st->results++;
+        st->left--;
+        return 1;
+    }
 
-            if ((rwho_opts.check[1] & RWM_CLONES) &&
-                (ce->gcount > rwho_opts.clones[1]))
-                continue;
+    /* not summarizing, so send each match */
+    for (ac = ce->clients; ac; ac = ac->clone.next)
+    {
+        st->examined++;
+        if (!rwho_match(ac, &st->failcode, &st->failclient))
+            continue;
 
-            fm = NULL;
-            rwho_opts.thismatches = 0;
-            rwho_opts.thisclones = ce->gcount;
+        if (!st->left)
+            break;
 
-            /* if using match flag D or summarizing, we need the match count */
-            if (((rwho_opts.check[0] | rwho_opts.check[1]) & RWM_MATCHES)
-                || (rwho_opts.rplfields & RWO_MATCHES))
-            {
-                for (ac = ce->clients; ac; ac = ac->clone.next)
-                {
-                    if (!rwho_match(ac, &failcode, &failclient))
-                        continue;
+        if (!rwho_opts.countonly)
+        {
+            rwho_reply(sptr, ac, fill, NULL);
+            sendto_one(sptr, "%s", rwhobuf);
+        }
 
-                    if (!fm)
-                        fm = ac;
+        st->results++;
+        st->left--;
+    }
 
-                    rwho_opts.thismatches++;
-                }
+    /* This may be inaccurate.  If the loop above finished without
+       hitting the limit, this reply is too early -- it suggests there
+       are more matches when there may not be.  But it's the easiest
+       way to handle this case at present. */
+    if (!st->left)
+    {
+        sendto_one(sptr, getreply(ERR_WHOLIMEXCEED), me.name, sptr->name,
+                   rwho_opts.limit, "RWHO");
+        return 0;
+    }
 
-                /* we know no matches, so no need to process further */
-                if (!rwho_opts.thismatches)
-                    continue;
+    return 1;
+}
+#endif  /* THROTTLE_ENABLE */
 
-                if ((rwho_opts.check[0] & RWM_MATCHES) &&
-                    (rwho_opts.thismatches < rwho_opts.matches[0]))
-                    continue;
+/*
+ * Look at one candidate.
+ * Returns 0 once the result limit is reached, 1 otherwise.
+ */
+static int rwho_candidate(aClient *sptr, struct rwho_search *st, aClient *ac,
+                          char *fill)
+{
+    st->examined++;
 
-                if ((rwho_opts.check[1] & RWM_MATCHES) &&
-                    (rwho_opts.thismatches > rwho_opts.matches[1]))
-                    continue;
-            }
+    if (!rwho_match(ac, &st->failcode, &st->failclient))
+        return 1;
 
-            /* if summarizing, we cached from the sweep above */
-            if (rwho_opts.rplfields & RWO_MATCHES)
-            {
-                if (!left)
-                {
-                    sendto_one(sptr, getreply(ERR_WHOLIMEXCEED), me.name,
-                               parv[0], rwho_opts.limit, "RWHO");
-                    break;
-                }
+    if (!st->left)
+    {
+        sendto_one(sptr, getreply(ERR_WHOLIMEXCEED), me.name, sptr->name,
+                   rwho_opts.limit, "RWHO");
+        return 0;
+    }
 
-                if (!rwho_opts.countonly)
-                {
-                    rwho_reply(sptr, fm, fill, NULL);
-                    sendto_one(sptr, "%s", rwhobuf);
-                }
+    if (!rwho_opts.countonly)
+    {
+        rwho_reply(sptr, ac, fill, rwho_opts.chptr ?
+                   find_user_member(rwho_opts.chptr, ac) : NULL);
+        sendto_one(sptr, "%s", rwhobuf);
+    }
 
-                results++;
-                left--;
-                continue;
-            }
+    st->results++;
+    st->left--;
+    return 1;
+}
 
-            /* not summarizing, so send each match */
-            for (ac = ce->clients; ac; ac = ac->clone.next)
-            {
-                if (!rwho_match(ac, &failcode, &failclient))
-                    continue;
+/*
+ * Carry on with a search until it ends or has had its slice.
+ * Returns 1 if there is more to do.
+ */
+static int rwho_run(aWhoSearch *ws, struct rwho_search *st)
+{
+    aClient *sptr = ws->cptr;
+    aClient *ac;
+    char    *fill;
 
-                if (!left)
-                    break;
+    fill = rwho_prepbuf(sptr);
 
-                if (!rwho_opts.countonly)
-                {
-                    rwho_reply(sptr, ac, fill, NULL);
-                    sendto_one(sptr, "%s", rwhobuf);
-                }
+#ifdef THROTTLE_ENABLE
+    if (st->clones)
+    {
+        CloneEnt *ce;
+        int       more;
 
-                results++;
-                left--;
-            }
+        while ((ce = st->ce))
+        {
+            more = rwho_clone(sptr, st, ce, fill);
+            if ((st->ce = ce->next))
+                clones_hold(st->ce);
+            clones_release(ce);
 
-            /* This may be inaccurate.  If the loop above finished without
-               hitting the limit, this reply is too early -- it suggests there
-               are more matches when there may not be.  But it's the easiest
-               way to handle this case at present. */
-            if (!left)
-            {
-                sendto_one(sptr, getreply(ERR_WHOLIMEXCEED), me.name, parv[0],
-                           rwho_opts.limit, "RWHO");
-                break;
-            }
+            if (!more)
+                return 0;
+            if (whosearch_full(ws))
+                return 1;
         }
+        return 0;
     }
-    else
-#endif  /* THROTTLE_ENABLE */
-    if (rwho_opts.chptr)
+#endif
+
+    /* a paused search may see the channel lose members, so +c is
+       always checked */
+    while ((ac = whosearch_next(ws)))
     {
-        rwho_opts.check[0] &= ~RWM_CHANNEL;
+        if (!IsClient(ac))
+            continue;
 
-        for (cm = rwho_opts.chptr->members; cm; cm = cm->next)
-        {
-            ac = cm->cptr;
+        if (!rwho_candidate(sptr, st, ac, fill))
+            return 0;
+        if (whosearch_full(ws))
+            return 1;
+    }
 
-            if (!rwho_match(ac, &failcode, &failclient))
-                continue;
+    return 0;
+}
 
-            if (!left)
-            {
-                sendto_one(sptr, getreply(ERR_WHOLIMEXCEED), me.name, parv[0],
-                           rwho_opts.limit, "RWHO");
-                break;
-            }
+/*
+ * Send the end of a search.
+ */
+static void rwho_done(aClient *sptr, struct rwho_search *st)
+{
+    if (rwho_opts.misc & RWC_TIME)
+    {
+        if (st->passes > 1)
+            ircsprintf(rwhobuf, "Search completed in %.03fs using %s, %d "
+                       "users examined over %d passes.",
+                       ((double) st->cpu) / CLOCKS_PER_SEC, st->plan,
+                       st->examined, st->passes);
+        else
+            ircsprintf(rwhobuf, "Search completed in %.03fs using %s, %d "
+                       "users examined.", ((double) st->cpu) / CLOCKS_PER_SEC,
+                       st->plan, st->examined);
+        sendto_one(sptr, getreply(RPL_COMMANDSYNTAX), me.name, sptr->name,
+                   rwhobuf);
+    }
 
-            if (!rwho_opts.countonly)
-            {
-                rwho_reply(sptr, ac, fill, cm);
-                sendto_one(sptr, "%s", rwhobuf);
-            }
+    if (rwho_opts.rplcookie)
+        ircsprintf(rwhobuf, "%d:%s", st->results, rwho_opts.rplcookie);
+    else
+        ircsprintf(rwhobuf, "%d", st->results);
+    sendto_one(sptr, getreply(RPL_ENDOFWHO), me.name, sptr->name, rwhobuf,
+               "RWHO");
+}
 
-            results++;
-            left--;
-        }
+/*
+ * Report a match failure in the last slice.
+ */
+static void rwho_failed(aClient *sptr, struct rwho_search *st)
+{
+    aClient *failclient = st->failclient;
+
+    if (!st->failcode)
+        return;
+
+    if (st->failcode == PCRE_ERROR_MATCHLIMIT)
+    {
+        sendto_one(sptr, ":%s NOTICE %s :RWHO: Regex match pattern is too "
+                   "recursive, so some matches failed prematurely.  Use a "
+                   "more specific pattern.", me.name, sptr->name);
     }
     else
     {
-        for (ac = client; ac; ac = ac->next)
-        {
-            if (!IsClient(ac))
-                continue;
+        sendto_one(sptr, ":%s NOTICE %s :RWHO: Internal error %d during "
+                   "match, notify coders!", me.name, sptr->name, st->failcode);
+        sendto_one(sptr, ":%s NOTICE %s :RWHO: Match target was: %s %s "
+                   "[%s] [%s]", me.name, sptr->name, failclient->name,
+                   failclient->user->username, failclient->info,
+                   failclient->user->away ? failclient->user->away : "");
+    }
 
-            if (!rwho_match(ac, &failcode, &failclient))
-                continue;
+    st->failcode = 0;
+    st->failclient = NULL;
+}
 
-            if (!left)
-            {
-                sendto_one(sptr, getreply(ERR_WHOLIMEXCEED), me.name, parv[0],
-                           rwho_opts.limit, "RWHO");
-                break;
-            }
+/*
+ * Run one slice of a search, ending it if that was the last.
+ * Returns 1 if there is more to do.
+ */
+static int rwho_slice(aWhoSearch *ws)
+{
+    struct rwho_search *st = WHOSEARCH_STATE(ws);
+    clock_t cbegin = clock();
+    int     more;
 
-            if (!rwho_opts.countonly)
-            {
-                rwho_reply(sptr, ac, fill, NULL);
-                sendto_one(sptr, "%s", rwhobuf);
-            }
+    more = rwho_run(ws, st);
+    st->cpu += clock() - cbegin;
+    st->passes++;
 
-            results++;
-            left--;
-        }
+    if (!more)
+        rwho_done(ws->cptr, st);
+    rwho_failed(ws->cptr, st);
+
+    return more;
+}
+
+/*
+ * Pick up a paused search where it left off.
+ */
+static int rwho_resume(aWhoSearch *ws)
+{
+    struct rwho_search *st = WHOSEARCH_STATE(ws);
+
+    rwho_opts = st->opts;
+    rwho_opts.server = st->server[0] ? find_server(st->server, NULL) : NULL;
+
+    /* once the channel is gone, none of the rest can be on it */
+    if (st->chname[0] &&
+        !(rwho_opts.chptr = find_channel(st->chname, NULL)))
+    {
+        rwho_done(ws->cptr, st);
+        return 0;
     }
+    /* nor may it show more than the channel as it is now would let it */
+    if (rwho_opts.chptr && !IsAdmin(ws->cptr) &&
+        !ShowChannel(ws->cptr, rwho_opts.chptr))
+        rwho_opts.countonly = 1;
 
-    cend = clock();
-    if (rwho_opts.misc & RWC_TIME)
+    return rwho_slice(ws);
+}
+
+/*
+ * End a paused search early, with what it has found so far.
+ */
+static void rwho_end(aWhoSearch *ws)
+{
+    struct rwho_search *st = WHOSEARCH_STATE(ws);
+
+    rwho_opts = st->opts;
+    rwho_done(ws->cptr, st);
+}
+
+static void rwho_release(aWhoSearch *ws)
+{
+    struct rwho_search *st = WHOSEARCH_STATE(ws);
+
+#ifdef THROTTLE_ENABLE
+    if (st->ce)
+        clones_release(st->ce);
+#endif
+    free(st->opts.re);
+}
+
+/*
+ * m_rwho - flexible client search with regular expression support
+ * parv[0] - sender
+ * parv[1] - flags
+ * parv[2] - arguments
+ *
+ * A search that takes too long, or fills the sendQ, carries on from
+ * the io loop; see whoindex.c.
+ */
+int m_rwho(aClient *cptr, aClient *sptr, int parc, char *parv[])
+{
+    struct rwho_search *st;
+    aWhoSearch *ws;
+    aClient   **found;
+    int         nfound;
+    int         i;
+    clock_t     cbegin;
+
+    if (!IsAnOper(sptr))
     {
-        ircsprintf(rwhobuf, "Search completed in %.03fs.",
-                   ((double)(cend - cbegin)) / CLOCKS_PER_SEC);
-        sendto_one(sptr, getreply(RPL_COMMANDSYNTAX), me.name, sptr->name,
-                   rwhobuf);
+        sendto_one(sptr, getreply(ERR_NOPRIVILEGES), me.name, parv[0]);
+        return 0;
+    }
+
+    /* a search still paused ends here, the new one takes its place */
+    whosearch_stop(sptr);
+
+    cbegin = clock();
+
+    if (!rwho_parseopts(sptr, parc, parv))
+        return 0;
+
+    if (rwho_opts.chptr && !IsAdmin(sptr) && !ShowChannel(sptr, rwho_opts.chptr))
+        rwho_opts.countonly = 1;
+
+    ws = whosearch_new(sptr, sizeof(struct rwho_search), rwho_resume,
+                       rwho_end, rwho_release);
+    st = WHOSEARCH_STATE(ws);
+    st->left = rwho_opts.limit ? rwho_opts.limit : INT_MAX;
+
+#ifdef THROTTLE_ENABLE
+    if (((rwho_opts.check[0] | rwho_opts.check[1]) & (RWM_CLONES|RWM_MATCHES))
+        || (rwho_opts.rplfields & (RWO_CLONES|RWO_MATCHES)))
+    {
+        strcpy(st->plan, "clone list");
+        st->clones = 1;
+        if ((st->ce = clones_list))
+            clones_hold(st->ce);
     }
-    
-    if (rwho_opts.rplcookie)
-        ircsprintf(rwhobuf, "%d:%s", results, rwho_opts.rplcookie);
     else
-        ircsprintf(rwhobuf, "%d", results);
-    sendto_one(sptr, getreply(RPL_ENDOFWHO), me.name, parv[0], rwhobuf,"RWHO");
+#endif  /* THROTTLE_ENABLE */
+    if (rwho_index(&found, &nfound, st->plan))
+        whosearch_set(ws, found, nfound);
+    else if (rwho_opts.chptr)
+    {
+        strcpy(st->plan, "channel members");
+        whosearch_members(ws, rwho_opts.chptr);
+    }
+    else
+    {
+        strcpy(st->plan, "full scan");
+        whosearch_clients(ws);
+    }
 
-    if (failcode)
+    st->cpu = clock() - cbegin;
+    if (!rwho_slice(ws))
     {
-        if (failcode == PCRE_ERROR_MATCHLIMIT)
-        {
-            sendto_one(sptr, ":%s NOTICE %s :RWHO: Regex match pattern is too "
-                       "recursive, so some matches failed prematurely.  Use a "
-                       "more specific pattern.", me.name, parv[0]);
-        }
-        else
-        {
-            sendto_one(sptr, ":%s NOTICE %s :RWHO: Internal error %d during "
-                       "match, notify coders!", me.name, parv[0], failcode);
-            sendto_one(sptr, ":%s NOTICE %s :RWHO: Match target was: %s %s "
-                       "[%s] [%s]", me.name, parv[0], failclient->name,
-                       failclient->user->username, failclient->info,
-                       failclient->user->away ? failclient->user->away : "");
-        }
+        st->opts = rwho_opts;
+        whosearch_free(ws);
+        return 0;
     }
 
-    free(rwho_opts.re);
+    /* parv[] is gone by the next slice */
+    for (i = 0; i < 2; i++)
+    {
+        rwho_opts.host_pat[i] = whosearch_save(ws, rwho_opts.host_pat[i]);
+        rwho_opts.ip_str[i] = whosearch_save(ws, rwho_opts.ip_str[i]);
+    }
+    rwho_opts.rplcookie = whosearch_save(ws, rwho_opts.rplcookie);
+    rwho_opts.nick_re = NULL;
+    st->opts = rwho_opts;
+    if (rwho_opts.chptr)
+        strcpy(st->chname, rwho_opts.chptr->chname);
+    if (rwho_opts.server)
+        strcpy(st->server, rwho_opts.server->name);
+    whosearch_pause(ws);
 
     return 0;
 }
-
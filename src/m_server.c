@@ -26,6 +26,7 @@
 #include "zlink.h"
 #include "throttle.h"
 #include "clones.h"
+#include "channel.h"
 
 /* externally defined functions */
 
@@ -56,7 +57,7 @@ static void sendnick_TS(aClient *cptr, aClient *acptr)
         }
 	if (IsNickIPStr(cptr))
 	{
-	    sendto_one(cptr, "NICK %s %d %ld %s %s %s %s %lu %s :%s",
+	    sendto_burst(cptr, "NICK %s %d %ld %s %s %s %s %lu %s :%s",
 			   acptr->name, acptr->hopcount + 1, acptr->tsinfo, ubuf,
 			   acptr->user->username, acptr->user->host,
 			   acptr->user->server, acptr->user->servicestamp,
@@ -64,7 +65,7 @@ static void sendnick_TS(aClient *cptr, aClient *acptr)
 	}
 	else
 	{
-	    sendto_one(cptr, "NICK %s %d %ld %s %s %s %s %lu %u :%s",
+	    sendto_burst(cptr, "NICK %s %d %ld %s %s %s %s %lu %u :%s",
 			   acptr->name, acptr->hopcount + 1, acptr->tsinfo, ubuf,
 			   acptr->user->username, acptr->user->host,
 			   acptr->user->server, acptr->user->servicestamp,
@@ -81,22 +82,404 @@ static void sendnick_TS(aClient *cptr, aClient *acptr)
                    ubuf[i++] = *(s + 1);
                 }
             ubuf[i++] = '\0';
-            sendto_one(cptr, "SVSTAG %s %ld %d %s :%s", acptr->name, acptr->tsinfo, servicestag->raw,
+            sendto_burst(cptr, "SVSTAG %s %ld %d %s :%s", acptr->name, acptr->tsinfo, servicestag->raw,
                        ubuf, servicestag->tag);
         }
 #ifdef USER_HOSTMASKING
         if(acptr->flags & FLAGS_SPOOFED)
-            sendto_one(cptr, "SVSHOST %s %s", acptr->name, acptr->user->mhost);
+            sendto_burst(cptr, "SVSHOST %s %s", acptr->name, acptr->user->mhost);
 #endif
     }
 }
 
+
+/*
+ * Paced netbursts.
+ *
+ * Users and channels go to a new link a slice at a time from the io
+ * loop, while its sendQ stays short, rather than all at once from
+ * do_server_estab().  The link gets normal traffic meanwhile, so
+ * burst_filter() keeps the two consistent: each running burst owns a
+ * bit in aClient.nicksent and aChannel.burstsent, set once the link
+ * has been sent that client or channel.  A message about something the
+ * link has not been sent yet either sends it first, or is dropped when
+ * the burst will carry its outcome anyway.
+ */
+
+#define BURST_SLOTS     8       /* bits in nicksent and burstsent */
+#define BURST_SENDQ     65536   /* don't refill a sendQ longer than this */
+#define BURST_SLICE     256     /* clients or channels per io loop pass */
+
+#define BURST_NICKS     0
+#define BURST_CHANNELS  1
+#define BURST_DONE      2
+
+/* what burst_slice() stopped for */
+#define SLICE_DONE      0       /* everything is queued */
+#define SLICE_MORE      1       /* its budget ran out, it can go on now */
+#define SLICE_WAIT      2       /* the link is full, wait until it drains */
+
+typedef struct Burst aBurst;
+
+struct Burst
+{
+    aClient        *cptr;       /* link being burst */
+    aBurst         *next;
+    unsigned char   bit;        /* 0 if sent in one go */
+    int             state;
+    aClient        *nextc;      /* next client to send, towards the head */
+    aChannel       *nextch;     /* next channel to send */
+    struct timeval  start;
+    int             nicks;
+    int             chans;
+    int             peaksq;
+};
+
+unsigned char burst_slots = 0;  /* nicksent bits owned by running bursts */
+static aBurst *bursts = NULL;
+static int burst_emitting = 0;  /* queueing burst data, don't filter it */
+
+static void burst_nick(aBurst *b, aClient *acptr)
+{
+    acptr->nicksent |= b->bit;
+    if (acptr->from == b->cptr || !IsPerson(acptr))
+        return;
+    burst_emitting++;
+    sendnick_TS(b->cptr, acptr);
+    burst_emitting--;
+    b->nicks++;
+}
+
+/* send a channel, introducing any members the link doesn't know yet */
+static void burst_channel(aBurst *b, aChannel *chptr)
+{
+    chanMember *cm;
+
+    chptr->burstsent |= b->bit;
+    if (b->bit)
+        for (cm = chptr->members; cm; cm = cm->next)
+            if (!(cm->cptr->nicksent & b->bit))
+                burst_nick(b, cm->cptr);
+    burst_emitting++;
+    send_channel_modes(b->cptr, chptr);
+    burst_emitting--;
+    b->chans++;
+}
+
+/*
+ * send up to count clients or channels, all of them if not paced.
+ * Paced, a sendQ at BURST_SENDQ is written out on the spot, and if the
+ * link won't take enough of it the slice stops to wait for the link.
+ * returns SLICE_DONE, SLICE_MORE or SLICE_WAIT.
+ */
+static int burst_slice(aBurst *b, int count, int paced)
+{
+    aClient *cptr = b->cptr;
+    aClient *acptr;
+    aChannel *chptr;
+    int waiting = 0;
+
+    while (b->state != BURST_DONE && count-- > 0 && !IsDead(cptr))
+    {
+        if (paced && SBufLength(&cptr->sendQ) >= BURST_SENDQ)
+        {
+            send_queued(cptr);
+            if (IsDead(cptr) || (cptr->flags & FLAGS_BLOCKED) ||
+                SBufLength(&cptr->sendQ) >= BURST_SENDQ)
+            {
+                waiting = 1;
+                break;
+            }
+        }
+
+        if (b->state == BURST_NICKS)
+        {
+            if (!(acptr = b->nextc))
+            {
+                b->state = BURST_CHANNELS;
+                b->nextch = channel;
+                continue;
+            }
+            b->nextc = acptr->prev;
+            if (!(acptr->nicksent & b->bit))
+                burst_nick(b, acptr);
+        }
+        else
+        {
+            if (!(chptr = b->nextch))
+            {
+                b->state = BURST_DONE;
+                break;
+            }
+            b->nextch = chptr->nextch;
+            if (!(chptr->burstsent & b->bit))
+                burst_channel(b, chptr);
+        }
+    }
+    if (SBufLength(&cptr->sendQ) > b->peaksq)
+        b->peaksq = SBufLength(&cptr->sendQ);
+    if (b->state == BURST_DONE)
+        return SLICE_DONE;
+    return waiting ? SLICE_WAIT : SLICE_MORE;
+}
+
+/* stop tracking a burst, clearing its bit everywhere */
+static void burst_release(aBurst *b)
+{
+    aBurst **bp;
+    aClient *acptr;
+    aChannel *chptr;
+
+    if (b->bit)
+    {
+        for (acptr = client; acptr; acptr = acptr->next)
+            acptr->nicksent &= ~b->bit;
+        for (chptr = channel; chptr; chptr = chptr->nextch)
+            chptr->burstsent &= ~b->bit;
+        burst_slots &= ~b->bit;
+    }
+    for (bp = &bursts; *bp; bp = &(*bp)->next)
+        if (*bp == b)
+        {
+            *bp = b->next;
+            break;
+        }
+    b->cptr->serv->burst = NULL;
+}
+
+static void burst_finish(aBurst *b)
+{
+    aClient *cptr = b->cptr;
+    struct timeval now;
+    unsigned long ms;
+
+    burst_release(b);
+
+    if(confopts & FLAGS_HUB)
+        fakelusers_sendlock(cptr);
+
+    if(ZipOut(cptr))
+    {
+        unsigned long inb, outb;
+        double rat;
+
+        zip_out_get_stats(cptr->serv->zip_out, &inb, &outb, &rat);
+
+        if(inb)
+        {
+            sendto_gnotice("from %s: Connect burst to %s: %lu bytes normal, "
+                           "%lu compressed (%3.2f%%)", me.name,
+                           get_client_name(cptr, HIDEME), inb, outb, rat);
+            sendto_serv_butone(cptr, ":%s GNOTICE :Connect burst to %s: %lu "
+                               "bytes normal, %lu compressed (%3.2f%%)",
+                               me.name, get_client_name(cptr, HIDEME), inb,
+                               outb, rat);
+        }
+    }
+
+    gettimeofday(&now, NULL);
+    ms = (now.tv_sec - b->start.tv_sec) * 1000 +
+         (now.tv_usec - b->start.tv_usec) / 1000;
+    ircstp->is_burst++;
+    ircstp->is_burstms += ms;
+    if (ms > ircstp->is_burstmax)
+        ircstp->is_burstmax = ms;
+    if (b->peaksq > ircstp->is_burstsq)
+        ircstp->is_burstsq = b->peaksq;
+    sendto_gnotice("from %s: Netburst to %s: %d users, %d channels in "
+                   "%lu.%03lu secs, peak sendQ %d", me.name,
+                   get_client_name(cptr, HIDEME), b->nicks, b->chans,
+                   ms / 1000, ms % 1000, b->peaksq);
+
+    /* stuff a PING at the end of this burst so we can figure out when
+       the other side has finished processing it. */
+    cptr->flags |= FLAGS_BURST|FLAGS_PINGSENT;
+    if (IsBurst(cptr)) cptr->flags |= FLAGS_SOBSENT;
+    sendto_one(cptr, "PING :%s", me.name);
+
+    MyFree(b);
+}
+
+/*
+ * Users go first, oldest first, then channels.  If every slot is taken,
+ * the link is sent everything here, as it always used to be.
+ */
+static void burst_start(aClient *cptr)
+{
+    aBurst *b;
+    int i;
+
+    b = (aBurst *) MyMalloc(sizeof(aBurst));
+    memset((char *) b, '\0', sizeof(aBurst));
+    b->cptr = cptr;
+    b->state = BURST_NICKS;
+    b->nextc = me.prev;
+    gettimeofday(&b->start, NULL);
+
+    for (i = 0; i < BURST_SLOTS; i++)
+        if (!(burst_slots & (1 << i)))
+            break;
+    if (i == BURST_SLOTS)
+    {
+        burst_slice(b, INT_MAX, 0);
+        burst_finish(b);
+        return;
+    }
+    b->bit = 1 << i;
+    burst_slots |= b->bit;
+    b->next = bursts;
+    bursts = b;
+    cptr->serv->burst = b;
+}
+
+/*
+ * send_bursts
+ * called from the io loop: tops up the sendQ of each link being burst.
+ * Returns 1 if one of them could take more right away; a link that is
+ * full wakes the loop by becoming writable instead.
+ */
+int send_bursts()
+{
+    aBurst *b, *bn;
+    int more = 0;
+
+    for (b = bursts; b; b = bn)
+    {
+        bn = b->next;
+        if (IsDead(b->cptr) || (b->cptr->flags & FLAGS_BLOCKED))
+            continue;
+        switch (burst_slice(b, BURST_SLICE, 1))
+        {
+            case SLICE_DONE:
+                burst_finish(b);
+                break;
+            case SLICE_MORE:
+                more = 1;
+                break;
+        }
+    }
+    return more;
+}
+
+static char *burst_word(char *p, char *end, char *word, int size)
+{
+    int i = 0;
+
+    while (p < end && *p == ' ')
+        p++;
+    while (p < end && *p != ' ' && *p != '\r' && *p != '\n' && *p != '\0')
+    {
+        if (i < size - 1)
+            word[i++] = *p;
+        p++;
+    }
+    word[i] = '\0';
+    return p;
+}
+
+/*
+ * burst_filter
+ * check a message for a link still being burst.  Returns 0 to drop it.
+ */
+int burst_filter(aClient *to, char *msg, int len)
+{
+    aBurst *b = (aBurst *) to->serv->burst;
+    char prefix[HOSTLEN + 1], cmd[32], arg1[64], arg2[64];
+    char *p, *end = msg + len, *chname;
+    aClient *acptr;
+    aChannel *chptr;
+
+    if (!b || burst_emitting)
+        return 1;
+
+    p = msg;
+    *prefix = '\0';
+    if (*p == ':')
+        p = burst_word(p + 1, end, prefix, sizeof(prefix));
+    p = burst_word(p, end, cmd, sizeof(cmd));
+    p = burst_word(p, end, arg1, sizeof(arg1));
+    burst_word(p, end, arg2, sizeof(arg2));
+
+    /* changes to a user it hasn't got yet: the burst sends the result */
+    if ((acptr = find_person(arg1, NULL)) && acptr->from != to &&
+        !(acptr->nicksent & b->bit))
+        return 0;
+
+    chname = mycmp(cmd, "SJOIN") ? arg1 : arg2;
+    while (*chname == '@' || *chname == '+' || *chname == '%')
+        chname++;
+    if (IsChannelName(chname) && (chptr = find_channel(chname, NULL)) &&
+        !(chptr->burstsent & b->bit))
+        burst_channel(b, chptr);
+
+    if (*prefix && (acptr = find_person(prefix, NULL)) && acptr->from != to &&
+        !(acptr->nicksent & b->bit))
+    {
+        if (!mycmp(cmd, "QUIT") || !mycmp(cmd, "NICK"))
+            return 0;
+        burst_nick(b, acptr);
+    }
+    return 1;
+}
+
+void burst_client_gone(aClient *cptr)
+{
+    aBurst *b;
+    DLink *lp;
+
+    for (b = bursts; b; b = b->next)
+        if (b->nextc == cptr)
+            b->nextc = cptr->prev;
+
+    if (IsServer(cptr))
+        for (lp = server_list; lp; lp = lp->next)
+            if (lp->value.cptr->serv->ingest == cptr)
+                lp->value.cptr->serv->ingest = NULL;
+}
+
+void burst_channel_gone(aChannel *chptr)
+{
+    aBurst *b;
+
+    for (b = bursts; b; b = b->next)
+        if (b->nextch == chptr)
+            b->nextch = chptr->nextch;
+}
+
+/* the link went away before its burst was done */
+void burst_abort(aClient *cptr)
+{
+    aBurst *b = (aBurst *) cptr->serv->burst;
+
+    if (b)
+    {
+        burst_release(b);
+        MyFree(b);
+    }
+}
+
+/*
+ * Incoming bursts introduce users a server at a time, so while a link
+ * is bursting to us (between BURST and its EOB) the server named by
+ * each NICK is nearly always the one named by the last.  Remember it
+ * rather than walking the client hash for it twice per user.
+ */
+aClient *burst_find_server(aClient *cptr, char *name)
+{
+    aClient *acptr;
+
+    if (!(cptr->flags & FLAGS_EOBRECV))
+        return find_server(name, NULL);
+    if ((acptr = cptr->serv->ingest) && mycmp(acptr->name, name) == 0)
+        return acptr;
+    return (cptr->serv->ingest = find_server(name, NULL));
+}
+
 static int
 do_server_estab(aClient *cptr)
 {
     aClient *acptr;
     aConnect *aconn;
-    aChannel *chptr;
     int i;
     /* "refresh" inpath with host  */
     char *inpath = get_client_name(cptr, HIDEME);
@@ -108,6 +491,7 @@ do_server_estab(aClient *cptr)
     if (IsUnknown(cptr)) Count.unknown--;
 
     SetServer(cptr);
+    schedule_ping(cptr);
 
     Count.server++;
     Count.myserver++;
@@ -281,75 +665,7 @@ do_server_estab(aClient *cptr)
     if (IsBurst(cptr))
         sendto_one(cptr, "BURST");
 
-    /*
-     * * Send it in the shortened format with the TS, if it's a TS
-     * server; walk the list of channels, sending all the nicks that
-     * haven't been sent yet for each channel, then send the channel
-     * itself -- it's less obvious than sending all nicks first, but
-     * on the receiving side memory will be allocated more nicely
-     * saving a few seconds in the handling of a split -orabidoo
-     */
-    {
-        chanMember       *cm;
-        static char nickissent = 1;
-
-        nickissent = 3 - nickissent;
-        /*
-         * flag used for each nick to check if we've sent it yet - must
-         * be different each time and !=0, so we alternate between 1 and
-         * 2 -orabidoo
-         */
-        for (chptr = channel; chptr; chptr = chptr->nextch)
-        {
-            for (cm = chptr->members; cm; cm = cm->next)
-            {
-                acptr = cm->cptr;
-                if (acptr->nicksent != nickissent)
-                {
-                    acptr->nicksent = nickissent;
-                    if (acptr->from != cptr)
-                        sendnick_TS(cptr, acptr);
-                }
-            }
-            send_channel_modes(cptr, chptr);
-        }
-        /* also send out those that are not on any channel */
-        for (acptr = &me; acptr; acptr = acptr->prev)
-            if (acptr->nicksent != nickissent)
-            {
-                acptr->nicksent = nickissent;
-                if (acptr->from != cptr)
-                    sendnick_TS(cptr, acptr);
-            }
-    }
-
-    if(confopts & FLAGS_HUB)
-        fakelusers_sendlock(cptr);
-
-    if(ZipOut(cptr))
-    {
-        unsigned long inb, outb;
-        double rat;
-
-        zip_out_get_stats(cptr->serv->zip_out, &inb, &outb, &rat);
-
-        if(inb)
-        {
-            sendto_gnotice("from %s: Connect burst to %s: %lu bytes normal, "
-                           "%lu compressed (%3.2f%%)", me.name,
-                           get_client_name(cptr, HIDEME), inb, outb, rat);
-            sendto_serv_butone(cptr, ":%s GNOTICE :Connect burst to %s: %lu "
-                               "bytes normal, %lu compressed (%3.2f%%)",
-                               me.name, get_client_name(cptr, HIDEME), inb,
-                               outb, rat);
-        }
-    }
-
-    /* stuff a PING at the end of this burst so we can figure out when
-       the other side has finished processing it. */
-    cptr->flags |= FLAGS_BURST|FLAGS_PINGSENT;
-    if (IsBurst(cptr)) cptr->flags |= FLAGS_SOBSENT;
-    sendto_one(cptr, "PING :%s", me.name);
+    burst_start(cptr);
 
     return 0;
 }
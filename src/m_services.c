@@ -31,6 +31,7 @@
 #include "h.h"
 #include "userban.h"
 #include "clones.h"
+#include "whoindex.h"
 #include "memcount.h"
 
 /* Externally defined stuffs */
@@ -248,6 +249,7 @@ int m_svsnick(aClient *cptr, aClient *sptr, int parc, char *parv[])
     }
     strcpy(acptr->name, newnick);
     add_to_client_hash_table(acptr->name, acptr);
+    whoidx_update(acptr, WIDX_NICK);
     hash_check_watch(acptr, RPL_LOGON);
     flush_user_banserial(acptr);
 
@@ -642,6 +644,7 @@ int m_svshost(aClient *cptr, aClient *sptr, int parc, char *parv[])
 
 #ifdef USER_HOSTMASKING
     strcpy(acptr->user->mhost, parv[2]); /* Set the requested (masked) host */
+    whoidx_update(acptr, WIDX_MHOST);
     acptr->flags |= FLAGS_SPOOFED;
 #else
     /* Save the real hostname if it's a local client */
@@ -668,6 +671,7 @@ int m_svshost(aClient *cptr, aClient *sptr, int parc, char *parv[])
         strcpy(acptr->sockhost, parv[2]);
     }
     strcpy(acptr->user->host, parv[2]); /* Set the requested host */
+    whoidx_update(acptr, WIDX_HOST);
 #endif
 
     /* Pass it to all the other servers */
@@ -44,7 +44,6 @@
 #endif
 
 extern float curSendK, curRecvK;
-extern aWhowas WHOWAS[];
 extern aCache *cachetop;
 #ifdef DEBUGMODE
 extern void report_fds(aClient *);
@@ -213,23 +212,30 @@ static void
 show_ports(aClient *cptr, char *name)
 {
     aPort *tmp;
+    aListener *lptr;
     int j = 0;
 
     if(!ports)
         sendto_realops("Lost all port configurations!");
     for(tmp = ports; tmp; tmp = tmp->next)
     {
-        if(tmp->lstn)
+        /* a line for each socket, with what accept_connection() counted */
+        for(lptr = tmp->lstn; lptr; lptr = lptr->shard)
         {
             if(IsULine(cptr) || (MyClient(cptr) && IsAdmin(cptr)))
-                sendto_one(cptr,":%s %d %s :%s %s %i %s %i", me.name, RPL_STATSDEBUG,
+                sendto_one(cptr,":%s %d %s :%s %s %i %s %i accepted %lu rejected %lu",
+                       me.name, RPL_STATSDEBUG,
                        name, tmp->address?tmp->address:"*", tmp->allow?tmp->allow:"*",
-                       tmp->port, pflagtotext(tmp->flags), tmp->lstn->clients);
+                       tmp->port, pflagtotext(tmp->flags), lptr->clients,
+                       lptr->accepted, lptr->rejected);
             else
-                sendto_one(cptr,":%s %d %s :<masked> <masked> %i %s %i", me.name, RPL_STATSDEBUG,
-                       name, tmp->port, pflagtotext(tmp->flags), tmp->lstn->clients);
-            j++;
+                sendto_one(cptr,":%s %d %s :<masked> <masked> %i %s %i accepted %lu rejected %lu",
+                       me.name, RPL_STATSDEBUG,
+                       name, tmp->port, pflagtotext(tmp->flags), lptr->clients,
+                       lptr->accepted, lptr->rejected);
         }
+        if(tmp->lstn)
+            j++;
     }
     sendto_one(cptr, ":%s %d %s :%d PORT%s", me.name, RPL_STATSDEBUG,
            name, j, (j == 1) ? "" : "s");
@@ -319,29 +325,34 @@ serv_info(aClient *cptr, char *name)
                         RPL_STATSDEBUG, name);
         if(ZipOut(acptr))
         {
-            unsigned long ib, ob;
+            unsigned long ib, ob, usec;
             double rat;
+            int level;
 
             zip_out_get_stats(acptr->serv->zip_out, &ib, &ob, &rat);
+            zip_out_get_cpu(acptr->serv->zip_out, &level, &usec);
             if(ib)
             {
                 sendto_one(cptr, ":%s %d %s : - [O] Zip inbytes %lu, "
-                            "outbytes %lu (%3.2f%%)", me.name, RPL_STATSDEBUG,
-                             name, ib, ob, rat);
+                            "outbytes %lu (%3.2f%%), level %d, cpu %lu.%03lus",
+                             me.name, RPL_STATSDEBUG, name, ib, ob, rat,
+                             level, usec / 1000000, (usec / 1000) % 1000);
             }
         }
 
         if(ZipIn(acptr))
         {
-            unsigned long ib, ob;
+            unsigned long ib, ob, usec;
             double rat;
 
             zip_in_get_stats(acptr->serv->zip_in, &ib, &ob, &rat);
+            zip_in_get_cpu(acptr->serv->zip_in, &usec);
             if(ob)
             {
                 sendto_one(cptr, ":%s %d %s : - [I] Zip inbytes %lu, "
-                            "outbytes %lu (%3.2f%%)", me.name, RPL_STATSDEBUG,
-                             name, ib, ob, rat);
+                            "outbytes %lu (%3.2f%%), cpu %lu.%03lus",
+                             me.name, RPL_STATSDEBUG, name, ib, ob, rat,
+                             usec / 1000000, (usec / 1000) % 1000);
             }
         }
         i++;
@@ -446,6 +457,14 @@ tstats(aClient *cptr, char *name)
     sendto_one(cptr, ":%s %d %s :banned users refused before ident/dns"
                      " %u after ident/dns %u", me.name, RPL_STATSDEBUG, 
                      name, sp->is_ref_1, sp->is_ref_2);
+    sendto_one(cptr, ":%s %d %s :netbursts %u total %lums longest %lums"
+                     " peak sendQ %lu", me.name, RPL_STATSDEBUG, name,
+                     sp->is_burst, sp->is_burstms, sp->is_burstmax,
+                     sp->is_burstsq);
+    sendto_one(cptr, ":%s %d %s :timers pending %lu fired %lu cascaded %lu"
+                     " most in one pass %lu", me.name, RPL_STATSDEBUG, name,
+                     timerstats.pending, timerstats.fired,
+                     timerstats.cascaded, timerstats.maxfired);
     sendto_one(cptr, ":%s %d %s :Client Server", 
                      me.name, RPL_STATSDEBUG, name);
     sendto_one(cptr, ":%s %d %s :connected %u %u",
@@ -772,14 +791,20 @@ int m_stats(aClient *cptr, aClient *sptr, int parc, char *parv[])
         }
         case 'k':
             if(IsAnOper(sptr))
+            {
                 report_userbans_match_flags(sptr, UBAN_TEMPORARY|UBAN_LOCAL, 0);
+                report_userban_stats(sptr);
+            }
             else
                 sendto_one(sptr, err_str(ERR_NOPRIVILEGES), me.name,  parv[0]);
             break;
 
         case 'K':
             if (IsAnOper(sptr))
+            {
                 report_userbans_match_flags(sptr, UBAN_LOCAL, UBAN_TEMPORARY);
+                report_userban_stats(sptr);
+            }
             else
                 sendto_one(sptr, err_str(ERR_NOPRIVILEGES), me.name,  parv[0]);
             break;
@@ -787,7 +812,10 @@ int m_stats(aClient *cptr, aClient *sptr, int parc, char *parv[])
         case 'A':
         case 'a':
             if(IsAnOper(sptr))
+            {
                 report_userbans_match_flags(sptr, UBAN_NETWORK, 0);
+                report_userban_stats(sptr);
+            }
             else
                 sendto_one(sptr, err_str(ERR_NOPRIVILEGES), me.name,  parv[0]);
             break;
@@ -802,8 +830,24 @@ int m_stats(aClient *cptr, aClient *sptr, int parc, char *parv[])
          */
             if(IsAnOper(sptr))
                 for (mptr = msgtab; mptr->cmd; mptr++)
+                {
+                    unsigned long p50, p99;
+
                     sendto_one(sptr, rpl_str(RPL_STATSCOMMANDS), me.name, 
                             parv[0], mptr->cmd, mptr->count, mptr->bytes);
+                    if (!mptr->ns)
+                        continue;
+                    /* handler time, from the log2 histogram in parse() */
+                    p50 = msg_percentile(mptr, 50);
+                    p99 = msg_percentile(mptr, 99);
+                    sendto_one(sptr, ":%s %d %s :%s p50 %lu.%03luus p99 "
+                               "%lu.%03luus max %lu.%03luus total %lu.%06lus",
+                               me.name, RPL_STATSDEBUG, parv[0], mptr->cmd,
+                               p50 / 1000, p50 % 1000, p99 / 1000, p99 % 1000,
+                               mptr->maxns / 1000, mptr->maxns % 1000,
+                               mptr->ns / 1000000000, 
+                               mptr->ns / 1000 % 1000000);
+                }
             break;
 
         case 'N':
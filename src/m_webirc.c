@@ -140,6 +140,7 @@ int m_webirc(aClient *cptr, aClient *sptr, int parc, char *parv[])
     if (throttle_check(parv[4], cptr->fd, NOW) == 0)
     {
 	cptr->flags |= FLAGS_DEADSOCKET;
+	timer_set(&cptr->timer, timeofday);
 
 	ircstp->is_ref++;
 	ircstp->is_throt++;
@@ -30,6 +30,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include "h.h"
+#include "whoindex.h"
 
 /* Internally defined stuffs */
 SOpts wsopts;
@@ -731,21 +732,91 @@ static inline char *first_visible_channel(aClient *cptr, aClient *sptr)
 #else
 #define WHO_HOST(s, a) ((wsopts.ip_show) ? (a)->hostip : (a)->user->host)
 #endif
-int m_who(aClient *cptr, aClient *sptr, int parc, char *parv[])
+
+/*
+ * If one of the positive checks can be answered from an index with
+ * fewer candidates than there are clients, fetch them.  Returns 1 and
+ * the MyMalloc()ed candidates if so, else 0.  chk_who() still has the
+ * final say on each.
+ */
+static int who_index(aClient ***found, int *nfound)
 {
-    aClient *ac;
-    chanMember *cm;
-    Link *lp;
-    int shown=0, i=0, showall=IsAnOper(sptr);
-    char status[4];
+    aWhoQuery q[5];
+    int nq=0, best;
 
-    /* drop nonlocal clients */
-    if(!MyClient(sptr))
+    if(wsopts.serv_plus && whoidx_server(&q[nq], wsopts.server))
+	nq++;
+    if(wsopts.nick_plus && wsopts.nick!=NULL &&
+       whoidx_nick(&q[nq], wsopts.nick))
+	nq++;
+    if(wsopts.host_plus && wsopts.host!=NULL &&
+       whoidx_host(&q[nq], wsopts.host))
+	nq++;
+    if(wsopts.cidr_plus &&
+       whoidx_cidr(&q[nq], wsopts.cidr_family, &wsopts.cidr_ip,
+		   wsopts.cidr_bits))
+	nq++;
+    if(wsopts.ip_plus && whoidx_ip(&q[nq], wsopts.ip))
+	nq++;
+
+    if((best=whoidx_plan(q, nq, Count.total)) < 0)
 	return 0;
-    
-    if(!build_searchopts(sptr, parc-1, parv+1))
-	return 0; /* /who was no good */
-    
+    *found=whoidx_collect(&q[best], nfound);
+    return 1;
+}
+
+/* reply for one client of a global search, 0 once the limit is hit */
+static int who_global(aClient *ac, aClient *sptr, int showall, int *shown)
+{
+    char status[4];
+
+    if(!chk_who(ac,sptr,showall))
+	return 1;
+    /* wow, they passed it all, give them the reply...
+     * IF they haven't reached the max, or they're an oper */
+    if(*shown==MAXWHOREPLIES && !IsAnOper(sptr))
+    {
+	sendto_one(sptr, getreply(ERR_WHOLIMEXCEED), me.name, 
+		   sptr->name, MAXWHOREPLIES, "WHO");
+	return 0; /* break out of loop so we can send end of who */
+    }
+    status[0]=(ac->user->away==NULL ? 'H' : 'G');
+    status[1]=(IsAnOper(ac) ? '*' : (IsInvisible(ac) && 
+				     IsAnOper(sptr) ? '%' : 0));
+    status[2]=0;
+    sendto_one(sptr, getreply(RPL_WHOREPLY), me.name, sptr->name,
+	       wsopts.show_chan ? first_visible_channel(ac, sptr) :
+	       "*", ac->user->username, WHO_HOST(sptr,ac),
+	       WHO_SERVER(sptr, ac), ac->name, status,
+	       WHO_HOPCOUNT(sptr, ac), ac->info);
+    (*shown)++;
+    return 1;
+}
+
+/* reply for one member of a channel search */
+static void who_member(aClient *ac, aClient *sptr, chanMember *cm)
+{
+    char status[4];
+    int i=0;
+
+    /* get rid of the pidly stuff first */
+    status[i++]=(ac->user->away==NULL ? 'H' : 'G');
+    status[i]=(IsAnOper(ac) ? '*' : ((IsInvisible(ac) &&
+				      IsOper(sptr)) ? '%' : 0));
+    status[((status[i]) ? ++i : i)]=((cm->flags&CHFL_CHANOP) ? '@'
+				     : ((cm->flags&CHFL_VOICE) ? 
+					'+' : 0));
+    status[++i]=0;
+    sendto_one(sptr, getreply(RPL_WHOREPLY), me.name, sptr->name,
+	       wsopts.channel->chname, ac->user->username,
+	       WHO_HOST(sptr,ac), WHO_SERVER(sptr, ac), ac->name, status,
+	       WHO_HOPCOUNT(sptr, ac),
+	       ac->info);
+}
+
+/* pick the match functions for the masks in wsopts */
+static void who_chkfns(void)
+{
     if(wsopts.gcos!=NULL && (strchr(wsopts.gcos, '?'))==NULL &&
        (strchr(wsopts.gcos, '*'))==NULL)
 	gchkfn=mycmp;
@@ -772,49 +843,154 @@ int m_who(aClient *cptr, aClient *sptr, int parc, char *parv[])
 	ichkfn=mycmp;
     else
 	ichkfn=match;
+}
+
+/* a channel or global WHO under way, kept with its aWhoSearch */
+struct who_search
+{
+    SOpts opts;
+    char chname[CHANNELLEN+1];	/* found again by name on resume */
+    char server[HOSTLEN+1];
+    int showall;
+    int shown;
+};
+
+/*
+ * May sptr see everyone on chptr (1), or only the visible (0)?  -1 if
+ * it is secret and sptr may see nobody there.
+ */
+static int who_chanshow(aClient *sptr, aChannel *chptr)
+{
+    if(IsMember(sptr,chptr) && (!(chptr->mode.mode & MODE_AUDITORIUM) ||
+       is_chan_opvoice(sptr, chptr) || IsAnOper(sptr)))
+	return 1;
+    if(SecretChannel(chptr) && IsAdmin(sptr))
+	return 1;
+    if(!SecretChannel(chptr) && IsAnOper(sptr))
+	return 1;
+    return SecretChannel(chptr) ? -1 : 0;
+}
 
+static void who_done(aClient *sptr)
+{
     if(wsopts.channel!=NULL)
+	sendto_one(sptr, getreply(RPL_ENDOFWHO), me.name, sptr->name,
+		   wsopts.channel->chname, "WHO");
+    else
+	sendto_one(sptr, getreply(RPL_ENDOFWHO), me.name, sptr->name,
+		   (wsopts.host!=NULL ? wsopts.host :
+		    (wsopts.nick!=NULL ? wsopts.nick :
+		     (wsopts.user!=NULL ? wsopts.user :
+		      (wsopts.gcos!=NULL ? wsopts.gcos :
+		       (wsopts.server!=NULL ? wsopts.server->name :
+			"*"))))), "WHO");
+}
+
+/* run a search until it ends or has had its slice, 1 if it has more */
+static int who_slice(aWhoSearch *ws)
+{
+    struct who_search *st=WHOSEARCH_STATE(ws);
+    aClient *sptr=ws->cptr, *ac;
+    chanMember *cm;
+
+    while((ac=whosearch_next(ws)))
     {
-	if(IsMember(sptr,wsopts.channel) && (!(wsopts.channel->mode.mode & MODE_AUDITORIUM) ||
-           is_chan_opvoice(sptr, wsopts.channel) || IsAnOper(sptr)))
-	    showall=1;
-	else if(SecretChannel(wsopts.channel) && IsAdmin(sptr))
-	    showall=1;
-	else if(!SecretChannel(wsopts.channel) && IsAnOper(sptr))
-	    showall=1;
-	else
-	    showall=0;
-	if(showall || !SecretChannel(wsopts.channel))
+	if(wsopts.channel!=NULL)
 	{
-	    for(cm=wsopts.channel->members; cm; cm=cm->next)
-	    {
-		ac=cm->cptr;
-		i=0;
-		if(!chk_who(ac,sptr,showall))
-		    continue;
-		/* If we have channel flags set, verify they match */
-		if(wsopts.channelflags && ((cm->flags & wsopts.channelflags) == 0))
-		    continue;
-		/* get rid of the pidly stuff first */
-		/* wow, they passed it all, give them the reply...
-		 * IF they haven't reached the max, or they're an oper */
-		status[i++]=(ac->user->away==NULL ? 'H' : 'G');
-		status[i]=(IsAnOper(ac) ? '*' : ((IsInvisible(ac) &&
-						  IsOper(sptr)) ? '%' : 0));
-		status[((status[i]) ? ++i : i)]=((cm->flags&CHFL_CHANOP) ? '@'
-						 : ((cm->flags&CHFL_VOICE) ? 
-						    '+' : 0));
-		status[++i]=0;
-		sendto_one(sptr, getreply(RPL_WHOREPLY), me.name, sptr->name,
-			   wsopts.channel->chname, ac->user->username,
-			   WHO_HOST(sptr,ac), WHO_SERVER(sptr, ac), ac->name, status,
-			   WHO_HOPCOUNT(sptr, ac),
-			   ac->info);
-	    }
+	    /* members may part while a search is paused */
+	    if(!(cm=find_user_member(wsopts.channel, ac)) ||
+	       !chk_who(ac,sptr,st->showall))
+		continue;
+	    /* If we have channel flags set, verify they match */
+	    if(wsopts.channelflags && ((cm->flags & wsopts.channelflags) == 0))
+		continue;
+	    who_member(ac, sptr, cm);
 	}
-	sendto_one(sptr, getreply(RPL_ENDOFWHO), me.name, sptr->name,
-		   wsopts.channel->chname, "WHO");
+	else if(!who_global(ac,sptr,st->showall,&st->shown))
+	    break;
+	if(whosearch_full(ws))
+	    return 1;
+    }
+    who_done(sptr);
+    return 0;
+}
+
+static int who_resume(aWhoSearch *ws)
+{
+    struct who_search *st=WHOSEARCH_STATE(ws);
+
+    wsopts=st->opts;
+    who_chkfns();
+    wsopts.server=st->server[0] ? find_server(st->server,NULL) : NULL;
+    if(st->chname[0])
+    {
+	/*
+	 * gone, and everyone with it, or no longer ours to see: the
+	 * asker may have parted, or it may be +s now, or new
+	 */
+	if(!(wsopts.channel=find_channel(st->chname,NullChn)) ||
+	   (st->showall=who_chanshow(ws->cptr, wsopts.channel)) < 0)
+	{
+	    sendto_one(ws->cptr, getreply(RPL_ENDOFWHO), me.name,
+		       ws->cptr->name, st->chname, "WHO");
+	    return 0;
+	}
+    }
+    return who_slice(ws);
+}
+
+/* end a paused search early, as another takes its place */
+static void who_end(aWhoSearch *ws)
+{
+    struct who_search *st=WHOSEARCH_STATE(ws);
+
+    if(st->chname[0])
+    {
+	sendto_one(ws->cptr, getreply(RPL_ENDOFWHO), me.name,
+		   ws->cptr->name, st->chname, "WHO");
+	return;
+    }
+    wsopts=st->opts;
+    wsopts.channel=NULL;
+    wsopts.server=st->server[0] ? find_server(st->server,NULL) : NULL;
+    who_done(ws->cptr);
+}
+
+/*
+ * Channel and global searches run a slice at a time, and carry on
+ * from the io loop once their time is up or the sendQ fills (see
+ * whoindex.c).  The exact nick lookup and +M are quick or bounded by
+ * the requester's channels, so they still finish here.
+ */
+int m_who(aClient *cptr, aClient *sptr, int parc, char *parv[])
+{
+    struct who_search *st;
+    aWhoSearch *ws;
+    aClient *ac, **found;
+    chanMember *cm;
+    Link *lp;
+    int shown=0, i=0, nfound, showall=IsAnOper(sptr);
+    char status[4];
+
+    /* drop nonlocal clients */
+    if(!MyClient(sptr))
 	return 0;
+
+    /* a search still paused ends here, the new one takes its place */
+    whosearch_stop(sptr);
+    
+    if(!build_searchopts(sptr, parc-1, parv+1))
+	return 0; /* /who was no good */
+    
+    who_chkfns();
+
+    if(wsopts.channel!=NULL)
+    {
+	if((showall=who_chanshow(sptr, wsopts.channel)) < 0)
+	{
+	    who_done(sptr);
+	    return 0;
+	}
     }
     /* if (for whatever reason) they gave us a nick with no
      * wildcards, just do a find_person, bewm! */
@@ -883,39 +1059,38 @@ int m_who(aClient *cptr, aClient *sptr, int parc, char *parv[])
 		shown++;
 	    }
 	}
+	who_done(sptr);
+	return 0;
     }
+
+    ws=whosearch_new(sptr, sizeof(struct who_search), who_resume, who_end,
+		     NULL);
+    st=WHOSEARCH_STATE(ws);
+    st->showall=showall;
+    if(wsopts.channel!=NULL)
+	whosearch_members(ws, wsopts.channel);
+    else if(who_index(&found, &nfound))
+	whosearch_set(ws, found, nfound);
     else
+	whosearch_clients(ws);
+
+    if(!who_slice(ws))
     {
-	for(ac=client;ac;ac=ac->next)
-	{
-	    if(!chk_who(ac,sptr,showall))
-		continue;
-	    /* wow, they passed it all, give them the reply...
-	     * IF they haven't reached the max, or they're an oper */
-	    if(shown==MAXWHOREPLIES && !IsAnOper(sptr))
-	    {
-		sendto_one(sptr, getreply(ERR_WHOLIMEXCEED), me.name, 
-			   sptr->name, MAXWHOREPLIES, "WHO");
-		break; /* break out of loop so we can send end of who */
-	    }
-	    status[0]=(ac->user->away==NULL ? 'H' : 'G');
-	    status[1]=(IsAnOper(ac) ? '*' : (IsInvisible(ac) && 
-					     IsAnOper(sptr) ? '%' : 0));
-	    status[2]=0;
-	    sendto_one(sptr, getreply(RPL_WHOREPLY), me.name, sptr->name,
-		       wsopts.show_chan ? first_visible_channel(ac, sptr) :
-		       "*", ac->user->username, WHO_HOST(sptr,ac),
-		       WHO_SERVER(sptr, ac), ac->name, status,
-		       WHO_HOPCOUNT(sptr, ac), ac->info);
-	    shown++;
-	}
+	whosearch_free(ws);
+	return 0;
     }
-    sendto_one(sptr, getreply(RPL_ENDOFWHO), me.name, sptr->name,
-	       (wsopts.host!=NULL ? wsopts.host :
-		(wsopts.nick!=NULL ? wsopts.nick :
-		 (wsopts.user!=NULL ? wsopts.user :
-		  (wsopts.gcos!=NULL ? wsopts.gcos :
-		   (wsopts.server!=NULL ? wsopts.server->name :
-		    "*"))))), "WHO");
+
+    /* parv[] is gone by the next slice */
+    wsopts.nick=whosearch_save(ws, wsopts.nick);
+    wsopts.user=whosearch_save(ws, wsopts.user);
+    wsopts.host=whosearch_save(ws, wsopts.host);
+    wsopts.gcos=whosearch_save(ws, wsopts.gcos);
+    wsopts.ip=whosearch_save(ws, wsopts.ip);
+    st->opts=wsopts;
+    if(wsopts.channel!=NULL)
+	strcpy(st->chname, wsopts.channel->chname);
+    if(wsopts.server!=NULL)
+	strcpy(st->server, wsopts.server->name);
+    whosearch_pause(ws);
     return 0;
 }
@@ -59,6 +59,17 @@ int mc_dlinks(DLink *lp)
     return c;
 }
 
+/* a client or channel hashtable, and how long its chains run */
+static void report_hashtable(aClient *cptr, char *pfxbuf, MemCount *mc,
+                             int *chains)
+{
+    sendto_one(cptr, "%s    hashtable: %d (%lu bytes)", pfxbuf, mc->c, mc->m);
+    sendto_one(cptr, "%s    hash chains: 0:%d 1:%d 2:%d 3:%d 4:%d 5:%d 6:%d"
+               " %d+:%d", pfxbuf, chains[0], chains[1], chains[2],
+               chains[3], chains[4], chains[5], chains[6], HASH_HIST - 1,
+               chains[HASH_HIST - 1]);
+}
+
 /*
  * A very long and involved function to report memory usage, along with leak
  * checking.
@@ -95,6 +106,7 @@ void report_memory_usage(aClient *cptr, int detail)
     MCsend          mc_send = {0};
     MCthrottle      mc_throttle = {0};
     MCuserban       mc_userban = {0};
+    MCwhoindex      mc_whoindex = {0};
     MCwhowas        mc_whowas = {0};
     MCzlink         mc_zlink = {0};
 #ifdef HAVE_ENCRYPTION_ON
@@ -111,7 +123,6 @@ void report_memory_usage(aClient *cptr, int detail)
     MCBlockHeap     mcbh_chanmembers = {0};
     MCBlockHeap     mcbh_users = {0};
     MCBlockHeap     mcbh_channels = {0};
-    MCBlockHeap     mcbh_hashents = {0};
 #ifdef FLUD
     MCBlockHeap     mcbh_fludbots = {0};
 #endif
@@ -121,6 +132,9 @@ void report_memory_usage(aClient *cptr, int detail)
 
     /* per generic hash counters */
     MCGenericHash   mcgh_clones = {0};
+    MCGenericHash   mcgh_scache = {0};
+    MCGenericHash   mcgh_watch = {0};
+    MCGenericHash   mcgh_member = {0};
 #ifdef THROTTLE_ENABLE
     MCGenericHash   mcgh_throttles = {0};
 #endif
@@ -155,6 +169,8 @@ void report_memory_usage(aClient *cptr, int detail)
     TracedCount     tc_scache = {0};
     TracedCount     tc_throttle = {0};
     TracedCount     tc_userban = {0};
+    TracedCount     tc_whoindex = {0};
+    TracedCount     tc_whowas = {0};
     TracedCount     tc_zlink = {0};
 #ifdef HAVE_ENCRYPTION_ON
     TracedCount     tc_dh = {0};
@@ -198,6 +214,7 @@ void report_memory_usage(aClient *cptr, int detail)
     alloc_total += memcount_send(&mc_send);
     alloc_total += memcount_throttle(&mc_throttle);
     alloc_total += memcount_userban(&mc_userban);
+    alloc_total += memcount_whoindex(&mc_whoindex);
     alloc_total += memcount_whowas(&mc_whowas);
     alloc_total += memcount_zlink(&mc_zlink);
 #ifdef HAVE_ENCRYPTION_ON
@@ -224,8 +241,6 @@ void report_memory_usage(aClient *cptr, int detail)
                                      &mcbh_chanmembers);
     alloc_heap += memcount_BlockHeap(mc_list.e_users_heap, &mcbh_users);
     alloc_heap += memcount_BlockHeap(mc_list.e_channels_heap, &mcbh_channels);
-    alloc_heap += memcount_BlockHeap(mc_throttle.e_hashent_heap,
-                                     &mcbh_hashents);
 #ifdef FLUD
     alloc_heap += memcount_BlockHeap(mc_list.e_fludbots_heap, &mcbh_fludbots);
 #endif
@@ -243,7 +258,6 @@ void report_memory_usage(aClient *cptr, int detail)
     use_heap += mcbh_chanmembers.objects.m + mcbh_chanmembers.management.m;
     use_heap += mcbh_users.objects.m + mcbh_users.management.m;
     use_heap += mcbh_channels.objects.m + mcbh_channels.management.m;
-    use_heap += mcbh_hashents.objects.m + mcbh_hashents.management.m;
 #ifdef FLUD
     use_heap += mcbh_fludbots.objects.m + mcbh_fludbots.management.m;
 #endif
@@ -256,6 +270,9 @@ void report_memory_usage(aClient *cptr, int detail)
 
     /* generic hashes */
     use_hash += memcount_GenericHash(mc_clones.e_hash, &mcgh_clones);
+    use_hash += memcount_GenericHash(mc_scache.e_hash, &mcgh_scache);
+    use_hash += memcount_GenericHash(mc_hash.e_watchhash, &mcgh_watch);
+    use_hash += memcount_GenericHash(mc_hash.e_memberhash, &mcgh_member);
 #ifdef THROTTLE_ENABLE
     use_hash += memcount_GenericHash(mc_throttle.e_throttle_hash,
                                      &mcgh_throttles);
@@ -297,6 +314,10 @@ void report_memory_usage(aClient *cptr, int detail)
      */
     if (detail)
         sendto_one(cptr, "%sClients", pfxbuf);
+    if (detail)
+        sendto_one(cptr, "%s    per client: %lu hot, %lu remote, %lu local "
+                   "bytes", pfxbuf, (u_long) CLIENT_HOT_SIZE,
+                   (u_long) CLIENT_REMOTE_SIZE, (u_long) CLIENT_LOCAL_SIZE);
     subtotal = 0;
     if (detail && mc_s_user.e_local_clients)
         sendto_one(cptr, "%s    local clients: %d (%lu bytes)", pfxbuf,
@@ -317,6 +338,10 @@ void report_memory_usage(aClient *cptr, int detail)
         sendto_one(cptr, "%s    watches: %d (%lu bytes)", pfxbuf,
                    mc_hash.watches.c, mc_hash.watches.m);
     subtotal += mc_hash.watches.m;
+    if (detail)
+        sendto_one(cptr, "%s    watch hash slots: %d (%lu bytes)", pfxbuf,
+                   mcgh_watch.buckets.c, mcgh_watch.total.m);
+    subtotal += mcgh_watch.total.m;
     if (detail && mc_s_user.aways.c)
         sendto_one(cptr, "%s    away messages: %d (%lu bytes)", pfxbuf,
                    mc_s_user.aways.c, mc_s_user.aways.m);
@@ -382,6 +407,10 @@ void report_memory_usage(aClient *cptr, int detail)
                    mc_clientlist.e_recvq_dlinks,
                    mc_clientlist.e_recvq_dlinks * mcbh_dlinks.objsize);
     subtotal += mc_clientlist.e_recvq_dlinks * mcbh_dlinks.objsize;
+    if (detail)
+        report_hashtable(cptr, pfxbuf, &mc_hash.clienthash,
+                         mc_hash.clientchains);
+    subtotal += mc_hash.clienthash.m;
 
     if (detail)
         sendto_one(cptr, "%s    TOTAL: %lu bytes", pfxbuf, subtotal);
@@ -484,11 +513,19 @@ void report_memory_usage(aClient *cptr, int detail)
         sendto_one(cptr, "%s    active list options: %d (%lu bytes)", pfxbuf,
                    mc_channel.lopts.c, mc_channel.lopts.m);
     subtotal += mc_channel.lopts.m;
+    if (detail && mc_channel.fanout.c)
+        sendto_one(cptr, "%s    fanout sets: %d (%lu bytes)", pfxbuf,
+                   mc_channel.fanout.c, mc_channel.fanout.m);
+    subtotal += mc_channel.fanout.m;
     if (detail && mc_channel.e_chanmembers)
         sendto_one(cptr, "%s    channel members: %d (%lu bytes)", pfxbuf,
                    mc_channel.e_chanmembers,
                    mc_channel.e_chanmembers * mcbh_chanmembers.objsize);
     subtotal += mc_channel.e_chanmembers * mcbh_chanmembers.objsize;
+    if (detail)
+        sendto_one(cptr, "%s    member hash slots: %d (%lu bytes)", pfxbuf,
+                   mcgh_member.buckets.c, mcgh_member.total.m);
+    subtotal += mcgh_member.total.m;
 #ifdef FLUD
     if (detail && mc_channel.e_fludbots)
         sendto_one(cptr, "%s    fludbots: %d (%lu bytes)", pfxbuf,
@@ -511,6 +548,10 @@ void report_memory_usage(aClient *cptr, int detail)
                    mc_channel.e_dlinks,
                    mc_channel.e_dlinks * mcbh_dlinks.objsize);
     subtotal += mc_channel.e_dlinks * mcbh_dlinks.objsize;
+    if (detail)
+        report_hashtable(cptr, pfxbuf, &mc_hash.channelhash,
+                         mc_hash.channelchains);
+    subtotal += mc_hash.channelhash.m;
 
     if (detail)
         sendto_one(cptr, "%s    TOTAL: %lu bytes", pfxbuf, subtotal);
@@ -542,6 +583,10 @@ void report_memory_usage(aClient *cptr, int detail)
         sendto_one(cptr, "%s    entries: %d (%lu bytes)", pfxbuf,
                    mc_userban.entries.c, mc_userban.entries.m);
     subtotal += mc_userban.entries.m;
+    if (detail && mc_userban.cidrnodes.c)
+        sendto_one(cptr, "%s    CIDR nodes: %d (%lu bytes)", pfxbuf,
+                   mc_userban.cidrnodes.c, mc_userban.cidrnodes.m);
+    subtotal += mc_userban.cidrnodes.m;
     if (detail && mc_userban.userbans.c)
         sendto_one(cptr, "%s    userbans: %d (%lu bytes)", pfxbuf,
                    mc_userban.userbans.c, mc_userban.userbans.m);
@@ -674,14 +719,10 @@ void report_memory_usage(aClient *cptr, int detail)
                    mcgh_clones.hashtable.c, mcgh_clones.hashtable.m);
     subtotal += mcgh_clones.hashtable.m;
     if (detail && mcgh_clones.buckets.c)
-        sendto_one(cptr, "%s    hash buckets: %d (%lu bytes)", pfxbuf,
-                   mcgh_clones.buckets.c, mcgh_clones.buckets.m);
+        sendto_one(cptr, "%s    hash slots: %d (%lu bytes), %d in use",
+                   pfxbuf, mcgh_clones.buckets.c, mcgh_clones.buckets.m,
+                   mcgh_clones.entries);
     subtotal += mcgh_clones.buckets.m;
-    if (detail && mcgh_clones.e_hashents)
-        sendto_one(cptr, "%s    hash entries: %d (%lu bytes)", pfxbuf,
-                   mcgh_clones.e_hashents,
-                   mcgh_clones.e_hashents * mcbh_hashents.objsize);
-    subtotal += mcgh_clones.e_hashents * mcbh_hashents.objsize;
 
     if (detail)
         sendto_one(cptr, "%s    TOTAL: %lu bytes", pfxbuf, subtotal);
@@ -690,7 +731,6 @@ void report_memory_usage(aClient *cptr, int detail)
     rep_total += subtotal;
 
     mcbh_clones.knownobjs += mc_clones.e_cloneents;
-    mcbh_hashents.knownobjs += mcgh_clones.e_hashents;
 
 
 #ifdef THROTTLE_ENABLE
@@ -710,14 +750,10 @@ void report_memory_usage(aClient *cptr, int detail)
                    mcgh_throttles.hashtable.c, mcgh_throttles.hashtable.m);
     subtotal += mcgh_throttles.hashtable.m;
     if (detail && mcgh_throttles.buckets.c)
-        sendto_one(cptr, "%s    hash buckets: %d (%lu bytes)", pfxbuf,
-                   mcgh_throttles.buckets.c, mcgh_throttles.buckets.m);
+        sendto_one(cptr, "%s    hash slots: %d (%lu bytes), %d in use",
+                   pfxbuf, mcgh_throttles.buckets.c, mcgh_throttles.buckets.m,
+                   mcgh_throttles.entries);
     subtotal += mcgh_throttles.buckets.m;
-    if (detail && mcgh_throttles.e_hashents)
-        sendto_one(cptr, "%s    hash entries: %d (%lu bytes)", pfxbuf,
-                   mcgh_throttles.e_hashents,
-                   mcgh_throttles.e_hashents * mcbh_hashents.objsize);
-    subtotal += mcgh_throttles.e_hashents * mcbh_hashents.objsize;
 
     if (detail)
         sendto_one(cptr, "%s    TOTAL: %lu bytes", pfxbuf, subtotal);
@@ -726,10 +762,70 @@ void report_memory_usage(aClient *cptr, int detail)
     rep_total += subtotal;
 
     mcbh_throttles.knownobjs += mc_throttle.e_throttles;
-    mcbh_hashents.knownobjs += mcgh_throttles.e_hashents;
 #endif
 
 
+    /*
+     * Detail whowas history memory.
+     */
+    if (detail)
+        sendto_one(cptr, "%sWhowas", pfxbuf);
+    subtotal = 0;
+    if (detail && mc_whowas.generations.c)
+        sendto_one(cptr, "%s    generations: %d (%lu bytes), %d entries",
+                   pfxbuf, mc_whowas.generations.c, mc_whowas.generations.m,
+                   mc_whowas.entries);
+    subtotal += mc_whowas.generations.m;
+    if (detail && mc_whowas.nicks.c)
+        sendto_one(cptr, "%s    nicknames: %d (%lu bytes)", pfxbuf,
+                   mc_whowas.nicks.c, mc_whowas.nicks.m);
+    subtotal += mc_whowas.nicks.m;
+    if (detail && mc_whowas.strings.c)
+        sendto_one(cptr, "%s    strings: %d (%lu bytes)", pfxbuf,
+                   mc_whowas.strings.c, mc_whowas.strings.m);
+    subtotal += mc_whowas.strings.m;
+    if (detail)
+    {
+        report_hashtable(cptr, pfxbuf, &mc_whowas.nickhash,
+                         mc_whowas.nickchains);
+        sendto_one(cptr, "%s    string hashtable: %d (%lu bytes)", pfxbuf,
+                   mc_whowas.stringhash.c, mc_whowas.stringhash.m);
+    }
+    subtotal += mc_whowas.nickhash.m + mc_whowas.stringhash.m;
+
+    if (detail)
+        sendto_one(cptr, "%s    TOTAL: %lu bytes", pfxbuf, subtotal);
+    else
+        sendto_one(cptr, "%sWhowas: %lu bytes", pfxbuf, subtotal);
+    rep_total += subtotal;
+
+
+    /*
+     * Detail WHO index memory.
+     */
+    if (detail)
+        sendto_one(cptr, "%sWho index", pfxbuf);
+    subtotal = 0;
+    if (detail && mc_whoindex.nodes.c)
+        sendto_one(cptr, "%s    nodes: %d (%lu bytes)", pfxbuf,
+                   mc_whoindex.nodes.c, mc_whoindex.nodes.m);
+    subtotal += mc_whoindex.nodes.m;
+    if (detail && mc_whoindex.leaves.c)
+        sendto_one(cptr, "%s    keys: %d (%lu bytes)", pfxbuf,
+                   mc_whoindex.leaves.c, mc_whoindex.leaves.m);
+    subtotal += mc_whoindex.leaves.m;
+    if (detail && mc_whoindex.searches.c)
+        sendto_one(cptr, "%s    paused searches: %d (%lu bytes)", pfxbuf,
+                   mc_whoindex.searches.c, mc_whoindex.searches.m);
+    subtotal += mc_whoindex.searches.m;
+
+    if (detail)
+        sendto_one(cptr, "%s    TOTAL: %lu bytes", pfxbuf, subtotal);
+    else
+        sendto_one(cptr, "%sWho index: %lu bytes", pfxbuf, subtotal);
+    rep_total += subtotal;
+
+
     /*
      * Detail miscellaneous memory.
      */
@@ -753,20 +849,24 @@ void report_memory_usage(aClient *cptr, int detail)
         sendto_one(cptr, "%s    module hooks: %d (%lu bytes)", pfxbuf,
                    mc_modules.hooks.c, mc_modules.hooks.m);
     subtotal += mc_modules.hooks.m;
+    if (detail && mc_modules.hooktabs.c)
+        sendto_one(cptr, "%s    module hook tables: %d (%lu bytes)", pfxbuf,
+                   mc_modules.hooktabs.c, mc_modules.hooktabs.m);
+    subtotal += mc_modules.hooktabs.m;
     if (detail && mc_modules.e_dlinks)
         sendto_one(cptr, "%s    module dlinks: %d (%lu bytes)", pfxbuf,
                    mc_modules.e_dlinks,
                    mc_modules.e_dlinks * mcbh_dlinks.objsize);
     subtotal += mc_modules.e_dlinks * mcbh_dlinks.objsize;
 #endif
-    if (detail && mc_parse.msgnodes.c)
-        sendto_one(cptr, "%s    parser nodes: %d (%lu bytes)", pfxbuf,
-                   mc_parse.msgnodes.c, mc_parse.msgnodes.m);
-    subtotal += mc_parse.msgnodes.m;
     if (detail && mc_res.cached.c)
         sendto_one(cptr, "%s    dns cache entries: %d (%lu bytes)", pfxbuf,
                    mc_res.cached.c, mc_res.cached.m);
     subtotal += mc_res.cached.m;
+    if (detail && mc_res.negcached.c)
+        sendto_one(cptr, "%s    dns negative entries: %d (%lu bytes)", pfxbuf,
+                   mc_res.negcached.c, mc_res.negcached.m);
+    subtotal += mc_res.negcached.m;
     if (detail && mc_res.requests.c)
         sendto_one(cptr, "%s    dns active requests: %d (%lu bytes)", pfxbuf,
                    mc_res.requests.c, mc_res.requests.m);
@@ -785,6 +885,10 @@ void report_memory_usage(aClient *cptr, int detail)
         sendto_one(cptr, "%s    scache: %d (%lu bytes)", pfxbuf,
                    mc_scache.cached.c, mc_scache.cached.m);
     subtotal += mc_scache.cached.m;
+    if (detail)
+        sendto_one(cptr, "%s    scache hash slots: %d (%lu bytes)", pfxbuf,
+                   mcgh_scache.buckets.c, mcgh_scache.total.m);
+    subtotal += mcgh_scache.total.m;
 
     if (detail)
         sendto_one(cptr, "%s    TOTAL: %lu bytes", pfxbuf, subtotal);
@@ -941,19 +1045,6 @@ void report_memory_usage(aClient *cptr, int detail)
     }
     subtotal += mcbh_throttles.total.m - mcbh_throttles.objects.m;
 #endif
-    if (detail)
-    {
-        sendto_one(cptr, "%s    hash entries:", pfxbuf);
-        sendto_one(cptr, "%s        objects: %d (%lu bytes)"
-                   " [pool: %d (%lu bytes)]", pfxbuf,
-                   mcbh_hashents.objects.c, mcbh_hashents.objects.m,
-                   mcbh_hashents.pool.c, mcbh_hashents.pool.m);
-        sendto_one(cptr, "%s        overhead: %lu bytes"
-                   " [blocks: %d (%lu bytes)]", pfxbuf,
-                   mcbh_hashents.management.m,
-                   mcbh_hashents.blocks.c, mcbh_hashents.blocks.m);
-    }
-    subtotal += mcbh_hashents.total.m - mcbh_hashents.objects.m;
 
     /* subtotal does not recount allocated objects, so sum of displayed
        subtotals matches final total */
@@ -1013,30 +1104,15 @@ void report_memory_usage(aClient *cptr, int detail)
     {
         sendto_one(cptr, "%sStatic Resources (not part of total)", pfxbuf);
         subtotal = 0;
-        sendto_one(cptr, "%s    client hashtable: %d (%lu bytes)", pfxbuf,
-                   mc_hash.s_clienthash.c, mc_hash.s_clienthash.m);
-        subtotal += mc_hash.s_clienthash.m;
-        sendto_one(cptr, "%s    channel hashtable: %d (%lu bytes)", pfxbuf,
-                   mc_hash.s_channelhash.c, mc_hash.s_channelhash.m);
-        subtotal += mc_hash.s_channelhash.m;
         sendto_one(cptr, "%s    dns cache hashtable: %d (%lu bytes)", pfxbuf,
                    mc_res.s_cachehash.c, mc_res.s_cachehash.m);
         subtotal += mc_res.s_cachehash.m;
+        sendto_one(cptr, "%s    dns negative hashtable: %d (%lu bytes)",
+                   pfxbuf, mc_res.s_neghash.c, mc_res.s_neghash.m);
+        subtotal += mc_res.s_neghash.m;
         sendto_one(cptr, "%s    dns request hashtable: %d (%lu bytes)",
                    pfxbuf, mc_res.s_requesthash.c, mc_res.s_requesthash.m);
         subtotal += mc_res.s_requesthash.m;
-        sendto_one(cptr, "%s    scache hashtable: %d (%lu bytes)", pfxbuf,
-                   mc_scache.s_hash.c, mc_scache.s_hash.m);
-        subtotal += mc_scache.s_hash.m;
-        sendto_one(cptr, "%s    watch hashtable: %d (%lu bytes)", pfxbuf,
-                   mc_hash.s_watchhash.c, mc_hash.s_watchhash.m);
-        subtotal += mc_hash.s_watchhash.m;
-        sendto_one(cptr, "%s    whowas hashtable: %d (%lu bytes)", pfxbuf,
-                   mc_whowas.s_hash.c, mc_whowas.s_hash.m);
-        subtotal += mc_whowas.s_hash.m;
-        sendto_one(cptr, "%s    whowas array: %d (%lu bytes)", pfxbuf,
-                   mc_whowas.s_whowas.c, mc_whowas.s_whowas.m);
-        subtotal += mc_whowas.s_whowas.m;
         sendto_one(cptr, "%s    fd master table: %d (%lu bytes)", pfxbuf,
                    mc_fds.s_fdlist.c, mc_fds.s_fdlist.m);
         subtotal += mc_fds.s_fdlist.m;
@@ -1057,6 +1133,9 @@ void report_memory_usage(aClient *cptr, int detail)
         sendto_one(cptr, "%s    configuration buffers: %d (%lu bytes)",
                    pfxbuf, mc_ircd.s_confbuf.c, mc_ircd.s_confbuf.m);
         subtotal += mc_ircd.s_confbuf.m;
+        sendto_one(cptr, "%s    kline journal buffers: %d (%lu bytes)",
+                   pfxbuf, mc_klines.s_bufs.c, mc_klines.s_bufs.m);
+        subtotal += mc_klines.s_bufs.m;
         sendto_one(cptr, "%s    parse buffers: %d (%lu bytes)", pfxbuf,
                    mc_parse.s_bufs.c, mc_parse.s_bufs.m);
         subtotal += mc_parse.s_bufs.m;
@@ -1161,14 +1240,6 @@ void report_memory_usage(aClient *cptr, int detail)
                    diff * mcbh_channels.objsize);
     }
 
-    if (mcbh_hashents.knownobjs != mcbh_hashents.objects.c)
-    {
-        int diff = mcbh_hashents.objects.c - mcbh_hashents.knownobjs;
-        sendto_one(cptr, "%sLEAK: %d objects (%lu bytes)"
-                   " from hashents blockheap", pfxbuf, diff,
-                   diff * mcbh_hashents.objsize);
-    }
-
 #ifdef FLUD
     if (mcbh_fludbots.knownobjs != mcbh_fludbots.objects.c)
     {
@@ -1215,12 +1286,13 @@ void report_memory_usage(aClient *cptr, int detail)
             memtrace_report(cptr, mc_channel.file);
     }
 
-    /* hash.c */
+    /* hash.c, which also allocates the whowas tables */
     traced_total += memtrace_count(&tc_hash, mc_hash.file);
-    if (mc_hash.total.m != tc_hash.allocated.m)
+    subtotal = mc_hash.total.m + mc_whowas.nickhash.m + mc_whowas.stringhash.m;
+    if (subtotal != tc_hash.allocated.m)
     {
         sendto_one(cptr, "%sLEAK: %ld bytes from watch hash", pfxbuf,
-                   tc_hash.allocated.m - mc_hash.total.m);
+                   tc_hash.allocated.m - subtotal);
         if (detail)
             memtrace_report(cptr, mc_hash.file);
     }
@@ -1317,7 +1389,8 @@ void report_memory_usage(aClient *cptr, int detail)
 
     /* throttle.c */
     traced_total += memtrace_count(&tc_throttle, mc_throttle.file);
-    subtotal = mcgh_clones.total.m;
+    subtotal = mcgh_clones.total.m + mcgh_scache.total.m + mcgh_watch.total.m +
+               mcgh_member.total.m;
 #ifdef THROTTLE_ENABLE
     subtotal += mcgh_throttles.total.m;
 #endif
@@ -1329,6 +1402,26 @@ void report_memory_usage(aClient *cptr, int detail)
             memtrace_report(cptr, mc_throttle.file);
     }
 
+    /* whoindex.c */
+    traced_total += memtrace_count(&tc_whoindex, mc_whoindex.file);
+    if (mc_whoindex.total.m != tc_whoindex.allocated.m)
+    {
+        sendto_one(cptr, "%sLEAK: %ld bytes from who index", pfxbuf,
+                   tc_whoindex.allocated.m - mc_whoindex.total.m);
+        if (detail)
+            memtrace_report(cptr, mc_whoindex.file);
+    }
+
+    /* whowas.c */
+    traced_total += memtrace_count(&tc_whowas, mc_whowas.file);
+    if (mc_whowas.total.m != tc_whowas.allocated.m)
+    {
+        sendto_one(cptr, "%sLEAK: %ld bytes from whowas", pfxbuf,
+                   tc_whowas.allocated.m - mc_whowas.total.m);
+        if (detail)
+            memtrace_report(cptr, mc_whowas.file);
+    }
+
     /* zlink.c */
     traced_total += memtrace_count(&tc_zlink, mc_zlink.file);
     subtotal = 0;
@@ -1435,6 +1528,8 @@ void report_memory_usage(aClient *cptr, int detail)
     subtotal += tc_scache.management.m;
     subtotal += tc_throttle.management.m;
     subtotal += tc_userban.management.m;
+    subtotal += tc_whoindex.management.m;
+    subtotal += tc_whowas.management.m;
     subtotal += tc_zlink.management.m;
 #ifdef HAVE_ENCRYPTION_ON
     subtotal += tc_dh.management.m;
@@ -56,8 +56,16 @@ m_module(aClient *cptr, aClient *sptr, int parc, char *parv[])
     return 0;
 }
 
+int hooks_set[HOOK_TYPES];
+
+int 
+run_hooks(enum c_hooktype hooktype, ...)
+{
+    return 0;
+}
+
 int 
-call_hooks(enum c_hooktype hooktype, ...)
+(call_hooks)(enum c_hooktype hooktype, ...)
 {
     return 0;
 }
@@ -102,6 +110,7 @@ void *bircmodule_malloc(int);
 void  bircmodule_free(void *);
 void  drop_all_hooks(aModule *owner);
 void  list_hooks(aClient *sptr);
+static void module_close(void *handle);
 
 aModule *
 find_module(char *name) 
@@ -187,7 +196,7 @@ void
 destroy_module(aModule *themod)
 {
     (*themod->module_shutdown)();
-    dlclose(themod->handle);
+    module_close(themod->handle);
     bircmodule_free(themod->name);
     bircmodule_free(themod->version);
     bircmodule_free(themod->description);   
@@ -475,30 +484,27 @@ typedef struct module_hook
     aModule *owner;
     void *funcptr;
     int hooktype;
+    unsigned long calls;
+    unsigned long usec;         /* total time spent in the hook */
+    unsigned long maxusec;
 } aHook;
 
-static DLink *preaccess_hooks = NULL;
-static DLink *onaccess_hooks = NULL;
-static DLink *postaccess_hooks = NULL;
-static DLink *postmotd_hooks = NULL;
-static DLink *msg_hooks = NULL;
-static DLink *chanmsg_hooks = NULL;
-static DLink *usermsg_hooks = NULL;
-static DLink *mymsg_hooks = NULL;
-static DLink *every10_hooks = NULL;
-static DLink *join_hooks = NULL;
-static DLink *sendburst_hooks = NULL;
-static DLink *throttle_hooks = NULL;
-static DLink *forbid_hooks = NULL;
-static DLink *whois_hooks = NULL;
-static DLink *maskhost_hooks = NULL;
-static DLink *floodwarn_hooks = NULL;
-static DLink *spamwarn_hooks = NULL;
-static DLink *signoff_hooks = NULL;
-static DLink *mload_hooks = NULL;
-static DLink *munload_hooks = NULL;
-
+/*
+ * Every registered hook is on all_hooks.  For dispatch, each hook type
+ * also has a NULL terminated array of its hooks, rebuilt whenever one is
+ * added or removed; hooks_set[] holds their counts for call_hooks() to
+ * test.  A hook may remove hooks, or unload a module, its own included,
+ * while run_hooks() is running: removed hooks lose their funcptr, so the
+ * table being walked skips them, and they, the old tables and the
+ * modules' code are only freed once the outermost run_hooks() returns.
+ */
 static DLink *all_hooks = NULL;
+static aHook **hooktab[HOOK_TYPES];
+static DLink *hooks_retired = NULL;
+static DLink *modules_retired = NULL;   /* dlopen() handles */
+static int hooks_running = 0;
+
+int hooks_set[HOOK_TYPES];
 
 char *
 get_texthooktype(enum c_hooktype hooktype)
@@ -573,103 +579,103 @@ get_texthooktype(enum c_hooktype hooktype)
     }
 }
 
-DLink **
-get_hooklist(enum c_hooktype hooktype)
+static void
+hook_retire(void *p)
 {
-    DLink **hooklist;
-
-    switch(hooktype)
-    {
-        case CHOOK_10SEC:
-            hooklist = &every10_hooks;
-            break;
-
-        case CHOOK_PREACCESS:
-            hooklist = &preaccess_hooks;
-            break;
-
-        case CHOOK_ONACCESS:
-            hooklist = &onaccess_hooks;
-            break;
-
-        case CHOOK_POSTACCESS:
-            hooklist = &postaccess_hooks;
-            break;
-
-        case CHOOK_POSTMOTD:
-            hooklist = &postmotd_hooks;
-            break;
-
-        case CHOOK_MSG:
-            hooklist = &msg_hooks;
-            break;
-
-        case CHOOK_CHANMSG:
-            hooklist = &chanmsg_hooks;
-            break;
-
-        case CHOOK_USERMSG:
-            hooklist = &usermsg_hooks;
-            break;
-
-        case CHOOK_MYMSG:
-            hooklist = &mymsg_hooks;
-            break;
-
-        case CHOOK_JOIN:
-            hooklist = &join_hooks;
-            break;
-
-        case CHOOK_SENDBURST:
-            hooklist = &sendburst_hooks;
-            break;
+    if(hooks_running)
+        add_to_list(&hooks_retired, p);
+    else
+        bircmodule_free(p);
+}
 
-        case CHOOK_THROTTLE:
-            hooklist = &throttle_hooks;
-            break;
+static void
+hook_reap()
+{
+    DLink *lp, *lpn;
 
-        case CHOOK_FORBID:
-            hooklist = &forbid_hooks;
-            break;
+    for(lp = hooks_retired; lp; lp = lpn)
+    {
+        lpn = lp->next;
+        bircmodule_free(lp->value.cp);
+        free_dlink(lp);
+    }
+    hooks_retired = NULL;
 
-        case CHOOK_WHOIS:
-            hooklist = &whois_hooks;
-            break;
+    for(lp = modules_retired; lp; lp = lpn)
+    {
+        lpn = lp->next;
+        dlclose(lp->value.cp);
+        free_dlink(lp);
+    }
+    modules_retired = NULL;
+}
 
-        case CHOOK_MASKHOST:
-            hooklist = &maskhost_hooks;
-            break;
+static void
+module_close(void *handle)
+{
+    if(hooks_running)
+        add_to_list(&modules_retired, handle);
+    else
+        dlclose(handle);
+}
 
-        case CHOOK_FLOODWARN:
-            hooklist = &floodwarn_hooks;
-            break;
+/* the next live hook in a dispatch table, from *hpp on */
+static aHook *
+hook_live(aHook ***hpp)
+{
+    while(**hpp && !(**hpp)->funcptr)
+        (*hpp)++;
+    return **hpp;
+}
 
-        case CHOOK_SPAMWARN:
-            hooklist = &spamwarn_hooks;
-            break;
+/* rebuild the dispatch table for one hook type from all_hooks */
+static void
+hook_rebuild(int hooktype)
+{
+    aHook **tab = NULL;
+    DLink *lp;
+    int n = 0;
 
-        case CHOOK_SIGNOFF:
-            hooklist = &signoff_hooks;
-            break;
+    for(lp = all_hooks; lp; lp = lp->next)
+        if(((aHook *) lp->value.cp)->hooktype == hooktype)
+            n++;
 
-        case MHOOK_LOAD:
-            hooklist = &mload_hooks;
-            break;
+    if(n)
+    {
+        tab = (aHook **) bircmodule_malloc((n + 1) * sizeof(aHook *));
+        n = 0;
+        for(lp = all_hooks; lp; lp = lp->next)
+            if(((aHook *) lp->value.cp)->hooktype == hooktype)
+                tab[n++] = (aHook *) lp->value.cp;
+        tab[n] = NULL;
+    }
 
-        case MHOOK_UNLOAD:
-            hooklist = &munload_hooks;
-            break;
+    if(hooktab[hooktype])
+        hook_retire(hooktab[hooktype]);
+    hooktab[hooktype] = tab;
+    hooks_set[hooktype] = n;
+}
 
-        default:
-            return NULL;
-    }
-    return hooklist;
+/* account the time one hook call took */
+static void
+hook_timing(aHook *hk, struct timeval *start)
+{
+    struct timeval now;
+    unsigned long usec;
+
+    gettimeofday(&now, NULL);
+    usec = (now.tv_sec - start->tv_sec) * 1000000 +
+           (now.tv_usec - start->tv_usec);
+    hk->calls++;
+    hk->usec += usec;
+    if(usec > hk->maxusec)
+        hk->maxusec = usec;
 }
 
 void 
 drop_all_hooks(aModule *owner)
 {
-    DLink *lp, *lpn, **hooklist;
+    DLink *lp, *lpn;
 
     for(lp = all_hooks; lp; lp = lpn)
     {
@@ -683,11 +689,10 @@ drop_all_hooks(aModule *owner)
                             " for opaque %lu", get_texthooktype(hk->hooktype), 
                             (u_long) owner);
 
-            hooklist = get_hooklist((enum c_hooktype) hk->hooktype);
-
-            remove_from_list(hooklist, hk, NULL);
             remove_from_list(&all_hooks, hk, NULL);
-            bircmodule_free(hk);
+            hook_rebuild(hk->hooktype);
+            hk->funcptr = NULL;
+            hook_retire(hk);
         }
     }
 }
@@ -695,7 +700,6 @@ drop_all_hooks(aModule *owner)
 void *
 bircmodule_add_hook(enum c_hooktype hooktype, void *opaque, void *funcptr)
 {
-    DLink **hooklist;
     aHook *hk;
     aModule *owner;
 
@@ -706,16 +710,17 @@ bircmodule_add_hook(enum c_hooktype hooktype, void *opaque, void *funcptr)
         return NULL;
     }
 
-    if((hooklist = get_hooklist(hooktype)) == NULL)
+    if((unsigned) hooktype >= HOOK_TYPES)
         return NULL;
 
     hk = (aHook *) bircmodule_malloc(sizeof(aHook));
+    memset(hk, 0, sizeof(aHook));
     hk->owner = owner;
     hk->funcptr = funcptr;
     hk->hooktype = (int) hooktype;
 
     add_to_list(&all_hooks, hk);
-    add_to_list(hooklist, hk);
+    hook_rebuild(hooktype);
 
     return (void *) hk;
 }
@@ -723,7 +728,7 @@ bircmodule_add_hook(enum c_hooktype hooktype, void *opaque, void *funcptr)
 void 
 bircmodule_del_hook(void *opaque)
 {
-    DLink *lp, *lpn, **hooklist;
+    DLink *lp, *lpn;
 
     for(lp = all_hooks; lp; lp = lpn)
     {
@@ -733,31 +738,36 @@ bircmodule_del_hook(void *opaque)
 
         if((void *) hk == opaque)
         {
-            hooklist = get_hooklist((enum c_hooktype) hk->hooktype);
-
-            remove_from_list(hooklist, hk, NULL);
             remove_from_list(&all_hooks, hk, NULL);
-            bircmodule_free(hk);
+            hook_rebuild(hk->hooktype);
+            hk->funcptr = NULL;
+            hook_retire(hk);
         }
     }
 }
 
-int 
-call_hooks(enum c_hooktype hooktype, ...)
+static int 
+run_hooks_va(enum c_hooktype hooktype, va_list vl)
 {
-    va_list vl;
     int ret = 0;
-    DLink *lp;
+    aHook **hp, *hk;
+    struct timeval start;
 
-    va_start(vl, hooktype);
+    /* call_hooks() normally sees to this */
+    if((unsigned) hooktype < HOOK_TYPES && !hooktab[hooktype])
+        return 0;
+
+    hooks_running++;
 
     switch(hooktype)
     {
         case CHOOK_10SEC:
-            for(lp = every10_hooks; lp; lp = lp->next)
+            for(hp = hooktab[hooktype]; (hk = hook_live(&hp)); hp++)
             {
-                void (*rfunc) () = ((aHook *)lp->value.cp)->funcptr;
+                void (*rfunc) () = hk->funcptr;
+                gettimeofday(&start, NULL);
                 (*rfunc)();
+                hook_timing(hk, &start);
             }
             break;
 
@@ -765,10 +775,13 @@ call_hooks(enum c_hooktype hooktype, ...)
             {
                 aClient *acptr = va_arg(vl, aClient *);
 
-                for(lp = preaccess_hooks; lp; lp = lp->next)
+                for(hp = hooktab[hooktype]; (hk = hook_live(&hp)); hp++)
                 {
-                    int (*rfunc) (aClient *) = ((aHook *)lp->value.cp)->funcptr;
-                    if((ret = (*rfunc)(acptr)) == FLUSH_BUFFER)
+                    int (*rfunc) (aClient *) = hk->funcptr;
+                    gettimeofday(&start, NULL);
+                    ret = (*rfunc)(acptr);
+                    hook_timing(hk, &start);
+                    if(ret == FLUSH_BUFFER)
                         break;
                 }
                 break;
@@ -782,11 +795,14 @@ call_hooks(enum c_hooktype hooktype, ...)
                 char *server = va_arg(vl, char *);
                 char *realname = va_arg(vl, char *);
 
-                for(lp = onaccess_hooks; lp; lp = lp->next)
+                for(hp = hooktab[hooktype]; (hk = hook_live(&hp)); hp++)
                 {
                     int (*rfunc) (aClient *, char *, char *, char *, char *) =
-                                    ((aHook *)lp->value.cp)->funcptr;
-                    if((ret = (*rfunc)(acptr, username, host, server, realname)) == FLUSH_BUFFER)
+                                    hk->funcptr;
+                    gettimeofday(&start, NULL);
+                    ret = (*rfunc)(acptr, username, host, server, realname);
+                    hook_timing(hk, &start);
+                    if(ret == FLUSH_BUFFER)
                         break;
                 }
                 break;
@@ -796,10 +812,13 @@ call_hooks(enum c_hooktype hooktype, ...)
             {
                 aClient *acptr = va_arg(vl, aClient *);
 
-                for(lp = postaccess_hooks; lp; lp = lp->next)
+                for(hp = hooktab[hooktype]; (hk = hook_live(&hp)); hp++)
                 {
-                    int (*rfunc) (aClient *) = ((aHook *)lp->value.cp)->funcptr;
-                    if((ret = (*rfunc)(acptr)) == FLUSH_BUFFER)
+                    int (*rfunc) (aClient *) = hk->funcptr;
+                    gettimeofday(&start, NULL);
+                    ret = (*rfunc)(acptr);
+                    hook_timing(hk, &start);
+                    if(ret == FLUSH_BUFFER)
                         break;
                 }
                 break;
@@ -809,10 +828,13 @@ call_hooks(enum c_hooktype hooktype, ...)
             {
                 aClient *acptr = va_arg(vl, aClient *);
 
-                for(lp = postmotd_hooks; lp; lp = lp->next)
+                for(hp = hooktab[hooktype]; (hk = hook_live(&hp)); hp++)
                 {
-                    int (*rfunc) (aClient *) = ((aHook *)lp->value.cp)->funcptr;
-                    if((ret = (*rfunc)(acptr)) == FLUSH_BUFFER)
+                    int (*rfunc) (aClient *) = hk->funcptr;
+                    gettimeofday(&start, NULL);
+                    ret = (*rfunc)(acptr);
+                    hook_timing(hk, &start);
+                    if(ret == FLUSH_BUFFER)
                         break;
                 }
                 break;
@@ -824,11 +846,14 @@ call_hooks(enum c_hooktype hooktype, ...)
                 int aint = va_arg(vl, int);
                 char *txtptr = va_arg(vl, char *);
 
-                for(lp = msg_hooks; lp; lp = lp->next)
+                for(hp = hooktab[hooktype]; (hk = hook_live(&hp)); hp++)
                 {
                     int (*rfunc) (aClient *, int, char *) = 
-                                    ((aHook *)lp->value.cp)->funcptr;
-                    if((ret = (*rfunc)(acptr, aint, txtptr)) == FLUSH_BUFFER)
+                                    hk->funcptr;
+                    gettimeofday(&start, NULL);
+                    ret = (*rfunc)(acptr, aint, txtptr);
+                    hook_timing(hk, &start);
+                    if(ret == FLUSH_BUFFER)
                         break;
                 }
                 break;
@@ -841,12 +866,14 @@ call_hooks(enum c_hooktype hooktype, ...)
                 int aint = va_arg(vl, int);
                 char *txtptr = va_arg(vl, char *);
 
-                for(lp = chanmsg_hooks; lp; lp = lp->next)
+                for(hp = hooktab[hooktype]; (hk = hook_live(&hp)); hp++)
                 {
                     int (*rfunc) (aClient *, aChannel *, int, char *) =
-                                  ((aHook *)lp->value.cp)->funcptr;
-                    if((ret = (*rfunc)(acptr, chptr, aint, txtptr)) 
-                                    == FLUSH_BUFFER)
+                                  hk->funcptr;
+                    gettimeofday(&start, NULL);
+                    ret = (*rfunc)(acptr, chptr, aint, txtptr);
+                    hook_timing(hk, &start);
+                    if(ret == FLUSH_BUFFER)
                         break;
                 }
                 break;
@@ -859,12 +886,14 @@ call_hooks(enum c_hooktype hooktype, ...)
                 int aint = va_arg(vl, int);
                 char *txtptr = va_arg(vl, char *);
 
-                for(lp = usermsg_hooks; lp; lp = lp->next)
+                for(hp = hooktab[hooktype]; (hk = hook_live(&hp)); hp++)
                 {
                     int (*rfunc) (aClient *, aClient *, int, char *) =
-                                 ((aHook *)lp->value.cp)->funcptr;
-                    if((ret = (*rfunc)(acptr, dcptr, aint, txtptr))
-                                    == FLUSH_BUFFER)
+                                 hk->funcptr;
+                    gettimeofday(&start, NULL);
+                    ret = (*rfunc)(acptr, dcptr, aint, txtptr);
+                    hook_timing(hk, &start);
+                    if(ret == FLUSH_BUFFER)
                         break;
                 }
                 break;
@@ -876,11 +905,14 @@ call_hooks(enum c_hooktype hooktype, ...)
                 int aint = va_arg(vl, int);
                 char *txtptr = va_arg(vl, char *);
     
-                for(lp = mymsg_hooks; lp; lp = lp->next)
+                for(hp = hooktab[hooktype]; (hk = hook_live(&hp)); hp++)
                 {  
                     int (*rfunc) (aClient *, int, char *) = 
-                                 ((aHook *)lp->value.cp)->funcptr;
-                    if((ret = (*rfunc)(acptr, aint, txtptr)) == FLUSH_BUFFER)
+                                 hk->funcptr;
+                    gettimeofday(&start, NULL);
+                    ret = (*rfunc)(acptr, aint, txtptr);
+                    hook_timing(hk, &start);
+                    if(ret == FLUSH_BUFFER)
                         break;
                 }
                 break;
@@ -891,11 +923,14 @@ call_hooks(enum c_hooktype hooktype, ...)
                 aClient *acptr = va_arg(vl, aClient *);
                 aChannel *chptr = va_arg(vl, aChannel *);
 
-                for(lp = join_hooks; lp; lp = lp->next)
+                for(hp = hooktab[hooktype]; (hk = hook_live(&hp)); hp++)
                 {
                     int (*rfunc) (aClient *, aChannel *) = 
-                                    ((aHook *)lp->value.cp)->funcptr;
-                    if((ret = (*rfunc)(acptr, chptr)) == FLUSH_BUFFER)
+                                    hk->funcptr;
+                    gettimeofday(&start, NULL);
+                    ret = (*rfunc)(acptr, chptr);
+                    hook_timing(hk, &start);
+                    if(ret == FLUSH_BUFFER)
                         break;
                 }
                 break;
@@ -904,11 +939,13 @@ call_hooks(enum c_hooktype hooktype, ...)
         case CHOOK_SENDBURST:
             {
                 aClient *acptr = va_arg(vl, aClient *);
-                for(lp = sendburst_hooks; lp; lp = lp->next)
+                for(hp = hooktab[hooktype]; (hk = hook_live(&hp)); hp++)
                 {
                     void (*rfunc) (aClient *) = 
-                                    ((aHook *)lp->value.cp)->funcptr;
+                                    hk->funcptr;
+                    gettimeofday(&start, NULL);
                     (*rfunc)(acptr);
+                    hook_timing(hk, &start);
                 }
                 break;
             }
@@ -920,11 +957,14 @@ call_hooks(enum c_hooktype hooktype, ...)
                 int type = va_arg(vl, int);
                 int jnum = va_arg(vl, int);
                 int jtime = va_arg(vl, int);
-                for(lp = throttle_hooks; lp; lp = lp->next)
+                for(hp = hooktab[hooktype]; (hk = hook_live(&hp)); hp++)
                 {
                     int (*rfunc) (aClient *, aChannel *, int, int, int) = 
-                                    ((aHook *)lp->value.cp)->funcptr;
-                    if((ret = (*rfunc)(acptr, chptr, type, jnum, jtime)) == FLUSH_BUFFER)
+                                    hk->funcptr;
+                    gettimeofday(&start, NULL);
+                    ret = (*rfunc)(acptr, chptr, type, jnum, jtime);
+                    hook_timing(hk, &start);
+                    if(ret == FLUSH_BUFFER)
                         break;
                 }
                 break;
@@ -935,11 +975,14 @@ call_hooks(enum c_hooktype hooktype, ...)
                 aClient *acptr = va_arg(vl, aClient *);
                 char *name = va_arg(vl, char *);
                 struct simBan *ban = va_arg(vl, struct simBan *);
-                for(lp = forbid_hooks; lp; lp = lp->next)
+                for(hp = hooktab[hooktype]; (hk = hook_live(&hp)); hp++)
                 {
                     int (*rfunc) (aClient *, char *, struct simBan *) = 
-                                    ((aHook *)lp->value.cp)->funcptr;
-                    if((ret = (*rfunc)(acptr, name, ban)) == FLUSH_BUFFER)
+                                    hk->funcptr;
+                    gettimeofday(&start, NULL);
+                    ret = (*rfunc)(acptr, name, ban);
+                    hook_timing(hk, &start);
+                    if(ret == FLUSH_BUFFER)
                         break;
                 }
                 break;
@@ -949,11 +992,14 @@ call_hooks(enum c_hooktype hooktype, ...)
             {
                 aClient *sptr = va_arg(vl, aClient *);
                 aClient *acptr = va_arg(vl, aClient *);
-                for(lp = whois_hooks; lp; lp = lp->next)
+                for(hp = hooktab[hooktype]; (hk = hook_live(&hp)); hp++)
                 {
                     int (*rfunc) (aClient *, aClient *) = 
-                                    ((aHook *)lp->value.cp)->funcptr;
-                    if((ret = (*rfunc)(sptr, acptr)) == FLUSH_BUFFER)
+                                    hk->funcptr;
+                    gettimeofday(&start, NULL);
+                    ret = (*rfunc)(sptr, acptr);
+                    hook_timing(hk, &start);
+                    if(ret == FLUSH_BUFFER)
                         break;
                 }
                 break;
@@ -966,16 +1012,19 @@ call_hooks(enum c_hooktype hooktype, ...)
                 char *orgip = va_arg(vl, char *);
                 char *newhost = va_arg(vl, char *);
                 int type = va_arg(vl, int);
-                for(lp = maskhost_hooks; lp; lp = lp->next)
+                for(hp = hooktab[hooktype]; (hk = hook_live(&hp)); hp++)
                 {
                     int (*rfunc) (char *, char *, char **, int) = 
-                                    ((aHook *)lp->value.cp)->funcptr;
+                                    hk->funcptr;
                     /* Possible results by the module:
                        1 (UHM_SUCCESS)                      = Success, the host has been masked (so don't try other modules).
                        0 (UHM_SOFT_FAILURE)                 = Failure, the host wasn't masked but try other modules (maybe they will mask the host).
                        -2 (UHM_HARD_FAILURE / FLUSH_BUFFER) = Failure, the host wasn't masked but *don't* try other modules.
                      */
-                    if((ret = (*rfunc)(orghost, orgip, &newhost, type)) != UHM_SOFT_FAILURE)
+                    gettimeofday(&start, NULL);
+                    ret = (*rfunc)(orghost, orgip, &newhost, type);
+                    hook_timing(hk, &start);
+                    if(ret != UHM_SOFT_FAILURE)
                         break; /* We stop trying other modules if we get UHM_SUCCESS or UHM_HARD_FAILURE */
                 }
                 break;
@@ -988,11 +1037,14 @@ call_hooks(enum c_hooktype hooktype, ...)
                 int type = va_arg(vl, int);
                 char *cmd = va_arg(vl, char *);
                 char *reason = va_arg(vl, char *);
-                for(lp = floodwarn_hooks; lp; lp = lp->next)
+                for(hp = hooktab[hooktype]; (hk = hook_live(&hp)); hp++)
                 {
                     int (*rfunc) (aClient *, aChannel *, int, char *, char *) = 
-                                    ((aHook *)lp->value.cp)->funcptr;
-                    if((ret = (*rfunc)(sptr, chptr, type, cmd, reason)) == FLUSH_BUFFER)
+                                    hk->funcptr;
+                    gettimeofday(&start, NULL);
+                    ret = (*rfunc)(sptr, chptr, type, cmd, reason);
+                    hook_timing(hk, &start);
+                    if(ret == FLUSH_BUFFER)
                         break;
                 }
                 break;
@@ -1004,11 +1056,14 @@ call_hooks(enum c_hooktype hooktype, ...)
                 int type = va_arg(vl, int);
                 int max_targets = va_arg(vl, int);
                 char *target_name = va_arg(vl, char *);
-                for(lp = spamwarn_hooks; lp; lp = lp->next)
+                for(hp = hooktab[hooktype]; (hk = hook_live(&hp)); hp++)
                 {
                     int (*rfunc) (aClient *, int, int, char *) = 
-                                    ((aHook *)lp->value.cp)->funcptr;
-                    if((ret = (*rfunc)(sptr, type, max_targets, target_name)) == FLUSH_BUFFER)
+                                    hk->funcptr;
+                    gettimeofday(&start, NULL);
+                    ret = (*rfunc)(sptr, type, max_targets, target_name);
+                    hook_timing(hk, &start);
+                    if(ret == FLUSH_BUFFER)
                         break;
                 }
                 break;
@@ -1017,11 +1072,13 @@ call_hooks(enum c_hooktype hooktype, ...)
         case CHOOK_SIGNOFF:
             {
                 aClient *acptr = va_arg(vl, aClient *);
-                for(lp = signoff_hooks; lp; lp = lp->next)
+                for(hp = hooktab[hooktype]; (hk = hook_live(&hp)); hp++)
                 {
                     void (*rfunc) (aClient *) = 
-                                    ((aHook *)lp->value.cp)->funcptr;
+                                    hk->funcptr;
+                    gettimeofday(&start, NULL);
                     (*rfunc)(acptr);
+                    hook_timing(hk, &start);
                 }
                 break;
             }
@@ -1031,11 +1088,13 @@ call_hooks(enum c_hooktype hooktype, ...)
                 char *txtptr = va_arg(vl, char *);
                 void *avoid = va_arg(vl, void *);
 
-                for(lp = mload_hooks; lp; lp = lp->next)
+                for(hp = hooktab[hooktype]; (hk = hook_live(&hp)); hp++)
                 {
                     int (*rfunc) (char *, void *) = 
-                                ((aHook *)lp->value.cp)->funcptr;
+                                hk->funcptr;
+                    gettimeofday(&start, NULL);
                     (*rfunc)(txtptr, avoid);
+                    hook_timing(hk, &start);
                 }
                 break;
             }
@@ -1044,11 +1103,13 @@ call_hooks(enum c_hooktype hooktype, ...)
             {
                 char *txtptr = va_arg(vl, char *);
                 void *avoid = va_arg(vl, void *);
-                for(lp = munload_hooks; lp; lp = lp->next)
+                for(hp = hooktab[hooktype]; (hk = hook_live(&hp)); hp++)
                 {
                     int (*rfunc) (char *, void *) = 
-                                  ((aHook *)lp->value.cp)->funcptr;
+                                  hk->funcptr;
+                    gettimeofday(&start, NULL);
                     (*rfunc)(txtptr, avoid);
+                    hook_timing(hk, &start);
                 }
                 break;
             }
@@ -1058,6 +1119,37 @@ call_hooks(enum c_hooktype hooktype, ...)
                 hooktype);
             break;
     }   
+
+    if(--hooks_running == 0 && (hooks_retired || modules_retired))
+        hook_reap();
+
+    return ret;
+}
+
+int 
+run_hooks(enum c_hooktype hooktype, ...)
+{
+    va_list vl;
+    int ret;
+
+    va_start(vl, hooktype);
+    ret = run_hooks_va(hooktype, vl);
+    va_end(vl);
+    return ret;
+}
+
+/*
+ * call_hooks() is a macro in hooks.h, but modules built against an
+ * older hooks.h still link against this.
+ */
+int 
+(call_hooks)(enum c_hooktype hooktype, ...)
+{
+    va_list vl;
+    int ret;
+
+    va_start(vl, hooktype);
+    ret = run_hooks_va(hooktype, vl);
     va_end(vl);
     return ret;
 }
@@ -1072,9 +1164,10 @@ list_hooks(aClient *sptr)
         aHook *hook = (aHook *) lp->value.cp;
         aModule *mod = hook->owner;
 
-        sendto_one(sptr, ":%s NOTICE %s :Module: %s  Type: %s",
-                   me.name, sptr->name, mod->name, 
-                   get_texthooktype(hook->hooktype));
+        sendto_one(sptr, ":%s NOTICE %s :Module: %s  Type: %s  Calls: %lu"
+                   "  Usec: %lu (max %lu)", me.name, sptr->name, mod->name, 
+                   get_texthooktype(hook->hooktype), hook->calls, hook->usec,
+                   hook->maxusec);
     }
 }
 
@@ -1098,7 +1191,7 @@ u_long
 memcount_modules(MCmodules *mc)
 {
 #ifdef USE_HOOKMODULES
-    int      c;
+    int      c, i;
     DLink   *dl;
     aModule *m;
 #endif
@@ -1125,29 +1218,16 @@ memcount_modules(MCmodules *mc)
     mc->hooks.m = c * sizeof(aHook);
     mc->e_dlinks += c;
 
-    mc->e_dlinks += mc_dlinks(preaccess_hooks);
-    mc->e_dlinks += mc_dlinks(onaccess_hooks);
-    mc->e_dlinks += mc_dlinks(postaccess_hooks);
-    mc->e_dlinks += mc_dlinks(postmotd_hooks);
-    mc->e_dlinks += mc_dlinks(msg_hooks);
-    mc->e_dlinks += mc_dlinks(chanmsg_hooks);
-    mc->e_dlinks += mc_dlinks(usermsg_hooks);
-    mc->e_dlinks += mc_dlinks(mymsg_hooks);
-    mc->e_dlinks += mc_dlinks(every10_hooks);
-    mc->e_dlinks += mc_dlinks(join_hooks);
-    mc->e_dlinks += mc_dlinks(sendburst_hooks);
-    mc->e_dlinks += mc_dlinks(throttle_hooks);
-    mc->e_dlinks += mc_dlinks(forbid_hooks);
-    mc->e_dlinks += mc_dlinks(whois_hooks);
-    mc->e_dlinks += mc_dlinks(maskhost_hooks);
-    mc->e_dlinks += mc_dlinks(floodwarn_hooks);
-    mc->e_dlinks += mc_dlinks(spamwarn_hooks);
-    mc->e_dlinks += mc_dlinks(signoff_hooks);
-    mc->e_dlinks += mc_dlinks(mload_hooks);
-    mc->e_dlinks += mc_dlinks(munload_hooks);
-
-    mc->total.c += mc->modules.c + mc->hooks.c;
-    mc->total.m += mc->modules.m + mc->hooks.m;
+    for (i = 0; i < HOOK_TYPES; i++)
+    {
+        if (!hooktab[i])
+            continue;
+        mc->hooktabs.c++;
+        mc->hooktabs.m += (hooks_set[i] + 1) * sizeof(aHook *);
+    }
+
+    mc->total.c += mc->modules.c + mc->hooks.c + mc->hooktabs.c;
+    mc->total.m += mc->modules.m + mc->hooks.m + mc->hooktabs.m;
 
     return mc->total.m;
 #else
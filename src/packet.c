@@ -25,6 +25,82 @@
 #include "h.h"
 #include "dh.h"
 #include "zlink.h"
+#include "scan.h"
+
+/*
+ * doline
+ * Accounts for and parses one complete line.  Returns FLUSH_BUFFER if
+ * cptr is gone, otherwise what parse() returned.
+ */
+static int doline(aClient *cptr, char *line, char *eol)
+{
+    aListener *lptr = cptr->lstn;
+    int ret;
+    
+    me.receiveM += 1;		/* Update messages received */
+    cptr->receiveM += 1;
+    if (lptr)
+	lptr->receiveM += 1;
+    cptr->count = 0;		/*
+				 * ...just in case parse returns with
+				 * FLUSH_BUFFER without removing the
+				 * structure pointed by cptr... --msa 
+				 */
+    if ((ret = parse(cptr, line, eol)) == FLUSH_BUFFER)
+	return FLUSH_BUFFER;
+    
+    /*
+     * Socket is dead so exit (which always returns with *
+     * FLUSH_BUFFER here).  - avalon
+     */
+    if (cptr->flags & FLAGS_DEADSOCKET)
+	return exit_client(cptr, cptr, &me,
+			   (cptr->flags & FLAGS_SENDQEX) ?
+			   "SendQ exceeded" : "Dead socket");
+    return ret;
+}
+
+/*
+ * zip_dopacket
+ * The dopacket line loop for a link that sends us compressed data.
+ * Lines are split and parsed right where zip_input() inflated them,
+ * and only an unfinished line is kept back for the next round, so
+ * cptr->buffer is not used.
+ */
+static int zip_dopacket(aClient *cptr, char *buffer, int length)
+{
+    void *zin = cptr->serv->zip_in;
+    char *zbuf, *line, *eol, *ch, *end;
+    int err, maxlen = sizeof(cptr->buffer) - 1;
+    
+    for (;;)
+    {
+	zbuf = zip_input(zin, buffer, &length, &err);
+	buffer = NULL;
+	
+	if (length == 0)
+	    return 0;
+	if (length == -1)
+	{
+	    sendto_realops("Zipin error for %s: (%d) %s\n", cptr->name,
+			   err, zbuf);
+	    return exit_client(cptr, cptr, &me, "fatal error in zip_input!");
+	}
+	
+	end = zbuf + length;
+	for (line = zbuf; (ch = memscan2(line, end, '\n', '\r')) < end;
+	     line = ch + 1)
+	{
+	    if (ch == line)
+		continue;		/* Skip extra LF/CR's */
+	    eol = (ch - line > maxlen) ? line + maxlen : ch;
+	    *eol = '\0';		/* as long as cptr->buffer allows */
+	    if (doline(cptr, line, eol) == FLUSH_BUFFER)
+		return FLUSH_BUFFER;
+	}
+	zip_input_keep(zin, line, MIN(end - line, maxlen));
+    }
+}
 
 /*
  * * dopacket 
@@ -33,6 +109,11 @@
  * buffer - pointr to the buffer containing the newly read data 
  * length - number of valid bytes of data in the buffer
  * 
+ * Lines are found with memscan2() and parsed where they lie in buffer,
+ * which is written to.  Only a line that began in an earlier read is
+ * put together in cptr->buffer, and the unfinished end of this one is
+ * kept there for the next.
+ *
  * Note: 
  * It is implicitly assumed that dopacket is called only
  * with cptr of "local" variation, which contains all the
@@ -40,12 +121,9 @@
  */
 int dopacket(aClient *cptr, char *buffer, int length)
 {
-    char   *ch1;
-    char   *ch2;
-    char *cptrbuf = cptr->buffer;
+    char *ch, *end, *line, *lend, *eol;
     aListener    *lptr = cptr->lstn;
-    char *nbuf = NULL;
-    int nlen;
+    int n, ret, maxlen = sizeof(cptr->buffer) - 1;
     
 #ifdef HAVE_ENCRYPTION_ON
     if(IsRC4IN(cptr))
@@ -76,130 +154,69 @@ int dopacket(aClient *cptr, char *buffer, int length)
 	me.receiveB &= 0x03ff;
     }
     
-zcontinue:
-    ch1 = cptrbuf + cptr->count;
-    ch2 = buffer;   
-    
     if(ZipIn(cptr))
-    {
-	int err;
-	ch2 = zip_input(cptr->serv->zip_in, ch2, &length, &err, &nbuf, &nlen);
+	return zip_dopacket(cptr, buffer, length);
 
-	if(length == -1)
+    /*
+     * Yuck.  Stuck.  To make sure we stay backward compatible, we
+     * must assume that either CR or LF terminates the message and
+     * not CR-LF.  By allowing CR or LF (alone) into the body of
+     * messages, backward compatibility is lost and major problems
+     * will arise. - Avalon
+     */
+    end = buffer + length;
+    for (ch = buffer; ch < end; ch = eol + 1)
+    {
+	eol = memscan2(ch, end, '\n', '\r');
+	if (cptr->count)
 	{
-	    sendto_realops("Zipin error for %s: (%d) %s\n", cptr->name,
-			   err, ch2);
-	    return exit_client(cptr, cptr, &me, "fatal error in zip_input!");
+	    /* the rest of the line we have the start of */
+	    n = MIN(eol - ch, maxlen - cptr->count);
+	    memcpy(cptr->buffer + cptr->count, ch, n);
+	    cptr->count += n;
+	    if (eol == end)
+		return 0;
+	    line = cptr->buffer;
+	    line[cptr->count] = '\0';
+	    ret = doline(cptr, line, line + cptr->count);
 	}
-    }
-    
-    while (--length >= 0) 
-    {
-	char g;
-	
-	g = (*ch1 = *ch2++);
-	/*
-	 * Yuck.  Stuck.  To make sure we stay backward compatible, we
-	 * must assume that either CR or LF terminates the message and
-	 * not CR-LF.  By allowing CR or LF (alone) into the body of
-	 * messages, backward compatibility is lost and major problems
-	 * will arise. - Avalon
-	 */
-	if (g < '\16' && (g == '\n' || g == '\r')) {
-	    if (ch1 == cptrbuf)
-		continue;		/* Skip extra LF/CR's */
-	    *ch1 = '\0';
-	    me.receiveM += 1;	/* Update messages received */
-	    cptr->receiveM += 1;
-	    if (lptr)
-		lptr->receiveM += 1;
-	    cptr->count = 0;	/*
-				 * ...just in case parse returns with
-				 * FLUSH_BUFFER without removing the
-				 * structure pointed by cptr... --msa 
-				 */
-	    switch (parse(cptr, cptr->buffer, ch1))
-	    {
-	    case FLUSH_BUFFER:
-		return FLUSH_BUFFER;
-		
-	    case ZIP_NEXT_BUFFER:
-		if(length)
-		{
-		    int err;
-		    ch2 = zip_input(cptr->serv->zip_in, ch2, &length,
-				    &err, &nbuf, &nlen);
-		    
-		    if(length == -1)
-		    {
-			sendto_realops("Zipin error for %s: (%d) %s\n",
-				       cptr->name, err, ch2);
-			return exit_client(cptr, cptr, &me,
-					   "fatal error in zip_input!");
-		    }
-		}
+	else
+	{
+	    if (eol == end)
 		break;
+	    if (eol == ch)
+		continue;		/* Skip extra LF/CR's */
+	    line = ch;
+	    lend = (eol - line > maxlen) ? line + maxlen : eol;
+	    *lend = '\0';		/* as long as cptr->buffer allows */
+	    ret = doline(cptr, line, lend);
+	}
+
+	switch (ret)
+	{
+	case FLUSH_BUFFER:
+	    return FLUSH_BUFFER;
+
+	case ZIP_NEXT_BUFFER:
+	    /* the rest of the buffer is compressed */
+	    return zip_dopacket(cptr, eol + 1, end - eol - 1);
 
 #ifdef HAVE_ENCRYPTION_ON
-	    case RC4_NEXT_BUFFER:
-		if(length)
-		    rc4_process_stream(cptr->serv->rc4_in, ch2, length);
-		break;
+	case RC4_NEXT_BUFFER:
+	    if (end - eol > 1)
+		rc4_process_stream(cptr->serv->rc4_in, eol + 1, end - eol - 1);
+	    break;
 #endif
 
-	    default:
-		break;
-	    }
-	    
-	    /*
-	     * Socket is dead so exit (which always returns with *
-	     * FLUSH_BUFFER here).  - avalon
-	     */
-	    if (cptr->flags & FLAGS_DEADSOCKET)
-		return exit_client(cptr, cptr, &me,
-				   (cptr->flags & FLAGS_SENDQEX) ?
-				   "SendQ exceeded" : "Dead socket");
-	    ch1 = cptrbuf;
+	default:
+	    break;
 	}
-	else if (ch1 < cptrbuf + (sizeof(cptr->buffer) - 1))
-	    ch1++;			/* There is always room for the null */
     }
-    cptr->count = ch1 - cptrbuf;
-    
-    if(nbuf)
-    {
-#if 0   /* this message is annoying and not quite that useful */
-	static time_t last_complain = 0;
-	static int numrepeat = 0;
-	
-	numrepeat++;
-	
-	if(NOW > (last_complain + 300)) /* if more than 5 mins have elapsed */
-	{
-	    if(last_complain == 0)
-	    {
-		sendto_realops("Overflowed zipInBuf! "
-			       "If you see this a lot, you should increase "
-			       "zipInBufSize in src/zlink.c.");
-	    }
-	    else
-	    {
-		sendto_realops("Overflowed zipInBuf %d time%s in the "
-			       "last %d minutes. If you see this a lot, you "
-			       "should increase zipInBufSize in src/zlink.c.",
-			       numrepeat, numrepeat == 1 ? "" : "s",
-			       (NOW - last_complain) / 60);
-	    }
-	    last_complain = NOW;
-	    numrepeat = 0;
-	}
-#endif
 
-	buffer = nbuf;
-	length = nlen;
-	nbuf = NULL;
-	goto zcontinue; /* gross, but it should work.. */
-    }   
+    /* keep the unfinished line */
+    n = MIN(end - ch, maxlen);
+    memcpy(cptr->buffer, ch, n);
+    cptr->count = n;
     
     return 0;
 }
@@ -18,6 +18,9 @@
  *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
 #include "struct.h"
 #include "common.h"
 #include "sys.h"
@@ -27,12 +30,14 @@
 #include "msg.h"
 #undef MSGTAB
 #include "memcount.h"
+#include "scan.h"
 
 #if defined( HAVE_STRING_H )
 #include <string.h>
 #else
 #include <strings.h>
 #endif
+#include <time.h>
 
 /* NOTE: parse() should not be called recursively by other functions! */
 static char *para[MAXPARA + 1];
@@ -43,10 +48,22 @@ static char sender[HOSTLEN + 1];
 static int  cancel_clients(aClient *, aClient *, char *);
 static void remove_unknown(aClient *, char *, char *);
 
-static struct Message *do_msg_tree(MESSAGE_TREE *, char *, struct Message *);
-static struct Message *tree_parse(char *);
+static struct Message *hash_parse(char *);
+static void msg_timing(struct Message *, struct timespec *);
+
+/*
+ * msgtab lookup table, see init_tree_parse().  msg_hash[] holds the
+ * msgtab index + 1 of the one command that can hash to each slot, and
+ * msg_seed[] the displacement chosen for each bucket of commands.
+ */
+#define MSG_HASHBITS	9
+#define MSG_HASHSIZE	(1 << MSG_HASHBITS)
+#define MSG_HASHBUCKETS	128
+#define MSG_HASHSLOT(h, seed) \
+	((((h) ^ (seed)) * 0x9e3779b1U) >> (32 - MSG_HASHBITS))
 
-int num_msg_trees = 0;
+static unsigned short msg_hash[MSG_HASHSIZE];
+static unsigned short msg_seed[MSG_HASHBUCKETS];
 
 /*
  * parse a buffer.
@@ -58,8 +75,9 @@ int parse(aClient *cptr, char *buffer, char *bufend)
 {
     aClient *from = cptr;
     char *ch, *s;
-    int i, numeric = 0, paramcount;
+    int i, numeric = 0, paramcount, ret;
     struct Message *mptr;
+    struct timespec start;
 
 #ifdef DUMP_DEBUG
     if(dumpfp!=NULL) 
@@ -189,12 +207,14 @@ int parse(aClient *cptr, char *buffer, char *bufend)
     }
     else 
     {
-	s = strchr(ch, ' ');
+	s = memscan2(ch, bufend, ' ', '\0');
 	
-	if (s)
+	if (s < bufend && *s == ' ')
 	    *s++ = '\0';
+	else
+	    s = NULL;
 	
-	mptr = tree_parse(ch);
+	mptr = hash_parse(ch);
 	
 	if (!mptr || !mptr->cmd) 
 	{
@@ -276,8 +296,7 @@ int parse(aClient *cptr, char *buffer, char *bufend)
 		break;
             }
 	    
-	    while(*s && *s != ' ')
-		s++;
+	    s = memscan2(s, bufend, ' ', '\0');
 	}
     }
     
@@ -298,26 +317,78 @@ int parse(aClient *cptr, char *buffer, char *bufend)
     if (IsRegisteredUser(cptr) && (mptr->flags & MF_RIDLE))
 	from->user->last = timeofday;
 
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
     if (mptr->flags & MF_ALIAS)
     {
 #ifdef __clang__
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wdeprecated-non-prototype"
 #endif
-         return mptr->func(cptr, from, i, para, &aliastab[mptr->aliasidx]);
+         ret = mptr->func(cptr, from, i, para, &aliastab[mptr->aliasidx]);
 #ifdef __clang__
 #pragma clang diagnostic pop
 #endif
     }
-
+    else
+    {
 #ifdef __clang__
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wdeprecated-non-prototype"
 #endif
-    return (*mptr->func) (cptr, from, i, para);
+	ret = (*mptr->func) (cptr, from, i, para);
 #ifdef __clang__
 #pragma clang diagnostic pop
 #endif
+    }
+
+    msg_timing(mptr, &start);
+    return ret;
+}
+
+/*
+ * msg_timing - charge the time since start to the command, in total,
+ * as its worst case, and in the histogram bucket for its log2.
+ */
+static void msg_timing(struct Message *mptr, struct timespec *start)
+{
+    struct timespec now;
+    unsigned long ns;
+    int b;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns = (now.tv_sec - start->tv_sec) * 1000000000UL + now.tv_nsec -
+	 start->tv_nsec;
+
+    mptr->ns += ns;
+    if (ns > mptr->maxns)
+	mptr->maxns = ns;
+    for (b = 0; (ns >>= 1) && b < MSG_HISTSIZE - 1; b++)
+	;
+    mptr->hist[b]++;
+}
+
+/*
+ * msg_percentile - estimate the time within which pct percent of the
+ * command's calls completed, as the upper bound of the histogram bucket
+ * holding that call (never more than the worst case seen).
+ */
+unsigned long msg_percentile(struct Message *mptr, int pct)
+{
+    unsigned long calls = 0, want, seen = 0;
+    int b;
+
+    for (b = 0; b < MSG_HISTSIZE; b++)
+	calls += mptr->hist[b];
+    if (!calls)
+	return 0;
+
+    want = (calls * pct + 99) / 100;
+    for (b = 0; b < MSG_HISTSIZE - 1; b++)
+	if ((seen += mptr->hist[b]) >= want)
+	    break;
+
+    return (2UL << b) - 1 < mptr->maxns ? (2UL << b) - 1 : mptr->maxns;
 }
 
 /*
@@ -327,6 +398,13 @@ int parse(aClient *cptr, char *buffer, char *bufend)
  *  NONE side effects   - MUST MUST be called at startup ONCE before
  * any other keyword hash routine is used.
  * 
+ * msgtab is fixed at compile time, so rather than walk a prefix tree
+ * letter by letter we build a perfect hash over it here: commands are
+ * grouped into buckets by msg_hashval(), and each bucket, largest first,
+ * is given the first seed that places all its commands in free slots
+ * of msg_hash[].  A lookup is then one hash, two table reads and one
+ * compare.
+ * 
  * -Dianora, orabidoo
  */
 
@@ -336,132 +414,110 @@ static int mcmp(struct Message *m1, struct Message *m2)
     return strcmp(m1->cmd, m2->cmd);
 }
 
-/* Initialize the msgtab parsing tree -orabidoo */
-void init_tree_parse(struct Message *mptr)
+/*
+ * case insensitive FNV-1a over a command name, or 0 if it holds
+ * anything other than letters (no command does).
+ */
+static unsigned int msg_hashval(char *cmd)
 {
-    int i;
-    struct Message *mpt = mptr;
-    
-    for (i = 0; mpt->cmd; mpt++)
-	i++;
-    qsort((void *) mptr, i, sizeof(struct Message),
-	  (int (*)(const void *, const void *)) mcmp);
-    
-    msg_tree_root = (MESSAGE_TREE *) MyMalloc(sizeof(MESSAGE_TREE));
-    num_msg_trees++;
-    mpt = do_msg_tree(msg_tree_root, "", mptr);
-    /*
-     * this happens if one of the msgtab entries included characters
-     * other than capital letters  -orabidoo
-     */
-    if (mpt->cmd)
+    unsigned int h = 2166136261U;
+    char r;
+
+    while ((r = *cmd++))
     {
-	fprintf(stderr, "bad msgtab entry: ``%s''\n", mpt->cmd);
-	exit(1);
+	r &= 0xdf;		/*
+				 * some touppers have trouble w/ 
+				 * lowercase, says Dianora 
+				 */
+	if (r < 'A' || r > 'Z')
+	    return 0;
+	h = (h ^ r) * 16777619U;
     }
+    return h;
 }
 
-/* Recursively make a prefix tree out of the msgtab -orabidoo */
-static struct Message *do_msg_tree(MESSAGE_TREE * mtree, char *prefix,
-				   struct Message *mptr)
+/* Initialize the msgtab lookup table */
+void init_tree_parse(struct Message *mptr)
 {
-    char newpref[64];	/* must be longer than any command */
-    int c, c2, lp;
-    MESSAGE_TREE *mtree1;
+    static unsigned short order[MSG_HASHBUCKETS];
+    unsigned int hv[MSG_HASHSIZE / 2];
+    int size[MSG_HASHBUCKETS];
+    int i, j, k, n, b;
+    unsigned int seed;
     
-    lp = strlen(prefix);
-    if (!lp || !strncmp(mptr->cmd, prefix, lp))
+    for (n = 0; mptr[n].cmd; n++)
     {
-	if (!mptr[1].cmd || (lp && strncmp(mptr[1].cmd, prefix, lp)))
+	if (n >= MSG_HASHSIZE / 2 || !(hv[n] = msg_hashval(mptr[n].cmd)))
 	{
-	    /* non ambiguous, make a final case */
-	    mtree->final = mptr->cmd + lp;
-	    mtree->msg = mptr;
-	    for (c = 0; c <= 25; c++)
-		mtree->pointers[c] = NULL;
-	    return mptr + 1;
+	    fprintf(stderr, "bad msgtab entry: ``%s''\n", mptr[n].cmd);
+	    exit(1);
 	}
-	else
+    }
+    qsort((void *) mptr, n, sizeof(struct Message),
+	  (int (*)(const void *, const void *)) mcmp);
+    for (i = 0; i < n; i++)
+	hv[i] = msg_hashval(mptr[i].cmd);
+    
+    memset(size, 0, sizeof(size));
+    for (i = 0; i < n; i++)
+	size[hv[i] % MSG_HASHBUCKETS]++;
+    for (b = 0; b < MSG_HASHBUCKETS; b++)
+    {
+	for (j = b; j > 0 && size[order[j - 1]] < size[b]; j--)
+	    order[j] = order[j - 1];
+	order[j] = b;
+    }
+    
+    memset(msg_hash, 0, sizeof(msg_hash));
+    for (k = 0; k < MSG_HASHBUCKETS && size[b = order[k]]; k++)
+    {
+	for (seed = 0; seed < 65536; seed++)
 	{
-	    /* ambigous, make new entries for each of the letters that match */
-	    if (!mycmp(mptr->cmd, prefix))
+	    for (i = 0; i < n; i++)
 	    {
-		mtree->final = (void *) 1;
-		mtree->msg = mptr;
-		mptr++;
+		if (hv[i] % MSG_HASHBUCKETS != b)
+		    continue;
+		j = MSG_HASHSLOT(hv[i], seed);
+		if (msg_hash[j])
+		    break;
+		msg_hash[j] = i + 1;
 	    }
-	    else
-		mtree->final = NULL;
-	    
-	    for (c = 'A'; c <= 'Z'; c++)
-	    {
-		if (mptr->cmd[lp] == c)
-		{
-		    mtree1 = (MESSAGE_TREE *) MyMalloc(sizeof(MESSAGE_TREE));
-		    num_msg_trees++;
-		    mtree1->final = NULL;
-		    mtree->pointers[c - 'A'] = mtree1;
-		    strcpy(newpref, prefix);
-		    newpref[lp] = c;
-		    newpref[lp + 1] = '\0';
-		    mptr = do_msg_tree(mtree1, newpref, mptr);
-		    if (!mptr->cmd || strncmp(mptr->cmd, prefix, lp))
-		    {
-			for (c2 = c + 1 - 'A'; c2 <= 25; c2++)
-			    mtree->pointers[c2] = NULL;
-			return mptr;
-		    }
-		}
-		else
-		{
-		    mtree->pointers[c - 'A'] = NULL;
-		}
-	    }
-	    return mptr;
+	    if (i == n)
+		break;
+	    /* collided, take back this bucket's entries */
+	    for (j = 0; j < MSG_HASHSIZE; j++)
+		if (msg_hash[j] && hv[msg_hash[j] - 1] % MSG_HASHBUCKETS == b)
+		    msg_hash[j] = 0;
 	}
-    }
-    else
-    {
-	fprintf(stderr, "do_msg_tree: this should never happen!\n");
-	exit(1);
+	if (seed == 65536)
+	{
+	    fprintf(stderr, "init_tree_parse: no seed for msgtab bucket %d\n",
+		    b);
+	    exit(1);
+	}
+	msg_seed[b] = seed;
     }
 }
 
 /*
- * tree_parse()
+ * hash_parse()
  * 
  * inputs               
- * - pointer to command in upper case output NULL pointer if not found 
+ * - pointer to command, in any case.  output NULL pointer if not found 
  * struct Message pointer to command entry if found 
  * side effects        - NONE
- * 
- * -Dianora, orabidoo
  */
-static struct Message *tree_parse(char *cmd)
+static struct Message *hash_parse(char *cmd)
 {
-    char    r;
-    MESSAGE_TREE *mtree = msg_tree_root;
+    unsigned int h = msg_hashval(cmd);
+    int i;
     
-    while ((r = *cmd++))
-    {
-	r &= 0xdf;		/*
-				 * some touppers have trouble w/ 
-				 * lowercase, says Dianora 
-				 */
-	if (r < 'A' || r > 'Z')
-	    return NULL;
-	mtree = mtree->pointers[r - 'A'];
-	if (!mtree)
-	    return NULL;
-	if (mtree->final == (void *) 1)
-	{
-	    if (!*cmd)
-		return mtree->msg;
-	}
-	else if (mtree->final && !mycmp(mtree->final, cmd))
-	    return mtree->msg;
-    }
-    return ((struct Message *) NULL);
+    if (!h)
+	return NULL;
+    i = msg_hash[MSG_HASHSLOT(h, msg_seed[h % MSG_HASHBUCKETS])];
+    if (!i || mycmp(msgtab[i - 1].cmd, cmd))
+	return NULL;
+    return &msgtab[i - 1];
 }
 
 /* field breakup for ircd.conf file. */
@@ -622,35 +678,19 @@ static void remove_unknown(aClient *cptr, char *sender, char *buffer)
     }
 }
 
-static u_long
-r_msgtree_memcount(MESSAGE_TREE *mptr, int *count)
-{
-    size_t  i;
-    u_long  m = sizeof(*mptr);
-
-    (*count)++;
-
-    for (i = 0; i < sizeof(mptr->pointers)/sizeof(mptr->pointers[0]); i++)
-        if (mptr->pointers[i])
-            m += r_msgtree_memcount(mptr->pointers[i], count);
-
-    return m;
-}
-
 u_long
 memcount_parse(MCparse *mc)
 {
     mc->file = __FILE__;
 
-    mc->msgnodes.m = r_msgtree_memcount(msg_tree_root, &mc->msgnodes.c);
-
-    mc->total.c += mc->msgnodes.c;
-    mc->total.m += mc->msgnodes.m;
-
     mc->s_bufs.c++;
     mc->s_bufs.m += sizeof(para);
     mc->s_bufs.c++;
     mc->s_bufs.m += sizeof(sender);
+    mc->s_bufs.c++;
+    mc->s_bufs.m += sizeof(msg_hash);
+    mc->s_bufs.c++;
+    mc->s_bufs.m += sizeof(msg_seed);
 
     mc->s_msgtab.c = sizeof(msgtab)/sizeof(msgtab[0]);
     mc->s_msgtab.m = sizeof(msgtab);
@@ -76,14 +76,32 @@ static int  incache = 0;
 static CacheTable hashtable[ARES_CACSIZE];
 static ResHash idcphashtable[ARES_IDCACSIZE];
 aCache *cachetop = NULL;
+static aCache *cachebottom;	/* least recently used */
 static ResRQ *last, *first;
 
+/*
+ * Addresses whose reverse lookup failed for good, most recently used
+ * first, so a connect flood from them doesn't ask again.
+ */
+static int  innegcache = 0;
+static aNegCache *negtable[ARES_NEGCACSIZE];
+static aNegCache *negtop, *negbottom;
+
+/*
+ * One socket per nameserver, connected to it, so the kernel drops
+ * replies from anywhere else and each server carries its own queries.
+ */
+static int  resfds[MAXNS];
+static int  nresfds;
+static int  ns_sent[MAXNS], ns_replies[MAXNS];
+
 static void rem_cache(aCache *);
 static void rem_request(ResRQ *);
 static int  do_query_name(Link *, char *, ResRQ *, int);
 static int  do_query_number(Link *, struct in_addr *, ResRQ *);
 static int  do_query_number6(Link *, struct in6_addr *, ResRQ *);
 static void resend_query(ResRQ *);
+static void query_timeout(void *);
 static int  proc_answer(ResRQ *, HEADER *, char *, char *);
 static int  query_name(char *, int, int, ResRQ *);
 static aCache *make_cache(ResRQ *);
@@ -91,7 +109,7 @@ static aCache *find_cache_name(char *);
 static aCache *find_cache_number(ResRQ *, char *, int);
 static int  add_request(ResRQ *);
 static ResRQ *make_request(Link *, int);
-static int  send_res_msg(char *, int, int);
+static int  send_res_msg(char *, int, ResRQ *);
 static ResRQ *find_id(int);
 static int  hash_number(unsigned char *, int);
 static unsigned int hash_id(unsigned int);
@@ -101,6 +119,9 @@ static void update_list(ResRQ *, aCache *);
 static int  hash_name(char *);
 #endif
 static struct hostent *getres_err(ResRQ *, char *);
+static aNegCache *find_negcache(char *, int);
+static void add_negcache(ResRQ *);
+static void rem_negcache(aNegCache *);
 
 static struct cacheinfo
 {
@@ -111,6 +132,9 @@ static struct cacheinfo
     int         ca_na_hits;
     int         ca_nu_hits;
     int         ca_updates;
+    int         ca_hits;	/* lookups answered from the cache */
+    int         ca_neg_adds;
+    int         ca_neg_hits;
 } cainfo;
 
 static struct resinfo
@@ -161,11 +185,33 @@ int init_resolver(int op)
     
     if (op & RES_INITSOCK)
     {
-	int         on = 0;
-	
-	ret = resfd = socket(AF_INET, SOCK_DGRAM, 0);
-	(void) setsockopt(ret, SOL_SOCKET, SO_BROADCAST,
-			  (char *) &on, sizeof(on));
+	int         i, fd;
+
+	for (i = 0; i < nresfds; i++)
+	    if (resfds[i] >= 0)
+	    {
+		del_fd(resfds[i]);
+		close(resfds[i]);
+	    }
+
+	nresfds = MIN(_res.nscount, MAXNS);
+	for (i = 0; i < nresfds; i++)
+	{
+	    resfds[i] = -1;
+	    ns_sent[i] = ns_replies[i] = 0;
+	    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+		continue;
+	    _res.nsaddr_list[i].sin_family = AF_INET;
+	    if (connect(fd, (struct sockaddr *) &_res.nsaddr_list[i],
+			sizeof(struct sockaddr_in)) < 0)
+	    {
+		close(fd);
+		continue;
+	    }
+	    add_fd(fd, FDT_RESOLVER, NULL);
+	    set_fd_flags(fd, FDF_WANTREAD);
+	    resfds[i] = ret = fd;
+	}
     }
 #ifdef DEBUG
     if (op & RES_INITDEBG);
@@ -176,9 +222,8 @@ int init_resolver(int op)
 	memset((char *) &cainfo, '\0', sizeof(cainfo));
 	memset((char *) hashtable, '\0', sizeof(hashtable));
 	memset((char *) idcphashtable, '\0', sizeof(idcphashtable));
+	memset((char *) negtable, '\0', sizeof(negtable));
     }
-    if (op == 0)
-	ret = resfd;
     return ret;
 }
 
@@ -299,6 +344,8 @@ static void rem_request(ResRQ * old)
     if(old->cinfo.value.cp != NULL)
        rem_request_cp(old);
 
+    timer_del(&old->timer);
+
     for (rptr = &first; *rptr; r2ptr = *rptr, rptr = &(*rptr)->next)
 	if (*rptr == old)
 	{
@@ -354,6 +401,8 @@ static ResRQ *make_request(Link *lp, int family)
 	memset((char *) &nreq->cinfo, '\0', sizeof(Link));
     
     nreq->timeout = 4;		/* start at 4 and exponential inc. */
+    timer_init(&nreq->timer, query_timeout, nreq);
+    timer_set(&nreq->timer, nreq->sentat + nreq->timeout);
     nreq->he.h_addrtype = family;
     nreq->he.h_name = NULL;
     nreq->he.h_aliases[0] = NULL;
@@ -362,64 +411,50 @@ static ResRQ *make_request(Link *lp, int family)
 }
 
 /*
- * Remove queries from the list which have been there too long without
- * being resolved.
+ * A query's timer has run out without an answer: ask again with twice
+ * the timeout, or give up on it.
  */
-time_t timeout_query_list(time_t now)
+static void query_timeout(void *arg)
 {
-    ResRQ  *rptr, *r2ptr;
-    time_t  next = 0, tout;
+    ResRQ      *rptr = (ResRQ *) arg;
     aClient    *cptr;
 
-    Debug((DEBUG_DNS, "timeout_query_list at %s", myctime(now)));
-    for (rptr = first; rptr; rptr = r2ptr)
+    if (--rptr->retries <= 0)
     {
-	r2ptr = rptr->next;
-	tout = rptr->sentat + rptr->timeout;
-	if (now >= tout)
-	{
-	    if (--rptr->retries <= 0)
-	    {
 #ifdef DEBUG
-		Debug((DEBUG_ERROR, "timeout %x now %d cptr %x",
-		       rptr, now, rptr->cinfo.value.cptr));
+	Debug((DEBUG_ERROR, "timeout %x now %d cptr %x",
+	       rptr, timeofday, rptr->cinfo.value.cptr));
 #endif
-		reinfo.re_timeouts++;
-		cptr = rptr->cinfo.value.cptr;
-		switch (rptr->cinfo.flags)
-		{
-		case ASYNC_CLIENT:
+	reinfo.re_timeouts++;
+	cptr = rptr->cinfo.value.cptr;
+	switch (rptr->cinfo.flags)
+	{
+	case ASYNC_CLIENT:
 #ifdef SHOW_HEADERS
-		    sendto_one(cptr, "%s", REPORT_FAIL_DNS);
+	    sendto_one(cptr, "%s", REPORT_FAIL_DNS);
 #endif
-		    ClearDNS(cptr);
-                    check_client_fd(cptr);
-		    break;
+	    ClearDNS(cptr);
+	    check_client_fd(cptr);
+	    break;
 
-		case ASYNC_CONNECT:
-		    sendto_ops("Host %s unknown",
-			       rptr->name);
-		    break;
-		}
-		rem_request(rptr);
-		continue;
-	    }
-	    else
-	    {
-		rptr->sentat = now;
-		rptr->timeout += rptr->timeout;
-		resend_query(rptr);
-#ifdef DEBUG
-		Debug((DEBUG_INFO, "r %x now %d retry %d c %x",
-		       rptr, now, rptr->retries,
-		       rptr->cinfo.value.cptr));
-#endif
-	    }
+	case ASYNC_CONNECT:
+	    sendto_ops("Host %s unknown",
+		       rptr->name);
+	    break;
 	}
-	if (!next || tout < next)
-	    next = tout;
+	rem_request(rptr);
+	return;
     }
-    return (next > now) ? next : (now + AR_TTL);
+
+    rptr->sentat = timeofday;
+    rptr->timeout += rptr->timeout;
+    timer_set(&rptr->timer, rptr->sentat + rptr->timeout);
+#ifdef DEBUG
+    Debug((DEBUG_INFO, "r %x now %d retry %d c %x",
+	   rptr, timeofday, rptr->retries,
+	   rptr->cinfo.value.cptr));
+#endif
+    resend_query(rptr);
 }
 
 /*
@@ -435,42 +470,40 @@ void del_queries(char *cp)
 }
 
 /*
- * sends msg to all nameservers found in the "_res" structure. This
- * should reflect /etc/resolv.conf. We will get responses which arent
- * needed but is easier than checking to see if nameserver isnt
- * present. Returns number of messages successfully sent to nameservers
- * or -1 if no successful sends.
+ * sends msg to one of the nameservers found in the "_res" structure,
+ * which should reflect /etc/resolv.conf: the first on the first try,
+ * then each of the others in turn as the query is resent.  Returns 1
+ * if it was sent, or -1 if no nameserver would take it.
  */
-static int send_res_msg(char *msg, int len, int rcount)
+static int send_res_msg(char *msg, int len, ResRQ *rptr)
 {
-    int     i;
-    int         sent = 0, max;
+    int     i, n, max;
 
     if (!msg)
 	return -1;
     
-    max = MIN(_res.nscount, rcount);
+    max = nresfds;
     if (_res.options & RES_PRIMARY)
 	max = 1;
     if (!max)
-	max = 1;
+	return -1;
 
-    for (i = 0; i < max; i++)
+    for (n = 0; n < max; n++)
     {
-	_res.nsaddr_list[i].sin_family = AF_INET;
-	if (sendto(resfd, msg, len, 0,
-		   (struct sockaddr *) &(_res.nsaddr_list[i]),
-		   sizeof(struct sockaddr)) == len)
+	i = (rptr->sends - 1 + n) % max;
+	if (resfds[i] < 0)
+	    continue;
+	if (send(resfds[i], msg, len, 0) == len)
 	{
 	    reinfo.re_sent++;
-	    sent++;
+	    ns_sent[i]++;
+	    rptr->nsmask |= 1 << i;
+	    return 1;
 	}
-	else
-	    Debug((DEBUG_ERROR, "s_r_m:sendto: %d on %d",
-		   errno, resfd));
+	Debug((DEBUG_ERROR, "s_r_m:send: %d on %d", errno, resfds[i]));
     }
     
-    return (sent) ? sent : -1;
+    return -1;
 }
 
 /* find a dns request id (id is determined by dn_mkquery) */
@@ -489,14 +522,23 @@ struct hostent *gethost_byname(char *name, Link *lp, int family)
 	return ((struct hostent *) NULL);
     
     reinfo.re_na_look++;
+    cainfo.ca_lookups++;
     if ((cp = find_cache_name(name)))
+    {
+	cainfo.ca_hits++;
 	return (struct hostent *) &(cp->he);
+    }
     if (!lp)
 	return NULL;
     (void) do_query_name(lp, name, NULL, family);
     return ((struct hostent *) NULL);
 }
 
+/*
+ * Returns the cached name for addr, or NULL and starts a lookup that
+ * will answer lp.  If the address is known to have no name, lp's flags
+ * are set to ASYNC_NONE instead, as nothing is left to wait for.
+ */
 struct hostent *gethost_byaddr(char *addr, Link *lp, int family)
 {
     aCache     *cp;
@@ -505,8 +547,19 @@ struct hostent *gethost_byaddr(char *addr, Link *lp, int family)
 	return ((struct hostent *) NULL);
 
     reinfo.re_nu_look++;
+    cainfo.ca_lookups++;
     if ((cp = find_cache_number(NULL, addr, family)))
+    {
+	cainfo.ca_hits++;
 	return (struct hostent *) &(cp->he);
+    }
+    if (find_negcache(addr, family))
+    {
+	cainfo.ca_neg_hits++;
+	if (lp)
+	    lp->flags = ASYNC_NONE;
+	return NULL;
+    }
     if (!lp)
 	return NULL;
     if (family == AF_INET)
@@ -656,7 +709,7 @@ static int query_name(char *name, int class, int type, ResRQ * rptr)
     rptr->id = ntohs(hptr->id);
     add_request_id(rptr);
     rptr->sends++;
-    s = send_res_msg(buf, r, rptr->sends);
+    s = send_res_msg(buf, r, rptr);
     if (s == -1)
     {
 	h_errno = TRY_AGAIN;
@@ -1303,19 +1356,21 @@ static int proc_answer(ResRQ * rptr, HEADER *hptr, char *buf, char *eob)
 /*
  * read a dns reply from the nameserver and process it.
  */
-struct hostent *get_res(char *lp)
+struct hostent *get_res(char *lp, int fd)
 {
     static char buf[sizeof(HEADER) + MAXPACKET];
     HEADER *hptr;
     ResRQ  *rptr = NULL;
     aCache     *cp = (aCache *) NULL;
-    struct sockaddr_in sin;
-    int         a, max;
-    unsigned    len = sizeof(sin), rc;
+    int         a, ns, rc;
     
-    rc = recvfrom(resfd, buf, sizeof(buf), 0, (struct sockaddr *) &sin, &len);
-    if (rc <= sizeof(HEADER))
+    for (ns = 0; ns < nresfds; ns++)
+	if (resfds[ns] == fd)
+	    break;
+    rc = recv(fd, buf, sizeof(buf), 0);
+    if (ns == nresfds || rc <= (int) sizeof(HEADER))
 	return getres_err(rptr, lp);
+    ns_replies[ns]++;
     
     /*
      * convert DNS reply reader from Network byte order to CPU byte
@@ -1340,20 +1395,10 @@ struct hostent *get_res(char *lp)
     if (!rptr)
 	return getres_err(rptr, lp);
     /*
-     * check against possibly fake replies
+     * check against possibly fake replies: the socket only hears from
+     * its own nameserver, and this one must have been asked.
      */
-    max = MIN(_res.nscount, rptr->sends);
-    if (!max)
-	max = 1;
-
-    for (a = 0; a < max; a++)
-	if (!_res.nsaddr_list[a].sin_addr.s_addr ||
-	    !memcmp((char *) &sin.sin_addr,
-		    (char *) &_res.nsaddr_list[a].sin_addr,
-		    sizeof(struct in_addr)))
-	    break;
-
-    if (a == max) 
+    if (!(rptr->nsmask & (1 << ns)))
     {
 	reinfo.re_unkrep++;
 	return getres_err(rptr, lp);
@@ -1380,6 +1425,8 @@ struct hostent *get_res(char *lp)
 	    break;
 	}
 	reinfo.re_errors++;
+	if (hptr->rcode == NXDOMAIN || hptr->rcode == NOERROR)
+	    add_negcache(rptr);
 	/*
 	 * If a bad error was returned, we stop here and dont send
 	 * send any more (no retries granted).
@@ -1486,6 +1533,7 @@ struct hostent *get_res(char *lp)
 			       invalid_parms_ip ? "MISSING" :
 			       resntoa((char *)&rptr->he.h_addr_list[0],
 				       rptr->he.h_addrtype));
+		add_negcache(rptr);
 		if (lp)
 		    memcpy(lp, (char *) &rptr->cinfo, sizeof(Link));
 		rem_request(rptr);
@@ -1561,6 +1609,7 @@ struct hostent *get_res(char *lp)
 			       me.name, ntoatmp_f, ntoatmp_r);
 		}
 		
+		add_negcache(rptr);
 		if (lp)
 		    memcpy(lp, (char *) &rptr->cinfo, sizeof(Link));
 		
@@ -1695,10 +1744,33 @@ static unsigned int hash_cp(char *cp)
    return ((unsigned long) cp) % ARES_IDCACSIZE;
 }
 
+/* put a cache entry at the top of the LRU list */
+static void cache_link(aCache *cp)
+{
+    cp->list_prev = NULL;
+    cp->list_next = cachetop;
+    if (cachetop)
+	cachetop->list_prev = cp;
+    else
+	cachebottom = cp;
+    cachetop = cp;
+}
+
+static void cache_unlink(aCache *cp)
+{
+    if (cp->list_prev)
+	cp->list_prev->list_next = cp->list_next;
+    else
+	cachetop = cp->list_next;
+    if (cp->list_next)
+	cp->list_next->list_prev = cp->list_prev;
+    else
+	cachebottom = cp->list_prev;
+}
+
 /* Add a new cache item to the queue and hash table. */
 static aCache *add_to_cache(aCache * ocp)
 {
-    aCache *cp = NULL;
     int     hashv;
     
 #ifdef DEBUG
@@ -1707,8 +1779,6 @@ static aCache *add_to_cache(aCache * ocp)
 	   ocp, &ocp->he, ocp->he.h_name, ocp->he.h_addr_list,
 	   ocp->he.h_addr_list[0]));
 #endif
-    ocp->list_next = cachetop;
-    cachetop = ocp;
     /* Make sure non-bind resolvers don't blow up (Thanks to Yves) */
     if (!ocp)
 	return NULL;
@@ -1716,6 +1786,7 @@ static aCache *add_to_cache(aCache * ocp)
 	return NULL;
     if (!(ocp->he.h_addr))
 	return NULL;
+    cache_link(ocp);
     
 #ifdef ALLOW_CACHE_NAMES
     hashv = hash_name(ocp->he.h_name);
@@ -1739,10 +1810,7 @@ static aCache *add_to_cache(aCache * ocp)
 #endif
     /* LRU deletion of excessive cache entries. */
     if (++incache > IRC_MAXCACHED)
-    {
-	for (cp = cachetop; cp->list_next; cp = cp->list_next);
-	rem_cache(cp);
-    }
+	rem_cache(cachebottom);
     cainfo.ca_adds++;
 
     return ocp;
@@ -1755,25 +1823,19 @@ static aCache *add_to_cache(aCache * ocp)
  */
 static void update_list(ResRQ * rptr, aCache * cachep)
 {
-    aCache **cpp, *cp = cachep;
+    aCache *cp = cachep;
     char   *s, *t, **base;
     int     i, j;
     int     addrcount;
 
-    /*
-     * search for the new cache item in the cache list by hostname. *
-     * If found, move the entry to the top of the list and return.
-     */
+    /* move the entry to the top of the list. */
     cainfo.ca_updates++;
 
-    for (cpp = &cachetop; *cpp; cpp = &((*cpp)->list_next))
-	if (cp == *cpp)
-	    break;
-    if (!*cpp)
-	return;
-    *cpp = cp->list_next;
-    cp->list_next = cachetop;
-    cachetop = cp;
+    if (cp != cachetop)
+    {
+	cache_unlink(cp);
+	cache_link(cp);
+    }
     if (!rptr)
 	return;
     
@@ -2086,12 +2148,7 @@ static void rem_cache(aCache * ocp)
     /*
      * remove cache entry from linked list
      */
-    for (cp = &cachetop; *cp; cp = &((*cp)->list_next))
-	if (*cp == ocp)
-	{
-	    *cp = ocp->list_next;
-	    break;
-	}
+    cache_unlink(ocp);
     /* remove cache entry from hashed name lists */
     if (hp->h_name == (char *) NULL)
 	return;
@@ -2154,6 +2211,123 @@ static void rem_cache(aCache * ocp)
     return;
 }
 
+static int hash_neg(char *addr, int family)
+{
+    return hash_number((u_char *) addr, family == AF_INET6 ?
+		       sizeof(struct in6_addr) : sizeof(struct in_addr))
+	% ARES_NEGCACSIZE;
+}
+
+/* find a live negative entry for an address, and mark it used */
+static aNegCache *find_negcache(char *addr, int family)
+{
+    aNegCache *nc;
+    int     len = (family == AF_INET6) ? sizeof(struct in6_addr) :
+	sizeof(struct in_addr);
+
+    for (nc = negtable[hash_neg(addr, family)]; nc; nc = nc->hnext)
+	if (nc->family == family && !memcmp(&nc->addr, addr, len))
+	    break;
+    if (!nc)
+	return NULL;
+    if (timeofday >= nc->expireat)
+    {
+	cainfo.ca_expires++;
+	rem_negcache(nc);
+	return NULL;
+    }
+    if (nc != negtop)
+    {
+	nc->list_prev->list_next = nc->list_next;
+	if (nc->list_next)
+	    nc->list_next->list_prev = nc->list_prev;
+	else
+	    negbottom = nc->list_prev;
+	nc->list_prev = NULL;
+	nc->list_next = negtop;
+	negtop->list_prev = nc;
+	negtop = nc;
+    }
+    return nc;
+}
+
+/*
+ * Remember that the address a reverse lookup, or the forward lookup
+ * confirming it, was for has no usable name.
+ */
+static void add_negcache(ResRQ *rptr)
+{
+    aNegCache *nc;
+    char   *addr;
+    int     family, hashv;
+
+    if (rptr->type == T_PTR)
+    {
+	addr = (char *) &rptr->addr;
+	family = rptr->he.h_addrtype;
+    }
+    else if (rptr->has_rev)
+    {
+	addr = (char *) &rptr->he_rev.h_addr;
+	family = rptr->he_rev.h_addrtype;
+    }
+    else
+	return;
+
+    if ((nc = find_negcache(addr, family)))
+    {
+	nc->expireat = timeofday + AR_NEGTTL;
+	return;
+    }
+
+    nc = (aNegCache *) MyMalloc(sizeof(aNegCache));
+    memset((char *) nc, '\0', sizeof(aNegCache));
+    nc->family = family;
+    memcpy(&nc->addr, addr, (family == AF_INET6) ?
+	   sizeof(struct in6_addr) : sizeof(struct in_addr));
+    nc->expireat = timeofday + AR_NEGTTL;
+
+    hashv = hash_neg(addr, family);
+    nc->hnext = negtable[hashv];
+    negtable[hashv] = nc;
+
+    nc->list_next = negtop;
+    if (negtop)
+	negtop->list_prev = nc;
+    else
+	negbottom = nc;
+    negtop = nc;
+
+    cainfo.ca_neg_adds++;
+    if (++innegcache > IRC_MAXNEGCACHED)
+	rem_negcache(negbottom);
+}
+
+static void rem_negcache(aNegCache *nc)
+{
+    aNegCache **ncp;
+
+    for (ncp = &negtable[hash_neg((char *) &nc->addr, nc->family)]; *ncp;
+	 ncp = &(*ncp)->hnext)
+	if (*ncp == nc)
+	{
+	    *ncp = nc->hnext;
+	    break;
+	}
+
+    if (nc->list_prev)
+	nc->list_prev->list_next = nc->list_next;
+    else
+	negtop = nc->list_next;
+    if (nc->list_next)
+	nc->list_next->list_prev = nc->list_prev;
+    else
+	negbottom = nc->list_prev;
+
+    MyFree(nc);
+    innegcache--;
+}
+
 /*
  * removes entries from the cache which are older than their expirey
  * times. returns the time at which the server should next poll the
@@ -2162,9 +2336,23 @@ static void rem_cache(aCache * ocp)
 time_t expire_cache(time_t now)
 {
     aCache *cp, *cp2;
+    aNegCache *nc, *nc2;
     time_t  next = 0;
     time_t  mmax = now + AR_TTL;
 
+    for (nc = negtop; nc; nc = nc2)
+    {
+	nc2 = nc->list_next;
+
+	if (now >= nc->expireat)
+	{
+	    cainfo.ca_expires++;
+	    rem_negcache(nc);
+	}
+	else if (!next || next > nc->expireat)
+	    next = nc->expireat;
+    }
+
     for (cp = cachetop; cp; cp = cp2)
     {
 	cp2 = cp->list_next;
@@ -2191,11 +2379,14 @@ void flush_cache()
     
     while ((cp = cachetop))
 	rem_cache(cp);
+    while (negtop)
+	rem_negcache(negtop);
 }
 
 int m_dns(aClient *cptr, aClient *sptr, int parc, char *parv[])
 {
     aCache *cp;
+    aNegCache *nc;
     int     i;
     
     if (parv[1] && *parv[1] == 'l')
@@ -2220,6 +2411,11 @@ int m_dns(aClient *cptr, aClient *sptr, int parc, char *parv[])
 			   parv[0], cp->he.h_name,
 			   resntoa(cp->he.h_addr_list[i], cp->he.h_addrtype));
 	}
+	for (nc = negtop; nc; nc = nc->list_next)
+	    sendto_one(sptr, "NOTICE %s :Ex %ld no name for %s",
+		       parv[0], (long)(nc->expireat - timeofday),
+		       nc->family == AF_INET6 ? inet6ntoa((char *) &nc->addr) :
+		       inetntoa((char *) &nc->addr));
 	return 0;
     }
     sendto_one(sptr, "NOTICE %s :Ca %d Cd %d Ce %d Cl %d Ch %d:%d Cu %d",
@@ -2234,6 +2430,18 @@ int m_dns(aClient *cptr, aClient *sptr, int parc, char *parv[])
     sendto_one(sptr, "NOTICE %s :Ru %d Rsh %d Rs %d(%d) Rt %d", sptr->name,
 	       reinfo.re_unkrep, reinfo.re_shortttl, reinfo.re_sent,
 	       reinfo.re_resends, reinfo.re_timeouts);
+    sendto_one(sptr, "NOTICE %s :Cache %d/%d, negative %d/%d, hits %d+%d "
+	       "of %d lookups (%d%%), %d negative added",
+	       sptr->name, incache, IRC_MAXCACHED, innegcache,
+	       IRC_MAXNEGCACHED, cainfo.ca_hits, cainfo.ca_neg_hits,
+	       cainfo.ca_lookups, cainfo.ca_lookups ?
+	       (int) ((cainfo.ca_hits + cainfo.ca_neg_hits) * 100LL /
+		      cainfo.ca_lookups) : 0, cainfo.ca_neg_adds);
+    for (i = 0; i < nresfds; i++)
+	sendto_one(sptr, "NOTICE %s :Nameserver %s: %d sent, %d replies%s",
+		   sptr->name, inetntoa((char *) &_res.nsaddr_list[i].sin_addr),
+		   ns_sent[i], ns_replies[i],
+		   resfds[i] < 0 ? " (no socket)" : "");
     return 0;
 }
 
@@ -2242,6 +2450,7 @@ memcount_res(MCres *mc)
 {
     ResRQ *rq;
     aCache *ce;
+    aNegCache *nc;
     int i;
 
     mc->file = __FILE__;
@@ -2296,13 +2505,22 @@ memcount_res(MCres *mc)
         }
     }
 
+    for (nc = negtop; nc; nc = nc->list_next)
+    {
+        mc->negcached.c++;
+        mc->negcached.m += sizeof(*nc);
+    }
+
     mc->s_cachehash.c = sizeof(hashtable) / sizeof(hashtable[0]);
     mc->s_cachehash.m = sizeof(hashtable);
     mc->s_requesthash.c = sizeof(idcphashtable) / sizeof(idcphashtable[0]);
     mc->s_requesthash.m = sizeof(idcphashtable);
 
-    mc->total.c = mc->requests.c + mc->cached.c;
-    mc->total.m = mc->requests.m + mc->cached.m;
+    mc->s_neghash.c = sizeof(negtable) / sizeof(negtable[0]);
+    mc->s_neghash.m = sizeof(negtable);
+
+    mc->total.c = mc->requests.c + mc->cached.c + mc->negcached.c;
+    mc->total.m = mc->requests.m + mc->cached.m + mc->negcached.m;
 
     return mc->total.m;
 }
@@ -70,6 +70,11 @@ extern void free_port(aPort *);
 #define IN_LOOPBACKNET  0x7f
 #endif
 
+/* accept4() hands sockets back already non-blocking and close-on-exec */
+#if defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+#define USE_ACCEPT4
+#endif
+
 #if defined(MAXBUFFERS)
 int rcvbufmax = 0, sndbufmax = 0;
 #endif
@@ -86,7 +91,7 @@ int listen_count = 0;
 
 
 aClient *local[MAXCONNECTIONS];
-int highest_fd = 0, resfd = -1;
+int highest_fd = 0;
 time_t timeofday;
 static struct sockaddr_in mysk;
 
@@ -251,13 +256,27 @@ void
 open_listeners()
 {
     aPort *tmp;
+    aListener *lptr;
+    int want;
+
     if(!ports)
         sendto_realops("Lost all port configurations!");
     for(tmp = ports; tmp; tmp = tmp->next)
     {
-        if(tmp->lstn)
-            continue;
-        add_listener(tmp);
+        want = 1;
+#ifdef SO_REUSEPORT
+        if(tmp->flags & CONF_FLAGS_P_REUSEPORT)
+        {
+            /* a socket left open without the flag won't share the port */
+            if(tmp->lstn && !(tmp->lstn->flags & CONF_FLAGS_P_REUSEPORT))
+                continue;
+            want = LISTENER_SHARDS;
+        }
+#endif
+        for(lptr = tmp->lstn; lptr; lptr = lptr->shard)
+            want--;
+        while(want-- > 0 && add_listener(tmp) == 0)
+            ;
     }
     return;
 }
@@ -286,6 +305,7 @@ int add_listener(aPort *aport)
 
     memset(&lstn, 0, sizeof(aListener));
     lstn.port = aport->port;
+    lstn.flags = aport->flags;
 
     memset(&server, 0, sizeof(server));
     if (!BadPtr(aport->address) && (*aport->address != '*'))
@@ -381,9 +401,9 @@ int add_listener(aPort *aport)
     }
 
     lptr->aport = aport;
+    lptr->shard = aport->lstn;
     aport->lstn = lptr;
 
-    lptr->flags = aport->flags;
     if(lptr->flags & CONF_FLAGS_P_SSL && ssl_capable)
     {
         SetSSL(lptr);
@@ -406,7 +426,7 @@ int add_listener(aPort *aport)
 
 void close_listener(aListener *lptr)
 {
-    aListener *alptr, *alptrprev = NULL;
+    aListener *alptr, *alptrprev = NULL, **shardp;
     aPort *aport, *aportl, *aportn = NULL;
 
     del_fd(lptr->fd);
@@ -414,11 +434,18 @@ void close_listener(aListener *lptr)
 
     /* drop our conf link */
     aport = lptr->aport;
-    aport->lstn = NULL;
+    for(shardp = &aport->lstn; *shardp; shardp = &(*shardp)->shard)
+    {
+        if(*shardp == lptr)
+        {
+            *shardp = lptr->shard;
+            break;
+        }
+    }
 
-    /* and now drop the conf itself */
+    /* and now drop the conf itself, with its last socket */
 
-    for(aportl = ports ; aportl ; aportl = aportl->next)
+    for(aportl = ports ; aportl && !aport->lstn ; aportl = aportl->next)
     {
         if(aportl == aport)
         {
@@ -525,9 +552,7 @@ void init_sys()
         engine_init();
 
         /* debugging is going to a tty */
-        resfd = init_resolver(0x1f);
-        add_fd(resfd, FDT_RESOLVER, NULL);
-        set_fd_flags(resfd, FDF_WANTREAD);
+        init_resolver(0x1f);
         return;
     }
 
@@ -557,9 +582,7 @@ void init_sys()
     }
 
     engine_init();
-    resfd = init_resolver(0x1f);
-    add_fd(resfd, FDT_RESOLVER, NULL);
-    set_fd_flags(resfd, FDF_WANTREAD);
+    init_resolver(0x1f);
     return;
 }
 
@@ -753,7 +776,6 @@ int check_server_init(aClient * cptr)
          */
         lin.value.aconn = aconn;
         lin.flags = ASYNC_CONF;
-        nextdnscheck = 1;
         if ((s = strchr(aconn->host, '@')))
             s++;
         else
@@ -965,8 +987,7 @@ void close_connection(aClient *cptr)
             aconn->hold = time(NULL);
             aconn->hold += (aconn->hold - cptr->since > HANGONGOODLINK) ?
                 HANGONRETRYDELAY : aconn->class->connfreq;
-            if (nextconnect > aconn->hold)
-                nextconnect = aconn->hold;
+            schedule_connect(aconn->hold);
         }
     } 
     else if (IsClient(cptr))
@@ -1006,6 +1027,7 @@ void close_connection(aClient *cptr)
         if(!IsDead(cptr))
         dump_connections(cptr->fd);
         local[cptr->fd] = NULL;
+        timer_del(&cptr->timer);
         if(IsSSL(cptr) && cptr->ssl)
         {
             SSL_set_shutdown(cptr->ssl, SSL_RECEIVED_SHUTDOWN);
@@ -1182,6 +1204,15 @@ static void set_listener_sock_opts(int fd, aListener *lptr, int family)
                    sizeof(opt)) < 0)
         report_listener_error("setsockopt(SO_REUSEADDR) %s:%s", lptr);
 #endif
+#ifdef SO_REUSEPORT
+    if (lptr->flags & CONF_FLAGS_P_REUSEPORT)
+    {
+        opt = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (char *) &opt,
+                       sizeof(opt)) < 0)
+            report_listener_error("setsockopt(SO_REUSEPORT) %s:%s", lptr);
+    }
+#endif
 #if  defined(SO_DEBUG) && defined(DEBUGMODE) && 0
    /*
     * Solaris with SO_DEBUG writes to syslog by default
@@ -1312,33 +1343,21 @@ void set_listener_non_blocking(int fd, aListener *lptr)
 
 
 /*
- * Creates a client which has just connected to us on the given fd. The
- * sockhost field is initialized with the ip# of the host. The client
- * is added to the linked list of clients but isnt added to any hash
- * tables yuet since it doesnt have a name.
+ * Creates a client which has just connected to us on the given fd, from
+ * the address accept() gave.  The sockhost field is initialized with the
+ * ip# of the host. The client is added to the linked list of clients but
+ * isnt added to any hash tables yuet since it doesnt have a name.
+ * accept_connection() has already turned away what it can without one.
  */
-aClient *add_connection(aListener *lptr, int fd)
+aClient *add_connection(aListener *lptr, int fd, struct sockaddr *sa)
 {
     Link lin;
     aClient *acptr = NULL;
-    union
-    {
-	struct sockaddr sa;
-	struct sockaddr_in addr4;
-	struct sockaddr_in6 addr6;
-    } addr;
-    unsigned int len = sizeof(addr);
-    struct userBan *ban;
-
-    if (getpeername(fd, &addr.sa, &len) == -1)
-    {
-        ircstp->is_ref++;
-        close(fd);
-        return NULL;
-    }
+    struct sockaddr_in *addr4 = (struct sockaddr_in *) sa;
+    struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *) sa;
 
     acptr = make_client(NULL, &me);
-    acptr->ip_family = addr.sa.sa_family;
+    acptr->ip_family = sa->sa_family;
 
     /*
      * Copy ascii address to 'sockhost' just in case. Then we have
@@ -1346,31 +1365,17 @@ aClient *add_connection(aListener *lptr, int fd)
      */
     if (acptr->ip_family == AF_INET)
     {
-	get_sockhost(acptr, (char *) inetntoa((char *) &addr.addr4.sin_addr));
-	memcpy((char *) &acptr->ip.ip4, (char *) &addr.addr4.sin_addr,
+	get_sockhost(acptr, (char *) inetntoa((char *) &addr4->sin_addr));
+	memcpy((char *) &acptr->ip.ip4, (char *) &addr4->sin_addr,
 		sizeof(struct in_addr));
-	acptr->port = ntohs(addr.addr4.sin_port);
+	acptr->port = ntohs(addr4->sin_port);
     }
     else if (acptr->ip_family == AF_INET6)
     {
-	get_sockhost(acptr, (char *) inet6ntoa((char *) &addr.addr6.sin6_addr));
-	memcpy((char *) &acptr->ip.ip6, (char *) &addr.addr6.sin6_addr,
+	get_sockhost(acptr, (char *) inet6ntoa((char *) &addr6->sin6_addr));
+	memcpy((char *) &acptr->ip.ip6, (char *) &addr6->sin6_addr,
 		sizeof(struct in6_addr));
-	acptr->port = ntohs(addr.addr6.sin6_port);
-    }
-
-    /*
-     * Check that this socket (client) is allowed to accept
-     * connections from this IP#.
-     */
-    if (lptr->allow_cidr_bits > 0 &&
-	bitncmp(&acptr->ip, &lptr->allow_ip, lptr->allow_cidr_bits) != 0)
-    {
-	ircstp->is_ref++;
-	acptr->fd = -2;
-	free_client(acptr);
-	close(fd);
-	return NULL;
+	acptr->port = ntohs(addr6->sin6_port);
     }
 
     lptr->ccount++;
@@ -1378,30 +1383,21 @@ aClient *add_connection(aListener *lptr, int fd)
     Count.unknown++;
     add_fd(fd, FDT_CLIENT, acptr);
     local[fd] = acptr;
+    timer_set(&acptr->timer, acptr->since + CONNECTTIMEOUT);
 
     acptr->fd = fd;
     if (fd > highest_fd)
         highest_fd = fd;
 
     /* sockets inherit the options of their parents.. do we need these? */
+#ifndef USE_ACCEPT4
     set_non_blocking(acptr->fd, acptr);
+#endif
     set_sock_opts(acptr->fd, acptr);
 
     acptr->lstn = lptr;
     add_client_to_list(acptr);
 
-    ban = check_userbanned(acptr, UBAN_IP|UBAN_CIDR4|UBAN_WILDUSER, 0);
-    if(ban)
-    {
-        int loc = (ban->flags & UBAN_LOCAL) ? 1 : 0;
-        
-        ircstp->is_ref++;
-        ircstp->is_ref_1++;
-        exit_banned_client(acptr, loc, loc ? 'K' : 'A', ban->reason, 0);
-
-        return NULL;
-    }
-
     if(call_hooks(CHOOK_PREACCESS, acptr) == FLUSH_BUFFER)
         return NULL;
 
@@ -1416,24 +1412,32 @@ aClient *add_connection(aListener *lptr, int fd)
 	if (acptr->ip_family == AF_INET)
 	{
 	    Debug((DEBUG_DNS, "lookup %s",
-		   inetntoa((char *) &addr.addr4.sin_addr)));
+		   inetntoa((char *) &addr4->sin_addr)));
 	    acptr->hostp = gethost_byaddr((char *) &acptr->ip.ip4, &lin,
 					  AF_INET);
 	}
 	else if (acptr->ip_family == AF_INET6)
 	{
 	    Debug((DEBUG_DNS, "lookup %s",
-		   inet6ntoa((char *) &addr.addr6.s6_addr)));
+		   inet6ntoa((char *) &addr6->sin6_addr)));
 	    acptr->hostp = gethost_byaddr((char *) &acptr->ip.ip6, &lin,
 					  AF_INET6);
 	}
-	if (!acptr->hostp)
-            SetDNS(acptr);
+	if (acptr->hostp)
+	{
 #ifdef SHOW_HEADERS
-        else
             sendto_one(acptr, "%s", REPORT_FIN_DNSC);
 #endif
-        nextdnscheck = 1;
+	}
+	else if (lin.flags == ASYNC_NONE)
+	{
+	    /* known not to resolve, no need to ask again */
+#ifdef SHOW_HEADERS
+	    sendto_one(acptr, "%s", REPORT_FAIL_DNS);
+#endif
+	}
+	else
+            SetDNS(acptr);
     }
     
 #ifdef DO_IDENTD
@@ -1669,6 +1673,82 @@ void read_error_exit(aClient *cptr, int length, int err)
     exit_client(cptr, cptr, &me, errmsg);
 }
 
+/*
+ * accept_refused
+ *
+ * Whether a connection just accepted on lptr is to be closed again at
+ * once: throttled, z-lined, from outside the port's ipmask, on a port
+ * being closed, or past the fd limit.  All of this needs only the
+ * address, so it is done before a client is made for the connection,
+ * and a flood costs an accept() and a close() each.  Returns 1 if so,
+ * having told the other end why where that's worth the bother.
+ */
+static int accept_refused(aListener *lptr, int fd, struct sockaddr *sa)
+{
+    char host[HOSTLEN + 2];
+    void *ip;
+    struct userBan *ban;
+
+    if (sa->sa_family == AF_INET)
+    {
+	ip = &((struct sockaddr_in *) sa)->sin_addr;
+	strncpyzt(host, (char *) inetntoa((char *) ip), sizeof(host));
+    }
+    else if (sa->sa_family == AF_INET6)
+    {
+	ip = &((struct sockaddr_in6 *) sa)->sin6_addr;
+	strncpyzt(host, (char *) inet6ntoa((char *) ip), sizeof(host));
+    }
+    else
+	return 1;	/* unknown address family. */
+
+    /* if they are throttled, drop them silently. */
+    if (throttle_check(host, fd, NOW) == 0)
+    {
+        ircstp->is_throt++;
+        return 1;
+    }
+
+    if (fd >= MAX_ACTIVECONN)
+    {
+        sendto_realops_lev(CCONN_LEV,"All connections in use. fd: %d (%s)",
+            fd,get_listener_name(lptr));
+        send(fd, "ERROR :All connections in use\r\n", 32, 0);
+        return 1;
+    }
+    if(lptr->aport->legal == -1)
+    {
+        send(fd, "ERROR :This port is closed\r\n", 29, 0);
+        return 1;
+    }
+
+    /*
+     * Check that this socket (client) is allowed to accept
+     * connections from this IP#.
+     */
+    if (lptr->allow_cidr_bits > 0 &&
+	bitncmp(ip, &lptr->allow_ip, lptr->allow_cidr_bits) != 0)
+	return 1;
+
+    if ((ban = check_ipbanned(sa->sa_family, ip, host)))
+    {
+        int loc = (ban->flags & UBAN_LOCAL) ? 1 : 0;
+
+        ircstp->is_ref_1++;
+        refuse_banned(fd, host, loc, loc ? 'K' : 'A', ban->reason);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * accept_connection
+ *
+ * Called once a pass of the io loop for a listener with connections
+ * waiting.  Takes up to ACCEPT_BUDGET new clients, or ACCEPT_TRIES
+ * connections counting the ones refused; the rest stay in the backlog,
+ * the listener is still readable, and we get back to them next pass.
+ */
 void accept_connection(aListener *lptr)
 {
     union
@@ -1677,20 +1757,28 @@ void accept_connection(aListener *lptr)
 	struct sockaddr_in addr4;
 	struct sockaddr_in6 addr6;
     } addr;
-    unsigned int addrlen = sizeof(addr);
-    char host[HOSTLEN + 2];
+    socklen_t addrlen;
     int newfd;
-    int i;
+    int taken, tries;
 
     lptr->lasttime = timeofday;
 
-    for (i = 0; i < 100; i++) /* accept up to 100 times per call
-                               * to deal with high connect rates */
+    for (taken = tries = 0; taken < ACCEPT_BUDGET && tries < ACCEPT_TRIES;
+         tries++)
     {
-        if((newfd = accept(lptr->fd, &addr.sa, &addrlen)) < 0)
+        addrlen = sizeof(addr);
+#ifdef USE_ACCEPT4
+        newfd = accept4(lptr->fd, &addr.sa, &addrlen,
+                        SOCK_NONBLOCK|SOCK_CLOEXEC);
+#else
+        newfd = accept(lptr->fd, &addr.sa, &addrlen);
+#endif
+        if (newfd < 0)
         {
             switch(errno)
             {
+                case ECONNABORTED:
+                    continue;   /* gone before we got to it */
 #ifdef EMFILE
                 case EMFILE:
                     report_listener_error("Cannot accept connections %s:%s", 
@@ -1704,57 +1792,24 @@ void accept_connection(aListener *lptr)
                     break;
 #endif
             }
-        return;
-        }
-
-	if (addr.sa.sa_family == AF_INET)
-	{
-	    strncpyzt(host, (char *) inetntoa((char *) &addr.addr4.sin_addr),
-		      sizeof(host));
-	}
-	else if (addr.sa.sa_family == AF_INET6)
-	{
-	    strncpyzt(host, (char *) inet6ntoa((char *) &addr.addr6.sin6_addr),
-		      sizeof(host));
-	}
-	else
-	{
-	    /* unknown address family. */
-	    close(newfd);
-	    return;
-	}
-
-        /* if they are throttled, drop them silently. */
-        if (throttle_check(host, newfd, NOW) == 0)
-        {
-            ircstp->is_ref++;
-            ircstp->is_throt++;
-            close(newfd);
             return;
         }
 
-        if (newfd >= MAX_ACTIVECONN)
+        lptr->accepted++;
+        if (accept_refused(lptr, newfd, &addr.sa))
         {
             ircstp->is_ref++;
-            sendto_realops_lev(CCONN_LEV,"All connections in use. fd: %d (%s)",
-                newfd,get_listener_name(lptr));
-            send(newfd, "ERROR :All connections in use\r\n", 32, 0);
+            lptr->rejected++;
             close(newfd);
-            return;
-        }
-        if(lptr->aport->legal == -1)
-        {
-            ircstp->is_ref++;
-            send(newfd, "ERROR :This port is closed\r\n", 29, 0);
-            close(newfd);
-            return;
+            /* the rest would get an fd as high, and the same notice */
+            if (newfd >= MAX_ACTIVECONN)
+                return;
+            continue;
         }
-        ircstp->is_ac++;
 
-        add_connection(lptr, newfd);
-#ifdef PINGNAZI
-        nextping = timeofday;
-#endif
+        ircstp->is_ac++;
+        taken++;
+        add_connection(lptr, newfd, &addr.sa);
     }
 }
 
@@ -1793,6 +1848,8 @@ int readwrite_client(aClient *cptr, int isread, int iswrite)
         {
             cptr->flags &= ~FLAGS_BLOCKED;
             unset_fd_flags(cptr->fd, FDF_WANTWRITE);
+            /* the queued data goes out in flush_connections() */
+            mark_sendq_dirty(cptr);
         }
         else 
         {
@@ -1888,7 +1945,6 @@ int connect_server(aConnect *aconn, aClient * by, struct hostent *hp)
 
         lin.flags = ASYNC_CONNECT;
         lin.value.aconn = aconn;
-        nextdnscheck = 1;
         s = (char *) strchr(aconn->host, '@');
         s++;            /* should NEVER be NULL */
 
@@ -2013,13 +2069,11 @@ int connect_server(aConnect *aconn, aClient * by, struct hostent *hp)
     if (cptr->fd > highest_fd)
         highest_fd = cptr->fd;
     local[cptr->fd] = cptr;
+    timer_set(&cptr->timer, cptr->since + CONNECTTIMEOUT);
     SetConnecting(cptr);
 
     get_sockhost(cptr, aconn->host);
     add_client_to_list(cptr);
-#ifdef PINGNAZI
-    nextping = timeofday;
-#endif
 
     add_fd(cptr->fd, FDT_CLIENT, cptr);
     cptr->flags |= FLAGS_BLOCKED;
@@ -2231,10 +2285,10 @@ void get_my_name(aClient * cptr, char *name, int len)
 /*
  * do_dns_async
  *
- * Called when the fd returned from init_resolver() has been selected for
- * reading.
+ * Called when one of the resolver's nameserver sockets has been
+ * selected for reading.
  */
-void do_dns_async()
+void do_dns_async(int fd)
 {
     static Link ln;
     aClient *cptr;
@@ -2245,7 +2299,7 @@ void do_dns_async()
     do
     {
         ln.flags = -1;
-        hp = get_res((char *) &ln);
+        hp = get_res((char *) &ln, fd);
         Debug((DEBUG_DNS, "%#x = get_res(%d,%#x)", hp, ln.flags, 
                ln.value.cptr));
 
@@ -2294,7 +2348,7 @@ void do_dns_async()
             default:
                 break;
         }
-        if (ioctl(resfd, FIONREAD, &bytes) == -1)
+        if (ioctl(fd, FIONREAD, &bytes) == -1)
             bytes = 0;
         packets++;
     } while ((bytes > 0) && (packets < 512));
@@ -35,7 +35,6 @@
  * Feb04 -epi
  */
 
-extern int  rehashed;
 extern int  forked;
 extern tConf tconftab[];
 extern sConf sconftab[];
@@ -1341,6 +1340,7 @@ confadd_port(cVar *vars[], int lnum)
                     case 'S': x->flags |= CONF_FLAGS_P_SSL; break;
                     case 'n': x->flags |= CONF_FLAGS_P_NODNS; break;
                     case 'i': x->flags |= CONF_FLAGS_P_NOIDENT; break;
+                    case 'R': x->flags |= CONF_FLAGS_P_REUSEPORT; break;
                     default:
                         confparse_error("Unknown port flag", lnum);
                         free_port(x);
@@ -2507,13 +2507,11 @@ int rehash(aClient *cptr, aClient *sptr, int sig)
 
     merge_confs();
     build_rplcache();
-    nextconnect = 1;    /* reset autoconnects */
+    schedule_connect(timeofday);    /* reset autoconnects */
 
     /* replay journal if necessary */
     klinestore_init( (sig == SIGHUP) ? 0 : 1 );
 
-    rehashed = 1;
-
     return 1;
 }
 
@@ -2682,6 +2680,8 @@ char *pflagtotext(int pflags)
         res[len++] = 'n';
     if(pflags & CONF_FLAGS_P_NOIDENT)
         res[len++] = 'i';
+    if(pflags & CONF_FLAGS_P_REUSEPORT)
+        res[len++] = 'R';
 
     if(!len)
         res[len++] = '-';
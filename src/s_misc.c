@@ -29,6 +29,7 @@
 #include "zlink.h"
 #include "hooks.h"
 #include "clones.h"
+#include "whoindex.h"
 #include <sys/stat.h>
 #include <fcntl.h>
 #if !defined(ULTRIX) && !defined(SGI) && !defined(sequent) && \
@@ -364,6 +365,7 @@ exit_one_client_in_split(aClient *cptr, aClient *dead, char *reason)
         cptr->user->alias->client = NULL;
 
     clones_remove(cptr);
+    whoidx_remove(cptr);
 
 #ifdef RWHO_PROBABILITY
     probability_remove(cptr);
@@ -558,34 +560,18 @@ exit_client(aClient *cptr, aClient *sptr, aClient *from, char *comment)
             remove_from_list(&server_list, sptr, NULL);
             if (server_list == NULL) 
                 server_was_split = YES;
+            burst_abort(sptr);
         }
         sptr->flags |= FLAGS_CLOSING;
         if (IsPerson(sptr)) 
         {
-            Link *lp, *next;
-            LOpts *lopt = sptr->user->lopt;
             /* poof goes their watchlist! */
             hash_del_watch_list(sptr);
             /* if they have listopts, axe those, too */
-            if(lopt != NULL) 
-            {
-                remove_from_list(&listing_clients, sptr, NULL);
-                for (lp = lopt->yeslist; lp; lp = next) 
-                {
-                    next = lp->next;
-                    MyFree(lp->value.cp);
-                    free_link(lp);
-                }
-                for (lp = lopt->nolist; lp; lp = next) 
-                {
-                    next = lp->next;
-                    MyFree(lp->value.cp);
-                    free_link(lp);
-                }
-                                
-                MyFree(sptr->user->lopt);
-                sptr->user->lopt = NULL;
-            }
+            if (sptr->user->lopt)
+                list_free(sptr);
+            /* and any WHO still being answered */
+            whosearch_abort(sptr);
             sendto_realops_lev(CCONN_LEV,
                                "Client exiting: %s (%s@%s) [%s] [%s]",
                                sptr->name, sptr->user->username,
@@ -764,6 +750,7 @@ exit_one_client(aClient *cptr, aClient *sptr, aClient *from, char *comment)
                 remove_user_from_channel(sptr, lp->value.chptr);
 
 	    clones_remove(sptr);
+	    whoidx_remove(sptr);
 
 #ifdef RWHO_PROBABILITY
             probability_remove(sptr);
@@ -863,3 +850,40 @@ exit_banned_client(aClient *cptr, int loc, char type, char *banmsg, int fast)
     
     return exit_client(cptr, cptr, &me, rbuf);
 }
+
+/*
+ * refuse_banned()
+ *
+ * The same for a connection turned away in accept_connection(), before
+ * it had a client: the notices go straight to the socket, which the
+ * caller then closes.
+ */
+void
+refuse_banned(int fd, char *ip, int loc, char type, char *banmsg)
+{
+    char rbuf[512], buf[2048];
+    char *reason = "<no reason specified>";
+    int len;
+
+    if (!BadPtr(banmsg))
+        reason = banmsg;
+
+    ircsnprintf(rbuf, sizeof(rbuf), "%c-banned: %s", type, reason);
+
+    len = ircsnprintf(buf, sizeof(buf),
+                      "NOTICE * :*** You are banned from %s\r\n"
+                      "NOTICE * :*** Reason: %s\r\n"
+                      "NOTICE * :*** Connection info: %s\r\n"
+                      "NOTICE * :*** Ban contact: %s\r\n"
+                      "NOTICE * :*** When contacting %s, please include "
+                      "all of the information shown above\r\n"
+                      ":%s 465 * :%s\r\n"
+                      "ERROR :Closing Link: 0.0.0.0 (%s)\r\n",
+                      loc ? me.name : Network_Name, reason, ip,
+                      loc ? Local_Kline_Address : Network_Kline_Address,
+                      Network_Name, me.name, rbuf, rbuf);
+    if (len > 0)
+        send(fd, buf, MIN(len, (int) sizeof(buf) - 1), 0);
+
+    throttle_force(ip);
+}
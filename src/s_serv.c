@@ -29,6 +29,7 @@
 #include "channel.h"
 #include "nameser.h"
 #include "resolv.h"
+#include "res.h"
 #include "dh.h"
 #include "zlink.h"
 #include "userban.h"
@@ -55,7 +56,6 @@
 #include <zlib.h>
 
 static char buf[BUFSIZE];
-extern int  rehashed;
 extern int  forked;
 extern int uhm_type;
 extern int uhm_umodeh;
@@ -372,6 +372,7 @@ m_burst(aClient *cptr, aClient *sptr, int parc, char *parv[])
         return 0;
     if (parc == 2) { /* This is an EOB */
         sptr->flags &= ~(FLAGS_EOBRECV);
+        sptr->serv->ingest = NULL;
         if (sptr->flags & (FLAGS_SOBSENT|FLAGS_BURST)) return 0;
 
         /* we've already sent our EOB.. we synched first
@@ -449,12 +450,7 @@ m_info(aClient *cptr, aClient *sptr, int parc, char *parv[])
                        RPL_INFO, parv[0], ZLIB_VERSION);
             sendto_one(sptr, ":%s %d %s :FD_SETSIZE=%d WRITEV_IOV=%d "
                              "MAXCONNECTIONS=%d MAX_BUFFER=%d MAXCLIENTS=%d uhm_type=%d uhm_umodeh=%d",
-                       me.name, RPL_INFO, parv[0], FD_SETSIZE,
-#ifdef WRITEV_IOV
-                       WRITEV_IOV,
-#else
-                       0,
-#endif
+                       me.name, RPL_INFO, parv[0], FD_SETSIZE, WRITEV_IOV,
                        MAXCONNECTIONS, MAX_BUFFER, MAXCLIENTS, uhm_type, uhm_umodeh);
         }
 
@@ -1734,7 +1730,8 @@ local_rehash(aClient *cptr, aClient *sptr, char *sender, char *option)
 	if (mycmp(option, "DNS") == 0)
 	{
 		flush_cache();			/* Flush the DNS cache */
-		res_init();			/* Re-Read /etc/resolv.conf file */
+		/* Re-Read /etc/resolv.conf file, and reconnect */
+		init_resolver(RES_CALLINIT|RES_INITSOCK);
 		sendto_one(sptr, ":%s NOTICE %s :Rehashing DNS", me.name, sender);
 		sendto_ops("%s is rehashing DNS while whistling innocently", sender);
 		return 0;
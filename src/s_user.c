@@ -29,6 +29,7 @@
 #include "channel.h"
 #include "throttle.h"
 #include "clones.h"
+#include "whoindex.h"
 #include <sys/stat.h>
 #include <fcntl.h>
 #include "h.h"
@@ -919,6 +920,7 @@ register_user(aClient *cptr, aClient *sptr, char *nick, char *username,
     if (MyConnect(sptr))
     {
         set_effective_class(sptr);
+        schedule_ping(sptr);
 #ifdef MAXBUFFERS
         /* Let's try changing the socket options for the client here... */
         reset_sock_opts(sptr->fd, 0);
@@ -1061,6 +1063,7 @@ register_user(aClient *cptr, aClient *sptr, char *nick, char *username,
 
         /* do this late because of oper masking */
 	clones_add(sptr);
+	whoidx_add(sptr);
     }
     else if (IsServer(cptr))
     {
@@ -1068,8 +1071,9 @@ register_user(aClient *cptr, aClient *sptr, char *nick, char *username,
 
         /* do this early because exit_client() calls clones_remove() */
 	clones_add(sptr);
+	whoidx_add(sptr);
 
-        if ((acptr = find_server(user->server, NULL)) &&
+        if ((acptr = burst_find_server(cptr, user->server)) &&
             acptr->from != sptr->from)
         {
             sendto_realops_lev(DEBUG_LEV,
@@ -424,26 +424,27 @@ char* sbuf_map(SBuf* theBuf, int* theLength)
     return NULL;
 }
 
-#ifdef WRITEV_IOV
-int sbuf_mapiov(SBuf *theBuf, struct iovec *iov)
+/*
+ * Point iov at up to WRITEV_IOV segments from the head of the queue, so
+ * the whole lot can go out in one writev() without copying.  Shared
+ * segments are referenced in place.  Returns the number of iovecs
+ * filled in and their total size in *theLength.
+ */
+int sbuf_mapiov(SBuf *theBuf, struct iovec *iov, int *theLength)
 {
-    int i = 0;
+    int i = 0, len = 0;
     SBufUser *sbu;
 
-    if (theBuf->length == 0)
-        return 0;
-
-    for (sbu = theBuf->head; sbu; sbu = sbu->next)
+    for (sbu = theBuf->head; sbu && i < WRITEV_IOV; sbu = sbu->next)
     {
         iov[i].iov_base = sbu->start;
         iov[i].iov_len = sbu->buf->end - sbu->start;
-        if (++i == WRITEV_IOV)
-            break;
+        len += iov[i++].iov_len;
     }
 
+    *theLength = len;
     return i;
 }
-#endif
 
 int sbuf_flush(SBuf* theBuf)
 {
@@ -4,8 +4,8 @@
 #include "numeric.h"
 #include "h.h"
 #include "memcount.h"
+#include "throttle.h"
 
-static int  hash(char *);	/* keep it hidden here */
 /*
  * ircd used to store full servernames in anUser as well as in the
  * whowas info.  there can be some 40k such structures alive at any
@@ -19,33 +19,26 @@ static int  hash(char *);	/* keep it hidden here */
  * separate for now -Dianora
  */
 
-#define SCACHE_HASH_SIZE 257
+#define SCACHE_HASH_SIZE 256
 
 typedef struct scache_entry
 {
     char        name[HOSTLEN + 1];
-    struct scache_entry *next;
 } SCACHE;
 
-static SCACHE *scache_hash[SCACHE_HASH_SIZE];
+static hash_table *scache_hash;
 
 /* renamed to keep it consistent with the other hash functions -Dianora */
 /* orabidoo had named it init_scache_hash(); */
 
 void clear_scache_hash_table(void)
 {
-    memset((char *) scache_hash, '\0', sizeof(scache_hash));
-}
-
-static int hash(char *string)
-{
-    int         hash_value;
-   
-    hash_value = 0;
-    while (*string)
-	hash_value += (*string++ & 0xDF);
-
-    return hash_value % SCACHE_HASH_SIZE;
+    if (scache_hash)
+	destroy_hash_table(scache_hash);
+    scache_hash = create_hash_table("Server name", SCACHE_HASH_SIZE,
+				    offsetof(SCACHE, name), HOSTLEN,
+				    HASH_FL_STRING | HASH_FL_NOCASE,
+				    (int (*)(void *, void *)) mycmp);
 }
 
 /*
@@ -57,78 +50,48 @@ static int hash(char *string)
  */
 char *find_or_add(char *name)
 {
-    int         hash_index;
-    SCACHE     *ptr, *newptr;
+    SCACHE     *ptr;
 
-    ptr = scache_hash[hash_index = hash(name)];
-    while (ptr) 
-    {
-	if (!mycmp(ptr->name, name))
-	    return (ptr->name);
-	else
-	    ptr = ptr->next;
-    }
+    if ((ptr = hash_find(scache_hash, name)))
+	return (ptr->name);
 
     /* not found -- add it */
-    if ((ptr = scache_hash[hash_index])) 
-    {
-	newptr = scache_hash[hash_index] = (SCACHE *) MyMalloc(sizeof(SCACHE));
-	strncpyzt(newptr->name, name, HOSTLEN + 1);
-	newptr->next = ptr;
-	return (newptr->name);
-    }
-    else
-    {
-	ptr = scache_hash[hash_index] = (SCACHE *) MyMalloc(sizeof(SCACHE));
-	strncpyzt(ptr->name, name, HOSTLEN + 1);
-	ptr->next = (SCACHE *) NULL;
-	return (ptr->name);
-    }
+    ptr = (SCACHE *) MyMalloc(sizeof(SCACHE));
+    strncpyzt(ptr->name, name, HOSTLEN + 1);
+    hash_insert(scache_hash, ptr);
+    return (ptr->name);
 }
 
 /* list all server names in scache very verbose */
 
 void list_scache(aClient *cptr, aClient *sptr, int parc, char *parv[])
 {
-    int         hash_index;
     SCACHE     *ptr;
+    int         pos = 0;
 
-    for (hash_index = 0; hash_index < SCACHE_HASH_SIZE; hash_index++) 
-    {
-	ptr = scache_hash[hash_index];
-	while (ptr) 
-	{
-	    if (ptr->name)
-		sendto_one(sptr, ":%s NOTICE %s :%s",
-			   me.name, parv[0], ptr->name);
-	    ptr = ptr->next;
-	}
-    }
+    while ((ptr = hash_walk(scache_hash, &pos)))
+	sendto_one(sptr, ":%s NOTICE %s :%s",
+		   me.name, parv[0], ptr->name);
 }
 
 u_long
 memcount_scache(MCscache *mc)
 {
     SCACHE *ce;
-    size_t i;
+    int pos = 0;
 
     mc->file = __FILE__;
 
-    for (i = 0; i < sizeof(scache_hash)/sizeof(scache_hash[0]); i++)
+    while ((ce = hash_walk(scache_hash, &pos)))
     {
-        for (ce = scache_hash[i]; ce; ce = ce->next)
-        {
-            mc->cached.c++;
-            mc->cached.m += sizeof(*ce);
-        }
+        mc->cached.c++;
+        mc->cached.m += sizeof(*ce);
     }
 
-    mc->s_hash.c = sizeof(scache_hash)/sizeof(scache_hash[0]);
-    mc->s_hash.m = sizeof(scache_hash);
+    mc->e_hash = scache_hash;
 
     mc->total.c += mc->cached.c;
     mc->total.m += mc->cached.m;
 
     return mc->total.m;
 }
-
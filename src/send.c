@@ -47,12 +47,6 @@ static char selfbuf[256];
 static int  send_message(aClient *, char *, int, void*);
 
 #ifdef HAVE_ENCRYPTION_ON
-/*
- * WARNING:
- * Please be aware that if you are using both encryption
- * and ziplinks, rc4buf in send.c MUST be the same size
- * as zipOutBuf in zlink.c!
- */
 static char rc4buf[16384];
 #endif
 
@@ -95,6 +89,7 @@ static int dead_link(aClient *to, char *notice, int sockerr)
     
     to->sockerr = sockerr;
     to->flags |= FLAGS_DEADSOCKET;
+    timer_set(&to->timer, timeofday);   /* exit it from the main loop */
     /*
      * If because of BUFFERPOOL problem then clean dbuf's now so that
      * notices don't hurt operators below.
@@ -118,6 +113,43 @@ static int dead_link(aClient *to, char *notice, int sockerr)
     return -1;
 }
 
+/*
+ * zip_send
+ * Feeds msg (if any) to the link's zip stream and queues whatever
+ * compressed data comes out; with flush set, that is everything the
+ * stream has been given so far.  Compressed data is encrypted in
+ * place, it is not needed afterwards.
+ */
+static int zip_send(aClient *to, char *msg, int len, int flush)
+{
+    int more, err;
+
+    do
+    {
+        msg = zip_output(to->serv->zip_out, msg, &len, flush, &more, &err);
+        if(len == -1)
+        {
+            sendto_realops("Zipout error for %s: (%d) %s\n", to->name, err,
+                           msg);
+            return dead_link(to, "Zip output error for %s", IRCERR_ZIP);
+        }
+
+        if(len)
+        {
+#ifdef HAVE_ENCRYPTION_ON
+            if(IsRC4OUT(to))
+                rc4_process_stream(to->serv->rc4_out, msg, len);
+#endif
+            if (sbuf_put(&to->sendQ, msg, len) < 0)
+                return dead_link(to, "Buffer allocation error for %s",
+                                 IRCERR_BUFALLOC);
+        }
+        msg = NULL;
+    } while(more);
+
+    return 0;
+}
+
 /*
  * send_message 
  * Internal utility which delivers one message buffer to the 
@@ -183,6 +215,11 @@ static int send_message(aClient *to, char *msg, int len, void* sbuf)
     if (IsDead(to))
         return 0;
 
+    /* a link still being burst may need other data sent first, or none */
+    if (IsServer(to) && to->serv->burst &&
+        (!burst_filter(to, msg, len) || IsDead(to)))
+        return 0;
+
     if (to->class && (SBufLength(&to->sendQ) > to->class->maxsendq))
     {
         /* this would be a duplicate notice, but it contains some useful 
@@ -209,40 +246,36 @@ static int send_message(aClient *to, char *msg, int len, void* sbuf)
 
     if(ZipOut(to))
     {
-        int ldata = (to->flags & FLAGS_BURST);
-
-        msg = zip_output(to->serv->zip_out, msg, &len, 0, &ldata);
-        if(len == -1)
-        {
-            sendto_realops("Zipout error for %s: (%d) %s\n", to->name, ldata,
-                           msg);
-            return dead_link(to, "Zip output error for %s", IRCERR_ZIP);
-        }
-        
-        if(len == 0)
-            return 0;
+        /*
+         * Server links batch into the zip stream, which send_queued()
+         * flushes when the sendQ is written.
+         */
+        if(zip_send(to, msg, len, 0))
+            return -1;
     }
-
-#ifdef HAVE_ENCRYPTION_ON
-    if(IsRC4OUT(to))
+    else
     {
-        /* don't destroy the data in 'msg' */
-        rc4_process_stream_to_buf(to->serv->rc4_out, msg, rc4buf, len);
-        msg = rc4buf;
-    }
+#ifdef HAVE_ENCRYPTION_ON
+        if(IsRC4OUT(to))
+        {
+            /* don't destroy the data in 'msg' */
+            rc4_process_stream_to_buf(to->serv->rc4_out, msg, rc4buf, len);
+            msg = rc4buf;
+        }
 #endif
 
-    if (!sbuf || flag)
-    {
-        if (sbuf_put(&to->sendQ, msg, len) < 0)
-            return dead_link(to, "Buffer allocation error for %s,"
-                                 " closing link", IRCERR_BUFALLOC);
-    }
-    else
-    {
-        if (sbuf_put_share(&to->sendQ, sbuf) < 0)
-            return dead_link(to, "Buffer allocation error for %s,"
-                                 " closing link", IRCERR_BUFALLOC);
+        if (!sbuf || flag)
+        {
+            if (sbuf_put(&to->sendQ, msg, len) < 0)
+                return dead_link(to, "Buffer allocation error for %s,"
+                                     " closing link", IRCERR_BUFALLOC);
+        }
+        else
+        {
+            if (sbuf_put_share(&to->sendQ, sbuf) < 0)
+                return dead_link(to, "Buffer allocation error for %s,"
+                                     " closing link", IRCERR_BUFALLOC);
+        }
     }
 
     /*
@@ -267,8 +300,11 @@ static int send_message(aClient *to, char *msg, int len, void* sbuf)
     if(to->flags & FLAGS_BLOCKED)
        return 0;
 
+    mark_sendq_dirty(to);
+
 #ifdef ALWAYS_SEND_DURING_SPLIT
-    if (currently_processing_netsplit)
+    /* a zip stream flushed per message would hardly compress */
+    if (currently_processing_netsplit && !ZipOut(to))
     {
         send_queued(to);
         return 0;
@@ -298,12 +334,10 @@ static int send_message(aClient *to, char *msg, int len, void* sbuf)
  */
 int send_queued(aClient *to)
 {
-    char       *msg;
     int         len, rlen;
     int more_data = 0; /* the hybrid approach.. */
-#ifdef WRITEV_IOV
+    int niov;
     struct iovec iov[WRITEV_IOV];
-#endif
         
     /*
      * Once socket is marked dead, we cannot start writing to it,
@@ -317,38 +351,14 @@ int send_queued(aClient *to)
     {
         if(SBufLength(&to->sendQ))
             more_data = 1;
-        else
-        {
-            int ldata = (to->flags & FLAGS_BURST);
-
-            msg = zip_output(to->serv->zip_out, NULL, &len, 1, &ldata);
-            if(len == -1)
-            {
-                sendto_realops("Zipout error for %s: (%d) %s\n", to->name,
-                               ldata, msg);
-                return dead_link(to, "Zip output error for %s", IRCERR_ZIP);
-            }
-
-#ifdef HAVE_ENCRYPTION_ON
-            if(IsRC4OUT(to))
-                rc4_process_stream(to->serv->rc4_out, msg, len);
-#endif
-            /* silently stick this on the sendq... */
-            if (!sbuf_put(&to->sendQ, msg, len))
-                return dead_link(to, "Buffer allocation error for %s",
-                                 IRCERR_BUFALLOC);
-        }
+        else if(zip_send(to, NULL, 0, 1))
+            return -1;
     }
    
     while (SBufLength(&to->sendQ) > 0) 
     {
-#ifdef WRITEV_IOV
-        len = sbuf_mapiov(&to->sendQ, iov);
-        if ((rlen = deliver_it(to, iov, len)) < 0)
-#else
-        msg = sbuf_map(&to->sendQ, &len);
-        if ((rlen = deliver_it(to, msg, len)) < 0)
-#endif
+        niov = sbuf_mapiov(&to->sendQ, iov, &len);
+        if ((rlen = deliver_it(to, iov, niov)) < 0)
             return dead_link(to, "Write error to %s, closing link (%s)", errno);
         sbuf_delete(&to->sendQ, rlen);
         to->lastsq = (SBufLength(&to->sendQ) >> 10);
@@ -369,28 +379,14 @@ int send_queued(aClient *to)
 
         if(more_data && SBufLength(&to->sendQ) == 0)
         {
-            int ldata = (to->flags & FLAGS_BURST);
-            
             more_data = 0;
-            
-            msg = zip_output(to->serv->zip_out, NULL, &len, 1, &ldata);
-            if(len == -1)
-            {
-                sendto_realops("Zipout error for %s: (%d) %s\n", to->name,
-                               ldata, msg);
-                return dead_link(to, "Zip output error for %s", IRCERR_ZIP);
-            }
-            
-#ifdef HAVE_ENCRYPTION_ON
-            if(IsRC4OUT(to))
-                rc4_process_stream(to->serv->rc4_out, msg, len);
-#endif
-            /* silently stick this on the sendq... */
-            if (!sbuf_put(&to->sendQ, msg, len))
-                return dead_link(to, "Buffer allocation error for %s",
-                                 IRCERR_BUFALLOC);        
+            if(zip_send(to, NULL, 0, 1))
+                return -1;
         }
     }
+
+    if(ZipOut(to))
+        zip_out_tune(to->serv->zip_out, SBufLength(&to->sendQ));
     
     if ((to->flags & FLAGS_SOBSENT) && IsBurst(to)
          && SBufLength(&to->sendQ) < 20480) 
@@ -425,7 +421,61 @@ void sendto_one(aClient *to, char *pattern, ...)
     va_end(vl);
 }
 
+/*
+ * sendto_one_lines
+ * Queue a block of lines for a local client, each already formatted and
+ * ended with CRLF, in one append to its sendQ rather than a
+ * send_message() per line.  'count' is the number of lines, for the
+ * statistics.  Only for clients: nothing here knows about zip, RC4 or
+ * bursting links.
+ */
+void sendto_one_lines(aClient *to, char *lines, int len, int count)
+{
+    if (IsDead(to))
+        return;
+
+    if (SBufLength(&to->sendQ) > to->class->maxsendq)
+    {
+        to->flags |= FLAGS_SENDQEX;
+        dead_link(to, "Max Sendq exceeded for %s, closing link", 0);
+        return;
+    }
+
+    to->sendM += count;
+    me.sendM += count;
+    if (to->lstn)
+        to->lstn->sendM += count;
+
+    if (sbuf_put(&to->sendQ, lines, len) < 0)
+    {
+        dead_link(to, "Buffer allocation error for %s, closing link",
+                  IRCERR_BUFALLOC);
+        return;
+    }
+
+    if (!(to->flags & FLAGS_BLOCKED))
+        mark_sendq_dirty(to);
+}
+
 /* send to an aliased super target */
+/*
+ * sendto_burst
+ * send netburst data to a server.  Formats on the stack rather than in
+ * sendbuf, since a bursting link may be sent a client or channel from
+ * inside send_message() for the message that refers to it.
+ */
+void sendto_burst(aClient *to, char *pattern, ...)
+{
+    char line[2048];
+    int len;
+    va_list vl;
+
+    va_start(vl, pattern);
+    len = ircvsprintf(line, pattern, vl);
+    va_end(vl);
+    send_message(to, line, len, NULL);
+}
+
 void sendto_alias(AliasInfo *ai, aClient *from, char *pattern, ...)
 {
     aClient *to;
@@ -572,13 +622,91 @@ static inline int check_fake_direction(aClient *from, aClient *to)
 }
 
 
+/*
+ * Queue a prefixed message for one local connection, formatting it once
+ * per call site: lens[0]/share_bufs[0] hold the copy with the full
+ * nick!user@host prefix for clients, lens[1]/share_bufs[1] the one for
+ * server links.  The caller releases both with sbuf_end_share().
+ */
+static void send_prefix_shared(aClient *to, aClient *from, char *pfix,
+                               char *pattern, va_list vl, int *lens,
+                               void **share_bufs)
+{
+    if (IsServer(to))
+    {
+        if (!lens[1])
+        {
+            lens[1] = prefix_buffer(1, from, pfix, remotebuf, pattern, vl);
+            sbuf_begin_share(remotebuf, lens[1], &share_bufs[1]);
+        }
+        send_message(to, remotebuf, lens[1], share_bufs[1]);
+        return;
+    }
+
+    if (!lens[0])
+    {
+        lens[0] = prefix_buffer(0, from, pfix, sendbuf, pattern, vl);
+        sbuf_begin_share(sendbuf, lens[0], &share_bufs[0]);
+    }
+    if (check_fake_direction(from, to))
+        return;
+    send_message(to, sendbuf, lens[0], share_bufs[0]);
+}
+
+/*
+ * Hand a channel message to every server link in the channel's fanout
+ * set except 'one', formatting it into remotebuf on first use.  Super
+ * servers configured with ULF_NOCHANMSG are skipped when the only
+ * members behind them are their own clients.
+ */
+static void send_channel_links(aClient *one, aClient *from, aChannel *chptr,
+                               char *pfix, char *pattern, va_list vl,
+                               void **share_buf)
+{
+    aFanoutLink *fl, *end;
+    chanMember *cm;
+    aClient *link;
+    int didremote = 0;
+
+    for (fl = chptr->rlinks, end = fl + chptr->nrlinks; fl < end; fl++)
+    {
+        link = fl->link;
+        if (link == one)
+            continue; /* ...was the one I should skip */
+
+        if((confopts & FLAGS_SERVHUB) && fl->ulined == fl->members &&
+           link->serv && (link->serv->uflags & ULF_NOCHANMSG))
+            continue; /* Don't send channel traffic to super servers */
+
+        if (link == from->from && !MyClient(from))
+        {
+            /* message is heading back where it came from; let
+             * check_fake_direction() sort out the member there */
+            for (cm = chptr->members; cm; cm = cm->next)
+                if (cm->cptr->from == link)
+                {
+                    check_fake_direction(from, cm->cptr);
+                    break;
+                }
+            continue;
+        }
+
+        if(!didremote)
+        {
+            didremote = prefix_buffer(1, from, pfix, remotebuf, pattern, vl);
+            sbuf_begin_share(remotebuf, didremote, share_buf);
+        }
+
+        send_message(link, remotebuf, didremote, *share_buf);
+    }
+}
+
 void sendto_channel_butone(aClient *one, aClient *from, aChannel *chptr,
                            char *pattern, ...) 
 {
-    chanMember *cm;
     aClient *acptr;
-    int i;
-    int didlocal = 0, didremote = 0;
+    int *fdp, *end;
+    int didlocal = 0;
     va_list vl;
     char *pfix;
     void *share_bufs[2] = { 0, 0 };
@@ -587,53 +715,23 @@ void sendto_channel_butone(aClient *one, aClient *from, aChannel *chptr,
 
     pfix = va_arg(vl, char *);
 
-    INC_SERIAL
-    for (cm = chptr->members; cm; cm = cm->next) 
+    for (fdp = chptr->lfds, end = fdp + chptr->nlocal; fdp < end; fdp++)
     {
-        acptr = cm->cptr;
-        if (acptr->from == one)
-            continue; /* ...was the one I should skip */
+        if (!(acptr = local[*fdp]) || acptr == one)
+            continue; /* ...closed, or the one I should skip */
 
-        if((confopts & FLAGS_SERVHUB) && IsULine(acptr) && (acptr->uplink->serv) && (acptr->uplink->serv->uflags & ULF_NOCHANMSG))
-            continue; /* Don't send channel traffic to super servers */
-
-        if (MyClient(acptr)) 
+        if(!didlocal)
         {
-            if(!didlocal)
-            {
-                didlocal = prefix_buffer(0, from, pfix, sendbuf, 
-                                         pattern, vl);
-                sbuf_begin_share(sendbuf, didlocal, &share_bufs[0]);
-            }
-            if(check_fake_direction(from, acptr))
-                    continue;
-            
-            send_message(acptr, sendbuf, didlocal, share_bufs[0]);
-        }
-        else 
-        {
-            /*
-             * Now check whether a message has been sent to this remote
-             * link already
-             */
-            if(!didremote)
-            {
-                didremote = prefix_buffer(1, from, pfix, remotebuf, 
-                                          pattern, vl);
-                sbuf_begin_share(remotebuf, didremote, &share_bufs[1]);
-            }
-            
-            if(check_fake_direction(from, acptr))
-                    continue;
-            
-            i = acptr->from->fd;
-            if (sentalong[i] != sent_serial) 
-            {
-                send_message(acptr, remotebuf, didremote, share_bufs[1]);
-                sentalong[i] = sent_serial;
-            }
+            didlocal = prefix_buffer(0, from, pfix, sendbuf, pattern, vl);
+            sbuf_begin_share(sendbuf, didlocal, &share_bufs[0]);
         }
+        if(check_fake_direction(from, acptr))
+                continue;
+
+        send_message(acptr, sendbuf, didlocal, share_bufs[0]);
     }
+
+    send_channel_links(one, from, chptr, pfix, pattern, vl, &share_bufs[1]);
     
     sbuf_end_share(share_bufs, 2);    
     va_end(vl);
@@ -647,10 +745,6 @@ void sendto_channel_butone(aClient *one, aClient *from, aChannel *chptr,
 void sendto_channel_remote_butone(aClient *one, aClient *from, aChannel *chptr,
                                   char *pattern, ...) 
 {
-    chanMember *cm;
-    aClient *acptr;
-    int i;
-    int didremote = 0;
     va_list vl;
     char *pfix;
     void *share_buf = NULL;
@@ -659,43 +753,7 @@ void sendto_channel_remote_butone(aClient *one, aClient *from, aChannel *chptr,
 
     pfix = va_arg(vl, char *);
 
-    INC_SERIAL
-    for (cm = chptr->members; cm; cm = cm->next) 
-    {
-        acptr = cm->cptr;
-        if (acptr->from == one)
-            continue; /* ...was the one I should skip */
-
-        if((confopts & FLAGS_SERVHUB) && IsULine(acptr) && (acptr->uplink->serv) && (acptr->uplink->serv->uflags & ULF_NOCHANMSG))
-            continue; /* Don't send channel traffic to super servers */
-
-        if(acptr->fd == -2)
-            continue;
-
-        if (!MyClient(acptr)) 
-        {
-            /*
-             * Now check whether a message has been sent to this remote
-             * link already
-             */
-            if(!didremote)
-            {
-                didremote = prefix_buffer(1, from, pfix, remotebuf,
-                                          pattern, vl);
-                sbuf_begin_share(remotebuf, didremote, &share_buf);
-            }
-            
-            if(check_fake_direction(from, acptr))
-                    continue;
-            
-            i = acptr->from->fd;
-            if (sentalong[i] != sent_serial) 
-            {
-                send_message(acptr, remotebuf, didremote, share_buf);
-                sentalong[i] = sent_serial;
-            }
-        }
-    }
+    send_channel_links(one, from, chptr, pfix, pattern, vl, &share_buf);
     
     sbuf_end_share(&share_buf, 1);
     
@@ -1076,8 +1134,8 @@ void sendto_channel_butlocal(aClient *one, aClient *from, aChannel *chptr,
  */
 void sendto_channel_butserv(aChannel *chptr, aClient *from, char *pattern, ...)
 {
-    chanMember  *cm;
     aClient *acptr;
+    int i;
     va_list vl;
     int didlocal = 0;
     char *pfix;
@@ -1087,11 +1145,12 @@ void sendto_channel_butserv(aChannel *chptr, aClient *from, char *pattern, ...)
     
     pfix = va_arg(vl, char *);
 
-    for (cm = chptr->members; cm; cm = cm->next)
+    for (i = 0; i < chptr->nlocal; i++)
     {
-        if (MyConnect(acptr = cm->cptr))
+        if ((acptr = local[chptr->lfds[i]]))
         {
-            if((chptr->mode.mode & MODE_AUDITORIUM) && (acptr != from) && !is_chan_opvoice(acptr, chptr) &&
+            if((chptr->mode.mode & MODE_AUDITORIUM) && (acptr != from) &&
+               !(chptr->lcms[i]->flags & (CHFL_CHANOP|CHFL_HALFOP|CHFL_VOICE)) &&
                !is_chan_opvoice(from, chptr)) continue;
             if(!didlocal)
             {
@@ -1119,8 +1178,8 @@ void sendto_channel_butserv(aChannel *chptr, aClient *from, char *pattern, ...)
  */
 void sendto_channel_butserv_noopvoice(aChannel *chptr, aClient *from, char *pattern, ...)
 {
-    chanMember  *cm;
     aClient *acptr;
+    int i;
     va_list vl;
     int didlocal = 0;
     char *pfix;
@@ -1130,11 +1189,11 @@ void sendto_channel_butserv_noopvoice(aChannel *chptr, aClient *from, char *patt
     
     pfix = va_arg(vl, char *);
 
-    for (cm = chptr->members; cm; cm = cm->next)
+    for (i = 0; i < chptr->nlocal; i++)
     {
-        if (MyConnect(acptr = cm->cptr))
+        if ((acptr = local[chptr->lfds[i]]))
         {
-            if((acptr == from) || is_chan_opvoice(acptr, chptr)) continue;
+            if((acptr == from) || (chptr->lcms[i]->flags & (CHFL_CHANOP|CHFL_HALFOP|CHFL_VOICE))) continue;
             if(!didlocal)
             {
                 didlocal = prefix_buffer(0, from, pfix, sendbuf, pattern, vl);
@@ -1161,8 +1220,8 @@ void sendto_channel_butserv_noopvoice(aChannel *chptr, aClient *from, char *patt
  */
 void sendto_channel_butserv_me(aChannel *chptr, aClient *from, char *pattern, ...)
 {
-    chanMember  *cm;
     aClient *acptr;
+    int i;
     va_list vl;
     int didlocal = 0;
     char *pfix;
@@ -1180,11 +1239,11 @@ void sendto_channel_butserv_me(aChannel *chptr, aClient *from, char *pattern, ..
     }
 #endif
 
-    for (cm = chptr->members; cm; cm = cm->next)
+    for (i = 0; i < chptr->nlocal; i++)
     {
-        if (MyConnect(acptr = cm->cptr))
+        if ((acptr = local[chptr->lfds[i]]))
         {
-            if((chptr->mode.mode & MODE_AUDITORIUM) && !is_chan_opvoice(acptr, chptr)) continue;
+            if((chptr->mode.mode & MODE_AUDITORIUM) && !(chptr->lcms[i]->flags & (CHFL_CHANOP|CHFL_HALFOP|CHFL_VOICE))) continue;
             if (!didlocal)
             {
                 didlocal = prefix_buffer(0, from, pfix, sendbuf, pattern, vl);
@@ -1211,8 +1270,8 @@ void sendto_channel_butserv_me(aChannel *chptr, aClient *from, char *pattern, ..
  */
 void sendto_channelopvoice_butserv_me(aChannel *chptr, aClient *from, char *pattern, ...)
 {
-    chanMember  *cm;
     aClient *acptr;
+    int i;
     va_list vl;
     int didlocal = 0;
     char *pfix;
@@ -1230,11 +1289,11 @@ void sendto_channelopvoice_butserv_me(aChannel *chptr, aClient *from, char *patt
     }
 #endif
 
-    for (cm = chptr->members; cm; cm = cm->next)
+    for (i = 0; i < chptr->nlocal; i++)
     {
-        if (MyConnect(acptr = cm->cptr))
+        if ((acptr = local[chptr->lfds[i]]))
         {
-            if(!is_chan_opvoice(acptr, chptr) && !IsAnOper(acptr)) continue;
+            if(!(chptr->lcms[i]->flags & (CHFL_CHANOP|CHFL_HALFOP|CHFL_VOICE)) && !IsAnOper(acptr)) continue;
             if (!didlocal)
             {
                 didlocal = prefix_buffer(0, from, pfix, sendbuf, pattern, vl);
@@ -1263,11 +1322,17 @@ void sendto_all_butone(aClient *one, aClient *from, char *pattern, ...)
     int     i;
     aClient *cptr;
     va_list vl;
+    char *pfix;
+    int lens[2] = { 0, 0 };
+    void *share_bufs[2] = { 0, 0 };
         
     va_start(vl, pattern);
+    pfix = va_arg(vl, char *);
     for (i = 0; i <= highest_fd; i++)
         if ((cptr = local[i]) && !IsMe(cptr) && one != cptr)
-            vsendto_prefix_one(cptr, from, pattern, vl);
+            send_prefix_shared(cptr, from, pfix, pattern, vl, lens,
+                               share_bufs);
+    sbuf_end_share(share_bufs, 2);
     va_end(vl);
     return;
 }
@@ -1473,8 +1538,12 @@ void sendto_ops_butone(aClient *one, aClient *from, char *pattern, ...)
     int     i;
     aClient *cptr;
     va_list vl;
+    char *pfix;
+    int lens[2] = { 0, 0 };
+    void *share_bufs[2] = { 0, 0 };
            
     va_start(vl, pattern);
+    pfix = va_arg(vl, char *);
 
     INC_SERIAL
 
@@ -1492,8 +1561,10 @@ void sendto_ops_butone(aClient *one, aClient *from, char *pattern, ...)
         if (cptr->from == one)
             continue;           /* ...was the one I should skip */
         sentalong[i] = sent_serial;
-        vsendto_prefix_one(cptr->from, from, pattern, vl);
+        send_prefix_shared(cptr->from, from, pfix, pattern, vl, lens,
+                           share_bufs);
     }
+    sbuf_end_share(share_bufs, 2);
     va_end(vl);
     return;
 }
@@ -1508,8 +1579,12 @@ void sendto_wallops_butone(aClient *one, aClient *from, char *pattern, ...)
     int     i;
     aClient *cptr;
     va_list vl;
+    char *pfix;
+    int lens[2] = { 0, 0 };
+    void *share_bufs[2] = { 0, 0 };
         
     va_start(vl, pattern);
+    pfix = va_arg(vl, char *);
     for(i=0;i<=highest_fd;i++)
     {
         if((cptr=local[i])!=NULL)
@@ -1517,9 +1592,11 @@ void sendto_wallops_butone(aClient *one, aClient *from, char *pattern, ...)
             if(!(IsRegistered(cptr) && (SendWallops(cptr) ||
                                         IsServer(cptr))) || cptr==one)
                 continue;
-            vsendto_prefix_one(cptr, from, pattern, vl);
+            send_prefix_shared(cptr, from, pfix, pattern, vl, lens,
+                               share_bufs);
         }
     }
+    sbuf_end_share(share_bufs, 2);
     va_end(vl);
     return;
 }
@@ -2153,6 +2230,27 @@ void sendto_channelflags_butone(aClient *one, aClient *from, aChannel *chptr,
  * Flushing functions (empty queues)
  *******************************************/
 
+/*
+ * Sockets that have been sent to since the last flush_connections(me.fd)
+ * while not blocked.  Blocked sockets are added again once they become
+ * writable, so the flush only has to look at these instead of every fd
+ * up to highest_fd.  There are two lists: the flush walks one while
+ * anything its sends queue (a BURST reply, the notices for a dead link)
+ * marks sockets on the other, so neither holds an fd twice.
+ */
+static int  dirty_fds[2][MAXCONNECTIONS];
+static int  num_dirty_fds = 0;
+static int  dirty_list = 0;
+static char fd_is_dirty[MAXCONNECTIONS];
+
+void mark_sendq_dirty(aClient *to)
+{
+    if (to->fd < 0 || fd_is_dirty[to->fd])
+        return;
+    fd_is_dirty[to->fd] = 1;
+    dirty_fds[dirty_list][num_dirty_fds++] = to->fd;
+}
+
 /*
  * flush_connections
  * Empty only buffers for clients without FLAGS_BLOCKED
@@ -2161,19 +2259,29 @@ void sendto_channelflags_butone(aClient *one, aClient *from, aChannel *chptr,
  */
 void flush_connections(int fd) 
 {
-    int     i;
+    int     i, n, *fds, rounds;
     aClient *cptr;
     
     if (fd == me.fd) 
     {
-        for (i = highest_fd; i >= 0; i--)
+        /* what the sends queue gets its own round, a few times over */
+        for (rounds = 0; num_dirty_fds > 0 && rounds < 4; rounds++)
         {
-            if (!(cptr = local[i]))
-               continue;
-            if(!(cptr->flags & FLAGS_BLOCKED) &&
-                (SBufLength(&cptr->sendQ) > 0 ||
-                (ZipOut(cptr) && zip_is_data_out(cptr->serv->zip_out))))
-                send_queued(cptr);
+            fds = dirty_fds[dirty_list];
+            n = num_dirty_fds;
+            dirty_list ^= 1;
+            num_dirty_fds = 0;
+
+            for (i = 0; i < n; i++)
+            {
+                fd_is_dirty[fds[i]] = 0;
+                if (!(cptr = local[fds[i]]))
+                   continue;
+                if(!(cptr->flags & FLAGS_BLOCKED) &&
+                    (SBufLength(&cptr->sendQ) > 0 ||
+                    (ZipOut(cptr) && zip_is_data_out(cptr->serv->zip_out))))
+                    send_queued(cptr);
+            }
         }
     }
     else if (fd >= 0 && (cptr = local[fd]) &&
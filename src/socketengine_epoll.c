@@ -112,9 +112,19 @@ int engine_read_message(time_t delay)
     aClient      *cptr;
     aListener    *lptr;
     
+    /*
+     * Output queued while the events are dispatched is written together
+     * afterwards, in flush_connections() on the dirty sockets.  Further
+     * passes only pick up what is already pending, so they must
+     * not sleep with unflushed output.
+     *
+     * Sockets stay level triggered: read_packet() does one recv() per
+     * event and leaves data in the kernel while a recvQ is full.
+     */
     do
     {
-        nfds = epoll_wait(epoll_id, events, ENGINE_MAX_EVENTS, delay * 1000);
+        nfds = epoll_wait(epoll_id, events, ENGINE_MAX_EVENTS,
+                          numloops ? 0 : delay * 1000);
         
         if (nfds == -1)
         {
@@ -159,7 +169,7 @@ int engine_read_message(time_t delay)
                     break;
                     
                 case FDT_RESOLVER:
-                    do_dns_async();
+                    do_dns_async(epfd->fd);
                     break;
                     
                 case FDT_CLIENT:
@@ -259,7 +259,7 @@ engine_read_message(time_t delay)
                     break;
 
                 case FDT_RESOLVER:
-                    do_dns_async();
+                    do_dns_async((int) events[i].ident);
                     break;
 
                 case FDT_CLIENT:
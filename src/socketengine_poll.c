@@ -139,7 +139,7 @@ int engine_read_message(time_t delay)
                break;
 
             case FDT_RESOLVER:
-               do_dns_async();
+               do_dns_async(pfd->fd);
                break;
 
             case FDT_CLIENT:
@@ -42,12 +42,62 @@ struct spam_filter
     pcre *re;
     unsigned int len;
     unsigned long matches;
+    int atom;               /* sf_nodes index of the required literal, 0 if none */
 };
 
 struct spam_filter *spam_filters = NULL;
 static char buf2[BUFSIZE];
 time_t last_spamfilter_save = 0;
 
+/*
+ * The filter set is compiled into one Aho-Corasick automaton over a
+ * required literal ("atom") of each rule: the longest literal run of a
+ * glob, or of a regexp outside any group or alternation.  check_sf()
+ * runs the automaton once over each text variant in use (raw, stripped
+ * of colors, stripped of everything) and only calls match() or
+ * pcre_exec() for rules whose atom was seen.  The automaton is
+ * case-insensitive like match(), which makes it a safe prefilter for
+ * case-sensitive regexps too.
+ */
+
+#define SF_TEXT_RAW       0
+#define SF_TEXT_STRIPCTRL 1
+#define SF_TEXT_STRIPALL  2
+#define SF_TEXT_VARIANTS  3
+
+#define SF_VARIANT(f) (((f) & SF_FLAG_STRIPALL) ? SF_TEXT_STRIPALL : \
+                       ((f) & SF_FLAG_STRIPCTRL) ? SF_TEXT_STRIPCTRL : \
+                       SF_TEXT_RAW)
+
+struct sf_node
+{
+    int child;              /* first child, 0 if none */
+    int sibling;            /* next child of our parent */
+    int fail;               /* longest proper suffix in the trie */
+    int dict;               /* nearest terminal node along fail links */
+    unsigned char c;        /* folded input character leading here */
+    unsigned char terminal; /* an atom ends here */
+};
+
+static struct sf_node *sf_nodes = NULL;
+static int sf_nnodes = 0, sf_maxnodes = 0;
+static int sf_rootnext[256];
+static unsigned int *sf_seen[SF_TEXT_VARIANTS];
+static unsigned int sf_seenserial = 0;
+static int sf_dirty = 1;
+
+/* counters for /stats S */
+static struct
+{
+    unsigned long rebuilds;
+    unsigned long messages;
+    unsigned long scans;        /* automaton passes over a text variant */
+    unsigned long checks;       /* match()/pcre_exec() calls made */
+    unsigned long skipped;      /* rules ruled out by the automaton */
+    unsigned long usec;         /* time spent in check_sf() */
+    unsigned long maxusec;
+} sfstats;
+
 /* load_spamfilter - Load the spamfilters
  *                   Returns: 1 = Success
  *                            0 = Failure
@@ -163,6 +213,268 @@ int m_spamops(aClient *cptr, aClient *sptr, int parc, char *parv[])
     return 0;
 }
 
+/*
+ * sf_glob_atom - longest literal run of a match() pattern, folded.  A
+ * '\\' and the character after it end a run, so no run holds an escape.
+ */
+static int sf_glob_atom(char *pat, char *atom)
+{
+    char *run, *best = NULL;
+    int len, bestlen = 0;
+
+    while (*pat)
+    {
+        for (run = pat; *pat && *pat != '*' && *pat != '?' && *pat != '\\';
+             pat++);
+        len = pat - run;
+        if (len > bestlen)
+        {
+            best = run;
+            bestlen = len;
+        }
+        if (*pat == '\\' && pat[1])
+            pat++;
+        if (*pat)
+            pat++;
+    }
+
+    for (len = 0; len < bestlen; len++)
+        atom[len] = touppertab[(u_char) best[len]];
+    atom[len] = '\0';
+    return bestlen;
+}
+
+/*
+ * sf_regex_atom - longest literal run every match of the regexp must
+ * contain, folded.  Only literals outside of groups are used; anything
+ * with alternation, option settings or \Q quoting gives no atom.
+ */
+static int sf_regex_atom(char *re, char *atom)
+{
+    char run[BUFSIZE];
+    int len = 0, bestlen = 0, depth = 0, lit;
+    char c;
+
+    if (strchr(re, '|') || strstr(re, "(?") || strstr(re, "\\Q"))
+        return 0;
+
+    for (;;)
+    {
+        lit = 0;
+        c = *re;
+        if (c == '\\' && re[1] && !IsAlpha(re[1]) && !IsDigit(re[1]))
+        {
+            /* escaped metacharacter */
+            c = re[1];
+            re += 2;
+            lit = 1;
+        }
+        else if (c == '\\')
+        {
+            /* class, assertion, backreference or coded character */
+            for (re++; IsAlpha(*re) || IsDigit(*re); re++);
+            if (*re == '{')
+                while (*re && *re++ != '}');
+        }
+        else if (c == '[')
+        {
+            re++;
+            if (*re == '^')
+                re++;
+            if (*re == ']')
+                re++;
+            for (; *re && *re != ']'; re++)
+                if (*re == '\\' && re[1])
+                    re++;
+            if (*re)
+                re++;
+        }
+        else if (c == '(')
+        {
+            depth++;
+            re++;
+        }
+        else if (c == ')')
+        {
+            if (--depth < 0)
+                return 0;
+            re++;
+        }
+        else if (c && !strchr(".^$*+?{}", c))
+        {
+            re++;
+            lit = 1;
+        }
+        else if (c)
+            re++;
+
+        /* a following quantifier may make the character optional */
+        if (lit && depth == 0 && *re != '*' && *re != '?' && *re != '{' &&
+            len < (int) sizeof(run))
+        {
+            run[len++] = touppertab[(u_char) c];
+            if (*re != '+')
+                continue;
+        }
+
+        /* anything else ends the run */
+        if (len > bestlen)
+        {
+            memcpy(atom, run, len);
+            bestlen = len;
+        }
+        len = 0;
+
+        if (!c)
+            break;
+    }
+
+    atom[bestlen] = '\0';
+    return bestlen;
+}
+
+static int sf_new_node(unsigned char c)
+{
+    struct sf_node *n;
+
+    if (sf_nnodes == sf_maxnodes)
+    {
+        sf_maxnodes = sf_maxnodes ? sf_maxnodes * 2 : 256;
+        sf_nodes = MyRealloc(sf_nodes, sf_maxnodes * sizeof(struct sf_node));
+    }
+    n = &sf_nodes[sf_nnodes];
+    memset(n, 0, sizeof(struct sf_node));
+    n->c = c;
+    return sf_nnodes++;
+}
+
+/* sf_next - trie child of node on c, 0 if none */
+static inline int sf_next(int node, unsigned char c)
+{
+    int n;
+
+    if (node == 0)
+        return sf_rootnext[c];
+    for (n = sf_nodes[node].child; n; n = sf_nodes[n].sibling)
+        if (sf_nodes[n].c == c)
+            return n;
+    return 0;
+}
+
+static int sf_add_atom(char *atom)
+{
+    int node = 0, n;
+    unsigned char c;
+
+    for (; *atom; atom++)
+    {
+        c = (unsigned char) *atom;
+        if (!(n = sf_next(node, c)))
+        {
+            n = sf_new_node(c);
+            if (node == 0)
+                sf_rootnext[c] = n;
+            else
+            {
+                sf_nodes[n].sibling = sf_nodes[node].child;
+                sf_nodes[node].child = n;
+            }
+        }
+        node = n;
+    }
+    sf_nodes[node].terminal = 1;
+    return node;
+}
+
+/* sf_rebuild - compile spam_filters into the automaton */
+static void sf_rebuild()
+{
+    struct spam_filter *p;
+    char atom[BUFSIZE];
+    int *queue, head = 0, tail = 0;
+    int i, n, f, v;
+
+    sf_nnodes = 0;
+    memset(sf_rootnext, 0, sizeof(sf_rootnext));
+    sf_new_node(0);     /* root */
+
+    for (p = spam_filters; p; p = p->next)
+    {
+        if (!(p->flags & (SF_FLAG_STRIPALL|SF_FLAG_STRIPCTRL)) &&
+            (p->flags & SF_FLAG_REGEXP))
+            n = sf_regex_atom(p->text, atom);
+        else
+            n = sf_glob_atom(p->text, atom);
+        p->atom = n ? sf_add_atom(atom) : 0;
+    }
+
+    /* breadth first, so fail links always point at finished nodes */
+    queue = MyMalloc(sf_nnodes * sizeof(int));
+    for (i = 0; i < 256; i++)
+        if ((n = sf_rootnext[i]))
+            queue[tail++] = n;
+    while (head < tail)
+    {
+        n = queue[head++];
+        for (v = sf_nodes[n].child; v; v = sf_nodes[v].sibling)
+        {
+            queue[tail++] = v;
+            for (f = sf_nodes[n].fail; f && !sf_next(f, sf_nodes[v].c);
+                 f = sf_nodes[f].fail);
+            f = sf_next(f, sf_nodes[v].c);
+            sf_nodes[v].fail = f;
+            sf_nodes[v].dict = sf_nodes[f].terminal ? f : sf_nodes[f].dict;
+        }
+    }
+    MyFree(queue);
+
+    for (i = 0; i < SF_TEXT_VARIANTS; i++)
+    {
+        MyFree(sf_seen[i]);
+        sf_seen[i] = MyMalloc(sf_maxnodes * sizeof(unsigned int));
+        memset(sf_seen[i], 0, sf_maxnodes * sizeof(unsigned int));
+    }
+    sf_seenserial = 0;
+    sf_dirty = 0;
+    sfstats.rebuilds++;
+}
+
+/* sf_scan - mark every atom occurring in text as seen */
+static void sf_scan(char *text, unsigned int *seen)
+{
+    int node = 0, n = 0, t;
+    unsigned char c;
+
+    for (; *text; text++)
+    {
+        c = touppertab[(u_char) *text];
+        while (node && !(n = sf_next(node, c)))
+            node = sf_nodes[node].fail;
+        node = node ? n : sf_rootnext[c];
+
+        /* marking a node always marks its dictionary chain too */
+        for (t = sf_nodes[node].terminal ? node : sf_nodes[node].dict;
+             t && seen[t] != sf_seenserial; t = sf_nodes[t].dict)
+            seen[t] = sf_seenserial;
+    }
+    sfstats.scans++;
+}
+
+/* sf_timing - account the time check_sf() spent on one message */
+static void sf_timing(struct timeval *start)
+{
+    struct timeval now;
+    unsigned long usec;
+
+    gettimeofday(&now, NULL);
+    usec = (now.tv_sec - start->tv_sec) * 1000000 +
+           (now.tv_usec - start->tv_usec);
+    sfstats.messages++;
+    sfstats.usec += usec;
+    if (usec > sfstats.maxusec)
+        sfstats.maxusec = usec;
+}
+
 /* check_sf - checks if a text matches a spamfilter pattern
               Returns: 1 = User message has been blocked.
                        2 = User has been killed and the message has been blocked.
@@ -181,12 +493,30 @@ int check_sf(aClient *cptr, char *text, char *caction, int action, char *target)
     int ovector[30]; /* For regexp */
     char *action_text;
     char *textptr;
+    char *variant[SF_TEXT_VARIANTS];
+    int scanned[SF_TEXT_VARIANTS];
+    int v;
+    struct timeval start;
 
     if(IsAnOper(cptr))
         return 0;
 
+    if(sf_dirty)
+        sf_rebuild();
+    gettimeofday(&start, NULL);
+    if(++sf_seenserial == 0)
+    {
+        for(v = 0; v < SF_TEXT_VARIANTS; v++)
+            memset(sf_seen[v], 0, sf_maxnodes * sizeof(unsigned int));
+        sf_seenserial = 1;
+    }
+
     stripamsg[0] = '\0';
     stripcmsg[0] = '\0';
+    variant[SF_TEXT_RAW] = text;
+    variant[SF_TEXT_STRIPCTRL] = stripcmsg;
+    variant[SF_TEXT_STRIPALL] = stripamsg;
+    memset(scanned, 0, sizeof(scanned));
 
     for(; p; p = p->next)
     {
@@ -208,14 +538,31 @@ int check_sf(aClient *cptr, char *text, char *caction, int action, char *target)
                 }
                 stripall(stripamsg, textptr);
             }
-            matched = !match(p->text,stripamsg);
         }
         else if(p->flags & SF_FLAG_STRIPCTRL)
         {
             if(stripcmsg[0]=='\0')
                 stripcolors(stripcmsg, text);
-            matched = !match(p->text,stripcmsg);
         }
+        if(p->atom)
+        {
+            v = SF_VARIANT(p->flags);
+            if(!scanned[v])
+            {
+                sf_scan(variant[v], sf_seen[v]);
+                scanned[v] = 1;
+            }
+            if(sf_seen[v][p->atom] != sf_seenserial)
+            {
+                sfstats.skipped++;
+                continue;
+            }
+        }
+        sfstats.checks++;
+        if(p->flags & SF_FLAG_STRIPALL)
+            matched = !match(p->text,stripamsg);
+        else if(p->flags & SF_FLAG_STRIPCTRL)
+            matched = !match(p->text,stripcmsg);
         else if(p->flags & SF_FLAG_REGEXP)
         {
             if(!len)
@@ -288,14 +635,16 @@ int check_sf(aClient *cptr, char *text, char *caction, int action, char *target)
                 {
                     ircsprintf(buf2, "Local kill by %s (%s)", me.name, p->reason?p->reason:"<none>");
                     exit_client(cptr, cptr, cptr, buf2);
+                    sf_timing(&start);
                     return blocked;
                 }
             }
             if(p->flags & SF_FLAG_BREAK)
-                return blocked;
+                break;
         }
     }
 
+    sf_timing(&start);
     return blocked;
 }
 
@@ -382,6 +731,7 @@ struct spam_filter *new_sf(char *text, long flags, char *reason, char *target)
         strcpy(p->target, target);
     }
     else p->target = NULL;
+    sf_dirty = 1;
 
     return p;
 }
@@ -410,6 +760,7 @@ int del_sf(char *text)
             if(p->re)
                 pcre_free(p->re);
             MyFree(p);
+            sf_dirty = 1;
             return 1; /* Success */
         }
     }
@@ -480,6 +831,19 @@ int report_spamfilters(aClient *cptr, aClient *sptr, int parc, char *parv[])
                    sf->reason);
     }
 
+    if(sf_dirty)
+        sf_rebuild();
+    sendto_one(sptr, ":%s %d %s :Spamfilter engine: %d nodes, rebuilt %lu times",
+               me.name, RPL_STATSDEBUG, sptr->name, sf_nnodes, sfstats.rebuilds);
+    sendto_one(sptr, ":%s %d %s :Spamfilter scans: %lu messages, %lu passes, "
+               "%lu rules checked, %lu skipped",
+               me.name, RPL_STATSDEBUG, sptr->name, sfstats.messages,
+               sfstats.scans, sfstats.checks, sfstats.skipped);
+    sendto_one(sptr, ":%s %d %s :Spamfilter time: %lu usec total, %lu avg, %lu max",
+               me.name, RPL_STATSDEBUG, sptr->name, sfstats.usec,
+               sfstats.messages ? sfstats.usec / sfstats.messages : 0,
+               sfstats.maxusec);
+
     return 0;
 }
 
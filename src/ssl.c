@@ -394,6 +394,7 @@ static int fatal_ssl_error(int ssl_error, int where, aClient *sptr)
         errno = 0; /* Not really an error */
         sptr->sockerr = IRCERR_SSL;
         sptr->flags |= FLAGS_DEADSOCKET;
+        timer_set(&sptr->timer, timeofday);
         return -1;
     }
 
@@ -421,6 +422,7 @@ static int fatal_ssl_error(int ssl_error, int where, aClient *sptr)
     errno = errtmp ? errtmp : EIO; /* Stick a generic I/O error */
     sptr->sockerr = IRCERR_SSL;
     sptr->flags |= FLAGS_DEADSOCKET;
+    timer_set(&sptr->timer, timeofday);
     return -1;
 }
 
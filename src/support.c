@@ -180,6 +180,11 @@ int inet_netof(struct in_addr in)
 
 #endif /* !HAVE_INET_NETOF */
 
+#ifdef BENCHMARK
+/* allocation counter reported by the 'make bench' driver */
+unsigned long bench_allocs = 0;
+#endif
+
 #ifdef MEMTRACE
 
 typedef struct {
@@ -282,6 +287,9 @@ void *MyMalloc_impl(MemTracer *mt, size_t mlen)
     }
 
     tag = malloc(mlen + sizeof(MemTag));
+#ifdef BENCHMARK
+    bench_allocs++;
+#endif
 
     if (!tag)
         outofmemory();
@@ -328,6 +336,9 @@ void *MyRealloc_impl(MemTracer *mt, void *obj, size_t mlen)
     }
 
     tag = realloc(obj, mlen + sizeof(MemTag));
+#ifdef BENCHMARK
+    bench_allocs++;
+#endif
 
     if (!tag)
         outofmemory();
@@ -346,6 +357,9 @@ void *MyMalloc(size_t x)
 {
     void       *ret = malloc(x);
 
+#ifdef BENCHMARK
+    bench_allocs++;
+#endif
     if (!ret)
     {
 	outofmemory();
@@ -357,6 +371,9 @@ void *MyRealloc(void *x, size_t y)
 {
     void       *ret = realloc(x, y);
 
+#ifdef BENCHMARK
+    bench_allocs++;
+#endif
     if (!ret)
     {
 	outofmemory();
@@ -46,172 +46,268 @@
 #include "queue.h"
 #include "throttle.h"
 
-BlockHeap *hashent_freelist;
 BlockHeap *throttle_freelist;
 
 /*******************************************************************************
  * hash code here.  why isn't it in hash.c?  see the license. :)
  ******************************************************************************/
 
-hashent *hashent_alloc()
+/* every table, for HASH */
+static hash_table *hash_tables;
+
+/* the slot an entry hashes to, and how far slot 'i' is from it */
+#define HASH_HOME(t, h)        ((h) & ((t)->size - 1))
+#define HASH_DIST(t, s, i)     (((i) - HASH_HOME(t, (s)->hash)) & \
+                                ((t)->size - 1))
+
+static int
+hash_slots_for(int elems)
 {
-   return BlockHeapALLOC(hashent_freelist, hashent);
+    int size = 16;
+
+    while (size < elems)
+        size <<= 1;
+    return size;
 }
 
-void hashent_free(hashent *hp)
+/* put an entry in, taking the slot of any entry nearer its home than this
+ * one is to its own, and carrying that one on instead */
+static void
+hash_place(hash_table *table, unsigned int hash, void *ent)
 {
-   BlockHeapFree(hashent_freelist, hp);
+    hashslot cur, tmp, *sp;
+    int i, dist = 0, sdist;
+
+    cur.hash = hash;
+    cur.ent = ent;
+    for (i = HASH_HOME(table, hash);; i = (i + 1) & (table->size - 1))
+    {
+        sp = &table->table[i];
+        if (!sp->ent)
+        {
+            *sp = cur;
+            return;
+        }
+        sdist = HASH_DIST(table, sp, i);
+        if (sdist < dist)
+        {
+            tmp = *sp;
+            *sp = cur;
+            cur = tmp;
+            dist = sdist;
+        }
+        dist++;
+    }
+}
+
+static void
+hash_rebuild(hash_table *table, int size)
+{
+    hashslot *oldtable = table->table;
+    int oldsize = table->size, i;
+
+    table->size = size;
+    table->table = MyMalloc(sizeof(hashslot) * size);
+    memset(table->table, 0, sizeof(hashslot) * size);
+    for (i = 0; i < oldsize; i++)
+        if (oldtable[i].ent)
+            hash_place(table, oldtable[i].hash, oldtable[i].ent);
+    MyFree(oldtable);
+    table->resizes++;
 }
 
 /* hash_table creation function.  given the user's paramters, allocate
  * and empty a new hash table and return it. */
 hash_table *
-create_hash_table(int elems, size_t offset, size_t len, int flags, 
-                  int (*cmpfunc)(void *, void *)) 
+create_hash_table(char *name, int elems, size_t offset, size_t len,
+                  int flags, int (*cmpfunc)(void *, void *)) 
 {
     hash_table *htp = MyMalloc(sizeof(hash_table));
 
-    htp->size = elems;
+    memset(htp, 0, sizeof(hash_table));
+    htp->name = name;
+    htp->size = htp->minsize = hash_slots_for(elems + elems / 3);
     htp->keyoffset = offset;
     htp->keylen = len;
     htp->flags = flags;
     htp->cmpfunc = cmpfunc;
 
-    htp->table = MyMalloc(sizeof(hashent_list) * htp->size);
-    memset(htp->table, 0, sizeof(hashent_list) * htp->size);
+    htp->table = MyMalloc(sizeof(hashslot) * htp->size);
+    memset(htp->table, 0, sizeof(hashslot) * htp->size);
+
+    htp->next = hash_tables;
+    hash_tables = htp;
 
     return htp;
 }
 
-/* hash_table destroyer.  sweep through the given table and kill off every
- * hashent */
+/* hash_table destroyer.  the entries belong to the caller, so this only
+ * has the slots to free */
 void 
 destroy_hash_table(hash_table *table) 
 {
-    hashent *hep;
-    int i;
+    hash_table **htpp;
 
-    for (i = 0;i < table->size;i++) 
+    for (htpp = &hash_tables; *htpp; htpp = &(*htpp)->next)
     {
-        while (!SLIST_EMPTY(&table->table[i])) 
+        if (*htpp == table)
         {
-            hep = SLIST_FIRST(&table->table[i]);
-            SLIST_REMOVE_HEAD(&table->table[i], lp);
-            hashent_free(hep);
+            *htpp = table->next;
+            break;
         }
     }
     MyFree(table->table);
     MyFree(table);
 }
 
-/* this is an expensive function.  it's not the sort of thing one should be
- * calling a lot, however, in the right situations it can provide a lot of
- * benefit */
 void 
 resize_hash_table(hash_table *table, int elems) 
 {
-    hashent_list *oldtable;
-    int oldsize, i;
-    hashent *hep;
-
-    /* preserve the old table, then create a new one.  */
-    oldtable = table->table;
-    oldsize = table->size;
-    table->size = elems;
-    table->table = MyMalloc(sizeof(hashent_list) * table->size);
-    memset(table->table, 0, sizeof(hashent_list) * table->size);
-
-    /* now walk each bucket in the old table, pulling off individual entries
-     * and re-adding them to the table as we go */
-    for (i = 0;i < oldsize;i++) 
-    {
-        while (!SLIST_EMPTY(&oldtable[i])) 
-        {
-            hep = SLIST_FIRST(&oldtable[i]);
-            hash_insert(table, hep->ent);
-            SLIST_REMOVE_HEAD(&oldtable[i], lp);
-            hashent_free(hep);
-        }
-    }
-    MyFree(oldtable);
+    table->minsize = hash_slots_for(elems + elems / 3);
+    if (table->size < table->minsize)
+        hash_rebuild(table, table->minsize);
 }
 
-/* get the hash of a given key.  really only useful for insert/delete */
+/* get the hash of a given key: FNV-1a, with a final mix so the low bits
+ * that pick the slot depend on the whole key */
 unsigned int 
 hash_get_key_hash(hash_table *table, void *key, size_t offset) 
 {
-    char *rkey = (char *)key + offset;
+    unsigned char *rkey = (unsigned char *)key + offset;
     unsigned int len = table->keylen;
-    unsigned int hash = 0;
+    unsigned int hash = 2166136261U;
 
     if (!len)
-        len = strlen(rkey);
+        len = strlen((char *) rkey);
     else if (table->flags & HASH_FL_STRING) 
     {
-        len = strlen(rkey);
+        len = strlen((char *) rkey);
         if (len > table->keylen)
             len = table->keylen;
     }
-    /* I borrowed this algorithm from perl5.  Kudos to Larry Wall & co. */
     if (table->flags & HASH_FL_NOCASE)
         while (len--)
-            hash = hash * 33 + ToLower(*rkey++);
+        {
+            hash ^= (unsigned char) ToLower(*rkey);
+            hash *= 16777619U;
+            rkey++;
+        }
     else
         while (len--)
-            hash = hash * 33 + *rkey++;
+        {
+            hash ^= *rkey++;
+            hash *= 16777619U;
+        }
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bU;
+    hash ^= hash >> 13;
 
-    return hash % table->size;
+    return hash;
 }
 
 /* add the given item onto the hash */
 int 
 hash_insert(hash_table *table, void *ent) 
 {
-    int hash = hash_get_key_hash(table, ent, table->keyoffset);
-    hashent *hep = hashent_alloc();
-
-    hep->ent = ent;
-    SLIST_INSERT_HEAD(&table->table[hash], hep, lp);
+    if ((table->count + 1) * 4 > table->size * 3)
+        hash_rebuild(table, table->size * 2);
+    hash_place(table, hash_get_key_hash(table, ent, table->keyoffset), ent);
+    table->count++;
 
     return 1;
 }
 
-/* delete the given item from the hash */
+/* delete the given item from the hash, shifting back the entries after it
+ * that are not already in their home slots */
 int 
 hash_delete(hash_table *table, void *ent) 
 {
-    int hash = hash_get_key_hash(table, ent, table->keyoffset);
-    hashent *hep;
+    unsigned int hash = hash_get_key_hash(table, ent, table->keyoffset);
+    int mask = table->size - 1;
+    int i, next, dist = 0;
+    hashslot *sp;
 
-    SLIST_FOREACH(hep, &table->table[hash], lp) 
+    for (i = HASH_HOME(table, hash);; i = (i + 1) & mask, dist++)
     {
-        if (hep->ent == ent)
+        sp = &table->table[i];
+        if (!sp->ent || HASH_DIST(table, sp, i) < dist)
+            return 0;
+        if (sp->ent == ent)
             break;
     }
-    if (hep == NULL)
-        return 0;
-    SLIST_REMOVE(&table->table[hash], hep, hashent_t, lp);
-    hashent_free(hep);
+    for (;; i = next)
+    {
+        next = (i + 1) & mask;
+        sp = &table->table[next];
+        if (!sp->ent || HASH_DIST(table, sp, next) == 0)
+            break;
+        table->table[i] = *sp;
+    }
+    table->table[i].ent = NULL;
+    table->table[i].hash = 0;
+    table->count--;
+
+    if (table->size > table->minsize && table->count * 8 < table->size)
+        hash_rebuild(table, table->size / 2);
     return 1;
 }
 
 /* last, but not least, the find function.  given the table and the key to
- * look for, it hashes the key, and then calls the compare function in the
- * given table slice until it finds the item, or reaches the end of the
- * list. */
+ * look for, it hashes the key, and then walks the slots from the key's
+ * home, calling the compare function on entries with the same hash, until
+ * it finds the item or an entry nearer its home than the key would be. */
 void *
 hash_find(hash_table *table, void *key) 
 {
-    int hash = hash_get_key_hash(table, key, 0);
-    hashent *hep;
+    unsigned int hash = hash_get_key_hash(table, key, 0);
+    int i, dist = 0;
+    hashslot *sp;
 
-    SLIST_FOREACH(hep, &table->table[hash], lp) 
+    table->lookups++;
+    for (i = HASH_HOME(table, hash);; i = (i + 1) & (table->size - 1))
     {
-        if (!table->cmpfunc(&((char *)hep->ent)[table->keyoffset], key))
-            return hep->ent;
+        table->probes++;
+        sp = &table->table[i];
+        if (!sp->ent || HASH_DIST(table, sp, i) < dist)
+            return NULL; /* not found */
+        if (sp->hash == hash &&
+            !table->cmpfunc(&((char *)sp->ent)[table->keyoffset], key))
+            return sp->ent;
+        dist++;
     }
+}
+
+void *
+hash_walk(hash_table *table, int *pos)
+{
+    while (*pos < table->size)
+        if (table->table[(*pos)++].ent)
+            return table->table[*pos - 1].ent;
+    return NULL;
+}
+
+void
+hash_table_report(aClient *cptr)
+{
+    hash_table *htp;
+    u_long avg;
+    int i, longest;
 
-    return NULL; /* not found */
+    for (htp = hash_tables; htp; htp = htp->next)
+    {
+        longest = 0;
+        for (i = 0; i < htp->size; i++)
+            if (htp->table[i].ent && HASH_DIST(htp, &htp->table[i], i) >
+                longest)
+                longest = HASH_DIST(htp, &htp->table[i], i);
+        avg = htp->lookups ? htp->probes * 100 / htp->lookups : 0;
+        sendto_one(cptr, ":%s NOTICE %s :%s hash: %d entries, %d slots,"
+                   " %d resizes", me.name, cptr->name, htp->name,
+                   htp->count, htp->size, htp->resizes);
+        sendto_one(cptr, ":%s NOTICE %s :%s lookups: %lu, %lu.%02lu slots"
+                   " each, furthest from home %d", me.name, cptr->name,
+                   htp->name, htp->lookups, avg / 100, avg % 100, longest);
+    }
 }
 
 /*******************************************************************************
@@ -256,10 +352,9 @@ int numthrottles = 0; /* number of throttles in existence */
 #ifdef THROTTLE_ENABLE
 void throttle_init(void) 
 {
-    hashent_freelist = BlockHeapCreate(sizeof(hashent), 1024);
     throttle_freelist = BlockHeapCreate(sizeof(throttle), 1024);
     /* create the throttle hash. */
-    throttle_hash = create_hash_table(THROTTLE_HASHSIZE,
+    throttle_hash = create_hash_table("Throttle", THROTTLE_HASHSIZE,
             offsetof(throttle, addr), HOSTIPLEN,
             HASH_FL_STRING, (int (*)(void *, void *))strcmp);
 }
@@ -350,15 +445,18 @@ throttle_force(char *host)
 int 
 throttle_check(char *host, int fd, time_t sotime) 
 {
-    throttle *tp = hash_find(throttle_hash, host);
+    throttle *tp;
 
     if (!throttle_enable)
         return 1; /* always successful */
 
-    /* If this is an old remote signon, just ignore it */
+    /* If this is an old remote signon, just ignore it (most of a netburst
+     * is, so don't look it up first) */
     if(fd == -1 && (NOW - sotime > throttle_ttime))
        return 1;
 
+    tp = hash_find(throttle_hash, host);
+
     /* If this user is signing on 'in the future', we need to 
        fix that. Someone has a bad remote TS, perhaps we should complain */
     if(sotime > NOW)
@@ -539,14 +637,13 @@ void throttle_stats(aClient *cptr, char *name)
            throttle_freelist->elemsPerBlock;
     tsz = tcnt * throttle_freelist->elemSize;
 
-    hcnt = hashent_freelist->blocksAllocated * 
-           hashent_freelist->elemsPerBlock;
-    hsz = hcnt * hashent_freelist->elemSize;
+    hcnt = throttle_hash->size;
+    hsz = hcnt * sizeof(hashslot);
 
     sendto_one(cptr, ":%s %d %s :throttles: %d", me.name, RPL_STATSDEBUG, name,
             numthrottles);
     sendto_one(cptr, ":%s %d %s :alloc memory: %d throttles (%d bytes), "
-            "%d hashents (%d bytes)", me.name, RPL_STATSDEBUG, name,
+            "%d hash slots (%d bytes)", me.name, RPL_STATSDEBUG, name,
             tcnt, tsz, hcnt, hsz);            
     sendto_one(cptr, ":%s %d %s :throttle hash table size: %d", me.name,
             RPL_STATSDEBUG, name, throttle_hash->size);
@@ -581,24 +678,15 @@ void throttle_force(char *host) {}
 u_long
 memcount_GenericHash(hash_table *ht, MCGenericHash *mc)
 {
-    hashent *hep;
-    int      i;
-
     mc->file = __FILE__;
 
     mc->hashtable.c = 1;
     mc->hashtable.m = sizeof(*ht);
 
     mc->buckets.c = ht->size;
-    mc->buckets.m = sizeof(hashent_list) * ht->size;
+    mc->buckets.m = sizeof(hashslot) * ht->size;
 
-    for (i = 0; i < ht->size; i++)
-    {
-        SLIST_FOREACH(hep, &ht->table[i], lp)
-        {
-            mc->e_hashents++;
-        }
-    }
+    mc->entries = ht->count;
 
     mc->total.c += mc->hashtable.c + mc->buckets.c;
     mc->total.m += mc->hashtable.m + mc->buckets.m;
@@ -625,8 +713,6 @@ memcount_throttle(MCthrottle *mc)
     mc->e_throttle_hash = throttle_hash;
 #endif
 
-    mc->e_hashent_heap = hashent_freelist;
-
     return 0;
 }
 
@@ -0,0 +1,231 @@
+/************************************************************************
+ *   IRC - Internet Relay Chat, src/timer.c
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * timer.c - a hierarchical timer wheel, in whole seconds.
+ *
+ * Level 0 has a slot for each of the next 64 seconds; each level above
+ * has 64 slots that each span all of the level below.  A timer goes in
+ * the lowest level that reaches its deadline, and is moved down a level
+ * when the wheel turns into its slot, so each second costs the timers
+ * due in it plus, once every 64 seconds, one slot's worth of moves.
+ * Nothing is ever scanned to find what is due.
+ */
+
+#include "struct.h"
+#include "common.h"
+#include "sys.h"
+#include "h.h"
+
+#define TIMER_BITS      6
+#define TIMER_SLOTS     (1 << TIMER_BITS)
+#define TIMER_MASK      (TIMER_SLOTS - 1)
+#define TIMER_LEVELS    4       /* 64^4 seconds, about 194 days */
+
+/* seconds spanned by one slot of a level */
+#define TIMER_SPAN(l)   ((time_t) 1 << (TIMER_BITS * (l)))
+
+static aTimer *wheel[TIMER_LEVELS][TIMER_SLOTS];
+static time_t wheel_now;        /* the second the wheel is at */
+
+TimerStats timerstats;
+
+static void timer_link(aTimer **head, aTimer *t)
+{
+    if ((t->next = *head))
+        t->next->prev = &t->next;
+    *head = t;
+    t->prev = head;
+}
+
+static void timer_unlink(aTimer *t)
+{
+    if ((*t->prev = t->next))
+        t->next->prev = t->prev;
+    t->prev = NULL;
+}
+
+static void timer_place(aTimer *t)
+{
+    time_t when = t->when, delta;
+    int level;
+
+    /* overdue timers go in the current slot, to fire on the next run */
+    if (when < wheel_now)
+        when = wheel_now;
+    delta = when - wheel_now;
+
+    for (level = 0; level < TIMER_LEVELS - 1; level++)
+        if (delta < TIMER_SPAN(level + 1))
+            break;
+
+    /* past the top of the wheel: park it as far out as we can see, and
+     * it is placed again from there */
+    if (delta >= TIMER_SPAN(TIMER_LEVELS))
+        when = wheel_now + TIMER_SPAN(TIMER_LEVELS) - 1;
+
+    timer_link(&wheel[level][(when >> (TIMER_BITS * level)) & TIMER_MASK], t);
+}
+
+/* the wheel has just turned to second 'now': move timers down from any
+ * level that turned over with it, topmost first */
+static void timer_cascade(time_t now)
+{
+    aTimer *list, *t;
+    int level, slot;
+
+    for (level = TIMER_LEVELS - 1; level > 0; level--)
+    {
+        if (now & (TIMER_SPAN(level) - 1))
+            continue;
+
+        slot = (now >> (TIMER_BITS * level)) & TIMER_MASK;
+        list = wheel[level][slot];
+        wheel[level][slot] = NULL;
+
+        while ((t = list))
+        {
+            list = t->next;
+            timer_place(t);
+            timerstats.cascaded++;
+        }
+    }
+}
+
+/*
+ * The clock jumped back, or so far forward that turning the wheel a
+ * second at a time would stall us.  Take every timer off and put it
+ * back relative to the new time; going backwards keeps how far off
+ * each one was, going forwards lets the overdue ones fire.
+ */
+static void timer_rebase(time_t now)
+{
+    aTimer *list = NULL, *t;
+    time_t shift = (now < wheel_now) ? wheel_now - now : 0;
+    int level, slot;
+
+    for (level = 0; level < TIMER_LEVELS; level++)
+        for (slot = 0; slot < TIMER_SLOTS; slot++)
+            while ((t = wheel[level][slot]))
+            {
+                timer_unlink(t);
+                t->next = list;
+                list = t;
+            }
+
+    wheel_now = now;
+
+    while ((t = list))
+    {
+        list = t->next;
+        t->when -= shift;
+        timer_place(t);
+    }
+}
+
+void init_timers(time_t now)
+{
+    memset((char *) wheel, '\0', sizeof(wheel));
+    memset((char *) &timerstats, '\0', sizeof(timerstats));
+    wheel_now = now;
+}
+
+void timer_init(aTimer *t, void (*func)(void *), void *arg)
+{
+    t->next = NULL;
+    t->prev = NULL;
+    t->when = 0;
+    t->func = func;
+    t->arg = arg;
+}
+
+void timer_set(aTimer *t, time_t when)
+{
+    if (TimerPending(t))
+        timer_unlink(t);
+    else
+        timerstats.pending++;
+    t->when = when;
+    timer_place(t);
+}
+
+void timer_del(aTimer *t)
+{
+    if (!TimerPending(t))
+        return;
+    timer_unlink(t);
+    timerstats.pending--;
+}
+
+/*
+ * Fire everything due by 'now'.  Each slot is taken off the wheel
+ * before its timers run, so a callback can set or delete any timer,
+ * itself included, and one set again for 'now' waits for the next call
+ * instead of looping here.
+ */
+void run_timers(time_t now)
+{
+    aTimer *firing, *t;
+    unsigned long n = 0;
+
+    if (now < wheel_now || now - wheel_now > TIMER_SPAN(2))
+        timer_rebase(now);
+
+    for (;;)
+    {
+        if ((firing = wheel[0][wheel_now & TIMER_MASK]))
+        {
+            wheel[0][wheel_now & TIMER_MASK] = NULL;
+            firing->prev = &firing;
+        }
+
+        while ((t = firing))
+        {
+            timer_unlink(t);
+            timerstats.pending--;
+            timerstats.fired++;
+            n++;
+            t->func(t->arg);
+        }
+
+        if (wheel_now >= now)
+            break;
+        timer_cascade(++wheel_now);
+    }
+
+    if (n > timerstats.maxfired)
+        timerstats.maxfired = n;
+}
+
+/*
+ * When the io loop next has to be back: the first second with anything
+ * due, or if nothing is due within the next 64, the next turn of level
+ * 1.  0 if no timers are set at all.
+ */
+time_t timer_next()
+{
+    int i;
+
+    for (i = 0; i < TIMER_SLOTS; i++)
+        if (wheel[0][(wheel_now + i) & TIMER_MASK])
+            return wheel_now + i;
+
+    if (timerstats.pending)
+        return (wheel_now | TIMER_MASK) + 1;
+    return 0;
+}
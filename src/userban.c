@@ -36,6 +36,7 @@ typedef struct banlist_t ban_list;
 typedef struct userBanEntry {
    struct userBan *ban;
    LIST_ENTRY(userBanEntry) lp;
+   struct cidrNode *node;      /* trie node holding a CIDR ban */
 } uBanEnt;
 
 typedef struct _abanlist {
@@ -47,8 +48,40 @@ typedef struct _abanlist {
 
 typedef struct userBan auserBan;
 
-ban_list CIDR4BIG_bans = LIST_HEAD_INITIALIZER(CIDR4BIG_bans);
-ban_list **CIDR4_bans; 
+/*
+ * IPv4 and IPv6 CIDR bans live in a path-compressed binary trie per
+ * address family, keyed on the ban's network prefix.  Each node holds
+ * the bans for exactly its prefix; nodes without bans only exist where
+ * two branches split.  A lookup follows the client's address from the
+ * root and sees every ban that covers it after at most one node per
+ * distinct prefix length on the path, however many bans there are.
+ */
+typedef struct cidrNode {
+   struct cidrNode *parent;
+   struct cidrNode *child[2];
+   unsigned int bits;            /* prefix length */
+   unsigned char prefix[16];     /* only the first 'bits' bits are set */
+   ban_list bans;                /* bans for exactly this prefix */
+} cidrNode;
+
+#define CIDR_V4        0
+#define CIDR_V6        1
+#define CIDR_FAM(f)    ((f) == AF_INET6 ? CIDR_V6 : CIDR_V4)
+#define CIDR_MAXBITS(i) ((i) == CIDR_V6 ? 128 : 32)
+#define CIDR_BIT(p, n) (((p)[(n) >> 3] >> (7 - ((n) & 7))) & 1)
+
+static cidrNode *cidr_root[2];
+static int cidr_walking = 0;     /* defer pruning while a walk is running */
+
+/* counters for /stats k, K and A */
+static struct
+{
+   int nodes[2];
+   unsigned long lookups;
+   unsigned long visited;        /* trie nodes looked at */
+   unsigned long usec;           /* time spent in the trie */
+   unsigned long maxusec;
+} cidrstats;
 
 aBanList host_bans;
 aBanList ip_bans;
@@ -66,6 +99,228 @@ void simban_free(struct simBan *);
 unsigned int host_hash(char *n);
 unsigned int ip_hash(char *n);
 
+/* number of leading bits a and b have in common, at most maxbits */
+static unsigned int cidr_common(const unsigned char *a, const unsigned char *b,
+                                unsigned int maxbits)
+{
+   unsigned int i, bits = 0;
+   unsigned char x;
+
+   for (i = 0; bits < maxbits; i++, bits += 8)
+   {
+      if ((x = a[i] ^ b[i]) == 0)
+         continue;
+      while (!(x & 0x80))
+      {
+         x <<= 1;
+         bits++;
+      }
+      break;
+   }
+   return (bits < maxbits) ? bits : maxbits;
+}
+
+static cidrNode *cidr_newnode(int fam, unsigned char *prefix, unsigned int bits,
+                              cidrNode *parent)
+{
+   cidrNode *n = (cidrNode *) MyMalloc(sizeof(cidrNode));
+   unsigned int i;
+
+   memset(n, 0, sizeof(cidrNode));
+   for (i = 0; i < bits / 8; i++)
+      n->prefix[i] = prefix[i];
+   if (bits & 7)
+      n->prefix[i] = prefix[i] & (0xff << (8 - (bits & 7)));
+   n->bits = bits;
+   n->parent = parent;
+   LIST_INIT(&n->bans);
+   cidrstats.nodes[fam]++;
+   return n;
+}
+
+/* find or create the node for prefix/bits */
+static cidrNode *cidr_get(int fam, unsigned char *prefix, unsigned int bits)
+{
+   cidrNode **link = &cidr_root[fam], *parent = NULL, *n, *nn, *glue;
+   unsigned int common;
+
+   while ((n = *link))
+   {
+      common = cidr_common(n->prefix, prefix, MIN(n->bits, bits));
+      if (common == n->bits)
+      {
+         if (n->bits == bits)
+            return n;
+         parent = n;
+         link = &n->child[CIDR_BIT(prefix, n->bits)];
+         continue;
+      }
+
+      nn = cidr_newnode(fam, prefix, bits, parent);
+      if (common == bits)
+      {
+         /* the new prefix covers n */
+         nn->child[CIDR_BIT(n->prefix, bits)] = n;
+         n->parent = nn;
+         *link = nn;
+         return nn;
+      }
+
+      /* split where the two prefixes part ways */
+      glue = cidr_newnode(fam, prefix, common, parent);
+      glue->child[CIDR_BIT(n->prefix, common)] = n;
+      glue->child[CIDR_BIT(prefix, common)] = nn;
+      n->parent = nn->parent = glue;
+      *link = glue;
+      return nn;
+   }
+
+   return (*link = cidr_newnode(fam, prefix, bits, parent));
+}
+
+/* find the node for exactly prefix/bits, or NULL */
+static cidrNode *cidr_find(int fam, unsigned char *prefix, unsigned int bits)
+{
+   cidrNode *n = cidr_root[fam];
+
+   while (n && n->bits <= bits)
+   {
+      if (cidr_common(n->prefix, prefix, n->bits) < n->bits)
+         return NULL;
+      if (n->bits == bits)
+         return n;
+      n = n->child[CIDR_BIT(prefix, n->bits)];
+   }
+   return NULL;
+}
+
+/* unlink n if it carries no bans and at most one child; 1 if removed */
+static int cidr_unlink(int fam, cidrNode *n)
+{
+   cidrNode *child, *parent = n->parent;
+
+   if (!LIST_EMPTY(&n->bans) || (n->child[0] && n->child[1]))
+      return 0;
+
+   child = n->child[0] ? n->child[0] : n->child[1];
+   if (parent)
+      parent->child[parent->child[1] == n] = child;
+   else
+      cidr_root[fam] = child;
+   if (child)
+      child->parent = parent;
+
+   cidrstats.nodes[fam]--;
+   MyFree(n);
+   return 1;
+}
+
+/* unlink n and then any glue nodes above it that became redundant */
+static void cidr_prune(int fam, cidrNode *n)
+{
+   cidrNode *parent;
+
+   while (n)
+   {
+      parent = n->parent;
+      if (!cidr_unlink(fam, n))
+         break;
+      n = parent;
+   }
+}
+
+/* bottom-up prune of a whole subtree, after a walk that removed bans */
+static void cidr_compact(int fam, cidrNode *n)
+{
+   if (!n)
+      return;
+   cidr_compact(fam, n->child[0]);
+   cidr_compact(fam, n->child[1]);
+   cidr_unlink(fam, n);
+}
+
+/* preorder walk: cidr_next() returns the node after n, or NULL */
+static cidrNode *cidr_next(cidrNode *n)
+{
+   if (n->child[0])
+      return n->child[0];
+   if (n->child[1])
+      return n->child[1];
+
+   for (; n->parent; n = n->parent)
+      if (n->parent->child[0] == n && n->parent->child[1])
+         return n->parent->child[1];
+
+   return NULL;
+}
+
+/* the report letter the old CIDR lists used: 'C' for big masks */
+static char cidr_rchar(cidrNode *n)
+{
+   uBanEnt *bl = LIST_FIRST(&n->bans);
+
+   return (bl && (bl->ban->flags & UBAN_CIDR4BIG)) ? 'C' : 'c';
+}
+
+/*
+ * the bans on the CIDR tree covering an address.  user is NULL for a
+ * connection that has none yet, and then only *@ bans can match.
+ */
+static struct userBan *cidr_check(int family, void *ip, char *user,
+                                  unsigned int yflags, unsigned int nflags)
+{
+   int fam = CIDR_FAM(family);
+   unsigned int maxbits = CIDR_MAXBITS(fam);
+   unsigned char *addr = (unsigned char *) ip;
+   struct userBan *ban = NULL;
+   struct timeval start, now;
+   unsigned long usec;
+   cidrNode *n;
+   uBanEnt *bl;
+
+   if (family != AF_INET && family != AF_INET6)
+      return NULL;
+
+   gettimeofday(&start, NULL);
+   cidrstats.lookups++;
+
+   for (n = cidr_root[fam]; n && !ban && n->bits <= maxbits; )
+   {
+      cidrstats.visited++;
+      if (cidr_common(n->prefix, addr, n->bits) < n->bits)
+         break;
+
+      LIST_FOREACH(bl, &n->bans, lp)
+      {
+         if((bl->ban->flags & UBAN_TEMPORARY) && bl->ban->timeset + bl->ban->duration <= NOW)
+            continue;
+
+         if( ((yflags & UBAN_WILDUSER) && !(bl->ban->flags & UBAN_WILDUSER)) ||
+             ((nflags & UBAN_WILDUSER) && (bl->ban->flags & UBAN_WILDUSER)))
+            continue;
+
+         if((!(bl->ban->flags & UBAN_WILDUSER)) && (!user || match(bl->ban->u, user)))
+            continue;
+
+         ban = bl->ban;
+         break;
+      }
+
+      if (n->bits == maxbits)
+         break;
+      n = n->child[CIDR_BIT(addr, n->bits)];
+   }
+
+   gettimeofday(&now, NULL);
+   usec = (now.tv_sec - start.tv_sec) * 1000000 +
+          (now.tv_usec - start.tv_usec);
+   cidrstats.usec += usec;
+   if (usec > cidrstats.maxusec)
+      cidrstats.maxusec = usec;
+
+   return ban;
+}
+
 /* userban (akill/kline) functions */
 
 void add_hostbased_userban(struct userBan *b)
@@ -76,21 +331,11 @@ void add_hostbased_userban(struct userBan *b)
    bl->ban = b;
    b->internal_ent = (void *) bl;
 
-   if(b->flags & UBAN_CIDR4BIG)
+   if(b->flags & (UBAN_CIDR4|UBAN_CIDR4BIG))
    {
-      LIST_INSERT_HEAD(&CIDR4BIG_bans, bl, lp);
-      return;
-   }
-
-   if(b->flags & UBAN_CIDR4)
-   {
-      unsigned char *s = (unsigned char *) &bl->ban->cidr_ip;
-      int a, b;
-
-      a = (int) *s++;
-      b = (int) *s;
-
-      LIST_INSERT_HEAD(&CIDR4_bans[a][b], bl, lp);
+      bl->node = cidr_get(CIDR_FAM(b->cidr_family),
+                          (unsigned char *) &b->cidr_ip, b->cidr_bits);
+      LIST_INSERT_HEAD(&bl->node->bans, bl, lp);
       return;
    }
 
@@ -136,6 +381,9 @@ void remove_userban(struct userBan *b)
 
    LIST_REMOVE(bl, lp);
 
+   if(bl->node && !cidr_walking)
+      cidr_prune(CIDR_FAM(b->cidr_family), bl->node);
+
    ubanent_free(bl);
 
    return;
@@ -215,95 +463,62 @@ int user_match_ban(aClient *cptr, struct userBan *ban)
    return 0;
 }
 
-struct userBan *check_userbanned(aClient *cptr, unsigned int yflags, unsigned int nflags)
+/* the bans on the IP lists matching an address, see cidr_check on user */
+static struct userBan *ip_check(char *iptmp, char *user, unsigned int yflags,
+                                unsigned int nflags)
 {
-   char iptmp[HOSTIPLEN + 1];
+   unsigned int hv = ip_hash(iptmp) % HASH_SIZE;
    uBanEnt *bl;
 
-   strncpyzt(iptmp, cipntoa(cptr), HOSTIPLEN + 1);
-
-   if(yflags & UBAN_IP)
+   LIST_FOREACH(bl, &ip_bans.hash_list[hv], lp) 
    {
-      unsigned int hv = ip_hash(iptmp) % HASH_SIZE;
-
-      LIST_FOREACH(bl, &ip_bans.hash_list[hv], lp) 
-      {
-         if((bl->ban->flags & UBAN_TEMPORARY) && bl->ban->timeset + bl->ban->duration <= NOW)
-            continue;
-
-         if( ((yflags & UBAN_WILDUSER) && !(bl->ban->flags & UBAN_WILDUSER)) ||
-             ((nflags & UBAN_WILDUSER) && (bl->ban->flags & UBAN_WILDUSER)))
-            continue;
-
-         if((!(bl->ban->flags & UBAN_WILDUSER)) && match(bl->ban->u, cptr->user->username)) 
-            continue;
-
-         if(mycmp(bl->ban->h, iptmp) == 0)
-            return bl->ban;
-      }
-
-      LIST_FOREACH(bl, &ip_bans.wild_list, lp) 
-      {
-         if((bl->ban->flags & UBAN_TEMPORARY) && bl->ban->timeset + bl->ban->duration <= NOW)
-            continue;
+      if((bl->ban->flags & UBAN_TEMPORARY) && bl->ban->timeset + bl->ban->duration <= NOW)
+         continue;
 
-         if( ((yflags & UBAN_WILDUSER) && !(bl->ban->flags & UBAN_WILDUSER)) ||
-             ((nflags & UBAN_WILDUSER) && (bl->ban->flags & UBAN_WILDUSER)))
-            continue;
+      if( ((yflags & UBAN_WILDUSER) && !(bl->ban->flags & UBAN_WILDUSER)) ||
+          ((nflags & UBAN_WILDUSER) && (bl->ban->flags & UBAN_WILDUSER)))
+         continue;
 
-         if((!(bl->ban->flags & UBAN_WILDUSER)) && match(bl->ban->u, cptr->user->username)) 
-            continue;
+      if((!(bl->ban->flags & UBAN_WILDUSER)) && (!user || match(bl->ban->u, user)))
+         continue;
 
-         if(match(bl->ban->h, iptmp) == 0)
-            return bl->ban;
-      }
+      if(mycmp(bl->ban->h, iptmp) == 0)
+         return bl->ban;
    }
 
-   if(yflags & UBAN_CIDR4 && cptr->ip_family == AF_INET)
+   LIST_FOREACH(bl, &ip_bans.wild_list, lp) 
    {
-      unsigned char *s = (unsigned char *) &cptr->ip.ip4.s_addr;
-      int a, b;
-
-      a = (int) *s++;
-      b = (int) *s;
-
-      LIST_FOREACH(bl, &CIDR4_bans[a][b], lp) 
-      {
-         if((bl->ban->flags & UBAN_TEMPORARY) && bl->ban->timeset + bl->ban->duration <= NOW)
-            continue;
+      if((bl->ban->flags & UBAN_TEMPORARY) && bl->ban->timeset + bl->ban->duration <= NOW)
+         continue;
 
-         if( ((yflags & UBAN_WILDUSER) && !(bl->ban->flags & UBAN_WILDUSER)) ||
-             ((nflags & UBAN_WILDUSER) && (bl->ban->flags & UBAN_WILDUSER)))
-            continue;
+      if( ((yflags & UBAN_WILDUSER) && !(bl->ban->flags & UBAN_WILDUSER)) ||
+          ((nflags & UBAN_WILDUSER) && (bl->ban->flags & UBAN_WILDUSER)))
+         continue;
 
-         if((!(bl->ban->flags & UBAN_WILDUSER)) && match(bl->ban->u, cptr->user->username)) 
-            continue;
+      if((!(bl->ban->flags & UBAN_WILDUSER)) && (!user || match(bl->ban->u, user)))
+         continue;
 
-	 if(cptr->ip_family == bl->ban->cidr_family &&
-	    bitncmp(&cptr->ip, &bl->ban->cidr_ip, bl->ban->cidr_bits) == 0)
-	     return bl->ban;
-      }
+      if(match(bl->ban->h, iptmp) == 0)
+         return bl->ban;
    }
+   return NULL;
+}
 
-   if(yflags & UBAN_CIDR4)
-   {
-      LIST_FOREACH(bl, &CIDR4BIG_bans, lp) 
-      {
-         if((bl->ban->flags & UBAN_TEMPORARY) && bl->ban->timeset + bl->ban->duration <= NOW)
-            continue;
+struct userBan *check_userbanned(aClient *cptr, unsigned int yflags, unsigned int nflags)
+{
+   char iptmp[HOSTIPLEN + 1];
+   char *user = cptr->user ? cptr->user->username : NULL;
+   struct userBan *ban;
+   uBanEnt *bl;
 
-         if( ((yflags & UBAN_WILDUSER) && !(bl->ban->flags & UBAN_WILDUSER)) ||
-             ((nflags & UBAN_WILDUSER) && (bl->ban->flags & UBAN_WILDUSER)))
-            continue;
+   strncpyzt(iptmp, cipntoa(cptr), HOSTIPLEN + 1);
 
-         if((!(bl->ban->flags & UBAN_WILDUSER)) && match(bl->ban->u, cptr->user->username)) 
-            continue;
+   if((yflags & UBAN_IP) && (ban = ip_check(iptmp, user, yflags, nflags)))
+      return ban;
 
-	 if(cptr->ip_family == bl->ban->cidr_family &&
-	    bitncmp(&cptr->ip, &bl->ban->cidr_ip, bl->ban->cidr_bits) == 0)
-	     return bl->ban;
-      }
-   }
+   if((yflags & UBAN_CIDR4) &&
+      (ban = cidr_check(cptr->ip_family, &cptr->ip, user, yflags, nflags)))
+      return ban;
 
    if(yflags & UBAN_HOST)
    {
@@ -352,42 +567,34 @@ struct userBan *check_userbanned(aClient *cptr, unsigned int yflags, unsigned in
    return NULL;
 }
 
-struct userBan *find_userban_exact(struct userBan *borig, unsigned int careflags)
+/*
+ * check_ipbanned - the *@ban on an address, for a connection that has
+ * just been accepted and has no client yet.  ip is the address in
+ * network order, iptmp the same in text.
+ */
+struct userBan *check_ipbanned(int family, void *ip, char *iptmp)
 {
-   uBanEnt *bl;
-
-   if(borig->flags & UBAN_CIDR4BIG)
-   {
-      LIST_FOREACH(bl, &CIDR4BIG_bans, lp) {
-         /* must have same wilduser, etc setting */
-         if((bl->ban->flags ^ borig->flags) & (UBAN_WILDUSER|careflags))
-            continue;
-
-         /* user fields do not match? */
-         if(!(borig->flags & UBAN_WILDUSER) && mycmp(borig->u, bl->ban->u))
-            continue;
-
-	 /* CIDR fields do not match? */
-	 if(borig->cidr_family != bl->ban->cidr_family ||
-	    borig->cidr_bits != bl->ban->cidr_bits ||
-	    bitncmp(&borig->cidr_ip, &bl->ban->cidr_ip, borig->cidr_bits) != 0)
-            continue;
+   struct userBan *ban;
 
-         return bl->ban;
-      }
+   if((ban = ip_check(iptmp, NULL, UBAN_WILDUSER, 0)))
+      return ban;
+   return cidr_check(family, ip, NULL, UBAN_WILDUSER, 0);
+}
 
-      return NULL;
-   }
+struct userBan *find_userban_exact(struct userBan *borig, unsigned int careflags)
+{
+   uBanEnt *bl;
 
-   if(borig->flags & UBAN_CIDR4)
+   if(borig->flags & (UBAN_CIDR4|UBAN_CIDR4BIG))
    {
-      unsigned char *s = (unsigned char *) &borig->cidr_ip;
-      int a, b;
+      cidrNode *n = cidr_find(CIDR_FAM(borig->cidr_family),
+                              (unsigned char *) &borig->cidr_ip,
+                              borig->cidr_bits);
 
-      a = (int) *s++;
-      b = (int) *s;
+      if(!n)
+         return NULL;
 
-      LIST_FOREACH(bl, &CIDR4_bans[a][b], lp) {
+      LIST_FOREACH(bl, &n->bans, lp) {
          /* must have same wilduser, etc setting */
          if((bl->ban->flags ^ borig->flags) & (UBAN_WILDUSER|careflags))
             continue;
@@ -396,12 +603,7 @@ struct userBan *find_userban_exact(struct userBan *borig, unsigned int careflags
          if(!(borig->flags & UBAN_WILDUSER) && mycmp(borig->u, bl->ban->u))
             continue;
 
-	 /* CIDR fields do not match? */
-	 if(borig->cidr_family != bl->ban->cidr_family ||
-	    borig->cidr_bits != bl->ban->cidr_bits ||
-	    bitncmp(&borig->cidr_ip, &bl->ban->cidr_ip, borig->cidr_bits) != 0)
-            continue;
-
+	 /* same family, prefix and length, or we wouldn't be here */
          return bl->ban;
       }
 
@@ -584,19 +786,18 @@ static inline void report_list_match_flags(aClient *cptr, uBanEnt *bl, unsigned
 void expire_userbans()
 {
    uBanEnt *bl;
-   int a, b;
-
-   bl = LIST_FIRST(&CIDR4BIG_bans);
-   expire_list(bl);
+   cidrNode *n;
+   int a;
 
-   for(a = 0; a < 256; a++)
+   cidr_walking++;
+   for(a = CIDR_V4; a <= CIDR_V6; a++)
    {
-     for(b = 0; b < 256; b++)
-     {
-        bl = LIST_FIRST(&CIDR4_bans[a][b]);
-        expire_list(bl);
-     }
+      for(n = cidr_root[a]; n; n = cidr_next(n))
+         expire_list(LIST_FIRST(&n->bans));
    }
+   cidr_walking--;
+   cidr_compact(CIDR_V4, cidr_root[CIDR_V4]);
+   cidr_compact(CIDR_V6, cidr_root[CIDR_V6]);
 
    bl = LIST_FIRST(&host_bans.wild_list);
    expire_list(bl);
@@ -615,19 +816,18 @@ void expire_userbans()
 void remove_userbans_match_flags(unsigned int flags, unsigned int nflags)
 {
    uBanEnt *bl;
-   int a, b;
-
-   bl = LIST_FIRST(&CIDR4BIG_bans);
-   remove_list_match_flags(bl, flags, nflags);
+   cidrNode *n;
+   int a;
 
-   for(a = 0; a < 256; a++)
+   cidr_walking++;
+   for(a = CIDR_V4; a <= CIDR_V6; a++)
    {
-     for(b = 0; b < 256; b++)
-     {
-        bl = LIST_FIRST(&CIDR4_bans[a][b]);
-        remove_list_match_flags(bl, flags, nflags);
-     }
+      for(n = cidr_root[a]; n; n = cidr_next(n))
+         remove_list_match_flags(LIST_FIRST(&n->bans), flags, nflags);
    }
+   cidr_walking--;
+   cidr_compact(CIDR_V4, cidr_root[CIDR_V4]);
+   cidr_compact(CIDR_V6, cidr_root[CIDR_V6]);
 
    bl = LIST_FIRST(&host_bans.wild_list);
    remove_list_match_flags(bl, flags, nflags);
@@ -646,18 +846,14 @@ void remove_userbans_match_flags(unsigned int flags, unsigned int nflags)
 void report_userbans_match_flags(aClient *cptr, unsigned int flags, unsigned int nflags)
 {
    uBanEnt *bl;
-   int a, b;
-
-   bl = LIST_FIRST(&CIDR4BIG_bans);
-   report_list_match_flags(cptr, bl, flags, nflags, 'C');
+   cidrNode *n;
+   int a;
 
-   for(a = 0; a < 256; a++)
+   for(a = CIDR_V4; a <= CIDR_V6; a++)
    {
-     for(b = 0; b < 256; b++)
-     {
-        bl = LIST_FIRST(&CIDR4_bans[a][b]);
-        report_list_match_flags(cptr, bl, flags, nflags, 'c');
-     }
+      for(n = cidr_root[a]; n; n = cidr_next(n))
+         report_list_match_flags(cptr, LIST_FIRST(&n->bans), flags, nflags,
+                                 cidr_rchar(n));
    }
 
    bl = LIST_FIRST(&host_bans.wild_list);
@@ -674,6 +870,21 @@ void report_userbans_match_flags(aClient *cptr, unsigned int flags, unsigned int
    }
 }
 
+/* report CIDR trie size and lookup cost to an oper */
+void report_userban_stats(aClient *cptr)
+{
+   sendto_one(cptr, ":%s %d %s :CIDR ban trie: %d IPv4 nodes, %d IPv6 nodes",
+              me.name, RPL_STATSDEBUG, cptr->name, cidrstats.nodes[CIDR_V4],
+              cidrstats.nodes[CIDR_V6]);
+   sendto_one(cptr, ":%s %d %s :CIDR ban lookups: %lu lookups, %lu nodes "
+              "visited", me.name, RPL_STATSDEBUG, cptr->name,
+              cidrstats.lookups, cidrstats.visited);
+   sendto_one(cptr, ":%s %d %s :CIDR ban time: %lu usec total, %lu avg, "
+              "%lu max", me.name, RPL_STATSDEBUG, cptr->name, cidrstats.usec,
+              cidrstats.lookups ? cidrstats.usec / cidrstats.lookups : 0,
+              cidrstats.maxusec);
+}
+
 char *get_userban_host(struct userBan *ban, char *buf, int buflen)
 {
    *buf = '\0';
@@ -1421,15 +1632,6 @@ void init_banlist(aBanList *a, int numbuckets)
 
 void init_userban()
 {
-   int i;
-
-   CIDR4_bans = (ban_list **) MyMalloc(256 * sizeof(ban_list *));
-   for(i = 0; i < 256; i++)
-   {
-      CIDR4_bans[i] = (ban_list *) MyMalloc(256 * sizeof(ban_list));
-      memset(CIDR4_bans[i], 0, 256 * sizeof(ban_list));
-   }
-
    init_banlist(&host_bans, HASH_SIZE);
    init_banlist(&ip_bans, HASH_SIZE);
 
@@ -1556,12 +1758,12 @@ void userban_sweep(struct userBan *ban)
  * ks_dumpklines() helper
  */
 static void
-ks_dumplist(int f, uBanEnt *be)
+ks_dumplist(uBanEnt *be)
 {
     struct userBan *ub;
 
     /* klines.c */
-    extern void ks_write(int, char, struct userBan *);
+    extern void ks_dumpban(struct userBan *);
 
     for (; be; be = LIST_NEXT(be, lp))
     {
@@ -1576,7 +1778,7 @@ ks_dumplist(int f, uBanEnt *be)
             && ub->duration < (KLINE_MIN_STORE_TIME * 60))
             continue;
 
-        ks_write(f, '+', ub);
+        ks_dumpban(ub);
     }
 }
 
@@ -1584,22 +1786,22 @@ ks_dumplist(int f, uBanEnt *be)
  * Called from klines.c during a storage GC.
  */
 void
-ks_dumpklines(int f)
+ks_dumpklines(void)
 {
-    int i, j;
+    cidrNode *n;
+    int i;
 
-    for (i = 0; i < 256; i++)
-        for (j = 0; j < 256; j++)
-            ks_dumplist(f, LIST_FIRST(&CIDR4_bans[i][j]));
+    for (i = CIDR_V4; i <= CIDR_V6; i++)
+        for (n = cidr_root[i]; n; n = cidr_next(n))
+            ks_dumplist(LIST_FIRST(&n->bans));
 
-    ks_dumplist(f, LIST_FIRST(&CIDR4BIG_bans));
-    ks_dumplist(f, LIST_FIRST(&host_bans.wild_list));
-    ks_dumplist(f, LIST_FIRST(&ip_bans.wild_list));
+    ks_dumplist(LIST_FIRST(&host_bans.wild_list));
+    ks_dumplist(LIST_FIRST(&ip_bans.wild_list));
 
     for (i = 0; i < HASH_SIZE; i++)
     {
-        ks_dumplist(f, LIST_FIRST(&host_bans.hash_list[i]));
-        ks_dumplist(f, LIST_FIRST(&ip_bans.hash_list[i]));
+        ks_dumplist(LIST_FIRST(&host_bans.hash_list[i]));
+        ks_dumplist(LIST_FIRST(&ip_bans.hash_list[i]));
     }
 }
 
@@ -1650,8 +1852,8 @@ mc_simlist(MemCount *mc, uBanEnt *be)
 u_long
 memcount_userban(MCuserban *mc)
 {
+    cidrNode *n;
     int i;
-    int j;
 
     mc->file = __FILE__;
 
@@ -1659,19 +1861,18 @@ memcount_userban(MCuserban *mc)
     mc->lists.c += 5 * HASH_SIZE;
     mc->lists.m += 5 * HASH_SIZE * sizeof(ban_list);
 
-    /* CIDR4 table */
-    mc->lists.c += 256;
-    mc->lists.m += 256 * sizeof(ban_list *);
-
-    /* CIDR4 subtables */
-    mc->lists.c += 256 * 256;
-    mc->lists.m += 256 * 256 * sizeof(ban_list);
-
-    mc_userlist(&mc->cidr4big_userbans, LIST_FIRST(&CIDR4BIG_bans));
-
-    for (i = 0; i < 256; i++)
-        for (j = 0; j < 256; j++)
-            mc_userlist(&mc->cidr4_userbans, LIST_FIRST(&CIDR4_bans[i][j]));
+    for (i = CIDR_V4; i <= CIDR_V6; i++)
+    {
+        for (n = cidr_root[i]; n; n = cidr_next(n))
+        {
+            mc->cidrnodes.c++;
+            mc->cidrnodes.m += sizeof(*n);
+            if (cidr_rchar(n) == 'C')
+                mc_userlist(&mc->cidr4big_userbans, LIST_FIRST(&n->bans));
+            else
+                mc_userlist(&mc->cidr4_userbans, LIST_FIRST(&n->bans));
+        }
+    }
 
     mc_userlist(&mc->hostwild_userbans, LIST_FIRST(&host_bans.wild_list));
     mc_userlist(&mc->ipwild_userbans, LIST_FIRST(&ip_bans.wild_list));
@@ -1710,6 +1911,8 @@ memcount_userban(MCuserban *mc)
 
     mc->total.c = mc->lists.c + mc->entries.c + mc->userbans.c + mc->simbans.c;
     mc->total.m = mc->lists.m + mc->entries.m + mc->userbans.m + mc->simbans.m;
+    mc->total.c += mc->cidrnodes.c;
+    mc->total.m += mc->cidrnodes.m;
 
     return mc->total.m;
 }
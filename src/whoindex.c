@@ -0,0 +1,754 @@
+/*
+ *   whoindex.c - Secondary indexes over clients for WHO and RWHO
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Every user is entered in one crit-bit tree per attribute WHO and RWHO
+ * search on:
+ *
+ *   server   - the server name
+ *   nick     - the nick, so "abc*" is a prefix query
+ *   host     - the hostname reversed, so "*.example.com" is one too
+ *   ip       - a family byte then the address, so a CIDR mask is a
+ *              prefix query of 8 + mask bits
+ *
+ * and under USER_HOSTMASKING a second host tree for the masked host.
+ *
+ * An inner node splits its subtree on one bit of the key; a leaf holds
+ * one key and the users that share it.  Each node counts the users
+ * below it, so the size of a prefix query's answer is known after one
+ * descent, before any of it is fetched.  whoidx_plan() uses that to
+ * pick the most selective index for a search, or none if scanning
+ * would be as cheap.  Every candidate is still checked against the full
+ * search, so a query only has to find a superset of the matches.
+ *
+ * The second half of the file runs searches in slices.  A search that
+ * runs out of time, or out of room in the sendQ of whoever asked, is
+ * paused with its place kept, and send_searches() carries on with it
+ * from the io loop, as send_safelists() does for LIST.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "struct.h"
+#include "common.h"
+#include "sys.h"
+#include "h.h"
+#include "inet.h"
+#include "memcount.h"
+#include "whoindex.h"
+
+#include <time.h>
+
+typedef struct WhoNode aWhoNode;
+typedef struct WhoLeaf aWhoLeaf;
+
+/* both start with bit and count, bit being -1 in a leaf */
+struct WhoNode
+{
+    int       bit;              /* bit the children differ in */
+    int       count;            /* users below */
+    aWhoNode *child[2];
+};
+
+struct WhoLeaf
+{
+    int       bit;
+    int       count;            /* users in the list */
+    aClient  *clients;
+    int       len;
+    unsigned char key[1];
+};
+
+static aWhoNode *widx_root[WIDX_TREES];
+static int       widx_nodes, widx_leaves;
+static u_long    widx_leafmem;
+
+static char *widx_names[WIDX_TREES] =
+{
+    "server",
+    "nick",
+    "host",
+    "IP",
+#ifdef USER_HOSTMASKING
+    "masked host",
+#endif
+};
+
+/* bit 'bit' of a key, counted from the top of its first byte */
+static inline int widx_bit(unsigned char *key, int len, int bit)
+{
+    int byte = bit >> 3;
+
+    return byte < len ? (key[byte] >> (7 - (bit & 7))) & 1 : 0;
+}
+
+/* append s upper cased, or reversed and upper cased, with terminator */
+static int widx_str(unsigned char *key, char *s, int reverse)
+{
+    int len = strlen(s), i;
+
+    if (len > WIDX_KEYLEN - 1)
+        len = WIDX_KEYLEN - 1;
+    for (i = 0; i < len; i++)
+        key[i] = ToUpper(reverse ? s[len - 1 - i] : s[i]);
+    key[len] = '\0';
+    return len + 1;
+}
+
+static int widx_addr(unsigned char *key, int family, void *addr)
+{
+    if (family == AF_INET6)
+    {
+        key[0] = 6;
+        memcpy(key + 1, addr, 16);
+        return 17;
+    }
+    key[0] = 4;
+    memcpy(key + 1, addr, 4);
+    return 5;
+}
+
+static int widx_key(aClient *cptr, int tree, unsigned char *key)
+{
+    switch (tree)
+    {
+        case WIDX_SERVER:
+            return widx_str(key, cptr->user->server, 0);
+        case WIDX_NICK:
+            return widx_str(key, cptr->name, 0);
+        case WIDX_HOST:
+            return widx_str(key, cptr->user->host, 1);
+#ifdef USER_HOSTMASKING
+        case WIDX_MHOST:
+            return widx_str(key, cptr->user->mhost, 1);
+#endif
+        default:
+            return widx_addr(key, cptr->ip_family, &cptr->ip);
+    }
+}
+
+/* does the leaf's key start with the query's bits? */
+static int widx_prefix(aWhoLeaf *lf, aWhoQuery *q)
+{
+    int i, n = q->bits >> 3, c;
+
+    for (i = 0; i < n; i++)
+        if ((i < lf->len ? lf->key[i] : 0) != q->key[i])
+            return 0;
+    if (q->bits & 7)
+    {
+        c = i < lf->len ? lf->key[i] : 0;
+        if ((c ^ q->key[i]) & (0xff00 >> (q->bits & 7)))
+            return 0;
+    }
+    return 1;
+}
+
+static void widx_insert(aClient *cptr, int tree)
+{
+    unsigned char key[WIDX_KEYLEN];
+    aWhoNode **pp, *p, *n;
+    aWhoLeaf *lf;
+    int len, i, a = 0, b = 0, diff = -1, dir;
+
+    len = widx_key(cptr, tree, key);
+
+    if ((p = widx_root[tree]))
+    {
+        /* the leaf the key would sit beside, and where they part */
+        while (p->bit >= 0)
+            p = p->child[widx_bit(key, len, p->bit)];
+        lf = (aWhoLeaf *) p;
+        for (i = 0; i < len || i < lf->len; i++)
+        {
+            a = i < len ? key[i] : 0;
+            b = i < lf->len ? lf->key[i] : 0;
+            if (a != b)
+                break;
+        }
+        if (a != b)
+            for (diff = i * 8, a ^= b; !(a & 0x80); a <<= 1)
+                diff++;
+
+        /* count the user in each node above where it goes */
+        for (pp = &widx_root[tree]; (p = *pp)->bit >= 0 &&
+             (diff < 0 || p->bit < diff);
+             pp = &p->child[widx_bit(key, len, p->bit)])
+            p->count++;
+    }
+    else
+        pp = &widx_root[tree];
+
+    if (!p || diff >= 0)
+    {
+        lf = MyMalloc(sizeof(aWhoLeaf) + len);
+        lf->bit = -1;
+        lf->count = 0;
+        lf->clients = NULL;
+        lf->len = len;
+        memcpy(lf->key, key, len);
+        widx_leaves++;
+        widx_leafmem += sizeof(aWhoLeaf) + len;
+
+        if (p)
+        {
+            n = MyMalloc(sizeof(aWhoNode));
+            dir = widx_bit(key, len, diff);
+            n->bit = diff;
+            n->count = p->count + 1;
+            n->child[dir] = (aWhoNode *) lf;
+            n->child[!dir] = p;
+            widx_nodes++;
+            *pp = n;
+        }
+        else
+            *pp = (aWhoNode *) lf;
+    }
+
+    cptr->user->widx[tree].prev = NULL;
+    cptr->user->widx[tree].next = lf->clients;
+    if (lf->clients)
+        lf->clients->user->widx[tree].prev = cptr;
+    lf->clients = cptr;
+    lf->count++;
+    cptr->user->widx[tree].leaf = lf;
+}
+
+static void widx_delete(aClient *cptr, int tree)
+{
+    aWhoLeaf *lf = cptr->user->widx[tree].leaf;
+    aWhoNode **pp, **parent = NULL, *p;
+
+    if (!lf)
+        return;
+
+    if (cptr->user->widx[tree].next)
+        cptr->user->widx[tree].next->user->widx[tree].prev =
+            cptr->user->widx[tree].prev;
+    if (cptr->user->widx[tree].prev)
+        cptr->user->widx[tree].prev->user->widx[tree].next =
+            cptr->user->widx[tree].next;
+    else
+        lf->clients = cptr->user->widx[tree].next;
+    cptr->user->widx[tree].leaf = NULL;
+    lf->count--;
+
+    /* walk down to the leaf by its own key, uncounting the user */
+    for (pp = &widx_root[tree]; (p = *pp)->bit >= 0;
+         pp = &p->child[widx_bit(lf->key, lf->len, p->bit)])
+    {
+        p->count--;
+        parent = pp;
+    }
+
+    if (lf->count)
+        return;
+
+    /* the last user went, so the leaf's sibling takes its parent's place */
+    if (parent)
+    {
+        p = *parent;
+        *parent = p->child[pp == &p->child[0]];
+        MyFree(p);
+        widx_nodes--;
+    }
+    else
+        widx_root[tree] = NULL;
+    widx_leaves--;
+    widx_leafmem -= sizeof(aWhoLeaf) + lf->len;
+    MyFree(lf);
+}
+
+/* enter a user in every index, at registration */
+void whoidx_add(aClient *cptr)
+{
+    int tree;
+
+    for (tree = 0; tree < WIDX_TREES; tree++)
+    {
+        widx_delete(cptr, tree);
+        widx_insert(cptr, tree);
+    }
+}
+
+void whoidx_remove(aClient *cptr)
+{
+    int tree;
+
+    for (tree = 0; tree < WIDX_TREES; tree++)
+        widx_delete(cptr, tree);
+}
+
+/* re-enter a registered user after a nick or host change */
+void whoidx_update(aClient *cptr, int tree)
+{
+    if (!cptr->user->widx[tree].leaf)
+        return;
+    widx_delete(cptr, tree);
+    widx_insert(cptr, tree);
+}
+
+int whoidx_server(aWhoQuery *q, aClient *server)
+{
+    q->tree = WIDX_SERVER;
+    q->bits = widx_str(q->key, server->name, 0) * 8;
+    return 1;
+}
+
+/* a nick mask: the part before its first wildcard */
+int whoidx_nick(aWhoQuery *q, char *mask)
+{
+    int len = strcspn(mask, "*?");
+
+    if (!len || len >= WIDX_KEYLEN - 1)
+        return 0;
+    q->tree = WIDX_NICK;
+    widx_str(q->key, mask, 0);
+    q->bits = (mask[len] ? len : len + 1) * 8;
+    return 1;
+}
+
+/* a host mask: the part after its last wildcard, reversed */
+int whoidx_host(aWhoQuery *q, char *mask)
+{
+    char *s, *tail = mask;
+    int len;
+
+    for (s = mask; *s; s++)
+        if (*s == '*' || *s == '?')
+            tail = s + 1;
+    if (!*tail || (len = strlen(tail)) >= WIDX_KEYLEN - 1)
+        return 0;
+    q->tree = WIDX_HOST;
+    widx_str(q->key, tail, 1);
+    q->bits = (tail == mask ? len + 1 : len) * 8;
+    return 1;
+}
+
+int whoidx_cidr(aWhoQuery *q, int family, void *addr, int bits)
+{
+    q->tree = WIDX_IP;
+    widx_addr(q->key, family, addr);
+    q->bits = 8 + bits;
+    return 1;
+}
+
+/*
+ * an IP mask, as matched against hostip: usable if it is an address,
+ * or an IPv4 address ending in ".*"
+ */
+int whoidx_ip(aWhoQuery *q, char *mask)
+{
+    char addr[16];
+    char *s;
+    int bits;
+
+    if (strchr(mask, '?') || strchr(mask, '/'))
+        return 0;
+    if ((s = strchr(mask, '*')) && (s == mask || s[-1] != '.' || s[1]))
+        return 0;
+    if ((bits = inet_parse_cidr(AF_INET, mask, addr, 4)) > 0 &&
+        (s ? bits < 32 : bits == 32))
+        return whoidx_cidr(q, AF_INET, addr, bits);
+    if (!s && inet_parse_cidr(AF_INET6, mask, addr, 16) == 128)
+        return whoidx_cidr(q, AF_INET6, addr, 128);
+    return 0;
+}
+
+/* the subtree holding every user the query finds, or NULL if none */
+static aWhoNode *widx_top(aWhoQuery *q)
+{
+    aWhoNode *p, *top;
+    int len = (q->bits + 7) / 8;
+
+    if (!(p = widx_root[q->tree]))
+        return NULL;
+    while (p->bit >= 0 && p->bit < q->bits)
+        p = p->child[widx_bit(q->key, len, p->bit)];
+    /* every key below shares the bits above top's, so check one */
+    for (top = p; p->bit >= 0; p = p->child[0])
+        ;
+    return widx_prefix((aWhoLeaf *) p, q) ? top : NULL;
+}
+
+#ifdef USER_HOSTMASKING
+/* host masks match either host, so host queries cover both trees */
+static void widx_mhost(aWhoQuery *q, aWhoQuery *mq)
+{
+    *mq = *q;
+    mq->tree = WIDX_MHOST;
+}
+#endif
+
+int whoidx_count(aWhoQuery *q)
+{
+    aWhoNode *top;
+    int count = (top = widx_top(q)) ? top->count : 0;
+#ifdef USER_HOSTMASKING
+    aWhoQuery mq;
+
+    if (q->tree == WIDX_HOST)
+    {
+        widx_mhost(q, &mq);
+        if ((top = widx_top(&mq)))
+            count += top->count;
+    }
+#endif
+    return count;
+}
+
+/* append the users below p, less those the skip query also finds */
+static void widx_walk(aWhoNode *p, int tree, aWhoQuery *skip,
+                      aClient **out, int *n)
+{
+    aClient *ac;
+
+    if (p->bit >= 0)
+    {
+        widx_walk(p->child[0], tree, skip, out, n);
+        widx_walk(p->child[1], tree, skip, out, n);
+        return;
+    }
+    for (ac = ((aWhoLeaf *) p)->clients; ac; ac = ac->user->widx[tree].next)
+        if (!skip || !widx_prefix(ac->user->widx[skip->tree].leaf, skip))
+            out[(*n)++] = ac;
+}
+
+/*
+ * The users a query finds, in a MyMalloc()ed array the caller frees,
+ * or NULL if there are none.
+ */
+aClient **whoidx_collect(aWhoQuery *q, int *n)
+{
+    aClient **out;
+    aWhoNode *top;
+    int count = whoidx_count(q);
+#ifdef USER_HOSTMASKING
+    aWhoQuery mq;
+#endif
+
+    *n = 0;
+    if (!count)
+        return NULL;
+    out = MyMalloc(count * sizeof(aClient *));
+    if ((top = widx_top(q)))
+        widx_walk(top, q->tree, NULL, out, n);
+#ifdef USER_HOSTMASKING
+    if (q->tree == WIDX_HOST)
+    {
+        widx_mhost(q, &mq);
+        if ((top = widx_top(&mq)))
+            widx_walk(top, WIDX_MHOST, q, out, n);
+    }
+#endif
+    return out;
+}
+
+/*
+ * Pick the query that finds the fewest users, if that is fewer than
+ * 'scan', what the search would look at without one.  Returns its
+ * index in q, or -1.
+ */
+int whoidx_plan(aWhoQuery *q, int nq, int scan)
+{
+    int i, count, best = -1;
+
+    for (i = 0; i < nq; i++)
+        if ((count = whoidx_count(&q[i])) < scan)
+        {
+            scan = count;
+            best = i;
+        }
+    return best;
+}
+
+char *whoidx_name(aWhoQuery *q)
+{
+    return widx_names[q->tree];
+}
+
+/* paused searches, in no particular order */
+static aWhoSearch *searches;
+
+static long long whosearch_clock()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Start a search for cptr, with room after it for 'size' bytes of the
+ * command's own state, zeroed.  resume() carries on with it, returning
+ * 1 if it stopped short again, end() sends its end reply if it is cut
+ * short, and release() frees what the state holds, if anything.
+ */
+aWhoSearch *whosearch_new(aClient *cptr, int size,
+                          int (*resume)(aWhoSearch *),
+                          void (*end)(aWhoSearch *),
+                          void (*release)(aWhoSearch *))
+{
+    aWhoSearch *ws;
+
+    ws = MyMalloc(sizeof(aWhoSearch) + size);
+    memset(ws, 0, sizeof(aWhoSearch) + size);
+    ws->cptr = cptr;
+    ws->size = sizeof(aWhoSearch) + size;
+    ws->resume = resume;
+    ws->end = end;
+    ws->release = release;
+    ws->deadline = whosearch_clock() + WHO_SLICE;
+    return ws;
+}
+
+/* keep a copy of one of the search's arguments, which outlive parv[] */
+char *whosearch_save(aWhoSearch *ws, char *s)
+{
+    char *copy = ws->strings + ws->strused;
+    int len;
+
+    if (!s)
+        return NULL;
+    len = strlen(s) + 1;
+    if (ws->strused + len > (int) sizeof(ws->strings))
+        return s;
+    memcpy(copy, s, len);
+    ws->strused += len;
+    return copy;
+}
+
+/* look at every client, in client list order */
+void whosearch_clients(aWhoSearch *ws)
+{
+    ws->nextc = client;
+}
+
+/* look at a MyMalloc()ed set of candidates, which the search now owns */
+void whosearch_set(aWhoSearch *ws, aClient **set, int n)
+{
+    ws->set = set;
+    ws->nset = n;
+    ws->pos = 0;
+}
+
+/* look at the members of a channel */
+void whosearch_members(aWhoSearch *ws, aChannel *chptr)
+{
+    chanMember *cm;
+    aClient **set;
+    int n = 0;
+
+    set = MyMalloc(MAX(chptr->users, 1) * sizeof(aClient *));
+    for (cm = chptr->members; cm; cm = cm->next)
+        set[n++] = cm->cptr;
+    whosearch_set(ws, set, n);
+}
+
+/* the next candidate, or NULL once there are none left */
+aClient *whosearch_next(aWhoSearch *ws)
+{
+    aClient *ac;
+
+    if (ws->set)
+        return (ws->pos < ws->nset) ? ws->set[ws->pos++] : NULL;
+    if ((ac = ws->nextc))
+        ws->nextc = ac->next;
+    return ac;
+}
+
+/*
+ * Should the search stop here for now?  It has a few milliseconds per
+ * io loop pass, checked every few candidates, and stops early once
+ * the sendQ of whoever asked is as full as LIST would let it get.
+ */
+int whosearch_full(aWhoSearch *ws)
+{
+    if (!MyConnect(ws->cptr))
+        return 0;
+    if (!IsSendable(ws->cptr))
+        return 1;
+    if (++ws->checks % 16)
+        return 0;
+    return whosearch_clock() > ws->deadline;
+}
+
+static int whosearch_cmp(const void *a, const void *b)
+{
+    aClient *x = *(aClient **) a, *y = *(aClient **) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Park a search that stopped short.  The candidates it has yet to look
+ * at are sorted by address, so whosearch_client_gone() can find one
+ * that leaves meanwhile.
+ */
+void whosearch_pause(aWhoSearch *ws)
+{
+    if (ws->set)
+        qsort(ws->set + ws->pos, ws->nset - ws->pos, sizeof(aClient *),
+              whosearch_cmp);
+    ws->next = searches;
+    searches = ws;
+}
+
+static void whosearch_unlink(aWhoSearch *ws)
+{
+    aWhoSearch **wp;
+
+    for (wp = &searches; *wp; wp = &(*wp)->next)
+        if (*wp == ws)
+        {
+            *wp = ws->next;
+            break;
+        }
+}
+
+void whosearch_free(aWhoSearch *ws)
+{
+    if (ws->release)
+        ws->release(ws);
+    MyFree(ws->set);
+    MyFree(ws);
+}
+
+static aWhoSearch *whosearch_find(aClient *cptr)
+{
+    aWhoSearch *ws;
+
+    for (ws = searches; ws; ws = ws->next)
+        if (ws->cptr == cptr)
+            return ws;
+    return NULL;
+}
+
+/*
+ * End cptr's paused search, if any, where it is, so that a new one
+ * neither overtakes it nor waits for it to run to the end.
+ */
+void whosearch_stop(aClient *cptr)
+{
+    aWhoSearch *ws;
+
+    if (!searches || !(ws = whosearch_find(cptr)))
+        return;
+    whosearch_unlink(ws);
+    if (ws->end)
+        ws->end(ws);
+    whosearch_free(ws);
+}
+
+/* drop cptr's paused search, as it leaves */
+void whosearch_abort(aClient *cptr)
+{
+    aWhoSearch *ws;
+
+    if (!searches || !(ws = whosearch_find(cptr)))
+        return;
+    whosearch_unlink(ws);
+    whosearch_free(ws);
+}
+
+/* a client is leaving the client list: paused searches move past it */
+void whosearch_client_gone(aClient *cptr)
+{
+    aWhoSearch *ws;
+    aClient **slot;
+
+    for (ws = searches; ws; ws = ws->next)
+    {
+        if (!ws->set)
+        {
+            if (ws->nextc == cptr)
+                ws->nextc = cptr->next;
+        }
+        else if ((slot = bsearch(&cptr, ws->set + ws->pos,
+                                 ws->nset - ws->pos, sizeof(aClient *),
+                                 whosearch_cmp)))
+        {
+            /* close the gap, so the rest stays sorted for the next one */
+            ws->nset--;
+            memmove(slot, slot + 1,
+                    (ws->set + ws->nset - slot) * sizeof(aClient *));
+        }
+    }
+}
+
+/*
+ * send_searches
+ * called from the io loop: gives each paused search whose asker has
+ * room in its sendQ another slice.  Returns 1 if one of them stopped
+ * for time and could go on right away.
+ */
+int send_searches()
+{
+    aWhoSearch *ws, *next, *paused = searches;
+    int more = 0;
+
+    searches = NULL;
+    for (ws = paused; ws; ws = next)
+    {
+        next = ws->next;
+        if (!IsSendable(ws->cptr))
+        {
+            ws->next = searches;
+            searches = ws;
+            continue;
+        }
+        ws->checks = 0;
+        ws->deadline = whosearch_clock() + WHO_SLICE;
+        if (!ws->resume(ws))
+        {
+            whosearch_free(ws);
+            continue;
+        }
+        /* what is left of its set is still in order */
+        ws->next = searches;
+        searches = ws;
+        if (IsSendable(ws->cptr))
+            more = 1;
+    }
+    return more;
+}
+
+u_long
+memcount_whoindex(MCwhoindex *mc)
+{
+    aWhoSearch *ws;
+
+    mc->file = __FILE__;
+
+    for (ws = searches; ws; ws = ws->next)
+    {
+        mc->searches.c++;
+        mc->searches.m += ws->size + ws->nset * sizeof(aClient *);
+    }
+
+    mc->nodes.c = widx_nodes;
+    mc->nodes.m = widx_nodes * sizeof(aWhoNode);
+    mc->leaves.c = widx_leaves;
+    mc->leaves.m = widx_leafmem;
+
+    mc->total.c = mc->nodes.c + mc->leaves.c + mc->searches.c;
+    mc->total.m = mc->nodes.m + mc->leaves.m + mc->searches.m;
+
+    return mc->total.m;
+}
@@ -24,41 +24,193 @@
 #include "h.h"
 #include "memcount.h"
 
-/* externally defined functions */
-unsigned int hash_whowas_name(char *);	/* defined in hash.c */
+/*
+ * The history is kept for WHOWAS_KEEPTIME seconds rather than a fixed
+ * number of entries.
+ *
+ * Entries are handed out in order from generations of WW_GENSIZE, and
+ * since they come and go oldest first a whole generation is freed at
+ * once, as soon as its newest entry is too old to keep (or the history
+ * has grown past WHOWAS_MAXENTRIES).  Lookups skip entries past their
+ * time that are still waiting on the rest of their generation.
+ *
+ * The strings are interned: each distinct one is stored once with a
+ * reference count, so a user changing nick a dozen times, or a hundred
+ * users from the same host, share one copy of it.  Server names come
+ * from the scache as before.
+ *
+ * Each nickname has one record in whowasTable, heading its entries
+ * newest first.
+ */
+
+#define WW_GENSIZE 512
+
+typedef struct WhowasNick
+{
+    struct WhowasNick *hnext;
+    aWhowas    *first;          /* most recent entry */
+    char        name[NICKLEN + 1];
+} aWhowasNick;
+
+typedef struct WhowasString
+{
+    struct WhowasString *hnext;
+    unsigned int refs;
+    char        text[1];
+} aWhowasString;
+
+typedef struct WhowasGen
+{
+    struct WhowasGen *next;     /* the next newer generation */
+    int         used;
+    aWhowas     entry[WW_GENSIZE];
+} aWhowasGen;
+
 /* internally defined function */
 static void add_whowas_to_clist(aWhowas **, aWhowas *);
 static void del_whowas_from_clist(aWhowas **, aWhowas *);
-static void add_whowas_to_list(aWhowas **, aWhowas *);
-static void del_whowas_from_list(aWhowas **, aWhowas *);
 
-aWhowas     WHOWAS[NICKNAMEHISTORYLENGTH];
-aWhowas    *WHOWASHASH[WW_MAX];
+aHashTable  whowasTable;
+aHashTable  wwstringTable;
 
-int         whowas_next = 0;
+static aWhowasGen *oldestgen, *newestgen;
+static int  ww_gens, ww_entries, ww_nicks, ww_strings;
+static u_long ww_stringbytes;
+
+static char *ww_intern(char *str)
+{
+    aWhowasString *ws;
+    aHashEntry *bucket;
+    int len;
+
+    bucket = hash_bucket(&wwstringTable, hash_nick_name(str));
+    for (ws = (aWhowasString *) bucket->list; ws; ws = ws->hnext)
+    {
+	if (!strcmp(ws->text, str))
+	{
+	    ws->refs++;
+	    return ws->text;
+	}
+    }
+    len = offsetof(aWhowasString, text) + strlen(str) + 1;
+    ws = (aWhowasString *) MyMalloc(len);
+    ws->refs = 1;
+    strcpy(ws->text, str);
+    hash_add(&wwstringTable, ws->text, ws);
+    ww_strings++;
+    ww_stringbytes += len;
+    return ws->text;
+}
+
+static void ww_release(char *text)
+{
+    aWhowasString *ws;
+
+    ws = (aWhowasString *) (text - offsetof(aWhowasString, text));
+    if (--ws->refs > 0)
+	return;
+    hash_del(&wwstringTable, ws->text, ws);
+    ww_strings--;
+    ww_stringbytes -= offsetof(aWhowasString, text) + strlen(ws->text) + 1;
+    MyFree(ws);
+}
+
+static aWhowasNick *find_whowas_nick(char *name)
+{
+    aWhowasNick *wn;
+    aHashEntry *bucket;
+
+    bucket = hash_bucket(&whowasTable, hash_nick_name(name));
+    for (wn = (aWhowasNick *) bucket->list; wn; wn = wn->hnext)
+	if (!mycmp(name, wn->name))
+	    return wn;
+    return NULL;
+}
+
+static void del_whowas(aWhowas *ww)
+{
+    aWhowasNick *wn = ww->nick;
+
+    if (ww->online)
+	del_whowas_from_clist(&(ww->online->whowas), ww);
+    if (ww->prev)
+	ww->prev->next = ww->next;
+    else
+	wn->first = ww->next;
+    if (ww->next)
+	ww->next->prev = ww->prev;
+    if (!wn->first)
+    {
+	hash_del(&whowasTable, wn->name, wn);
+	MyFree(wn);
+	ww_nicks--;
+    }
+    ww_release(ww->name);
+    ww_release(ww->username);
+    ww_release(ww->hostname);
+#ifdef USER_HOSTMASKING
+    ww_release(ww->mhostname);
+    ww_release(ww->hostip);
+#endif
+    ww_release(ww->realname);
+}
+
+/*
+ * Free the oldest generations while they are wholly past keeping, or
+ * while the history is over its cap.  Only full generations go, so the
+ * one being filled is never pulled out from under add_history().
+ */
+static void expire_whowas(void)
+{
+    aWhowasGen *gen;
+    time_t cutoff = NOW - WHOWAS_KEEPTIME;
+    int i;
+
+    while ((gen = oldestgen) && gen->used == WW_GENSIZE &&
+	   (gen->entry[WW_GENSIZE - 1].logoff < cutoff ||
+	    ww_entries >= WHOWAS_MAXENTRIES))
+    {
+	for (i = 0; i < WW_GENSIZE; i++)
+	    del_whowas(&gen->entry[i]);
+	if (!(oldestgen = gen->next))
+	    newestgen = NULL;
+	ww_entries -= WW_GENSIZE;
+	ww_gens--;
+	MyFree(gen);
+    }
+}
 
 void add_history(aClient *cptr, int online)
 {
     aWhowas    *new;
-    
-    new = &WHOWAS[whowas_next];
+    aWhowasNick *wn;
+    aWhowasGen *gen;
 
-    if (new->hashv != -1) 
+    expire_whowas();
+    if (!newestgen || newestgen->used == WW_GENSIZE)
     {
-	if (new->online)
-	    del_whowas_from_clist(&(new->online->whowas), new);
-	del_whowas_from_list(&WHOWASHASH[new->hashv], new);
+	gen = (aWhowasGen *) MyMalloc(sizeof(aWhowasGen));
+	gen->next = NULL;
+	gen->used = 0;
+	if (newestgen)
+	    newestgen->next = gen;
+	else
+	    oldestgen = gen;
+	newestgen = gen;
+	ww_gens++;
     }
-    new->hashv = hash_whowas_name(cptr->name);
+    new = &newestgen->entry[newestgen->used++];
+    ww_entries++;
+
     new->logoff = NOW;
-    strncpyzt(new->name, cptr->name, NICKLEN + 1);
-    strncpyzt(new->username, cptr->user->username, USERLEN + 1);
-    strncpyzt(new->hostname, cptr->user->host, HOSTLEN + 1);
+    new->name = ww_intern(cptr->name);
+    new->username = ww_intern(cptr->user->username);
+    new->hostname = ww_intern(cptr->user->host);
 #ifdef USER_HOSTMASKING
-    strncpyzt(new->mhostname, cptr->user->mhost, HOSTLEN + 1);
-    strncpyzt(new->hostip, cptr->hostip, HOSTIPLEN + 1);
+    new->mhostname = ww_intern(cptr->user->mhost);
+    new->hostip = ww_intern(cptr->hostip);
 #endif
-    strncpyzt(new->realname, cptr->info, REALLEN + 1);
+    new->realname = ww_intern(cptr->info);
     /*
      * Its not string copied, a pointer to the scache hash is copied
      * -Dianora
@@ -73,10 +225,20 @@ void add_history(aClient *cptr, int online)
     }
     else
 	new->online = NULL;
-    add_whowas_to_list(&WHOWASHASH[new->hashv], new);
-    whowas_next++;
-    if (whowas_next == NICKNAMEHISTORYLENGTH)
-	whowas_next = 0;
+
+    if (!(wn = find_whowas_nick(cptr->name)))
+    {
+	wn = (aWhowasNick *) MyMalloc(sizeof(aWhowasNick));
+	wn->first = NULL;
+	strncpyzt(wn->name, cptr->name, NICKLEN + 1);
+	hash_add(&whowasTable, wn->name, wn);
+	ww_nicks++;
+    }
+    new->nick = wn;
+    new->prev = NULL;
+    if ((new->next = wn->first) != NULL)
+	new->next->prev = new;
+    wn->first = new;
 }
 
 void off_history(aClient *cptr)
@@ -93,21 +255,12 @@ void off_history(aClient *cptr)
 
 aClient *get_history(char *nick, time_t timelimit)
 {
-    aWhowas    *temp;
-    int         blah;
+    aWhowasNick *wn;
 
-    timelimit = NOW - timelimit;
-    blah = hash_whowas_name(nick);
-    temp = WHOWASHASH[blah];
-    for (; temp; temp = temp->next)
-    {
-	if (mycmp(nick, temp->name))
-	    continue;
-	if (temp->logoff < timelimit)
-	    continue;
-	return temp->online;
-    }
-    return NULL;
+    /* the most recent entry is the only one that can be recent enough */
+    if (!(wn = find_whowas_nick(nick)) || wn->first->logoff < NOW - timelimit)
+	return NULL;
+    return wn->first->online;
 }
 
 /*
@@ -118,6 +271,8 @@ aClient *get_history(char *nick, time_t timelimit)
 int m_whowas(aClient *cptr, aClient *sptr, int parc, char *parv[])
 {
     aWhowas *temp;
+    aWhowasNick *wn;
+    time_t cutoff = NOW - WHOWAS_KEEPTIME;
     int cur = 0;
     int         max = -1, found = 0;
     char       *p, *nick, *s;
@@ -137,40 +292,42 @@ int m_whowas(aClient *cptr, aClient *sptr, int parc, char *parv[])
     parv[1] = canonize(parv[1]);
     if (!MyConnect(sptr) && (max > 20))
 	max = 20;
+    /* hours of history can run to hundreds of entries for a Guest nick */
+    if (max <= 0 && !IsAnOper(sptr))
+	max = 20;
     for (s = parv[1]; (nick = strtoken(&p, s, ",")); s = NULL) 
     {
-	temp = WHOWASHASH[hash_whowas_name(nick)];
+	wn = find_whowas_nick(nick);
 	found = 0;
-	for (; temp; temp = temp->next) 
+	for (temp = wn ? wn->first : NULL; temp; temp = temp->next) 
 	{
-	    if (!mycmp(nick, temp->name)) 
-	    {
-		sendto_one(sptr, rpl_str(RPL_WHOWASUSER),
-			   me.name, parv[0], temp->name,
-			   temp->username,
+	    if (temp->logoff < cutoff)
+		break;
+	    sendto_one(sptr, rpl_str(RPL_WHOWASUSER),
+		       me.name, parv[0], temp->name,
+		       temp->username,
 #ifdef USER_HOSTMASKING
-			   (temp->umode & UMODE_H)?temp->mhostname:
+		       (temp->umode & UMODE_H)?temp->mhostname:
 #endif
-                                                                   temp->hostname,
-			   temp->realname);
+                                                               temp->hostname,
+		       temp->realname);
 #ifdef USER_HOSTMASKING
-                if((temp->umode & UMODE_H) && IsAnOper(sptr))
-                {
-                    sendto_one(sptr, rpl_str(RPL_WHOISACTUALLY), me.name, sptr->name,
-                               temp->name, "*", temp->hostname, temp->hostip);
-                }
+            if((temp->umode & UMODE_H) && IsAnOper(sptr))
+            {
+                sendto_one(sptr, rpl_str(RPL_WHOISACTUALLY), me.name, sptr->name,
+                           temp->name, "*", temp->hostname, temp->hostip);
+            }
 #endif
-		if((temp->umode & UMODE_I) && !IsAnOper(sptr))
-		    sendto_one(sptr, rpl_str(RPL_WHOISSERVER),
-			       me.name, parv[0], temp->name,
-			       HIDDEN_SERVER_NAME, myctime(temp->logoff));
-		else
-		    sendto_one(sptr, rpl_str(RPL_WHOISSERVER),
-			       me.name, parv[0], temp->name,
-			       temp->servername, myctime(temp->logoff));
-		cur++;
-		found++;
-	    }
+	    if((temp->umode & UMODE_I) && !IsAnOper(sptr))
+		sendto_one(sptr, rpl_str(RPL_WHOISSERVER),
+			   me.name, parv[0], temp->name,
+			   HIDDEN_SERVER_NAME, myctime(temp->logoff));
+	    else
+		sendto_one(sptr, rpl_str(RPL_WHOISSERVER),
+			   me.name, parv[0], temp->name,
+			   temp->servername, myctime(temp->logoff));
+	    cur++;
+	    found++;
 	    if (max > 0 && cur >= max)
 		break;
 	}
@@ -186,15 +343,10 @@ int m_whowas(aClient *cptr, aClient *sptr, int parc, char *parv[])
 
 void initwhowas()
 {
-    int i;
-
-    for (i = 0; i < NICKNAMEHISTORYLENGTH; i++)
-    {
-	memset((char *) &WHOWAS[i], '\0', sizeof(aWhowas));
-	WHOWAS[i].hashv = -1;
-    }
-    for (i = 0; i < WW_MAX; i++)
-	WHOWASHASH[i] = NULL;
+    hash_init(&whowasTable, WW_HASH_MIN, offsetof(aWhowasNick, hnext),
+	      offsetof(aWhowasNick, name));
+    hash_init(&wwstringTable, WW_HASH_MIN, offsetof(aWhowasString, hnext),
+	      offsetof(aWhowasString, text));
 }
 
 static void add_whowas_to_clist(aWhowas ** bucket, aWhowas * whowas)
@@ -215,34 +367,25 @@ static void del_whowas_from_clist(aWhowas ** bucket, aWhowas * whowas)
 	whowas->cnext->cprev = whowas->cprev;
 }
 
-static void add_whowas_to_list(aWhowas ** bucket, aWhowas * whowas)
-{
-    whowas->prev = NULL;
-    if ((whowas->next = *bucket) != NULL)
-	whowas->next->prev = whowas;
-    *bucket = whowas;
-}
-
-static void del_whowas_from_list(aWhowas ** bucket, aWhowas * whowas)
-{
-    if (whowas->prev)
-	whowas->prev->next = whowas->next;
-    else
-	*bucket = whowas->next;
-    if (whowas->next)
-	whowas->next->prev = whowas->prev;
-}
-
 u_long
 memcount_whowas(MCwhowas *mc)
 {
     mc->file = __FILE__;
 
-    mc->s_whowas.c = sizeof(WHOWAS)/sizeof(WHOWAS[0]);
-    mc->s_whowas.m = sizeof(WHOWAS);
-    mc->s_hash.c = sizeof(WHOWASHASH)/sizeof(WHOWASHASH[0]);
-    mc->s_hash.m = sizeof(WHOWASHASH);
+    mc->generations.c = ww_gens;
+    mc->generations.m = ww_gens * sizeof(aWhowasGen);
+    mc->entries = ww_entries;
+    mc->nicks.c = ww_nicks;
+    mc->nicks.m = ww_nicks * sizeof(aWhowasNick);
+    mc->strings.c = ww_strings;
+    mc->strings.m = ww_stringbytes;
+    mc->total.m = mc->generations.m + mc->nicks.m + mc->strings.m;
 
-    return 0;
-}
+    mc->nickhash.c = whowasTable.size[0] + whowasTable.size[1];
+    mc->nickhash.m = mc->nickhash.c * sizeof(aHashEntry);
+    hash_histogram(&whowasTable, mc->nickchains);
+    mc->stringhash.c = wwstringTable.size[0] + wwstringTable.size[1];
+    mc->stringhash.m = mc->stringhash.c * sizeof(aHashEntry);
 
+    return mc->total.m + mc->nickhash.m + mc->stringhash.m;
+}
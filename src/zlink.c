@@ -26,50 +26,72 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
 #include "memcount.h"
 #include <zlib.h>
 
-#define COMPRESSION_LEVEL 	3 	/* 0 to 9, 0 = none */
-#define ZIP_MIN_BLOCK		1024	/* smallest block to compress */
-#define ZIP_MAX_BLOCK 		8192	/* largest block to compress */
-
 /*
- * This shouldn't be necessary.
- * The outbuf should never be larger than 
- * the maximum block.. should it?
- * I'll account for any weirdness in zlib.
- *
- * WARNING:
- * Please be aware that if you are using both encryption
- * and ziplinks, rc4buf in send.c MUST be the same size
- * as zipOutBuf in zlink.c!
+ * Each outgoing link starts at ZIP_LEVEL and is moved between
+ * ZIP_LEVEL_MIN and ZIP_LEVEL_MAX by zip_out_tune(): up a level while
+ * the link can't keep up with what we send it, down a level while
+ * compressing for it costs more than ZIP_CPU_BUDGET of our time.
  */
-#define zipOutBufSize (ZIP_MAX_BLOCK * 2)
-static char zipOutBuf[zipOutBufSize];
+#define ZIP_LEVEL		3	/* 0 to 9, 0 = none */
+#define ZIP_LEVEL_MIN		1
+#define ZIP_LEVEL_MAX		6
+#define ZIP_TUNE_INTERVAL	10	/* seconds between level changes */
+#define ZIP_TUNE_BACKLOG	16384	/* sendQ that means the link is full */
+#define ZIP_CPU_BUDGET		20	/* per mille of wall time */
+
+#define ZIP_MAX_BLOCK 		16384	/* data staged before deflate() */
+#define ZIP_IN_BLOCK		16384	/* inflate() output per call */
 
 /*
- * 64k overflowed every now and then.
- * This isn't that important, an overflow is 
- * non-fatal, but causes more calls to deflate()
- * 96k seems to overflow a lot now.
+ * Compressed data is handed out of zipOutBuf one buffer at a time;
+ * zip_output() sets *more when zlib has more for the caller.
  */
-#define zipInBufSize (131072) /* 128K */
-static char zipInBuf[zipInBufSize];
+#define zipOutBufSize (ZIP_MAX_BLOCK * 2)
+static char zipOutBuf[zipOutBufSize];
 
 /* opaque "out" data structure */
 struct zipped_link_out 
 {
     z_stream    stream;             /* zip stream data */
-    char        buf[ZIP_MAX_BLOCK]; /* zipped buffer */
-    int         bufsize;            /* size of inbuf content */
+    char        buf[ZIP_MAX_BLOCK]; /* data staged for deflate() */
+    int         bufsize;            /* size of buf content */
+    char       *next;               /* data too big to stage, deflated
+				     * straight from the caller */
+    int         nextlen;
+    int         busy;               /* zlib had more output than fit */
+    int         unflushed;          /* deflated but not yet flushed */
+    int         level;              /* current compression level */
+    int         want;               /* level to switch to at next flush */
+    unsigned long usec;             /* time spent in deflate() */
+    time_t      tune_time;          /* zip_out_tune() bookkeeping */
+    unsigned long tune_in;
+    unsigned long tune_usec;
+    int         tune_backlog;
 };
 
 /* opaque "in" data structure */
 struct zipped_link_in 
 {
     z_stream    stream;             /* zip stream data */
+    char        buf[ZIP_IN_BLOCK];  /* kept partial line + inflated data */
+    int         keep;               /* partial line at the head of buf */
+    unsigned long usec;             /* time spent in inflate() */
 };
 
+static unsigned long
+zip_elapsed(struct timeval *start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) * 1000000 +
+	   (now.tv_usec - start->tv_usec);
+}
+
 /* returns a pointer to a setup opaque input session */
 void *zip_create_input_session()
 {
@@ -102,9 +124,12 @@ void *zip_create_output_session()
     zip->stream.zfree = NULL;
     zip->stream.data_type = Z_ASCII;
 
-    if(deflateInit(&zip->stream, COMPRESSION_LEVEL) != Z_OK)
+    if(deflateInit(&zip->stream, ZIP_LEVEL) != Z_OK)
 	return NULL;
 
+    zip->level = zip->want = ZIP_LEVEL;
+    zip->tune_time = timeofday;
+
     return (void *) zip;
 }
 
@@ -112,56 +137,66 @@ void *zip_create_output_session()
  * zip_input()
  *
  * session - opaque in-session pointer
- * buffer - compressed buffer
+ * buffer - compressed buffer, or NULL to carry on with what is left
+ *          of the last one
  * len - length of buffer (will change)
  * err - numeric error if length is -1 on return
- * nbuf - set if this function needs to be called again
- * nbuflen - if nbuf is set, length to call with again.
- *  -- nbuf, if set, should call zip_input when done processing
- *     first return, with buffer set to nbuf.
+ *
+ * Data is inflated into the session's own buffer, right behind the
+ * partial line last given to zip_input_keep(), so the caller can split
+ * and parse lines where they lie.  Call again with a NULL buffer until
+ * len comes back 0.
  * returns:
- * len > -1:
- *   compressed data
+ * len > 0:
+ *   the session buffer, len bytes long, with room for a terminating NUL
+ * len == 0:
+ *   all input used up
  * len == -1:
  *   error message
  */
-char *zip_input(void *session, char *buffer, int *len, int *err,
-		unsigned char **nbuf, int *nbuflen)
+char *zip_input(void *session, char *buffer, int *len, int *err)
 {
     struct zipped_link_in *z = (struct zipped_link_in *) session;
     z_stream *zin = &z->stream;
-    int ret;
+    struct timeval start;
+    int ret, room;
 
-    *nbuf = NULL;
     *err = 0;
 
-    zin->next_in = (unsigned char *) buffer;
-    zin->avail_in = *len;
-    zin->next_out = (unsigned char *) zipInBuf;
-    zin->avail_out = zipInBufSize;   
+    if(buffer)
+    {
+	zin->next_in = (unsigned char *) buffer;
+	zin->avail_in = *len;
+    }
 
+    if(!zin->avail_in)
+    {
+	*len = 0;
+	return NULL;
+    }
+
+    room = ZIP_IN_BLOCK - 1 - z->keep;
+    zin->next_out = (unsigned char *) z->buf + z->keep;
+    zin->avail_out = room;
+
+    gettimeofday(&start, NULL);
     ret = inflate(zin, Z_SYNC_FLUSH);
+    z->usec += zip_elapsed(&start);
 
     switch(ret)
     {
     case Z_OK:
-        if(zin->avail_in) /* grrr, didn't take all the input */
-        {
-	    if(zin->avail_out != 0) /* but there was still output left??? */
-	    {
-		*len = -1;
-		return zin->msg ? zin->msg : "????";
-	    }
-	    *nbuf = zin->next_in;
-	    *nbuflen = zin->avail_in;
-	    *len = zipInBufSize - zin->avail_out;
-	    return zipInBuf;
-        }
-        else
-        {
-	    *len = zipInBufSize - zin->avail_out;
-	    return zipInBuf;
-        }
+	if(zin->avail_out == room)
+	{
+	    *len = 0;
+	    return NULL;
+	}
+	*len = z->keep + room - zin->avail_out;
+	return z->buf;
+
+    case Z_BUF_ERROR: /* input ran out mid-block, wait for more */
+	*len = 0;
+	return NULL;
 
     default:
 	*len = -1;
@@ -170,12 +205,26 @@ char *zip_input(void *session, char *buffer, int *len, int *err,
     }
 }
 
+/*
+ * zip_input_keep()
+ * Holds on to the unterminated line at the end of what zip_input()
+ * returned, until the rest of it arrives.
+ */
+void zip_input_keep(void *session, char *line, int len)
+{
+    struct zipped_link_in *z = (struct zipped_link_in *) session;
+
+    if(len && line != z->buf)
+	memmove(z->buf, line, len);
+    z->keep = len;
+}
+
 /* returns the amount of data waiting in the outgoing buffer */
 int zip_is_data_out(void *session)
 {
     struct zipped_link_out *z = (struct zipped_link_out *) session;
 
-    return z->bufsize;
+    return z->bufsize + z->unflushed + z->busy;
 }
 
 /*
@@ -183,53 +232,127 @@ int zip_is_data_out(void *session)
  * session is opaque session pointer.
  * buffer is buffer to compress.
  * len is length of buffer, will change.
- * forceflush forces inflate to return a buffer, even if it has
- * not optimally compressed something.
- * Largedata should be nonzero during a split.
- * largedata is also an error number, it is set if len is -1.
+ * flush forces deflate to return everything it has been given.
+ * This is done once per pass through the io loop, when the sendQ is
+ * written, so that data is compressed in large blocks.
+ * more is set if zlib has more data than fit; call zip_output() again,
+ * with a NULL buffer and the same flush, to get the rest.
+ * err is set if len is -1.
  * if len is -1, returns null terminated error string.
  */
 char *zip_output(void *session, char *buffer, int *len,
-		 int forceflush, int *largedata)
+		 int flush, int *more, int *err)
 {
     struct zipped_link_out *z = (struct zipped_link_out *) session;
     z_stream *zout = &z->stream;
+    struct timeval start;
     int ret;
 
-    if(buffer)
-    {
-	memcpy(z->buf + z->bufsize, buffer, *len);
-	z->bufsize += *len;
-    }
+    *more = 0;
 
-    if( !forceflush && ((z->bufsize < ZIP_MIN_BLOCK) || 
-			(largedata && (z->bufsize < (ZIP_MAX_BLOCK - 512)))))
+    if(!z->busy)
     {
-	*len = 0;
-	return NULL;
+	if(buffer && (z->bufsize + *len) <= ZIP_MAX_BLOCK)
+	{
+	    memcpy(z->buf + z->bufsize, buffer, *len);
+	    z->bufsize += *len;
+	    buffer = NULL;
+	}
+
+	if(!buffer && !flush)
+	{
+	    *len = 0;
+	    return NULL;
+	}
+
+	/* compress what is staged, then anything that did not fit */
+	zout->next_in = (unsigned char *) z->buf;
+	zout->avail_in = z->bufsize;
+	z->next = buffer;
+	z->nextlen = buffer ? *len : 0;
+	z->bufsize = 0;
+	z->busy = 1;
     }
-    
-    zout->next_in = (unsigned char *) z->buf;
-    zout->avail_in = z->bufsize;
+
     zout->next_out = (unsigned char *) zipOutBuf;
     zout->avail_out = zipOutBufSize;
-   
-    /*
-     * We do our own internal buffering,
-     * so flush all the time.
-     */
-    ret = deflate(zout, Z_SYNC_FLUSH);
-
-    if(ret == Z_OK)
+
+    gettimeofday(&start, NULL);
+    for(;;)
     {
-	z->bufsize = 0;
-	*len = zipOutBufSize - zout->avail_out;
-	return zipOutBuf;
-    }   
+	ret = deflate(zout, (flush && !z->next) ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+	if(ret != Z_OK && ret != Z_BUF_ERROR)
+	{
+	    z->usec += zip_elapsed(&start);
+	    *len = -1;
+	    *err = ret;
+	    return zout->msg ? zout->msg : "???";
+	}
+
+	if(!zout->avail_out)
+	{
+	    *more = 1;
+	    break;
+	}
+
+	if(!z->next)
+	{
+	    z->busy = 0;
+	    z->unflushed = !flush;
+	    break;
+	}
+
+	zout->next_in = (unsigned char *) z->next;
+	zout->avail_in = z->nextlen;
+	z->next = NULL;
+    }
+
+    /* everything is flushed: a good time to change level */
+    if(!z->busy && flush && z->want != z->level &&
+       deflateParams(zout, z->want, Z_DEFAULT_STRATEGY) == Z_OK)
+	z->level = z->want;
+
+    z->usec += zip_elapsed(&start);
+    *len = zipOutBufSize - zout->avail_out;
+    return zipOutBuf;
+}
+
+/*
+ * zip_out_tune():
+ * Called after the sendQ has been written, with what is left of it.
+ * Every ZIP_TUNE_INTERVAL seconds, picks the level the next flush
+ * switches to: higher if the sendQ has been backing up and there is
+ * CPU to spare, lower if it has not and compression is costly.
+ */
+void zip_out_tune(void *session, int sendq)
+{
+    struct zipped_link_out *z = (struct zipped_link_out *) session;
+    unsigned long usec, cpu;
+    time_t secs;
+
+    if(sendq > z->tune_backlog)
+	z->tune_backlog = sendq;
 
-    *len = -1;
-    *largedata = ret;
-    return zout->msg ? zout->msg : "???";
+    if((secs = timeofday - z->tune_time) < ZIP_TUNE_INTERVAL)
+	return;
+
+    usec = z->usec - z->tune_usec;
+    cpu = usec / (secs * 1000);        /* per mille */
+
+    if(z->stream.total_in != z->tune_in)
+    {
+	if(z->tune_backlog >= ZIP_TUNE_BACKLOG && cpu < ZIP_CPU_BUDGET &&
+	   z->want < ZIP_LEVEL_MAX)
+	    z->want++;
+	else if(z->tune_backlog < ZIP_TUNE_BACKLOG && cpu > ZIP_CPU_BUDGET &&
+		z->want > ZIP_LEVEL_MIN)
+	    z->want--;
+    }
+
+    z->tune_time = timeofday;
+    z->tune_in = z->stream.total_in;
+    z->tune_usec = z->usec;
+    z->tune_backlog = 0;
 }
 
 /* if *insiz is zero, there are no stats available for this session. */
@@ -259,6 +382,23 @@ void zip_in_get_stats(void *session, unsigned long *insiz,
 		  (double) z->stream.total_out);
 }
 
+/* current level and microseconds spent compressing */
+void zip_out_get_cpu(void *session, int *level, unsigned long *usec)
+{
+    struct zipped_link_out *z = (struct zipped_link_out *) session;
+
+    *level = z->level;
+    *usec = z->usec;
+}
+
+/* microseconds spent decompressing */
+void zip_in_get_cpu(void *session, unsigned long *usec)
+{
+    struct zipped_link_in *z = (struct zipped_link_in *) session;
+
+    *usec = z->usec;
+}
+
 void zip_destroy_output_session(void *session)
 {
     struct zipped_link_out *z = (struct zipped_link_out *) session;
@@ -285,9 +425,6 @@ memcount_zlink(MCzlink *mc)
 
     mc->s_bufs.c++;
     mc->s_bufs.m += sizeof(zipOutBuf);
-    mc->s_bufs.c++;
-    mc->s_bufs.m += sizeof(zipInBuf);
 
     return 0;
 }
-